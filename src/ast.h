@@ -109,6 +109,7 @@ typedef struct program_t {
     statement_t **statements; //array of statements
     size_t nstatements; // number of statements
     size_t array_size; //size of statements array so that we can grow it as required
+    cm_arena *arena; // if not NULL, owns all the nodes of the program
 } program_t;
 
 typedef struct identifier_t {
@@ -135,6 +136,7 @@ typedef struct prefix_expression_t {
     token_t *token;
     expression_t *right;
     char *operator;
+    token_type op; // token type of the operator, what evaluation dispatches on
 } prefix_expression_t;
 
 typedef struct infix_expression_t {
@@ -143,6 +145,7 @@ typedef struct infix_expression_t {
     expression_t *left;
     expression_t *right;
     char *operator;
+    token_type op;
 } infix_expression_t;
 
 typedef struct letstatement_t {
@@ -32,14 +32,18 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 
 #include "compiler.h"
 #include "evaluator.h"
+#include "jit.h"
 #include "lexer.h"
 #include "parser.h"
+#include "regcompiler.h"
+#include "regvm.h"
 #include "vm.h"
 
-static const char *INPUT = "let fib = fn(x) {\n"
+static const char *FIB_INPUT = "let fib = fn(x) {\n"
     "   if (x == 0) {\n"
     "       return 0;\n"
     "   } else {\n"
@@ -52,19 +56,58 @@ static const char *INPUT = "let fib = fn(x) {\n"
     "};"
     "fib(35);";
 
+static const char *LOOP_INPUT = "let sum = fn(n) {\n"
+    "   let total = 0;\n"
+    "   let i = 0;\n"
+    "   while (i < n) {\n"
+    "       let total = total + i;\n"
+    "       let i = i + 1;\n"
+    "   }\n"
+    "   total\n"
+    "};"
+    "sum(10000000);";
+
 int
 main(int argc, char **argv)
 {
-   if (argc != 2)
-        errx(EXIT_FAILURE, "Expected 2 arguments, got %d", argc);
-   char *engine = argv[1];
+   int ch;
+   _Bool peephole = true;
+   size_t jit_threshold = 0;
+   const char *input = FIB_INPUT;
+   while ((ch = getopt(argc, argv, "Pjw:")) != -1) {
+       switch (ch) {
+       case 'P':
+           peephole = false;
+           break;
+       case 'j':
+           jit_threshold = JIT_THRESHOLD;
+           break;
+       case 'w':
+           if (strcmp(optarg, "fib") == 0)
+               input = FIB_INPUT;
+           else if (strcmp(optarg, "loop") == 0)
+               input = LOOP_INPUT;
+           else
+               errx(EXIT_FAILURE, "unknown workload %s, expected fib or loop", optarg);
+           break;
+       default:
+           errx(EXIT_FAILURE, "usage: benchmark [-Pj] [-w fib|loop] engine");
+       }
+   }
+   argc -= optind;
+   argv += optind;
+   if (argc != 1)
+        errx(EXIT_FAILURE, "usage: benchmark [-Pj] [-w fib|loop] engine");
+   char *engine = argv[0];
    monkey_object_t *result;
-   lexer_t *lexer = lexer_init(INPUT);
+   lexer_t *lexer = lexer_init(input);
    parser_t *parser = parser_init(lexer);
    program_t *program = parse_program(parser);
    compiler_t *compiler = NULL;
    bytecode_t *bytecode = NULL;
    vm_t *vm = NULL;
+   regcompiler_t *regcompiler = NULL;
+   regvm_t *regvm = NULL;
    clock_t start;
    clock_t end;
 
@@ -77,7 +120,10 @@ main(int argc, char **argv)
            goto EXIT;
        }
        bytecode = get_bytecode(compiler);
+       if (peephole)
+           peephole_optimize(bytecode);
        vm = vm_init(bytecode);
+       vm->jit_threshold = jit_threshold;
        start = clock();
        vm_error_t vm_err = vm_run(vm);
        if (vm_err.code != VM_ERROR_NONE) {
@@ -87,6 +133,25 @@ main(int argc, char **argv)
        }
        end = clock();
        result = vm_last_popped_stack_elem(vm);
+   } else if (strcmp(engine, "regvm") == 0) {
+       regcompiler = regcompiler_init();
+       compiler_error_t compile_error = regcompile(regcompiler, program);
+       if (compile_error.code != COMPILER_ERROR_NONE) {
+           fprintf(stderr, "Failed to compile the program with error: %s\n", compile_error.msg);
+           free(compile_error.msg);
+           goto EXIT;
+       }
+       bytecode = regcompiler_get_bytecode(regcompiler);
+       regvm = regvm_init(bytecode);
+       start = clock();
+       vm_error_t vm_err = regvm_run(regvm);
+       if (vm_err.code != VM_ERROR_NONE) {
+           fprintf(stderr, "Faield to execute the program with error: %s\n", vm_err.msg);
+           free(vm_err.msg);
+           goto EXIT;
+       }
+       end = clock();
+       result = regvm_last_popped_stack_elem(regvm);
    } else {
        environment_t *env = create_env();
        start = clock();
@@ -94,7 +159,7 @@ main(int argc, char **argv)
        end = clock();
        env_free(env);
    }
-   char *result_str = result->inspect(result);
+   char *result_str = inspect(result);
    printf("engine=%s, result=%s, duration=%f seconds\n", engine, result_str, (float) (end - start) / CLOCKS_PER_SEC);
    free(result_str);
    free_monkey_object(result);
@@ -105,6 +170,10 @@ main(int argc, char **argv)
        compiler_free(compiler);
    if (vm != NULL)
        vm_free(vm);
+   if (regcompiler != NULL)
+       regcompiler_free(regcompiler);
+   if (regvm != NULL)
+       regvm_free(regvm);
    if (bytecode != NULL)
         bytecode_free(bytecode);
 }
@@ -74,7 +74,7 @@ monkey_puts(cm_list *arguments)
     while (node != NULL) {
         arg = (monkey_object_t *) node->data;
         node = node->next;
-        s = arg->inspect(arg);
+        s = inspect(arg);
         printf("%s\n", s);
         free(s);
     }
@@ -92,7 +92,7 @@ type(cm_list *arguments)
     }
 
     arg = (monkey_object_t *) arguments->head->data;
-    const char *typename = get_type_name(arg->type);
+    const char *typename = get_type_name(get_monkey_object_type(arg));
     return (monkey_object_t *) create_monkey_string(typename, strlen(typename));
 }
 
@@ -108,7 +108,7 @@ len(cm_list *arguments)
     }
 
     monkey_object_t *arg = (monkey_object_t *) arguments->head->data;
-    switch (arg->type) {
+    switch (get_monkey_object_type(arg)) {
         case MONKEY_STRING:
             str = (monkey_string_t *) arg;
             return (monkey_object_t *) create_monkey_int(str->length);
@@ -120,7 +120,7 @@ len(cm_list *arguments)
             return (monkey_object_t *) create_monkey_int(hash_obj->pairs->nkeys);
         default:
             return (monkey_object_t *) create_monkey_error(
-                "argument to `len` not supported, got %s", get_type_name(arg->type));
+                "argument to `len` not supported, got %s", get_type_name(get_monkey_object_type(arg)));
     }
 }
 
@@ -135,9 +135,9 @@ first(cm_list *arguments)
     }
 
     monkey_object_t *arg = (monkey_object_t *) arguments->head->data;
-    if (arg->type != MONKEY_ARRAY) {
+    if (get_monkey_object_type(arg) != MONKEY_ARRAY) {
         return (monkey_object_t *) create_monkey_error(
-            "argument to `first` must be ARRAY, got %s", get_type_name(arg->type));
+            "argument to `first` must be ARRAY, got %s", get_type_name(get_monkey_object_type(arg)));
     }
     array = (monkey_array_t *) arg;
     if (array->elements->length > 0)
@@ -157,9 +157,9 @@ last(cm_list *arguments)
     }
 
     monkey_object_t *arg = (monkey_object_t *) arguments->head->data;
-    if (arg->type != MONKEY_ARRAY) {
+    if (get_monkey_object_type(arg) != MONKEY_ARRAY) {
         return (monkey_object_t *) create_monkey_error(
-            "argument to `last` must be ARRAY, got %s", get_type_name(arg->type)
+            "argument to `last` must be ARRAY, got %s", get_type_name(get_monkey_object_type(arg))
         );
     }
 
@@ -184,9 +184,9 @@ rest(cm_list *arguments)
     }
 
     monkey_object_t *arg = (monkey_object_t *) arguments->head->data;
-    if (arg->type != MONKEY_ARRAY) {
+    if (get_monkey_object_type(arg) != MONKEY_ARRAY) {
         return (monkey_object_t *) create_monkey_error("argument to `rest` must be ARRAY, got %s",
-        get_type_name(arg->type));
+        get_type_name(get_monkey_object_type(arg)));
     }
 
     array = (monkey_array_t *) arg;
@@ -219,10 +219,10 @@ push(cm_list *arguments)
     }
 
     monkey_object_t *arg = (monkey_object_t *) arguments->head->data;
-    if (arg->type != MONKEY_ARRAY) {
+    if (get_monkey_object_type(arg) != MONKEY_ARRAY) {
         return (monkey_object_t *)
             create_monkey_error("argument to `push` must be ARRAY, got %s",
-            get_type_name(arg->type));
+            get_type_name(get_monkey_object_type(arg)));
     }
 
     array = (monkey_array_t *) arg;
@@ -0,0 +1,427 @@
+/*-
+ * Copyright (c) 2019 Abhinav Upadhyay <er.abhinav.upadhyay@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bytecode_file.h"
+#include "cmonkey_utils.h"
+#include "object.h"
+#include "opcode.h"
+
+#define MNKC_HEADER_SIZE 24 // magic, version, num_globals and nconstants
+
+static char *
+get_err_msg(const char *s, ...)
+{
+    char *msg = NULL;
+    va_list ap;
+    va_start(ap, s);
+    int retval = vasprintf(&msg, s, ap);
+    va_end(ap);
+    if (retval == -1)
+        err(EXIT_FAILURE, "malloc failed");
+    return msg;
+}
+
+static void
+put_uint(FILE *file, uint64_t value, size_t width)
+{
+    for (size_t i = 0; i < width; i++)
+        putc((int) ((value >> (8 * i)) & 0xff), file);
+}
+
+static void
+put_bytes(FILE *file, const void *bytes, size_t length)
+{
+    put_uint(file, length, 8);
+    if (length > 0)
+        fwrite(bytes, 1, length, file);
+}
+
+static int
+put_constant(FILE *file, monkey_object_t *obj)
+{
+    monkey_string_t *str_obj;
+    monkey_compiled_fn_t *fn;
+    switch (get_monkey_object_type(obj)) {
+    case MONKEY_INT:
+        put_uint(file, MNKC_INT, 1);
+        put_uint(file, (uint64_t) get_monkey_int_value(obj), 8);
+        return 0;
+    case MONKEY_STRING:
+        str_obj = (monkey_string_t *) obj;
+        put_uint(file, MNKC_STRING, 1);
+        put_bytes(file, str_obj->value, str_obj->length);
+        return 0;
+    case MONKEY_COMPILED_FUNCTION:
+        fn = (monkey_compiled_fn_t *) obj;
+        put_uint(file, MNKC_FUNCTION, 1);
+        put_uint(file, fn->num_locals, 8);
+        put_uint(file, fn->num_args, 8);
+        put_bytes(file, fn->instructions->bytes, fn->instructions->length);
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+/*
+ * Writes the bytecode to a temporary file renamed to path once complete,
+ * so that a reader never maps a partly written file. Returns 0 on success,
+ * -1 with *errmsg set otherwise.
+ */
+int
+bytecode_write(bytecode_t *bytecode, const char *path, char **errmsg)
+{
+    char *tmp_path;
+    int fd;
+    FILE *file;
+    size_t nconstants = bytecode->constants_pool == NULL? 0: bytecode->constants_pool->length;
+    if (asprintf(&tmp_path, "%s.XXXXXX", path) == -1)
+        err(EXIT_FAILURE, "malloc failed");
+    if ((fd = mkstemp(tmp_path)) == -1 || (file = fdopen(fd, "w")) == NULL) {
+        *errmsg = get_err_msg("failed to create %s: %s", tmp_path, strerror(errno));
+        if (fd != -1) {
+            close(fd);
+            unlink(tmp_path);
+        }
+        free(tmp_path);
+        return -1;
+    }
+    /* mkstemp creates the file readable by the owner only */
+    mode_t mask = umask(0);
+    umask(mask);
+    fchmod(fd, 0666 & ~mask);
+    fwrite(MNKC_MAGIC, 1, 4, file);
+    put_uint(file, MNKC_VERSION, 4);
+    put_uint(file, bytecode->num_globals, 8);
+    put_uint(file, nconstants, 8);
+    put_bytes(file, bytecode->instructions->bytes, bytecode->instructions->length);
+    for (size_t i = 0; i < nconstants; i++) {
+        monkey_object_t *obj = cm_array_list_get(bytecode->constants_pool, i);
+        if (put_constant(file, obj) == -1) {
+            *errmsg = get_err_msg("constants of type %s can not be saved",
+                get_type_name(get_monkey_object_type(obj)));
+            fclose(file);
+            unlink(tmp_path);
+            free(tmp_path);
+            return -1;
+        }
+    }
+    if (ferror(file) || fclose(file) != 0 || rename(tmp_path, path) == -1) {
+        *errmsg = get_err_msg("failed to write %s: %s", path, strerror(errno));
+        unlink(tmp_path);
+        free(tmp_path);
+        return -1;
+    }
+    free(tmp_path);
+    return 0;
+}
+
+typedef struct reader_t {
+    uint8_t *p;
+    size_t remaining;
+} reader_t;
+
+static _Bool
+get_uint(reader_t *reader, size_t width, uint64_t *value)
+{
+    if (reader->remaining < width)
+        return false;
+    *value = 0;
+    for (size_t i = 0; i < width; i++)
+        *value |= (uint64_t) reader->p[i] << (8 * i);
+    reader->p += width;
+    reader->remaining -= width;
+    return true;
+}
+
+static _Bool
+get_bytes(reader_t *reader, uint8_t **bytes, size_t *length)
+{
+    uint64_t value;
+    if (!get_uint(reader, 8, &value) || value > reader->remaining)
+        return false;
+    *bytes = reader->p;
+    *length = value;
+    reader->p += value;
+    reader->remaining -= value;
+    return true;
+}
+
+static instructions_t *
+map_instructions(uint8_t *bytes, size_t length)
+{
+    instructions_t *ins = malloc(sizeof(*ins));
+    if (ins == NULL)
+        err(EXIT_FAILURE, "malloc failed");
+    ins->bytes = bytes;
+    ins->length = length;
+    ins->size = length;
+    ins->mapped = true;
+    return ins;
+}
+
+static monkey_object_t *
+get_constant(reader_t *reader)
+{
+    uint64_t kind, value, num_locals, num_args;
+    uint8_t *bytes;
+    size_t length;
+    if (!get_uint(reader, 1, &kind))
+        return NULL;
+    switch (kind) {
+    case MNKC_INT:
+        if (!get_uint(reader, 8, &value))
+            return NULL;
+        return (monkey_object_t *) create_monkey_int((long) value);
+    case MNKC_STRING:
+        if (!get_bytes(reader, &bytes, &length))
+            return NULL;
+        return (monkey_object_t *) create_monkey_string((const char *) bytes, length);
+    case MNKC_FUNCTION:
+        if (!get_uint(reader, 8, &num_locals) || !get_uint(reader, 8, &num_args) ||
+                !get_bytes(reader, &bytes, &length))
+            return NULL;
+        return (monkey_object_t *) create_monkey_compiled_fn(map_instructions(bytes, length),
+            num_locals, num_args);
+    default:
+        return NULL;
+    }
+}
+
+/*
+ * Maps a file written by bytecode_write. Returns NULL with *errmsg set if
+ * the file can not be read or was not written by this version.
+ */
+mapped_bytecode_t *
+bytecode_map(const char *path, char **errmsg)
+{
+    struct stat sb;
+    reader_t reader;
+    uint64_t version = 0, num_globals = 0, nconstants = 0;
+    uint8_t *bytes;
+    size_t length;
+    monkey_object_t *constant;
+    mapped_bytecode_t *mapped;
+    int fd = open(path, O_RDONLY);
+    if (fd == -1 || fstat(fd, &sb) == -1) {
+        *errmsg = get_err_msg("failed to open %s: %s", path, strerror(errno));
+        if (fd != -1)
+            close(fd);
+        return NULL;
+    }
+    if ((size_t) sb.st_size < MNKC_HEADER_SIZE) {
+        *errmsg = get_err_msg("%s is not a monkey bytecode file", path);
+        close(fd);
+        return NULL;
+    }
+    void *addr = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        *errmsg = get_err_msg("failed to map %s: %s", path, strerror(errno));
+        return NULL;
+    }
+    mapped = malloc(sizeof(*mapped));
+    if (mapped == NULL)
+        err(EXIT_FAILURE, "malloc failed");
+    mapped->addr = addr;
+    mapped->length = sb.st_size;
+    mapped->bytecode = NULL;
+    reader.p = addr;
+    reader.remaining = sb.st_size;
+    if (memcmp(reader.p, MNKC_MAGIC, 4) != 0) {
+        *errmsg = get_err_msg("%s is not a monkey bytecode file", path);
+        goto FAIL;
+    }
+    reader.p += 4;
+    reader.remaining -= 4;
+    get_uint(&reader, 4, &version);
+    if (version != MNKC_VERSION) {
+        *errmsg = get_err_msg("%s has version %u, expected %u", path,
+            (unsigned) version, (unsigned) MNKC_VERSION);
+        goto FAIL;
+    }
+    get_uint(&reader, 8, &num_globals);
+    get_uint(&reader, 8, &nconstants);
+    /* every constant takes at least a byte */
+    if (!get_bytes(&reader, &bytes, &length) || nconstants > reader.remaining)
+        goto TRUNCATED;
+    mapped->bytecode = malloc(sizeof(*mapped->bytecode));
+    if (mapped->bytecode == NULL)
+        err(EXIT_FAILURE, "malloc failed");
+    mapped->bytecode->num_globals = num_globals;
+    mapped->bytecode->instructions = map_instructions(bytes, length);
+    mapped->bytecode->constants_pool = cm_array_list_init(nconstants == 0? 1: nconstants,
+        free_monkey_object);
+    for (uint64_t i = 0; i < nconstants; i++) {
+        if ((constant = get_constant(&reader)) == NULL)
+            goto TRUNCATED;
+        cm_array_list_add(mapped->bytecode->constants_pool, constant);
+    }
+    return mapped;
+
+TRUNCATED:
+    *errmsg = get_err_msg("%s is truncated or corrupt", path);
+FAIL:
+    if (mapped->bytecode != NULL)
+        instructions_free(mapped->bytecode->instructions);
+    bytecode_unmap(mapped);
+    return NULL;
+}
+
+/*
+ * Releases the constants and the mapping. The main instructions belong to
+ * the vm run on the bytecode, which has to be freed first.
+ */
+void
+bytecode_unmap(mapped_bytecode_t *mapped)
+{
+    if (mapped->bytecode != NULL) {
+        cm_array_list_free(mapped->bytecode->constants_pool);
+        bytecode_free(mapped->bytecode);
+    }
+    munmap(mapped->addr, mapped->length);
+    free(mapped);
+}
+
+/*
+ * The compile cache lives in $MONKEY_CACHE_DIR, $XDG_CACHE_HOME/cmonkey or
+ * ~/.cache/cmonkey, the first one set. An empty MONKEY_CACHE_DIR turns it
+ * off.
+ */
+static char *
+get_cache_dir(void)
+{
+    char *dir = NULL;
+    const char *env;
+    int ret = 0;
+    if ((env = getenv("MONKEY_CACHE_DIR")) != NULL) {
+        if (*env == 0)
+            return NULL;
+        dir = strdup(env);
+    } else if ((env = getenv("XDG_CACHE_HOME")) != NULL && *env != 0)
+        ret = asprintf(&dir, "%s/cmonkey", env);
+    else if ((env = getenv("HOME")) != NULL && *env != 0)
+        ret = asprintf(&dir, "%s/.cache/cmonkey", env);
+    else
+        return NULL;
+    if (ret == -1 || dir == NULL)
+        err(EXIT_FAILURE, "malloc failed");
+    return dir;
+}
+
+/*
+ * Returns where the bytecode of the source is cached, or NULL if there is
+ * no cache. The file is named after the SHA-256 of the source, of the
+ * version of the format and of the compiler and of the options that change
+ * the bytecode.
+ */
+char *
+bytecode_cache_path(const char *source, _Bool peephole)
+{
+    char *dir, *key, *path;
+    uint8_t digest[CM_SHA256_DIGEST_LENGTH];
+    char hex[2 * CM_SHA256_DIGEST_LENGTH + 1];
+    if ((dir = get_cache_dir()) == NULL)
+        return NULL;
+    int length = asprintf(&key, "mnkc %d compiler %s peephole %d\n%s", MNKC_VERSION,
+        compiler_version, peephole, source);
+    if (length == -1)
+        err(EXIT_FAILURE, "malloc failed");
+    cm_sha256(key, length, digest);
+    for (size_t i = 0; i < CM_SHA256_DIGEST_LENGTH; i++)
+        snprintf(hex + 2 * i, 3, "%02x", digest[i]);
+    if (asprintf(&path, "%s/%s%s", dir, hex, MNKC_EXTENSION) == -1)
+        err(EXIT_FAILURE, "malloc failed");
+    free(key);
+    free(dir);
+    return path;
+}
+
+/*
+ * Maps the cached bytecode, NULL on a miss. A file that can not be used is
+ * a miss as well, it is replaced once the source is compiled again.
+ */
+mapped_bytecode_t *
+bytecode_cache_lookup(const char *path)
+{
+    char *errmsg;
+    mapped_bytecode_t *mapped;
+    if (access(path, R_OK) == -1)
+        return NULL;
+    if ((mapped = bytecode_map(path, &errmsg)) == NULL)
+        free(errmsg);
+    return mapped;
+}
+
+/*
+ * Creates the directories leading to path as needed.
+ */
+static int
+make_parent_dirs(const char *path)
+{
+    char *dir = strdup(path);
+    if (dir == NULL)
+        err(EXIT_FAILURE, "malloc failed");
+    for (char *p = strchr(dir + 1, '/'); p != NULL; p = strchr(p + 1, '/')) {
+        *p = 0;
+        if (mkdir(dir, 0755) == -1 && errno != EEXIST) {
+            free(dir);
+            return -1;
+        }
+        *p = '/';
+    }
+    free(dir);
+    return 0;
+}
+
+/*
+ * Caches the bytecode. The cache is only an optimization, failing to
+ * write it is not an error. bytecode_write renames complete files into
+ * place, concurrent runs of a script never see a partial one.
+ */
+void
+bytecode_cache_store(const char *path, bytecode_t *bytecode)
+{
+    char *errmsg;
+    if (make_parent_dirs(path) == -1)
+        return;
+    if (bytecode_write(bytecode, path, &errmsg) == -1)
+        free(errmsg);
+}
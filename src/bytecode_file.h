@@ -0,0 +1,79 @@
+/*-
+ * Copyright (c) 2019 Abhinav Upadhyay <er.abhinav.upadhyay@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef BYTECODE_FILE_H
+#define BYTECODE_FILE_H
+
+#include <stddef.h>
+#include "compiler.h"
+
+/*
+ * Compiled bytecode saved to disk (.mnkc files). All the integers are
+ * little endian:
+ *
+ *   "MNKC" version:u32 num_globals:u64 nconstants:u64
+ *   main instructions: length:u64 bytes
+ *   nconstants times: kind:u8 followed by
+ *     MNKC_INT       value:i64
+ *     MNKC_STRING    length:u64 bytes
+ *     MNKC_FUNCTION  num_locals:u64 num_args:u64 length:u64 bytes
+ *
+ * Nested functions are constants like any other, OPCLOSURE refers to them
+ * by index. MNKC_VERSION has to change along with the format or the
+ * opcode numbering.
+ */
+#define MNKC_MAGIC "MNKC"
+#define MNKC_VERSION 1
+#define MNKC_EXTENSION ".mnkc"
+
+typedef enum mnkc_constant_kind {
+    MNKC_INT = 1,
+    MNKC_STRING,
+    MNKC_FUNCTION
+} mnkc_constant_kind;
+
+/*
+ * Bytecode loaded from a mapped file. The instructions point into the
+ * mapping, which is private: the vm quickening them only copies the pages
+ * it writes to.
+ */
+typedef struct mapped_bytecode_t {
+    bytecode_t *bytecode;
+    void *addr;
+    size_t length;
+} mapped_bytecode_t;
+
+int bytecode_write(bytecode_t *, const char *, char **);
+mapped_bytecode_t *bytecode_map(const char *, char **);
+void bytecode_unmap(mapped_bytecode_t *);
+char *bytecode_cache_path(const char *, _Bool);
+mapped_bytecode_t *bytecode_cache_lookup(const char *);
+void bytecode_cache_store(const char *, bytecode_t *);
+
+#endif
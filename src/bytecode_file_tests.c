@@ -0,0 +1,229 @@
+/*-
+ * Copyright (c) 2019 Abhinav Upadhyay <er.abhinav.upadhyay@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bytecode_file.h"
+#include "compiler.h"
+#include "lexer.h"
+#include "object.h"
+#include "object_test_utils.h"
+#include "parser.h"
+#include "test_utils.h"
+#include "vm.h"
+
+typedef struct bytecode_file_test {
+    const char *input;
+    monkey_object_t *expected;
+} bytecode_file_test;
+
+static char *
+get_tmp_path(void)
+{
+    char *path = strdup("/tmp/bytecode_file_tests.XXXXXX");
+    if (path == NULL)
+        err(EXIT_FAILURE, "malloc failed");
+    int fd = mkstemp(path);
+    if (fd == -1)
+        err(EXIT_FAILURE, "mkstemp failed");
+    close(fd);
+    return path;
+}
+
+static void
+write_file(const char *path, const void *bytes, size_t length)
+{
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+        err(EXIT_FAILURE, "Failed to open file %s", path);
+    fwrite(bytes, 1, length, file);
+    fclose(file);
+}
+
+static void
+compile_to(const char *input, const char *path, _Bool cache)
+{
+    char *errmsg;
+    lexer_t *lexer = lexer_init(input);
+    parser_t *parser = parser_init(lexer);
+    program_t *program = parse_program(parser);
+    compiler_t *compiler = compiler_init();
+    compiler_error_t error = compile(compiler, (node_t *) program);
+    if (error.code != COMPILER_ERROR_NONE)
+        errx(EXIT_FAILURE, "compilation failed for input %s with error %s\n",
+            input, error.msg);
+    bytecode_t *bytecode = get_bytecode(compiler);
+    peephole_optimize(bytecode);
+    if (cache)
+        bytecode_cache_store(path, bytecode);
+    else
+        test(bytecode_write(bytecode, path, &errmsg) == 0, "bytecode_write failed: %s\n", errmsg);
+    instructions_free(bytecode->instructions);
+    bytecode_free(bytecode);
+    parser_free(parser);
+    program_free(program);
+    compiler_free(compiler);
+}
+
+static void
+test_round_trip(void)
+{
+    bytecode_file_test tests[] = {
+        {"1 + 2 * 3", (monkey_object_t *) create_monkey_int(7)},
+        {"-4611686018427387905", (monkey_object_t *) create_monkey_int(-4611686018427387905)},
+        {"let s = \"mon\"; s + \"key\"", (monkey_object_t *) create_monkey_string("monkey", 6)},
+        {"\"\"", (monkey_object_t *) create_monkey_string("", 0)},
+        {
+            "let fib = fn(n) { if (n < 2) { n } else { fib(n - 1) + fib(n - 2) } };\n"
+            "fib(15);",
+            (monkey_object_t *) create_monkey_int(610)
+        },
+        {
+            "let adder = fn(x) { fn(y) { x + y } };\n"
+            "let add2 = adder(2);\n"
+            "add2(3) + len([1, 2]);",
+            (monkey_object_t *) create_monkey_int(7)
+        }
+    };
+    print_test_separator_line();
+    printf("Testing bytecode files\n");
+    char *path = get_tmp_path();
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        char *errmsg;
+        printf("Testing bytecode file for input %s\n", tests[i].input);
+        compile_to(tests[i].input, path, false);
+        mapped_bytecode_t *mapped = bytecode_map(path, &errmsg);
+        test(mapped != NULL, "bytecode_map failed: %s\n", errmsg);
+        test(mapped->bytecode->instructions->mapped,
+            "Expected the instructions to be executed in place\n");
+        vm_t *vm = vm_init(mapped->bytecode);
+        vm_error_t vm_error = vm_run(vm);
+        test(vm_error.code == VM_ERROR_NONE, "vm error: %s\n", vm_error.msg);
+        monkey_object_t *top = vm_last_popped_stack_elem(vm);
+        test_monkey_object(top, tests[i].expected);
+        free_monkey_object(top);
+        free_monkey_object(tests[i].expected);
+        vm_free(vm);
+        bytecode_unmap(mapped);
+    }
+    unlink(path);
+    free(path);
+}
+
+static void
+test_invalid_files(void)
+{
+    static const uint8_t bad_magic[24] = "MNKX";
+    static const uint8_t bad_version[24] = {'M', 'N', 'K', 'C', 0xff};
+    /* claims a main function of 16 bytes */
+    static const uint8_t truncated[32] = {'M', 'N', 'K', 'C', MNKC_VERSION, [24] = 16};
+    struct {
+        const void *bytes;
+        size_t length;
+    } tests[] = {
+        {"", 0},
+        {bad_magic, sizeof(bad_magic)},
+        {bad_version, sizeof(bad_version)},
+        {truncated, sizeof(truncated)}
+    };
+    print_test_separator_line();
+    printf("Testing invalid bytecode files\n");
+    char *path = get_tmp_path();
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        char *errmsg = NULL;
+        write_file(path, tests[i].bytes, tests[i].length);
+        test(bytecode_map(path, &errmsg) == NULL, "Expected file %zu to be rejected\n", i);
+        printf("%s\n", errmsg);
+        free(errmsg);
+    }
+    unlink(path);
+    free(path);
+}
+
+static void
+test_cache(void)
+{
+    char dir[] = "/tmp/bytecode_file_tests.XXXXXX";
+    print_test_separator_line();
+    printf("Testing the compile cache\n");
+    if (mkdtemp(dir) == NULL)
+        err(EXIT_FAILURE, "mkdtemp failed");
+    setenv("MONKEY_CACHE_DIR", "", 1);
+    test(bytecode_cache_path("1", true) == NULL,
+        "Expected an empty MONKEY_CACHE_DIR to turn the cache off\n");
+    /* a directory the cache creates */
+    char *cache_dir;
+    if (asprintf(&cache_dir, "%s/cache", dir) == -1)
+        err(EXIT_FAILURE, "malloc failed");
+    setenv("MONKEY_CACHE_DIR", cache_dir, 1);
+    char *path = bytecode_cache_path("1 + 2", true);
+    char *same_path = bytecode_cache_path("1 + 2", true);
+    char *other_source = bytecode_cache_path("1 + 3", true);
+    char *other_options = bytecode_cache_path("1 + 2", false);
+    test(strncmp(path, cache_dir, strlen(cache_dir)) == 0, "Expected %s to be in %s\n", path, cache_dir);
+    test(strcmp(path, same_path) == 0, "Expected the same source to have the same key\n");
+    test(strcmp(path, other_source) != 0, "Expected a different source to have a different key\n");
+    test(strcmp(path, other_options) != 0, "Expected different options to have a different key\n");
+    test(bytecode_cache_lookup(path) == NULL, "Expected a miss on an empty cache\n");
+
+    compile_to("1 + 2", path, true);
+    mapped_bytecode_t *mapped = bytecode_cache_lookup(path);
+    test(mapped != NULL, "Expected a hit after storing the bytecode\n");
+    vm_t *vm = vm_init(mapped->bytecode);
+    vm_error_t vm_error = vm_run(vm);
+    test(vm_error.code == VM_ERROR_NONE, "vm error: %s\n", vm_error.msg);
+    test_integer_object(vm_last_popped_stack_elem(vm), 3);
+    vm_free(vm);
+    bytecode_unmap(mapped);
+
+    write_file(path, "MNKC", 4);
+    test(bytecode_cache_lookup(path) == NULL, "Expected a corrupt file to be a miss\n");
+    unlink(path);
+    rmdir(cache_dir);
+    rmdir(dir);
+    unsetenv("MONKEY_CACHE_DIR");
+    free(path);
+    free(same_path);
+    free(other_source);
+    free(other_options);
+    free(cache_dir);
+}
+
+int
+main(int argc, char **argv)
+{
+    test_round_trip();
+    test_invalid_files();
+    test_cache();
+    return 0;
+}
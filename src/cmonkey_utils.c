@@ -38,6 +38,109 @@
 
 #include "cmonkey_utils.h"
 
+#define ARENA_ALIGN(n) (((n) + _Alignof(max_align_t) - 1) & ~(_Alignof(max_align_t) - 1))
+
+cm_arena *
+cm_arena_init(void)
+{
+    cm_arena *arena;
+    arena = malloc(sizeof(*arena));
+    if (arena == NULL)
+        err(EXIT_FAILURE, "malloc failed");
+    arena->chunks = NULL;
+    arena->cleanups = NULL;
+    arena->last = NULL;
+    arena->nbytes = 0;
+    return arena;
+}
+
+static cm_arena_chunk *
+add_arena_chunk(cm_arena *arena, size_t min_size)
+{
+    size_t size = min_size > CM_ARENA_CHUNK_SIZE ? min_size: CM_ARENA_CHUNK_SIZE;
+    cm_arena_chunk *chunk = malloc(sizeof(*chunk) + size);
+    if (chunk == NULL)
+        err(EXIT_FAILURE, "malloc failed");
+    chunk->size = size;
+    chunk->used = 0;
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    return chunk;
+}
+
+void *
+cm_arena_alloc(cm_arena *arena, size_t size)
+{
+    cm_arena_chunk *chunk = arena->chunks;
+    size = ARENA_ALIGN(size);
+    if (chunk == NULL || chunk->size - chunk->used < size)
+        chunk = add_arena_chunk(arena, size);
+    void *p = (char *) chunk->data + chunk->used;
+    chunk->used += size;
+    arena->nbytes += size;
+    arena->last = p;
+    return p;
+}
+
+/*
+ * Grows an allocation made from the arena. If it was the most recent one
+ * and the chunk has room it is extended in place, otherwise the contents
+ * are copied to a fresh allocation and the old space is simply left behind.
+ */
+void *
+cm_arena_realloc(cm_arena *arena, void *p, size_t old_size, size_t new_size)
+{
+    if (p == NULL)
+        return cm_arena_alloc(arena, new_size);
+    old_size = ARENA_ALIGN(old_size);
+    new_size = ARENA_ALIGN(new_size);
+    cm_arena_chunk *chunk = arena->chunks;
+    if (p == arena->last && new_size >= old_size &&
+        chunk->size - chunk->used >= new_size - old_size) {
+        chunk->used += new_size - old_size;
+        arena->nbytes += new_size - old_size;
+        return p;
+    }
+    void *new_p = cm_arena_alloc(arena, new_size);
+    memcpy(new_p, p, old_size < new_size ? old_size: new_size);
+    return new_p;
+}
+
+char *
+cm_arena_strdup(cm_arena *arena, const char *s)
+{
+    size_t len = strlen(s) + 1;
+    char *copy = cm_arena_alloc(arena, len);
+    memcpy(copy, s, len);
+    return copy;
+}
+
+void
+cm_arena_add_cleanup(cm_arena *arena, void (*func) (void *), void *data)
+{
+    cm_arena_cleanup *cleanup = cm_arena_alloc(arena, sizeof(*cleanup));
+    cleanup->func = func;
+    cleanup->data = data;
+    cleanup->next = arena->cleanups;
+    arena->cleanups = cleanup;
+}
+
+void
+cm_arena_free(cm_arena *arena)
+{
+    if (arena == NULL)
+        return;
+    for (cm_arena_cleanup *cleanup = arena->cleanups; cleanup != NULL; cleanup = cleanup->next)
+        cleanup->func(cleanup->data);
+    cm_arena_chunk *chunk = arena->chunks;
+    while (chunk != NULL) {
+        cm_arena_chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    free(arena);
+}
+
 void *
 cm_list_get_at(cm_list *list, size_t index)
 {
@@ -62,13 +165,29 @@ cm_list_init(void)
     list->head = NULL;
     list->tail = NULL;
     list->length = 0;
+    list->arena = NULL;
+    return list;
+}
+
+cm_list *
+cm_list_init_arena(cm_arena *arena)
+{
+    cm_list *list = cm_arena_alloc(arena, sizeof(*list));
+    list->head = NULL;
+    list->tail = NULL;
+    list->length = 0;
+    list->arena = arena;
     return list;
 }
 
 int
 cm_list_add(cm_list *list, void *data)
 {
-    cm_list_node *node = malloc(sizeof(*node));
+    cm_list_node *node;
+    if (list->arena != NULL)
+        node = cm_arena_alloc(list->arena, sizeof(*node));
+    else
+        node = malloc(sizeof(*node));
     if (node == NULL)
         return 0;
     node->data = data;
@@ -98,10 +217,12 @@ cm_list_free(cm_list *list, void (*free_data) (void *))
         // else
             // free(list_node->data);
         temp_node = list_node->next;
-        free(list_node);
+        if (list->arena == NULL)
+            free(list_node);
         list_node = temp_node;
     }
-    free(list);
+    if (list->arena == NULL)
+        free(list);
 }
 
 void *
@@ -199,6 +320,49 @@ find_entry(cm_list *list, cm_hash_entry *other_entry, _Bool (*keyequals) (void *
 }
 
 
+static cm_list *
+add_bucket(cm_hash_table *hash_table, size_t index)
+{
+    cm_list *entry_list = cm_list_init();
+    hash_table->table[index] = entry_list;
+    size_t *used_slot = malloc(sizeof(*used_slot));
+    if (used_slot == NULL)
+        errx(EXIT_FAILURE, "malloc failed");
+    *used_slot = index;
+    cm_array_list_add(hash_table->used_slots, used_slot);
+    return entry_list;
+}
+
+/*
+ * Doubles the number of buckets and moves the entries over, keeping the
+ * chains short as keys are added.
+ */
+static void
+grow_hash_table(cm_hash_table *hash_table)
+{
+    cm_list **old_table = hash_table->table;
+    cm_array_list *old_used_slots = hash_table->used_slots;
+    hash_table->table_size *= 2;
+    hash_table->table = calloc(hash_table->table_size, sizeof(*hash_table->table));
+    if (hash_table->table == NULL)
+        errx(EXIT_FAILURE, "malloc failed");
+    hash_table->used_slots = cm_array_list_init(old_used_slots->length * 2, free);
+    for (size_t i = 0; i < old_used_slots->length; i++) {
+        cm_list *old_list = old_table[*(size_t *) old_used_slots->array[i]];
+        for (cm_list_node *node = old_list->head; node != NULL; node = node->next) {
+            cm_hash_entry *entry = (cm_hash_entry *) node->data;
+            size_t index = hash_table->hash_func(entry->key) % hash_table->table_size;
+            cm_list *entry_list = hash_table->table[index];
+            if (entry_list == NULL)
+                entry_list = add_bucket(hash_table, index);
+            cm_list_add(entry_list, entry);
+        }
+        cm_list_free(old_list, NULL);
+    }
+    free(old_table);
+    cm_array_list_free(old_used_slots);
+}
+
 void
 cm_hash_table_put(cm_hash_table *hash_table, void *key, void *value)
 {
@@ -206,14 +370,7 @@ cm_hash_table_put(cm_hash_table *hash_table, void *key, void *value)
     size_t index = hash_table->hash_func(key) % hash_table->table_size;
     cm_list *entry_list = hash_table->table[index];
     if (entry_list == NULL) {
-        entry_list = cm_list_init();
-        hash_table->table[index] = entry_list;
-        size_t *used_slot = malloc(sizeof(*used_slot));
-        if (used_slot == NULL)
-            errx(EXIT_FAILURE, "malloc failed");
-        *used_slot = index;
-        cm_array_list_add(hash_table->used_slots, used_slot);
-        //TODO: resize when nentries == table size
+        entry_list = add_bucket(hash_table, index);
     } else {
         cm_hash_entry temp_entry = {key, NULL};
         entry = find_entry(entry_list, &temp_entry, hash_table->keyequals);
@@ -227,6 +384,8 @@ cm_hash_table_put(cm_hash_table *hash_table, void *key, void *value)
         entry->value = value;
         hash_table->nkeys++;
         cm_list_add(entry_list, entry);
+        if (hash_table->nkeys > hash_table->table_size)
+            grow_hash_table(hash_table);
     } else {
         if (hash_table->free_value)
             hash_table->free_value(entry->value);
@@ -689,4 +848,79 @@ cm_stack_pop(cm_stack *stack)
     void *head = stack->list->head;
     stack->list->head = stack->list->head->next;
     return head;
-}
\ No newline at end of file
+}
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void
+sha256_block(uint32_t state[8], const uint8_t block[64])
+{
+    uint32_t w[64];
+    uint32_t a, b, c, d, e, f, g, h, t1, t2;
+    for (int i = 0; i < 16; i++)
+        w[i] = (uint32_t) block[4 * i] << 24 | (uint32_t) block[4 * i + 1] << 16 |
+            (uint32_t) block[4 * i + 2] << 8 | block[4 * i + 3];
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = ROTR32(w[i - 15], 7) ^ ROTR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR32(w[i - 2], 17) ^ ROTR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    a = state[0]; b = state[1]; c = state[2]; d = state[3];
+    e = state[4]; f = state[5]; g = state[6]; h = state[7];
+    for (int i = 0; i < 64; i++) {
+        t1 = h + (ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25)) + ((e & f) ^ (~e & g)) +
+            sha256_k[i] + w[i];
+        t2 = (ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+/*
+ * SHA-256 of the bytes, for keys which have to stay unique across runs
+ * rather than spread well in a hash table.
+ */
+void
+cm_sha256(const void *bytes, size_t length, uint8_t digest[CM_SHA256_DIGEST_LENGTH])
+{
+    uint32_t state[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    const uint8_t *p = bytes;
+    uint8_t block[64];
+    size_t remaining = length;
+    uint64_t bits = (uint64_t) length * 8;
+    for (; remaining >= 64; remaining -= 64, p += 64)
+        sha256_block(state, p);
+    /* the last block is padded with a one bit, zeros and the bit length */
+    memset(block, 0, sizeof(block));
+    if (remaining > 0)
+        memcpy(block, p, remaining);
+    block[remaining] = 0x80;
+    if (remaining >= 56) {
+        sha256_block(state, block);
+        memset(block, 0, sizeof(block));
+    }
+    for (int i = 0; i < 8; i++)
+        block[63 - i] = (uint8_t) (bits >> (8 * i));
+    sha256_block(state, block);
+    for (int i = 0; i < 8; i++) {
+        digest[4 * i] = (uint8_t) (state[i] >> 24);
+        digest[4 * i + 1] = (uint8_t) (state[i] >> 16);
+        digest[4 * i + 2] = (uint8_t) (state[i] >> 8);
+        digest[4 * i + 3] = (uint8_t) state[i];
+    }
+}
@@ -31,10 +31,39 @@
 #define CMONKEY_UTILS_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 
 #define INITIAL_HASHTABLE_SIZE 64
+#define CM_SHA256_DIGEST_LENGTH 32
+#define CM_ARENA_CHUNK_SIZE 65536
+
+/*
+ * A bump allocator: memory is carved out of large chunks and is only
+ * given back when the whole arena is freed. Objects which still need a
+ * destructor (e.g. heap backed containers) can be registered with
+ * cm_arena_add_cleanup and are torn down by cm_arena_free.
+ */
+typedef struct cm_arena_chunk {
+    struct cm_arena_chunk *next;
+    size_t size;
+    size_t used;
+    max_align_t data[];
+} cm_arena_chunk;
+
+typedef struct cm_arena_cleanup {
+    void (*func) (void *);
+    void *data;
+    struct cm_arena_cleanup *next;
+} cm_arena_cleanup;
+
+typedef struct cm_arena {
+    cm_arena_chunk *chunks;
+    cm_arena_cleanup *cleanups;
+    void *last; // most recent allocation, it can be grown in place
+    size_t nbytes; // total bytes handed out
+} cm_arena;
 
 typedef struct cm_list_node {
     void *data;
@@ -45,6 +74,7 @@ typedef struct cm_list {
     cm_list_node *head;
     cm_list_node *tail;
     size_t length;
+    cm_arena *arena; // if not NULL, the list and its nodes live in it
 } cm_list;
 
 typedef struct cm_array_list {
@@ -75,7 +105,15 @@ typedef struct cm_stack {
 } cm_stack;
 
 
+cm_arena *cm_arena_init(void);
+void *cm_arena_alloc(cm_arena *, size_t);
+void *cm_arena_realloc(cm_arena *, void *, size_t, size_t);
+char *cm_arena_strdup(cm_arena *, const char *);
+void cm_arena_add_cleanup(cm_arena *, void (*) (void *), void *);
+void cm_arena_free(cm_arena *);
+
 cm_list *cm_list_init(void);
+cm_list *cm_list_init_arena(cm_arena *);
 int cm_list_add(cm_list *, void *);
 void cm_list_free(cm_list *, void (*free_data) (void *));
 void *cm_list_get(cm_list *, void *, _Bool (*cmp) (void *, void *));
@@ -118,6 +156,7 @@ size_t pointer_hash_function(void *);
 _Bool pointer_equals(void *, void*);
 size_t *create_size_t_array(size_t, ...);
 uint8_t *create_uint8_array(size_t, ...);
+void cm_sha256(const void *, size_t, uint8_t [CM_SHA256_DIGEST_LENGTH]);
 uint8_t *size_t_to_uint8_be(size_t, size_t);
 size_t be_to_size_t(uint8_t *, size_t);
 #define be_to_size_t_1(bytes) ((size_t) (bytes)[0])
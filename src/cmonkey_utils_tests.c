@@ -93,6 +93,35 @@ test_hash_table_put(void)
     cm_hash_table_free(table);
 }
 
+static void
+test_hash_table_resize(void)
+{
+    char key[32];
+    size_t nkeys = INITIAL_HASHTABLE_SIZE * 4;
+    print_test_separator_line();
+    printf("Testing hash table resize\n");
+    cm_hash_table *table = cm_hash_table_init(string_hash_function,
+        string_equals, free, free);
+    for (size_t i = 0; i < nkeys; i++) {
+        snprintf(key, sizeof(key), "key%zu", i);
+        cm_hash_table_put(table, strdup(key), strdup(key));
+    }
+    test(table->nkeys == nkeys, "Expected nkeys to be %zu, found %zu\n",
+        nkeys, table->nkeys);
+    test(table->table_size > INITIAL_HASHTABLE_SIZE,
+        "Expected hash table to grow past size %d\n", INITIAL_HASHTABLE_SIZE);
+    for (size_t i = 0; i < nkeys; i++) {
+        snprintf(key, sizeof(key), "key%zu", i);
+        void *value = cm_hash_table_get(table, key);
+        test(value != NULL && strcmp((char *) value, key) == 0,
+            "Expected value for key %s to be %s\n", key, key);
+    }
+    cm_array_list *keys = cm_hash_table_get_keys(table);
+    test(keys->length == nkeys, "Expected %zu keys, found %zu\n", nkeys, keys->length);
+    cm_array_list_free(keys);
+    cm_hash_table_free(table);
+}
+
 static void
 test_cm_array_list_init(void)
 {
@@ -201,13 +230,91 @@ test_be_to_size_t(void)
     print_test_separator_line();
 }
 
+static void
+test_sha256(void)
+{
+    struct {
+        const char *input;
+        const char *expected;
+    } tests[] = {
+        {"", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"},
+        {"abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"},
+        {
+            "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+            "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"
+        }
+    };
+    print_test_separator_line();
+    printf("Testing sha256\n");
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        uint8_t digest[CM_SHA256_DIGEST_LENGTH];
+        char hex[2 * CM_SHA256_DIGEST_LENGTH + 1];
+        cm_sha256(tests[i].input, strlen(tests[i].input), digest);
+        for (size_t j = 0; j < CM_SHA256_DIGEST_LENGTH; j++)
+            snprintf(hex + 2 * j, 3, "%02x", digest[j]);
+        test(strcmp(hex, tests[i].expected) == 0, "Expected sha256 of \"%s\" to be %s, got %s\n",
+            tests[i].input, tests[i].expected, hex);
+    }
+}
+
+static void
+free_array_list(void *list)
+{
+    cm_array_list_free((cm_array_list *) list);
+}
+
+static void
+test_arena(void)
+{
+    print_test_separator_line();
+    printf("Testing arena allocation\n");
+    cm_arena *arena = cm_arena_init();
+    size_t *sizes[1024];
+    for (size_t i = 0; i < 1024; i++) {
+        sizes[i] = cm_arena_alloc(arena, 100);
+        test(((uintptr_t) sizes[i]) % _Alignof(max_align_t) == 0,
+            "Expected an aligned allocation\n");
+        *sizes[i] = i;
+    }
+    for (size_t i = 0; i < 1024; i++)
+        test(*sizes[i] == i, "Expected %zu, got %zu\n", i, *sizes[i]);
+
+    char *s = cm_arena_strdup(arena, "monkey");
+    test(strcmp(s, "monkey") == 0, "Expected monkey, got %s\n", s);
+    char *grown = cm_arena_realloc(arena, s, 7, 32);
+    test(grown == s, "Expected the last allocation to grow in place\n");
+    cm_arena_alloc(arena, 8);
+    grown = cm_arena_realloc(arena, grown, 32, 64);
+    test(grown != s && strcmp(grown, "monkey") == 0,
+        "Expected a copy of monkey, got %s\n", grown);
+
+    /* larger than a chunk */
+    char *big = cm_arena_alloc(arena, 2 * CM_ARENA_CHUNK_SIZE);
+    memset(big, 'x', 2 * CM_ARENA_CHUNK_SIZE);
+
+    cm_list *list = cm_list_init_arena(arena);
+    for (size_t i = 0; i < 100; i++)
+        cm_list_add(list, sizes[i]);
+    test(list->length == 100, "Expected 100 list entries, got %zu\n", list->length);
+    test(cm_list_get_at(list, 42) == sizes[42], "Expected entry 42 at index 42\n");
+    cm_list_free(list, NULL);
+
+    cm_array_list *array_list = cm_array_list_init(4, NULL);
+    cm_array_list_add(array_list, s);
+    cm_arena_add_cleanup(arena, free_array_list, array_list);
+    cm_arena_free(arena);
+}
+
 int
 main(int argc, char **argv)
 {
     test_hash_table_init();
     test_hash_table_put();
+    test_hash_table_resize();
     test_cm_array_list_init();
     test_cm_array_list();
     test_cm_array_list_init_size_t();
     test_be_to_size_t();
+    test_sha256();
+    test_arena();
 }
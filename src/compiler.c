@@ -28,6 +28,7 @@
  */
 
 #include <err.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
@@ -39,6 +40,14 @@
 #include "opcode.h"
 
 #define CONSTANTS_POOL_INIT_SIZE 16
+#define INLINE_BUDGET 24 // AST nodes in the body of a function worth inlining
+#define INLINE_MAX_DEPTH 4
+
+/*
+ * Part of the key of cached bytecode. The build time keeps a rebuilt
+ * compiler from reusing what the previous build compiled.
+ */
+const char *compiler_version = COMPILER_VERSION " " __DATE__ " " __TIME__;
 
 static instructions_t *
 get_current_instructions(compiler_t *compiler)
@@ -69,16 +78,6 @@ remove_last_instruction(compiler_t *compiler)
     scope->last_instruction.position = scope->prev_instruction.position;
 }
 
-static size_t
-add_instructions(compiler_t *compiler, instructions_t *ins)
-{
-    compilation_scope_t *scope = get_top_scope(compiler);
-    size_t new_ins_pos = scope->instructions->length;
-    concat_instructions(scope->instructions, ins);
-    instructions_free(ins);
-    return new_ins_pos;
-}
-
 static void
 set_last_instruction(compiler_t *compiler, opcode_t opcode, size_t pos)
 {
@@ -89,37 +88,103 @@ set_last_instruction(compiler_t *compiler, opcode_t opcode, size_t pos)
     scope->last_instruction.position = pos;
 }
 
-static void
-replace_instruction(compiler_t *compiler, size_t position, instructions_t *ins)
-{
-    compilation_scope_t *scope = get_top_scope(compiler);
-    for (size_t i = 0; i < ins->length; i++)
-        scope->instructions->bytes[position + i] = ins->bytes[i];
-}
-
 static void
 change_operand(compiler_t *compiler, size_t op_pos, size_t operand)
 {
-    compilation_scope_t *scope = get_top_scope(compiler);
-    opcode_t op = (opcode_t) scope->instructions->bytes[op_pos];
-    instructions_t *new_ins = instruction_init(op, operand);
-    replace_instruction(compiler, op_pos, new_ins);
-    instructions_free(new_ins);
+    instructions_patch_operand(get_current_instructions(compiler), op_pos, operand);
 }
 
+/*
+ * Instructions are encoded straight into the buffer of the current scope,
+ * so emitting one allocates nothing unless the buffer has to grow.
+ */
 size_t
 emit(compiler_t *compiler, opcode_t op, ...)
 {
     va_list ap;
     va_start(ap, op);
-    instructions_t *ins = vinstruction_init(op, ap);
-    size_t new_ins_pos = add_instructions(compiler, ins);
+    size_t new_ins_pos = vinstructions_append(get_current_instructions(compiler), op, ap);
     va_end(ap);
     set_last_instruction(compiler, op, new_ins_pos);
     return new_ins_pos;
 }
 
 
+/*
+ * Ints, strings and compiled functions equal in value share one slot of the
+ * constants pool. Compiled functions are equal when their instructions,
+ * which refer to other constants by index, and their frame layout are.
+ */
+static size_t
+constant_hash(void *key)
+{
+    monkey_object_t *obj = (monkey_object_t *) key;
+    monkey_compiled_fn_t *fn;
+    size_t hash;
+    switch (obj->type) {
+    case MONKEY_INT:
+        return (size_t) ((monkey_int_t *) obj)->value * 2654435761u;
+    case MONKEY_STRING:
+        return string_hash_function(((monkey_string_t *) obj)->value);
+    case MONKEY_COMPILED_FUNCTION:
+        fn = (monkey_compiled_fn_t *) obj;
+        hash = 2166136261u ^ fn->num_locals ^ (fn->num_args << 8);
+        for (size_t i = 0; i < fn->instructions->length; i++)
+            hash = (hash ^ fn->instructions->bytes[i]) * 16777619u;
+        return hash;
+    default:
+        return (size_t) obj;
+    }
+}
+
+static _Bool
+constant_equals(void *key1, void *key2)
+{
+    monkey_object_t *obj1 = (monkey_object_t *) key1;
+    monkey_object_t *obj2 = (monkey_object_t *) key2;
+    monkey_compiled_fn_t *fn1, *fn2;
+    if (obj1->type != obj2->type)
+        return false;
+    switch (obj1->type) {
+    case MONKEY_INT:
+    case MONKEY_STRING:
+        return monkey_object_equals(obj1, obj2);
+    case MONKEY_COMPILED_FUNCTION:
+        fn1 = (monkey_compiled_fn_t *) obj1;
+        fn2 = (monkey_compiled_fn_t *) obj2;
+        return fn1->num_locals == fn2->num_locals && fn1->num_args == fn2->num_args &&
+            monkey_object_equals(obj1, obj2);
+    default:
+        return obj1 == obj2;
+    }
+}
+
+static void
+index_constant(compiler_t *compiler, monkey_object_t *obj, size_t index)
+{
+    cm_hash_table_put(compiler->constants_index, obj, (void *) (index + 1));
+}
+
+/*
+ * Adds the object to the constants pool, taking ownership of it, and
+ * returns its index. An equal constant already in the pool is reused and
+ * the object freed.
+ */
+static size_t
+add_constant(compiler_t *compiler, monkey_object_t *obj)
+{
+    if (compiler->constants_pool == NULL)
+        compiler->constants_pool = cm_array_list_init(CONSTANTS_POOL_INIT_SIZE, free_monkey_object);
+    size_t index = (size_t) cm_hash_table_get(compiler->constants_index, obj);
+    if (index != 0) {
+        free_monkey_object(obj);
+        return index - 1;
+    }
+    cm_array_list_add(compiler->constants_pool, obj);
+    index_constant(compiler, obj, compiler->constants_pool->length - 1);
+    return compiler->constants_pool->length - 1;
+}
+
 compilation_scope_t *
 scope_init()
 {
@@ -133,6 +198,7 @@ scope_init()
     scope->instructions->bytes = NULL;
     scope->instructions->length = 0;
     scope->instructions->size = 0;
+    scope->instructions->mapped = false;
     return scope;
 }
 
@@ -153,6 +219,16 @@ compiler_init(void)
     }
     compiler->scope_index = 0;
     compiler->scopes = cm_array_list_init(16, _scope_free);
+    compiler->constants_index = cm_hash_table_init(constant_hash, constant_equals, NULL, NULL);
+    compiler->global_constants = cm_array_list_init(16, NULL);
+    compiler->rebound_globals = cm_hash_table_init(string_hash_function, string_equals,
+        free, NULL);
+    compiler->whole_program = true;
+    compiler->fold_constants = true;
+    compiler->inline_candidates = cm_hash_table_init(string_hash_function, string_equals,
+        NULL, NULL);
+    compiler->inline_frame = NULL;
+    compiler->inline_functions = true;
     compilation_scope_t *main_scope = scope_init();
     cm_array_list_add(compiler->scopes, main_scope);
     return compiler;
@@ -217,6 +293,10 @@ compiler_init_with_state(symbol_table_t *symbol_table, cm_array_list *constants)
     free_symbol_table(compiler->symbol_table);
     compiler->symbol_table = symbol_table_copy(symbol_table);
     compiler->constants_pool = cm_array_list_copy(constants, _copy_monkey_object);
+    for (size_t i = 0; i < compiler->constants_pool->length; i++)
+        index_constant(compiler, cm_array_list_get(compiler->constants_pool, i), i);
+    /* the next input may bind any global again */
+    compiler->whole_program = false;
     return compiler;
 }
 
@@ -224,6 +304,15 @@ void
 compiler_free(compiler_t *compiler)
 {
     cm_array_list_free(compiler->scopes);
+    for (size_t i = 0; i < compiler->global_constants->length; i++) {
+        monkey_object_t *value = cm_array_list_get(compiler->global_constants, i);
+        if (value != NULL)
+            free_monkey_object(value);
+    }
+    cm_array_list_free(compiler->global_constants);
+    cm_hash_table_free(compiler->rebound_globals);
+    cm_hash_table_free(compiler->inline_candidates);
+    cm_hash_table_free(compiler->constants_index);
     if (compiler->constants_pool)
         cm_array_list_free(compiler->constants_pool);
     free_symbol_table(compiler->symbol_table);
@@ -236,15 +325,6 @@ bytecode_free(bytecode_t *bytecode)
     free(bytecode);
 }
 
-static size_t
-add_constant(compiler_t *compiler, monkey_object_t *obj)
-{
-    if (compiler->constants_pool == NULL)
-        compiler->constants_pool = cm_array_list_init(CONSTANTS_POOL_INIT_SIZE, free_monkey_object);
-    cm_array_list_add(compiler->constants_pool, obj);
-    return compiler->constants_pool->length - 1;
-}
-
 static char *
 get_err_msg(const char *s, ...)
 {
@@ -276,12 +356,687 @@ replace_last_pop_with_return(compiler_t *compiler)
 {
     compilation_scope_t *top_scope = get_top_scope(compiler);
     size_t lastpos = top_scope->last_instruction.position;
-    instructions_t *new_ins = instruction_init(OPRETURNVALUE);
-    replace_instruction(compiler, lastpos, new_ins);
-    instructions_free(new_ins);
+    top_scope->instructions->bytes[lastpos] = OPRETURNVALUE;
     top_scope->last_instruction.opcode = OPRETURNVALUE;
 }
 
+/*
+ * A call whose result is returned right away, possibly after the jump out
+ * of an if expression, becomes a tail call that reuses the caller's frame.
+ */
+static void
+mark_tail_calls(instructions_t *ins)
+{
+    uint8_t *bytes = ins->bytes;
+    for (size_t pos = 0; pos < ins->length; pos += get_instruction_length(bytes[pos])) {
+        if (bytes[pos] != OPCALL)
+            continue;
+        size_t next = pos + get_instruction_length(OPCALL);
+        while (next < ins->length && bytes[next] == OPJMP)
+            next = decode_instructions_to_sizet(bytes + next + 1, 2);
+        if (next < ins->length && bytes[next] == OPRETURNVALUE)
+            bytes[pos] = OPTAILCALL;
+    }
+}
+
+static void
+set_global_constant(compiler_t *compiler, size_t index, monkey_object_t *value)
+{
+    while (compiler->global_constants->length <= index)
+        cm_array_list_add(compiler->global_constants, NULL);
+    compiler->global_constants->array[index] = value;
+}
+
+static symbol_table_t *
+get_global_symbol_table(compiler_t *compiler)
+{
+    symbol_table_t *table = compiler->symbol_table;
+    while (table->outer != NULL)
+        table = table->outer;
+    return table;
+}
+
+static symbol_t *
+get_inlined_param(inline_frame_t *frame, const char *name)
+{
+    size_t i = 0;
+    for (cm_list_node *node = frame->fn->parameters->head; node != NULL; node = node->next, i++) {
+        if (strcmp(((identifier_t *) node->data)->value, name) == 0)
+            return frame->params[i];
+    }
+    return NULL;
+}
+
+/*
+ * Returns the symbol a name stands for where the code being compiled is.
+ * In the body of an inlined function the parameters are the variables
+ * holding the arguments and any other name is global, as it is where the
+ * function was defined. The symbol tables are searched directly rather
+ * than through symbol_resolve, which would define the name as free in the
+ * enclosing functions.
+ */
+static symbol_t *
+lookup_symbol(compiler_t *compiler, const char *name)
+{
+    symbol_t *sym = NULL;
+    symbol_table_t *table;
+    if (compiler->inline_frame != NULL) {
+        if ((sym = get_inlined_param(compiler->inline_frame, name)) != NULL)
+            return sym;
+        table = get_global_symbol_table(compiler);
+        return table->store == NULL? NULL: cm_hash_table_get(table->store, (void *) name);
+    }
+    for (table = compiler->symbol_table; table != NULL; table = table->outer) {
+        if (table->store != NULL && (sym = cm_hash_table_get(table->store, (void *) name)) != NULL)
+            break;
+    }
+    return sym;
+}
+
+/*
+ * Returns the constant value bound to the global the name resolves to, if
+ * any.
+ */
+static monkey_object_t *
+get_global_constant(compiler_t *compiler, const char *name)
+{
+    symbol_t *sym = lookup_symbol(compiler, name);
+    if (sym == NULL || sym->scope != GLOBAL || sym->index >= compiler->global_constants->length)
+        return NULL;
+    return cm_array_list_get(compiler->global_constants, sym->index);
+}
+
+static void find_rebound_globals_in_expression(compiler_t *, cm_hash_table *, expression_t *);
+
+/*
+ * Records the names the main program binds more than once, which then
+ * change value as it runs, so that they are never propagated as
+ * constants. Let statements inside function literals bind locals and are
+ * not looked at.
+ */
+static void
+find_rebound_globals_in_statement(compiler_t *compiler, cm_hash_table *seen,
+    statement_t *statement)
+{
+    letstatement_t *let_stmt;
+    block_statement_t *block_stmt;
+    char *name;
+    switch (statement->statement_type) {
+    case LET_STATEMENT:
+        let_stmt = (letstatement_t *) statement;
+        name = let_stmt->name->value;
+        if (cm_hash_table_get(seen, name) == NULL)
+            cm_hash_table_put(seen, name, name);
+        else if (cm_hash_table_get(compiler->rebound_globals, name) == NULL) {
+            name = strdup(name);
+            if (name == NULL)
+                err(EXIT_FAILURE, "malloc failed");
+            cm_hash_table_put(compiler->rebound_globals, name, name);
+        }
+        find_rebound_globals_in_expression(compiler, seen, let_stmt->value);
+        break;
+    case RETURN_STATEMENT:
+        find_rebound_globals_in_expression(compiler, seen,
+            ((return_statement_t *) statement)->return_value);
+        break;
+    case EXPRESSION_STATEMENT:
+        find_rebound_globals_in_expression(compiler, seen,
+            ((expression_statement_t *) statement)->expression);
+        break;
+    case BLOCK_STATEMENT:
+        block_stmt = (block_statement_t *) statement;
+        for (size_t i = 0; i < block_stmt->nstatements; i++)
+            find_rebound_globals_in_statement(compiler, seen, block_stmt->statements[i]);
+        break;
+    }
+}
+
+static void
+find_rebound_globals_in_expression(compiler_t *compiler, cm_hash_table *seen,
+    expression_t *exp)
+{
+    if_expression_t *if_exp;
+    while_expression_t *while_exp;
+    infix_expression_t *infix_exp;
+    call_expression_t *call_exp;
+    array_literal_t *array_exp;
+    index_expression_t *index_exp;
+    hash_literal_t *hash_exp;
+    cm_array_list *keys;
+    if (exp == NULL)
+        return;
+    switch (exp->expression_type) {
+    case PREFIX_EXPRESSION:
+        find_rebound_globals_in_expression(compiler, seen,
+            ((prefix_expression_t *) exp)->right);
+        break;
+    case INFIX_EXPRESSION:
+        infix_exp = (infix_expression_t *) exp;
+        find_rebound_globals_in_expression(compiler, seen, infix_exp->left);
+        find_rebound_globals_in_expression(compiler, seen, infix_exp->right);
+        break;
+    case IF_EXPRESSION:
+        if_exp = (if_expression_t *) exp;
+        find_rebound_globals_in_expression(compiler, seen, if_exp->condition);
+        find_rebound_globals_in_statement(compiler, seen, (statement_t *) if_exp->consequence);
+        if (if_exp->alternative != NULL)
+            find_rebound_globals_in_statement(compiler, seen,
+                (statement_t *) if_exp->alternative);
+        break;
+    case WHILE_EXPRESSION:
+        while_exp = (while_expression_t *) exp;
+        find_rebound_globals_in_expression(compiler, seen, while_exp->condition);
+        find_rebound_globals_in_statement(compiler, seen, (statement_t *) while_exp->body);
+        break;
+    case CALL_EXPRESSION:
+        call_exp = (call_expression_t *) exp;
+        find_rebound_globals_in_expression(compiler, seen, call_exp->function);
+        for (cm_list_node *node = call_exp->arguments->head; node != NULL; node = node->next)
+            find_rebound_globals_in_expression(compiler, seen, (expression_t *) node->data);
+        break;
+    case ARRAY_LITERAL:
+        array_exp = (array_literal_t *) exp;
+        for (size_t i = 0; i < array_exp->elements->length; i++)
+            find_rebound_globals_in_expression(compiler, seen, array_exp->elements->array[i]);
+        break;
+    case INDEX_EXPRESSION:
+        index_exp = (index_expression_t *) exp;
+        find_rebound_globals_in_expression(compiler, seen, index_exp->left);
+        find_rebound_globals_in_expression(compiler, seen, index_exp->index);
+        break;
+    case HASH_LITERAL:
+        hash_exp = (hash_literal_t *) exp;
+        keys = cm_hash_table_get_keys(hash_exp->pairs);
+        if (keys == NULL)
+            break;
+        for (size_t i = 0; i < keys->length; i++) {
+            find_rebound_globals_in_expression(compiler, seen, keys->array[i]);
+            find_rebound_globals_in_expression(compiler, seen,
+                cm_hash_table_get(hash_exp->pairs, keys->array[i]));
+        }
+        cm_array_list_free(keys);
+        break;
+    default:
+        break;
+    }
+}
+
+static _Bool
+is_constant_global(compiler_t *compiler, const char *name)
+{
+    return compiler->whole_program &&
+        cm_hash_table_get(compiler->rebound_globals, (void *) name) == NULL;
+}
+
+static monkey_object_t *fold_constant_expression(compiler_t *, expression_t *);
+
+static monkey_object_t *
+fold_infix_expression(compiler_t *compiler, infix_expression_t *infix_exp)
+{
+    monkey_object_t *left, *right, *result = NULL;
+    long leftval, rightval, value;
+    _Bool leftbool, rightbool;
+    left = fold_constant_expression(compiler, infix_exp->left);
+    if (left == NULL)
+        return NULL;
+    right = fold_constant_expression(compiler, infix_exp->right);
+    if (right == NULL) {
+        free_monkey_object(left);
+        return NULL;
+    }
+    if (left->type == MONKEY_INT && right->type == MONKEY_INT) {
+        leftval = ((monkey_int_t *) left)->value;
+        rightval = ((monkey_int_t *) right)->value;
+        switch (infix_exp->op) {
+        case PLUS:
+            if (!__builtin_add_overflow(leftval, rightval, &value))
+                result = (monkey_object_t *) create_monkey_int(value);
+            break;
+        case MINUS:
+            if (!__builtin_sub_overflow(leftval, rightval, &value))
+                result = (monkey_object_t *) create_monkey_int(value);
+            break;
+        case ASTERISK:
+            if (!__builtin_mul_overflow(leftval, rightval, &value))
+                result = (monkey_object_t *) create_monkey_int(value);
+            break;
+        case SLASH:
+            if (rightval != 0 && !(leftval == LONG_MIN && rightval == -1))
+                result = (monkey_object_t *) create_monkey_int(leftval / rightval);
+            break;
+        case PERCENT:
+            if (rightval != 0 && !(leftval == LONG_MIN && rightval == -1))
+                result = (monkey_object_t *) create_monkey_int(leftval % rightval);
+            break;
+        case LT:
+            result = (monkey_object_t *) create_monkey_bool(leftval < rightval);
+            break;
+        case GT:
+            result = (monkey_object_t *) create_monkey_bool(leftval > rightval);
+            break;
+        case LT_EQ:
+            result = (monkey_object_t *) create_monkey_bool(leftval <= rightval);
+            break;
+        case GT_EQ:
+            result = (monkey_object_t *) create_monkey_bool(leftval >= rightval);
+            break;
+        case EQ:
+            result = (monkey_object_t *) create_monkey_bool(leftval == rightval);
+            break;
+        case NOT_EQ:
+            result = (monkey_object_t *) create_monkey_bool(leftval != rightval);
+            break;
+        default:
+            break;
+        }
+    } else if (left->type == MONKEY_STRING && right->type == MONKEY_STRING) {
+        if (infix_exp->op == PLUS) {
+            monkey_string_t *leftstr = (monkey_string_t *) left;
+            monkey_string_t *rightstr = (monkey_string_t *) right;
+            char *s = malloc(leftstr->length + rightstr->length + 1);
+            if (s == NULL)
+                err(EXIT_FAILURE, "malloc failed");
+            memcpy(s, leftstr->value, leftstr->length);
+            memcpy(s + leftstr->length, rightstr->value, rightstr->length);
+            s[leftstr->length + rightstr->length] = 0;
+            result = (monkey_object_t *) create_monkey_string(s, leftstr->length + rightstr->length);
+            free(s);
+        }
+    } else if (left->type == MONKEY_BOOL && right->type == MONKEY_BOOL) {
+        leftbool = ((monkey_bool_t *) left)->value;
+        rightbool = ((monkey_bool_t *) right)->value;
+        switch (infix_exp->op) {
+        case EQ:
+            result = (monkey_object_t *) create_monkey_bool(leftbool == rightbool);
+            break;
+        case NOT_EQ:
+            result = (monkey_object_t *) create_monkey_bool(leftbool != rightbool);
+            break;
+        case AND:
+            result = (monkey_object_t *) create_monkey_bool(leftbool && rightbool);
+            break;
+        case OR:
+            result = (monkey_object_t *) create_monkey_bool(leftbool || rightbool);
+            break;
+        default:
+            break;
+        }
+    }
+    free_monkey_object(left);
+    free_monkey_object(right);
+    return result;
+}
+
+static monkey_object_t *
+fold_prefix_expression(compiler_t *compiler, prefix_expression_t *prefix_exp)
+{
+    monkey_object_t *right, *result = NULL;
+    right = fold_constant_expression(compiler, prefix_exp->right);
+    if (right == NULL)
+        return NULL;
+    if (prefix_exp->op == MINUS) {
+        if (right->type == MONKEY_INT && ((monkey_int_t *) right)->value != LONG_MIN)
+            result = (monkey_object_t *) create_monkey_int(-((monkey_int_t *) right)->value);
+    } else if (prefix_exp->op == BANG) {
+        if (right->type == MONKEY_BOOL)
+            result = (monkey_object_t *) create_monkey_bool(!((monkey_bool_t *) right)->value);
+    }
+    free_monkey_object(right);
+    return result;
+}
+
+/*
+ * Evaluates an expression made of literals, operators and globals bound
+ * to constants at compile time, with the semantics the vm gives it.
+ * Whatever the vm would reject or overflow on is left for it to report at
+ * runtime. Returns a new object, or NULL when the expression is not
+ * constant.
+ */
+static monkey_object_t *
+fold_constant_expression(compiler_t *compiler, expression_t *exp)
+{
+    monkey_object_t *value;
+    switch (exp->expression_type) {
+    case INTEGER_EXPRESSION:
+        return (monkey_object_t *) create_monkey_int(((integer_t *) exp)->value);
+    case BOOLEAN_EXPRESSION:
+        return (monkey_object_t *) create_monkey_bool(((boolean_expression_t *) exp)->value);
+    case STRING_EXPRESSION:
+        return (monkey_object_t *) create_monkey_string(((string_t *) exp)->value,
+            strlen(((string_t *) exp)->value));
+    case IDENTIFIER_EXPRESSION:
+        value = get_global_constant(compiler, ((identifier_t *) exp)->value);
+        return value == NULL? NULL: copy_monkey_object(value);
+    case INFIX_EXPRESSION:
+        return fold_infix_expression(compiler, (infix_expression_t *) exp);
+    case PREFIX_EXPRESSION:
+        return fold_prefix_expression(compiler, (prefix_expression_t *) exp);
+    default:
+        return NULL;
+    }
+}
+
+static void
+emit_constant(compiler_t *compiler, monkey_object_t *value)
+{
+    if (value->type == MONKEY_BOOL)
+        emit(compiler, ((monkey_bool_t *) value)->value? OPTRUE: OPFALSE);
+    else
+        emit(compiler, OPCONSTANT, add_constant(compiler, value));
+}
+
+/*
+ * Returns the number of AST nodes in an expression that may be part of an
+ * inlined body, or INLINE_BUDGET + 1 when it may not. Function literals,
+ * loops, lets and returns are left out: they would need the body to have
+ * a scope of its own. So are references to the function itself.
+ */
+static size_t
+inline_cost(expression_t *exp, const char *self)
+{
+    size_t cost = 1;
+    statement_t *stmt;
+    block_statement_t *block;
+    if (exp == NULL)
+        return cost;
+    switch (exp->expression_type) {
+    case INTEGER_EXPRESSION:
+    case STRING_EXPRESSION:
+    case BOOLEAN_EXPRESSION:
+        return cost;
+    case IDENTIFIER_EXPRESSION:
+        return strcmp(((identifier_t *) exp)->value, self) == 0? INLINE_BUDGET + 1: cost;
+    case PREFIX_EXPRESSION:
+        return cost + inline_cost(((prefix_expression_t *) exp)->right, self);
+    case INFIX_EXPRESSION:
+        return cost + inline_cost(((infix_expression_t *) exp)->left, self) +
+            inline_cost(((infix_expression_t *) exp)->right, self);
+    case INDEX_EXPRESSION:
+        return cost + inline_cost(((index_expression_t *) exp)->left, self) +
+            inline_cost(((index_expression_t *) exp)->index, self);
+    case IF_EXPRESSION:
+        cost += inline_cost(((if_expression_t *) exp)->condition, self);
+        for (int branch = 0; branch < 2; branch++) {
+            block = branch == 0? ((if_expression_t *) exp)->consequence:
+                ((if_expression_t *) exp)->alternative;
+            for (size_t i = 0; block != NULL && i < block->nstatements; i++) {
+                stmt = block->statements[i];
+                if (stmt->statement_type != EXPRESSION_STATEMENT)
+                    return INLINE_BUDGET + 1;
+                cost += inline_cost(((expression_statement_t *) stmt)->expression, self);
+            }
+        }
+        return cost;
+    case CALL_EXPRESSION:
+        cost += inline_cost(((call_expression_t *) exp)->function, self);
+        for (size_t i = 0; i < ((call_expression_t *) exp)->arguments->length; i++)
+            cost += inline_cost(cm_list_get_at(((call_expression_t *) exp)->arguments, i), self);
+        return cost;
+    case ARRAY_LITERAL:
+        for (size_t i = 0; i < ((array_literal_t *) exp)->elements->length; i++)
+            cost += inline_cost(cm_array_list_get(((array_literal_t *) exp)->elements, i), self);
+        return cost;
+    default:
+        return INLINE_BUDGET + 1;
+    }
+}
+
+/*
+ * Remembers a global bound once, at the top level of the program, to a
+ * function small enough to inline. Calls compiled after the binding
+ * may then be replaced by the body of the function.
+ */
+static void
+add_inline_candidate(compiler_t *compiler, statement_t *stmt)
+{
+    letstatement_t *let_stmt;
+    function_literal_t *fn;
+    block_statement_t *body;
+    symbol_t *sym;
+    if (stmt->statement_type != LET_STATEMENT)
+        return;
+    let_stmt = (letstatement_t *) stmt;
+    if (let_stmt->value == NULL || let_stmt->value->expression_type != FUNCTION_LITERAL)
+        return;
+    fn = (function_literal_t *) let_stmt->value;
+    body = fn->body;
+    sym = cm_hash_table_get(compiler->symbol_table->store, let_stmt->name->value);
+    if (sym == NULL || sym->scope != GLOBAL || !is_constant_global(compiler, sym->name))
+        return;
+    if (body == NULL || body->nstatements != 1 ||
+            body->statements[0]->statement_type != EXPRESSION_STATEMENT)
+        return;
+    if (inline_cost(((expression_statement_t *) body->statements[0])->expression,
+            let_stmt->name->value) > INLINE_BUDGET)
+        return;
+    cm_hash_table_put(compiler->inline_candidates, let_stmt->name->value, fn);
+}
+
+/*
+ * Returns the function a call can be replaced with: one inlining allows,
+ * called by the name of the global it is bound to, with as many arguments
+ * as it takes and not already being inlined further out.
+ */
+static function_literal_t *
+get_inline_candidate(compiler_t *compiler, call_expression_t *call_exp)
+{
+    identifier_t *callee;
+    function_literal_t *fn;
+    symbol_t *sym;
+    if (call_exp->function->expression_type != IDENTIFIER_EXPRESSION)
+        return NULL;
+    callee = (identifier_t *) call_exp->function;
+    fn = cm_hash_table_get(compiler->inline_candidates, callee->value);
+    if (fn == NULL || fn->parameters->length != call_exp->arguments->length)
+        return NULL;
+    /* a local or a parameter of the same name hides the global */
+    sym = lookup_symbol(compiler, callee->value);
+    if (sym == NULL || sym != cm_hash_table_get(get_global_symbol_table(compiler)->store,
+            callee->value))
+        return NULL;
+    for (inline_frame_t *frame = compiler->inline_frame; frame != NULL; frame = frame->outer) {
+        if (frame->fn == fn || frame->depth + 1 >= INLINE_MAX_DEPTH)
+            return NULL;
+    }
+    return fn;
+}
+
+/*
+ * Tells whether a statement binds a name with let, in its own scope. A
+ * constant if or while keeps a block it would skip when it does, so that
+ * the name can still be resolved after the block.
+ */
+static _Bool expression_binds_names(expression_t *);
+
+static _Bool
+statement_binds_names(statement_t *statement)
+{
+    block_statement_t *block_stmt;
+    if (statement == NULL)
+        return false;
+    switch (statement->statement_type) {
+    case LET_STATEMENT:
+        return true;
+    case RETURN_STATEMENT:
+        return expression_binds_names(((return_statement_t *) statement)->return_value);
+    case EXPRESSION_STATEMENT:
+        return expression_binds_names(((expression_statement_t *) statement)->expression);
+    case BLOCK_STATEMENT:
+        block_stmt = (block_statement_t *) statement;
+        for (size_t i = 0; i < block_stmt->nstatements; i++)
+            if (statement_binds_names(block_stmt->statements[i]))
+                return true;
+        return false;
+    }
+    return false;
+}
+
+static _Bool
+expression_binds_names(expression_t *exp)
+{
+    if_expression_t *if_exp;
+    while_expression_t *while_exp;
+    infix_expression_t *infix_exp;
+    call_expression_t *call_exp;
+    array_literal_t *array_exp;
+    index_expression_t *index_exp;
+    hash_literal_t *hash_exp;
+    cm_array_list *keys;
+    _Bool binds = false;
+    if (exp == NULL)
+        return false;
+    switch (exp->expression_type) {
+    case PREFIX_EXPRESSION:
+        return expression_binds_names(((prefix_expression_t *) exp)->right);
+    case INFIX_EXPRESSION:
+        infix_exp = (infix_expression_t *) exp;
+        return expression_binds_names(infix_exp->left) ||
+            expression_binds_names(infix_exp->right);
+    case IF_EXPRESSION:
+        if_exp = (if_expression_t *) exp;
+        return expression_binds_names(if_exp->condition) ||
+            statement_binds_names((statement_t *) if_exp->consequence) ||
+            statement_binds_names((statement_t *) if_exp->alternative);
+    case WHILE_EXPRESSION:
+        while_exp = (while_expression_t *) exp;
+        return expression_binds_names(while_exp->condition) ||
+            statement_binds_names((statement_t *) while_exp->body);
+    case CALL_EXPRESSION:
+        call_exp = (call_expression_t *) exp;
+        if (expression_binds_names(call_exp->function))
+            return true;
+        for (cm_list_node *node = call_exp->arguments->head; node != NULL; node = node->next)
+            if (expression_binds_names((expression_t *) node->data))
+                return true;
+        return false;
+    case ARRAY_LITERAL:
+        array_exp = (array_literal_t *) exp;
+        for (size_t i = 0; i < array_exp->elements->length; i++)
+            if (expression_binds_names(array_exp->elements->array[i]))
+                return true;
+        return false;
+    case INDEX_EXPRESSION:
+        index_exp = (index_expression_t *) exp;
+        return expression_binds_names(index_exp->left) ||
+            expression_binds_names(index_exp->index);
+    case HASH_LITERAL:
+        hash_exp = (hash_literal_t *) exp;
+        keys = cm_hash_table_get_keys(hash_exp->pairs);
+        if (keys == NULL)
+            return false;
+        for (size_t i = 0; i < keys->length && !binds; i++)
+            binds = expression_binds_names(keys->array[i]) ||
+                expression_binds_names(cm_hash_table_get(hash_exp->pairs, keys->array[i]));
+        cm_array_list_free(keys);
+        return binds;
+    default:
+        /* function literals bind their names in a scope of their own */
+        return false;
+    }
+}
+
+/*
+ * Compiles a block that leaves its value on the stack: the value of its
+ * last expression, or null when it ends in something else. A block ending
+ * in a return leaves nothing, as control never gets past it.
+ */
+static compiler_error_t
+compile_block_value(compiler_t *compiler, block_statement_t *block)
+{
+    compiler_error_t error = {COMPILER_ERROR_NONE, NULL};
+    if (block == NULL) {
+        emit(compiler, OPNULL);
+        return error;
+    }
+    size_t start = get_current_instructions(compiler)->length;
+    error = compile(compiler, (node_t *) block);
+    if (error.code != COMPILER_ERROR_NONE)
+        return error;
+    if (get_current_instructions(compiler)->length == start)
+        emit(compiler, OPNULL);
+    else if (last_instruction_is(compiler, OPPOP))
+        remove_last_instruction(compiler);
+    else if (!last_instruction_is(compiler, OPRETURNVALUE))
+        emit(compiler, OPNULL);
+    return error;
+}
+
+/*
+ * Compiles a call as the body of the function it calls. The arguments are
+ * all evaluated, in order, before being stored in the variables standing
+ * for the parameters, so that calls inlined while evaluating them can
+ * reuse the variables of their depth.
+ */
+static compiler_error_t
+compile_inlined_call(compiler_t *compiler, call_expression_t *call_exp, function_literal_t *fn)
+{
+    compiler_error_t error = {COMPILER_ERROR_NONE, NULL};
+    inline_frame_t frame;
+    size_t nargs = call_exp->arguments->length;
+    char *name;
+    for (size_t i = 0; i < nargs; i++) {
+        error = compile(compiler, cm_list_get_at(call_exp->arguments, i));
+        if (error.code != COMPILER_ERROR_NONE)
+            return error;
+    }
+    frame.fn = fn;
+    frame.depth = compiler->inline_frame == NULL? 0: compiler->inline_frame->depth + 1;
+    frame.outer = compiler->inline_frame;
+    frame.params = malloc((nargs == 0? 1: nargs) * sizeof(*frame.params));
+    if (frame.params == NULL)
+        err(EXIT_FAILURE, "malloc failed");
+    for (size_t i = nargs; i > 0; i--) {
+        /* the dot keeps the names out of reach of the program */
+        if (asprintf(&name, "inline.%zu.%zu", frame.depth, i - 1) == -1)
+            err(EXIT_FAILURE, "malloc failed");
+        frame.params[i - 1] = symbol_bind(compiler->symbol_table, name);
+        free(name);
+        if (frame.params[i - 1]->scope == GLOBAL)
+            emit(compiler, OPSETGLOBAL, frame.params[i - 1]->index);
+        else
+            emit(compiler, OPSETLOCAL, frame.params[i - 1]->index);
+    }
+    compiler->inline_frame = &frame;
+    error = compile_block_value(compiler, fn->body);
+    compiler->inline_frame = frame.outer;
+    free(frame.params);
+    return error;
+}
+
+/*
+ * && and || short-circuit: the right side only runs when the left one
+ * does not settle the result. && leaves false or the value of the right
+ * side, || leaves true or the value of the right side.
+ */
+static compiler_error_t
+compile_logical_expression(compiler_t *compiler, infix_expression_t *infix_exp)
+{
+    compiler_error_t error;
+    size_t opjmpfalse_pos, jmp_pos;
+    _Bool is_and = infix_exp->op == AND;
+    error = compile(compiler, (node_t *) infix_exp->left);
+    if (error.code != COMPILER_ERROR_NONE)
+        return error;
+    opjmpfalse_pos = emit(compiler, OPJMPFALSE, 9999);
+    if (is_and) {
+        error = compile(compiler, (node_t *) infix_exp->right);
+        if (error.code != COMPILER_ERROR_NONE)
+            return error;
+    } else
+        emit(compiler, OPTRUE);
+    jmp_pos = emit(compiler, OPJMP, 9999);
+    change_operand(compiler, opjmpfalse_pos, get_current_instructions(compiler)->length);
+    if (is_and)
+        emit(compiler, OPFALSE);
+    else {
+        error = compile(compiler, (node_t *) infix_exp->right);
+        if (error.code != COMPILER_ERROR_NONE)
+            return error;
+    }
+    change_operand(compiler, jmp_pos, get_current_instructions(compiler)->length);
+    return error;
+}
+
 static compiler_error_t
 compile_expression_node(compiler_t *compiler, expression_t *expression_node)
 {
@@ -293,6 +1048,7 @@ compile_expression_node(compiler_t *compiler, expression_t *expression_node)
     boolean_expression_t *bool_exp;
     identifier_t *ident_exp;
     if_expression_t *if_exp;
+    while_expression_t *while_exp;
     monkey_int_t *int_obj;
     monkey_bool_t *bool_obj;
     string_t *str_exp;
@@ -304,18 +1060,23 @@ compile_expression_node(compiler_t *compiler, expression_t *expression_node)
     call_expression_t *call_exp;
     size_t constant_idx;
     size_t opjmpfalse_pos, after_consequence_pos, jmp_pos, after_alternative_pos;
+    size_t loop_start_pos;
     compilation_scope_t *scope;
+    monkey_object_t *folded;
+    function_literal_t *inlined;
+    _Bool truthy;
     switch (expression_node->expression_type) {
     case INFIX_EXPRESSION:
         infix_exp = (infix_expression_t *) expression_node;
-        if (strcmp(infix_exp->operator, "<") == 0) {
-            error = compile(compiler, (node_t *) infix_exp->right);
-            if (error.code != COMPILER_ERROR_NONE)
-                return error;
-            error = compile(compiler, (node_t *) infix_exp->left);
+        if (compiler->fold_constants &&
+                (folded = fold_constant_expression(compiler, expression_node)) != NULL) {
+            emit_constant(compiler, folded);
+            break;
+        }
+        if (infix_exp->op == AND || infix_exp->op == OR) {
+            error = compile_logical_expression(compiler, infix_exp);
             if (error.code != COMPILER_ERROR_NONE)
                 return error;
-            emit(compiler, OPGREATERTHAN);
             break;
         }
         error = compile(compiler, (node_t *) infix_exp->left);
@@ -324,21 +1085,41 @@ compile_expression_node(compiler_t *compiler, expression_t *expression_node)
         error = compile(compiler, (node_t *) infix_exp->right);
         if (error.code != COMPILER_ERROR_NONE)
             return error;
-        if (strcmp(infix_exp->operator, "+") == 0)
+        switch (infix_exp->op) {
+        case PLUS:
             emit(compiler, OPADD);
-        else if (strcmp(infix_exp->operator, "-") == 0)
+            break;
+        case MINUS:
             emit(compiler, OPSUB);
-        else if (strcmp(infix_exp->operator, "*") == 0)
+            break;
+        case ASTERISK:
             emit(compiler, OPMUL);
-        else if(strcmp(infix_exp->operator, "/") == 0)
+            break;
+        case SLASH:
             emit(compiler, OPDIV);
-        else if (strcmp(infix_exp->operator, ">") == 0)
+            break;
+        case PERCENT:
+            emit(compiler, OPMOD);
+            break;
+        case LT:
+            emit(compiler, OPLESSTHAN);
+            break;
+        case GT:
             emit(compiler, OPGREATERTHAN);
-        else if (strcmp(infix_exp->operator, "==") == 0)
+            break;
+        case LT_EQ:
+            emit(compiler, OPLESSEQUAL);
+            break;
+        case GT_EQ:
+            emit(compiler, OPGREATEREQUAL);
+            break;
+        case EQ:
             emit(compiler, OPEQUAL);
-        else if (strcmp(infix_exp->operator, "!=") == 0)
+            break;
+        case NOT_EQ:
             emit(compiler, OPNOTEQUAL);
-        else {
+            break;
+        default:
             error.code = COMPILER_UNKNOWN_OPERATOR;
             error.msg = get_err_msg("Unknown operator %s", infix_exp->operator);
             return error;
@@ -346,12 +1127,17 @@ compile_expression_node(compiler_t *compiler, expression_t *expression_node)
         break;
     case PREFIX_EXPRESSION:
         prefix_exp = (prefix_expression_t *) expression_node;
+        if (compiler->fold_constants &&
+                (folded = fold_constant_expression(compiler, expression_node)) != NULL) {
+            emit_constant(compiler, folded);
+            break;
+        }
         error = compile(compiler, (node_t *) prefix_exp->right);
         if (error.code != COMPILER_ERROR_NONE)
             return error;
-        if (strcmp(prefix_exp->operator, "-") == 0)
+        if (prefix_exp->op == MINUS)
             emit(compiler, OPMINUS);
-        else if (strcmp(prefix_exp->operator, "!") == 0)
+        else if (prefix_exp->op == BANG)
             emit(compiler, OPBANG);
         else {
             error.code = COMPILER_UNKNOWN_OPERATOR;
@@ -381,34 +1167,78 @@ compile_expression_node(compiler_t *compiler, expression_t *expression_node)
         break;
     case IF_EXPRESSION:
         if_exp = (if_expression_t *) expression_node;
+        if (compiler->fold_constants &&
+                (folded = fold_constant_expression(compiler, if_exp->condition)) != NULL) {
+            /* null never folds, anything but false is truthy */
+            truthy = folded->type != MONKEY_BOOL || ((monkey_bool_t *) folded)->value;
+            free_monkey_object(folded);
+            if (!statement_binds_names((statement_t *)
+                    (truthy? if_exp->alternative: if_exp->consequence))) {
+                error = compile_block_value(compiler,
+                    truthy? if_exp->consequence: if_exp->alternative);
+                if (error.code != COMPILER_ERROR_NONE)
+                    return error;
+                break;
+            }
+        }
         error = compile(compiler, (node_t *) if_exp->condition);
         if (error.code != COMPILER_ERROR_NONE)
             return error;
         opjmpfalse_pos = emit(compiler, OPJMPFALSE, 9999);
-        error = compile(compiler, (node_t *) if_exp->consequence);
+        error = compile_block_value(compiler, if_exp->consequence);
         if (error.code != COMPILER_ERROR_NONE)
             return error;
-        if (last_instruction_is(compiler, OPPOP))
-            remove_last_instruction(compiler);
         jmp_pos = emit(compiler, OPJMP, 9999);
         scope = get_top_scope(compiler);
         after_consequence_pos = scope->instructions->length;
         change_operand(compiler, opjmpfalse_pos, after_consequence_pos);
-        if (if_exp->alternative == NULL) {
-            emit(compiler, OPNULL);
-        } else {
-            error = compile(compiler, (node_t *) if_exp->alternative);
-            if (error.code != COMPILER_ERROR_NONE)
-                return error;
-            if (last_instruction_is(compiler, OPPOP))
-                remove_last_instruction(compiler);
-        }
+        error = compile_block_value(compiler, if_exp->alternative);
+        if (error.code != COMPILER_ERROR_NONE)
+            return error;
         after_alternative_pos = scope->instructions->length;
         change_operand(compiler, jmp_pos, after_alternative_pos);
         break;
+    case WHILE_EXPRESSION:
+        /*
+         * The loop keeps its value on the stack: null to begin with, then
+         * the value of the last run of the body, which replaces the
+         * previous one.
+         */
+        while_exp = (while_expression_t *) expression_node;
+        if (compiler->fold_constants &&
+                (folded = fold_constant_expression(compiler, while_exp->condition)) != NULL) {
+            truthy = folded->type != MONKEY_BOOL || ((monkey_bool_t *) folded)->value;
+            free_monkey_object(folded);
+            if (!truthy && !statement_binds_names((statement_t *) while_exp->body)) {
+                emit(compiler, OPNULL);
+                break;
+            }
+        }
+        emit(compiler, OPNULL);
+        loop_start_pos = get_current_instructions(compiler)->length;
+        error = compile(compiler, (node_t *) while_exp->condition);
+        if (error.code != COMPILER_ERROR_NONE)
+            return error;
+        opjmpfalse_pos = emit(compiler, OPJMPFALSE, 9999);
+        emit(compiler, OPPOP);
+        error = compile_block_value(compiler, while_exp->body);
+        if (error.code != COMPILER_ERROR_NONE)
+            return error;
+        emit(compiler, OPJMP, loop_start_pos);
+        change_operand(compiler, opjmpfalse_pos, get_current_instructions(compiler)->length);
+        break;
     case IDENTIFIER_EXPRESSION:
         ident_exp = (identifier_t *) expression_node;
-        symbol_t *sym = symbol_resolve(compiler->symbol_table, ident_exp->value);
+        if (compiler->fold_constants &&
+                (folded = get_global_constant(compiler, ident_exp->value)) != NULL) {
+            emit_constant(compiler, copy_monkey_object(folded));
+            break;
+        }
+        symbol_t *sym;
+        if (compiler->inline_frame != NULL)
+            sym = lookup_symbol(compiler, ident_exp->value);
+        else
+            sym = symbol_resolve(compiler->symbol_table, ident_exp->value);
         if (sym == NULL) {
             error.code = COMPILER_UNDEFINED_VARIABLE;
             error.msg = get_err_msg("undefined variable: %s\n", ident_exp->value);
@@ -472,6 +1302,7 @@ compile_expression_node(compiler_t *compiler, expression_t *expression_node)
             replace_last_pop_with_return(compiler);
         if (!last_instruction_is(compiler, OPRETURNVALUE))
             emit(compiler, OPRETURN);
+        mark_tail_calls(get_current_instructions(compiler));
 
         cm_array_list *free_symbols = cm_array_list_copy(compiler->symbol_table->free_symbols, _copy_symbol);
         size_t num_locals = compiler->symbol_table->nentries;
@@ -489,6 +1320,8 @@ compile_expression_node(compiler_t *compiler, expression_t *expression_node)
         break;
     case CALL_EXPRESSION:
         call_exp = (call_expression_t *) expression_node;
+        if (compiler->inline_functions && (inlined = get_inline_candidate(compiler, call_exp)) != NULL)
+            return compile_inlined_call(compiler, call_exp, inlined);
         error = compile(compiler, (node_t *) call_exp->function);
         if (error.code != COMPILER_ERROR_NONE)
             return error;
@@ -535,10 +1368,15 @@ compile_statement_node(compiler_t *compiler, statement_t *statement_node)
         break;
     case LET_STATEMENT:
         let_stmt = (letstatement_t *) statement_node;
-        sym = symbol_define(compiler->symbol_table, let_stmt->name->value);
+        sym = symbol_bind(compiler->symbol_table, let_stmt->name->value);
         error = compile(compiler, (node_t *) let_stmt->value);
         if (error.code != COMPILER_ERROR_NONE)
             return error;
+        /* a global bound only once to a constant is one */
+        if (sym->scope == GLOBAL && compiler->fold_constants &&
+                is_constant_global(compiler, sym->name))
+            set_global_constant(compiler, sym->index,
+                fold_constant_expression(compiler, let_stmt->value));
         if (sym->scope == GLOBAL)
             emit(compiler, OPSETGLOBAL, sym->index);
         else
@@ -563,16 +1401,23 @@ compile(compiler_t *compiler, node_t *node)
     program_t *program;
     expression_t *expression_node;
     statement_t *statement_node;
+    cm_hash_table *seen;
     compiler_error_t error;
     compiler_error_t none_error = {COMPILER_ERROR_NONE, NULL};
     size_t i;
     switch (node->type) {
     case PROGRAM:
         program = (program_t *) node;
+        seen = cm_hash_table_init(string_hash_function, string_equals, NULL, NULL);
+        for (i = 0; i < program->nstatements; i++)
+            find_rebound_globals_in_statement(compiler, seen, program->statements[i]);
+        cm_hash_table_free(seen);
         for (i = 0; i < program->nstatements; i++) {
             error = compile(compiler, (node_t *) program->statements[i]);
             if (error.code != COMPILER_ERROR_NONE)
                 return error;
+            if (compiler->inline_functions)
+                add_inline_candidate(compiler, program->statements[i]);
         }
         break;
     case STATEMENT:
@@ -601,6 +1446,7 @@ get_bytecode(compiler_t *compiler)
     compilation_scope_t *scope = get_top_scope(compiler);
     bytecode->instructions = copy_instructions(scope->instructions);
     bytecode->constants_pool = compiler->constants_pool;
+    bytecode->num_globals = compiler->symbol_table->nentries;
     return bytecode;
 }
 
@@ -624,7 +1470,9 @@ instructions_t *
 compiler_leave_scope(compiler_t *compiler)
 {
     compilation_scope_t *scope = get_top_scope(compiler);
-    instructions_t *ins = copy_instructions(scope->instructions);
+    /* the function being compiled takes the buffer over */
+    instructions_t *ins = scope->instructions;
+    scope->instructions = NULL;
     cm_array_list_remove(compiler->scopes, compiler->scope_index);
     compiler->scope_index--;
     symbol_table_t *table = compiler->symbol_table;
@@ -640,4 +1488,111 @@ compiler_enter_scope(compiler_t *compiler)
     cm_array_list_add(compiler->scopes, scope);
     compiler->scope_index++;
     compiler->symbol_table = enclosed_symbol_table_init(compiler->symbol_table);
-}
\ No newline at end of file
+}
+
+#define read_operand(bytes, width) decode_instructions_to_sizet(bytes, width)
+
+/*
+ * Fuses the sequences
+ *   OPGETLOCAL OPCONSTANT OPADD/OPSUB        -> OPLOCALCONSTADD/OPLOCALCONSTSUB
+ *   OPGETLOCAL OPCONSTANT OPEQUAL OPJMPFALSE -> OPLOCALCONSTEQUALJMPFALSE
+ *   OPGETGLOBAL OPGETLOCAL OPCALL 1          -> OPGLOBALLOCALCALL
+ * unless a jump lands in the middle of the sequence. Jump targets are
+ * remapped to the new offsets afterwards. Already fused code is left as it
+ * is, so running the pass again is harmless.
+ */
+static void
+peephole_optimize_instructions(instructions_t *ins)
+{
+    uint8_t *bytes = ins->bytes;
+    size_t length = ins->length;
+    size_t pos, next, new_length = 0;
+    _Bool *targets = calloc(length + 1, sizeof(*targets));
+    size_t *offsets = malloc((length + 1) * sizeof(*offsets));
+    uint8_t *new_bytes = malloc(length == 0? 1: length);
+    if (targets == NULL || offsets == NULL || new_bytes == NULL)
+        err(EXIT_FAILURE, "malloc failed");
+
+    for (pos = 0; pos < length; pos += get_instruction_length(bytes[pos])) {
+        if (bytes[pos] == OPJMP || bytes[pos] == OPJMPFALSE)
+            targets[read_operand(bytes + pos + 1, 2)] = true;
+        else if (bytes[pos] == OPLOCALCONSTEQUALJMPFALSE)
+            targets[read_operand(bytes + pos + 4, 2)] = true;
+    }
+
+#define OP_AT(p) ((p) < length && !targets[p]? bytes[p]: 0)
+    for (pos = 0; pos < length; pos = next) {
+        size_t p1, p2;
+        offsets[pos] = new_length;
+        next = pos + get_instruction_length(bytes[pos]);
+        if (bytes[pos] == OPGETLOCAL && OP_AT(next) == OPCONSTANT) {
+            p1 = next + 3;
+            p2 = p1 + 1;
+            if (OP_AT(p1) == OPEQUAL && OP_AT(p2) == OPJMPFALSE) {
+                new_bytes[new_length] = OPLOCALCONSTEQUALJMPFALSE;
+                new_bytes[new_length + 1] = bytes[pos + 1];
+                memcpy(new_bytes + new_length + 2, bytes + next + 1, 2);
+                memcpy(new_bytes + new_length + 4, bytes + p2 + 1, 2);
+                new_length += 6;
+                next = p2 + 3;
+                continue;
+            }
+            if (OP_AT(p1) == OPADD || OP_AT(p1) == OPSUB) {
+                new_bytes[new_length] = bytes[p1] == OPADD? OPLOCALCONSTADD: OPLOCALCONSTSUB;
+                new_bytes[new_length + 1] = bytes[pos + 1];
+                memcpy(new_bytes + new_length + 2, bytes + next + 1, 2);
+                new_length += 4;
+                next = p1 + 1;
+                continue;
+            }
+        } else if (bytes[pos] == OPGETGLOBAL && OP_AT(next) == OPGETLOCAL) {
+            p1 = next + 2;
+            if (OP_AT(p1) == OPCALL && bytes[p1 + 1] == 1) {
+                new_bytes[new_length] = OPGLOBALLOCALCALL;
+                memcpy(new_bytes + new_length + 1, bytes + pos + 1, 2);
+                new_bytes[new_length + 3] = bytes[next + 1];
+                new_length += 4;
+                next = p1 + 2;
+                continue;
+            }
+        }
+        memcpy(new_bytes + new_length, bytes + pos, next - pos);
+        new_length += next - pos;
+    }
+#undef OP_AT
+    offsets[length] = new_length;
+
+    for (pos = 0; pos < new_length; pos += get_instruction_length(new_bytes[pos])) {
+        if (new_bytes[pos] == OPJMP || new_bytes[pos] == OPJMPFALSE)
+            encode_operand(new_bytes + pos + 1, offsets[read_operand(new_bytes + pos + 1, 2)], 2);
+        else if (new_bytes[pos] == OPLOCALCONSTEQUALJMPFALSE)
+            encode_operand(new_bytes + pos + 4, offsets[read_operand(new_bytes + pos + 4, 2)], 2);
+    }
+
+    free(targets);
+    free(offsets);
+    if (!ins->mapped)
+        free(ins->bytes);
+    ins->mapped = false;
+    ins->bytes = new_bytes;
+    ins->length = new_length;
+    ins->size = length == 0? 1: length;
+}
+
+/*
+ * Rewrites the main program and every compiled function in the constants
+ * pool to use superinstructions. This is optional: the vm runs the
+ * unoptimized bytecode just as well.
+ */
+void
+peephole_optimize(bytecode_t *bytecode)
+{
+    peephole_optimize_instructions(bytecode->instructions);
+    if (bytecode->constants_pool == NULL)
+        return;
+    for (size_t i = 0; i < bytecode->constants_pool->length; i++) {
+        monkey_object_t *obj = cm_array_list_get(bytecode->constants_pool, i);
+        if (obj->type == MONKEY_COMPILED_FUNCTION)
+            peephole_optimize_instructions(((monkey_compiled_fn_t *) obj)->instructions);
+    }
+}
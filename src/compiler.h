@@ -48,22 +48,44 @@ typedef struct compilation_scope_t {
 } compilation_scope_t;
 
 
+/*
+ * A call being replaced by the body of the function it calls. The
+ * arguments are kept in hidden variables of the caller, one per
+ * parameter.
+ */
+typedef struct inline_frame_t {
+    function_literal_t *fn;
+    symbol_t **params; // the variables holding the arguments, by position
+    size_t depth;
+    struct inline_frame_t *outer;
+} inline_frame_t;
+
 typedef struct compiler_t {
     cm_array_list *constants_pool;
     symbol_table_t *symbol_table;
     cm_array_list *scopes;
     size_t scope_index;
+    cm_hash_table *constants_index; // constant -> its position in the pool + 1
+    cm_array_list *global_constants; // constant values of globals, by index
+    cm_hash_table *rebound_globals; // globals the program binds more than once
+    _Bool whole_program; // no later input can rebind the globals
+    _Bool fold_constants;
+    cm_hash_table *inline_candidates; // global name -> function literal small enough to inline
+    inline_frame_t *inline_frame; // innermost call being inlined, if any
+    _Bool inline_functions;
 } compiler_t;
 
 typedef struct bytecode_t {
     instructions_t *instructions;
     cm_array_list *constants_pool;
+    size_t num_globals;
 } bytecode_t;
 
 typedef enum compiler_error_code {
     COMPILER_ERROR_NONE,
     COMPILER_UNKNOWN_OPERATOR,
-    COMPILER_UNDEFINED_VARIABLE
+    COMPILER_UNDEFINED_VARIABLE,
+    COMPILER_TOO_MANY_REGISTERS
 } compiler_error_code;
 
 typedef struct compiler_error_t {
@@ -74,11 +96,15 @@ typedef struct compiler_error_t {
 static const char *compiler_errors[] = {
     "COMPILER_ERROR_NONE",
     "COMPILER_UNKNOWN_OPERATOR",
-    "COMPILER_UNDEFINED_VARIABLE"
+    "COMPILER_UNDEFINED_VARIABLE",
+    "COMPILER_TOO_MANY_REGISTERS"
 };
 
 
 #define get_compiler_error(e) compiler_errors[e]
+#define COMPILER_VERSION "1" // to change along with the code the compiler generates
+
+extern const char *compiler_version;
 
 compiler_t *compiler_init(void);
 compiler_t *compiler_init_with_state(symbol_table_t *, cm_array_list *);
@@ -86,6 +112,7 @@ void compiler_free(compiler_t *);
 compiler_error_t compile(compiler_t *, node_t *);
 bytecode_t *get_bytecode(compiler_t *);
 void bytecode_free(bytecode_t *);
+void peephole_optimize(bytecode_t *);
 symbol_table_t *symbol_table_copy(symbol_table_t *);
 size_t emit(compiler_t *, opcode_t, ...);
 void compiler_enter_scope(compiler_t *);
@@ -98,7 +98,7 @@ test_constant_pool(cm_array_list *expected, cm_array_list *actual)
 }
 
 static void
-run_compiler_tests(size_t ntests, compiler_test tests[ntests])
+run_compiler_tests_with(size_t ntests, compiler_test tests[ntests], _Bool peephole, _Bool fold)
 {
     for (size_t i = 0; i < ntests; i++) {
         compiler_test t = tests[i];
@@ -107,11 +107,15 @@ run_compiler_tests(size_t ntests, compiler_test tests[ntests])
         parser_t *parser = parser_init(lexer);
         program_t *program = parse_program(parser);
         compiler_t *compiler = compiler_init();
+        compiler->fold_constants = fold;
+        compiler->inline_functions = fold;
         compiler_error_t e = compile(compiler, (node_t *)program);
         if (e.code != COMPILER_ERROR_NONE)
             errx(EXIT_FAILURE, "Compilation failed for input %s with error %s\n",
                 t.input, e.msg);
         bytecode_t *bytecode = get_bytecode(compiler);
+        if (peephole)
+            peephole_optimize(bytecode);
         instructions_t *flattened_instructions = flatten_instructions(t.instructions_count, t.expected_instructions);
         char *actual_ins_string = instructions_to_string(bytecode->instructions);
         char *expected_ins_string = instructions_to_string(flattened_instructions);
@@ -133,6 +137,12 @@ run_compiler_tests(size_t ntests, compiler_test tests[ntests])
     }
 }
 
+static void
+run_compiler_tests(size_t ntests, compiler_test tests[ntests])
+{
+    run_compiler_tests_with(ntests, tests, false, false);
+}
+
 static void
 test_compiler_scopes(void)
 {
@@ -258,10 +268,32 @@ test_boolean_expressions(void)
             {
                 instruction_init(OPCONSTANT, 0),
                 instruction_init(OPCONSTANT, 1),
-                instruction_init(OPGREATERTHAN),
+                instruction_init(OPLESSTHAN),
                 instruction_init(OPPOP)
             },
-            create_constant_pool(2, create_monkey_int(2), create_monkey_int(1))
+            create_constant_pool(2, create_monkey_int(1), create_monkey_int(2))
+        },
+        {
+            "1 <= 2",
+            4,
+            {
+                instruction_init(OPCONSTANT, 0),
+                instruction_init(OPCONSTANT, 1),
+                instruction_init(OPLESSEQUAL),
+                instruction_init(OPPOP)
+            },
+            create_constant_pool(2, create_monkey_int(1), create_monkey_int(2))
+        },
+        {
+            "1 >= 2",
+            4,
+            {
+                instruction_init(OPCONSTANT, 0),
+                instruction_init(OPCONSTANT, 1),
+                instruction_init(OPGREATEREQUAL),
+                instruction_init(OPPOP)
+            },
+            create_constant_pool(2, create_monkey_int(1), create_monkey_int(2))
         },
         {
             "1 == 2",
@@ -522,18 +554,16 @@ test_index_expressions(void)
                 instruction_init(OPCONSTANT, 1),
                 instruction_init(OPCONSTANT, 2),
                 instruction_init(OPARRAY, 3),
-                instruction_init(OPCONSTANT, 3),
-                instruction_init(OPCONSTANT, 4),
+                instruction_init(OPCONSTANT, 0),
+                instruction_init(OPCONSTANT, 1),
                 instruction_init(OPADD),
                 instruction_init(OPINDEX),
                 instruction_init(OPPOP)
             },
-            create_constant_pool(5,
+            create_constant_pool(3,
                 (monkey_object_t *) create_monkey_int(1),
                 (monkey_object_t *) create_monkey_int(2),
-                (monkey_object_t *) create_monkey_int(3),
-                (monkey_object_t *) create_monkey_int(1),
-                (monkey_object_t *) create_monkey_int(2))
+                (monkey_object_t *) create_monkey_int(3))
         },
         {
             "{1: 2}[2 - 1]",
@@ -542,17 +572,15 @@ test_index_expressions(void)
                 instruction_init(OPCONSTANT, 0),
                 instruction_init(OPCONSTANT, 1),
                 instruction_init(OPHASH, 2),
-                instruction_init(OPCONSTANT, 2),
-                instruction_init(OPCONSTANT, 3),
+                instruction_init(OPCONSTANT, 1),
+                instruction_init(OPCONSTANT, 0),
                 instruction_init(OPSUB),
                 instruction_init(OPINDEX),
                 instruction_init(OPPOP)
             },
-            create_constant_pool(4,
+            create_constant_pool(2,
                 (monkey_object_t *) create_monkey_int(1),
-                (monkey_object_t *) create_monkey_int(2),
-                (monkey_object_t *) create_monkey_int(2),
-                (monkey_object_t *) create_monkey_int(1))
+                (monkey_object_t *) create_monkey_int(2))
         }
     };
     size_t ntests = sizeof(tests) / sizeof(tests[0]);
@@ -590,20 +618,19 @@ test_recursive_functions(void)
                 instruction_init(OPCLOSURE, 1, 0),
                 instruction_init(OPSETGLOBAL, 0),
                 instruction_init(OPGETGLOBAL, 0),
-                instruction_init(OPCONSTANT, 2),
+                instruction_init(OPCONSTANT, 0),
                 instruction_init(OPCALL, 1),
                 instruction_init(OPPOP)
             },
-            create_constant_pool(3,
+            create_constant_pool(2,
                 (monkey_object_t *) create_monkey_int(1),
                 (monkey_object_t *) create_monkey_compiled_fn(create_compiled_fn_instructions(6,
                     instruction_init(OPCURRENTCLOSURE),
                     instruction_init(OPGETLOCAL, 0),
                     instruction_init(OPCONSTANT, 0),
                     instruction_init(OPSUB),
-                    instruction_init(OPCALL, 1),
-                    instruction_init(OPRETURNVALUE)), 0, 1),
-                (monkey_object_t *) create_monkey_int(1))
+                    instruction_init(OPTAILCALL, 1),
+                    instruction_init(OPRETURNVALUE)), 0, 1))
         },
         {
             "let wrapper = fn() {\n"
@@ -615,28 +642,27 @@ test_recursive_functions(void)
             "wrapper();",
             5,
             {
-                instruction_init(OPCLOSURE, 3, 0),
+                instruction_init(OPCLOSURE, 2, 0),
                 instruction_init(OPSETGLOBAL, 0),
                 instruction_init(OPGETGLOBAL, 0),
                 instruction_init(OPCALL, 0),
                 instruction_init(OPPOP)
             },
-            create_constant_pool(4,
+            create_constant_pool(3,
                 (monkey_object_t *) create_monkey_int(1),
                 (monkey_object_t *) create_monkey_compiled_fn(create_compiled_fn_instructions(6,
                     instruction_init(OPCURRENTCLOSURE),
                     instruction_init(OPGETLOCAL, 0),
                     instruction_init(OPCONSTANT, 0),
                     instruction_init(OPSUB),
-                    instruction_init(OPCALL, 1),
+                    instruction_init(OPTAILCALL, 1),
                     instruction_init(OPRETURNVALUE)), 0, 1),
-                (monkey_object_t *) create_monkey_int(1),
                 (monkey_object_t *) create_monkey_compiled_fn(create_compiled_fn_instructions(6,
                     instruction_init(OPCLOSURE, 1, 0),
                     instruction_init(OPSETLOCAL, 0),
                     instruction_init(OPGETLOCAL, 0),
-                    instruction_init(OPCONSTANT, 2),
-                    instruction_init(OPCALL, 1),
+                    instruction_init(OPCONSTANT, 0),
+                    instruction_init(OPTAILCALL, 1),
                     instruction_init(OPRETURNVALUE)), 1, 0))
         }
     };
@@ -1019,7 +1045,7 @@ test_builtins(void)
                     create_compiled_fn_instructions(4,
                     instruction_init(OPGETBUILTIN, 0),
                     instruction_init(OPARRAY, 0),
-                    instruction_init(OPCALL, 1),
+                    instruction_init(OPTAILCALL, 1),
                     instruction_init(OPRETURNVALUE)), 0, 0))
         }
     };
@@ -1089,6 +1115,17 @@ test_integer_arithmetic(void)
             },
             create_constant_pool(2, create_monkey_int(2), create_monkey_int(1))
         },
+        {
+            "5 % 2",
+            4,
+            {
+                instruction_init(OPCONSTANT, 0),
+                instruction_init(OPCONSTANT, 1),
+                instruction_init(OPMOD),
+                instruction_init(OPPOP)
+            },
+            create_constant_pool(2, create_monkey_int(5), create_monkey_int(2))
+        },
         {
             "-1",
             3,
@@ -1106,6 +1143,507 @@ test_integer_arithmetic(void)
     run_compiler_tests(ntests, tests);
 }
 
+static void
+test_tail_calls(void)
+{
+    compiler_test tests[] = {
+        {
+            "fn(f, x) { if (x) { f(x) } else { return f(1); } };",
+            2,
+            {
+                instruction_init(OPCLOSURE, 1, 0),
+                instruction_init(OPPOP)
+            },
+            create_constant_pool(2,
+                (monkey_object_t *) create_monkey_int(1),
+                (monkey_object_t *) create_monkey_compiled_fn(
+                    create_compiled_fn_instructions(11,
+                        instruction_init(OPGETLOCAL, 1),
+                        instruction_init(OPJMPFALSE, 14),
+                        instruction_init(OPGETLOCAL, 0),
+                        instruction_init(OPGETLOCAL, 1),
+                        instruction_init(OPTAILCALL, 1),
+                        instruction_init(OPJMP, 22),
+                        instruction_init(OPGETLOCAL, 0),
+                        instruction_init(OPCONSTANT, 0),
+                        instruction_init(OPTAILCALL, 1),
+                        instruction_init(OPRETURNVALUE),
+                        instruction_init(OPRETURNVALUE)), 2, 2))
+        },
+        {
+            // the result of the call is still needed by the caller
+            "fn(f) { let x = f(); x };",
+            2,
+            {
+                instruction_init(OPCLOSURE, 0, 0),
+                instruction_init(OPPOP)
+            },
+            create_constant_pool(1,
+                (monkey_object_t *) create_monkey_compiled_fn(
+                    create_compiled_fn_instructions(5,
+                        instruction_init(OPGETLOCAL, 0),
+                        instruction_init(OPCALL, 0),
+                        instruction_init(OPSETLOCAL, 1),
+                        instruction_init(OPGETLOCAL, 1),
+                        instruction_init(OPRETURNVALUE)), 2, 1))
+        }
+    };
+    print_test_separator_line();
+    printf("Testing tail calls\n");
+    size_t ntests = sizeof(tests) / sizeof(tests[0]);
+    run_compiler_tests(ntests, tests);
+}
+
+static void
+test_while_loops(void)
+{
+    compiler_test tests[] = {
+        {
+            "let i = 0; while (i < 3) { let i = i + 1; }",
+            15,
+            {
+                instruction_init(OPCONSTANT, 0),
+                instruction_init(OPSETGLOBAL, 0),
+                instruction_init(OPNULL),
+                instruction_init(OPGETGLOBAL, 0),
+                instruction_init(OPCONSTANT, 1),
+                instruction_init(OPLESSTHAN),
+                instruction_init(OPJMPFALSE, 32),
+                instruction_init(OPPOP),
+                instruction_init(OPGETGLOBAL, 0),
+                instruction_init(OPCONSTANT, 2),
+                instruction_init(OPADD),
+                instruction_init(OPSETGLOBAL, 0),
+                instruction_init(OPNULL),
+                instruction_init(OPJMP, 7),
+                instruction_init(OPPOP)
+            },
+            create_constant_pool(3,
+                (monkey_object_t *) create_monkey_int(0),
+                (monkey_object_t *) create_monkey_int(3),
+                (monkey_object_t *) create_monkey_int(1))
+        },
+        {
+            // the value of the last run of the body is the value of the loop
+            "fn(n) { while (n) { n } };",
+            2,
+            {
+                instruction_init(OPCLOSURE, 0, 0),
+                instruction_init(OPPOP)
+            },
+            create_constant_pool(1,
+                (monkey_object_t *) create_monkey_compiled_fn(
+                    create_compiled_fn_instructions(7,
+                        instruction_init(OPNULL),
+                        instruction_init(OPGETLOCAL, 0),
+                        instruction_init(OPJMPFALSE, 12),
+                        instruction_init(OPPOP),
+                        instruction_init(OPGETLOCAL, 0),
+                        instruction_init(OPJMP, 1),
+                        instruction_init(OPRETURNVALUE)), 1, 1))
+        }
+    };
+    print_test_separator_line();
+    printf("Testing while loops\n");
+    size_t ntests = sizeof(tests) / sizeof(tests[0]);
+    run_compiler_tests(ntests, tests);
+}
+
+static void
+test_logical_operators(void)
+{
+    compiler_test tests[] = {
+        {
+            "true && false",
+            6,
+            {
+                instruction_init(OPTRUE),
+                instruction_init(OPJMPFALSE, 8),
+                instruction_init(OPFALSE),
+                instruction_init(OPJMP, 9),
+                instruction_init(OPFALSE),
+                instruction_init(OPPOP)
+            },
+            NULL
+        },
+        {
+            "false || true",
+            6,
+            {
+                instruction_init(OPFALSE),
+                instruction_init(OPJMPFALSE, 8),
+                instruction_init(OPTRUE),
+                instruction_init(OPJMP, 9),
+                instruction_init(OPTRUE),
+                instruction_init(OPPOP)
+            },
+            NULL
+        }
+    };
+    print_test_separator_line();
+    printf("Testing logical operators\n");
+    size_t ntests = sizeof(tests) / sizeof(tests[0]);
+    run_compiler_tests(ntests, tests);
+}
+
+static void
+test_constant_deduplication(void)
+{
+    compiler_test tests[] = {
+        {
+            "1; 1; \"a\"; \"a\"; fn() { 1 }; fn() { 1 }; fn(x) { 1 }",
+            14,
+            {
+                instruction_init(OPCONSTANT, 0),
+                instruction_init(OPPOP),
+                instruction_init(OPCONSTANT, 0),
+                instruction_init(OPPOP),
+                instruction_init(OPCONSTANT, 1),
+                instruction_init(OPPOP),
+                instruction_init(OPCONSTANT, 1),
+                instruction_init(OPPOP),
+                instruction_init(OPCLOSURE, 2, 0),
+                instruction_init(OPPOP),
+                instruction_init(OPCLOSURE, 2, 0),
+                instruction_init(OPPOP),
+                // same instructions, but a different frame layout
+                instruction_init(OPCLOSURE, 3, 0),
+                instruction_init(OPPOP)
+            },
+            create_constant_pool(4,
+                (monkey_object_t *) create_monkey_int(1),
+                (monkey_object_t *) create_monkey_string("a", 1),
+                (monkey_object_t *) create_monkey_compiled_fn(
+                    create_compiled_fn_instructions(2,
+                        instruction_init(OPCONSTANT, 0),
+                        instruction_init(OPRETURNVALUE)), 0, 0),
+                (monkey_object_t *) create_monkey_compiled_fn(
+                    create_compiled_fn_instructions(2,
+                        instruction_init(OPCONSTANT, 0),
+                        instruction_init(OPRETURNVALUE)), 1, 1))
+        }
+    };
+    print_test_separator_line();
+    printf("Testing constant deduplication\n");
+    size_t ntests = sizeof(tests) / sizeof(tests[0]);
+    run_compiler_tests(ntests, tests);
+}
+
+static void
+test_constant_folding(void)
+{
+    compiler_test tests[] = {
+        {
+            "60 * 60 * 24",
+            2,
+            {
+                instruction_init(OPCONSTANT, 0),
+                instruction_init(OPPOP)
+            },
+            create_constant_pool(1, (monkey_object_t *) create_monkey_int(86400))
+        },
+        {
+            "7 % 3 == 1 && 2 <= 3 || false",
+            2,
+            {
+                instruction_init(OPTRUE),
+                instruction_init(OPPOP)
+            },
+            NULL
+        },
+        {
+            "\"mon\" + \"key\"",
+            2,
+            {
+                instruction_init(OPCONSTANT, 0),
+                instruction_init(OPPOP)
+            },
+            create_constant_pool(1, (monkey_object_t *) create_monkey_string("monkey", 6))
+        },
+        {
+            "(-(2 - 5) > 1) == !false",
+            2,
+            {
+                instruction_init(OPTRUE),
+                instruction_init(OPPOP)
+            },
+            NULL
+        },
+        {
+            "let day = 60 * 60 * 24;\n"
+            "let week = day * 7;\n"
+            "fn() { week };",
+            6,
+            {
+                instruction_init(OPCONSTANT, 0),
+                instruction_init(OPSETGLOBAL, 0),
+                instruction_init(OPCONSTANT, 1),
+                instruction_init(OPSETGLOBAL, 1),
+                instruction_init(OPCLOSURE, 2, 0),
+                instruction_init(OPPOP)
+            },
+            create_constant_pool(3,
+                (monkey_object_t *) create_monkey_int(86400),
+                (monkey_object_t *) create_monkey_int(604800),
+                (monkey_object_t *) create_monkey_compiled_fn(
+                    create_compiled_fn_instructions(2,
+                        instruction_init(OPCONSTANT, 1),
+                        instruction_init(OPRETURNVALUE)), 0, 0))
+        },
+        {
+            // a parameter shadows the global
+            "let x = 1;\n"
+            "fn(x) { x };",
+            4,
+            {
+                instruction_init(OPCONSTANT, 0),
+                instruction_init(OPSETGLOBAL, 0),
+                instruction_init(OPCLOSURE, 1, 0),
+                instruction_init(OPPOP)
+            },
+            create_constant_pool(2,
+                (monkey_object_t *) create_monkey_int(1),
+                (monkey_object_t *) create_monkey_compiled_fn(
+                    create_compiled_fn_instructions(2,
+                        instruction_init(OPGETLOCAL, 0),
+                        instruction_init(OPRETURNVALUE)), 1, 1))
+        },
+        {
+            "if (1 > 2) { 10 } else { 20 }; if (false) { 30 }",
+            4,
+            {
+                instruction_init(OPCONSTANT, 0),
+                instruction_init(OPPOP),
+                instruction_init(OPNULL),
+                instruction_init(OPPOP)
+            },
+            create_constant_pool(1, (monkey_object_t *) create_monkey_int(20))
+        },
+        {
+            "while (false) { 1 }",
+            2,
+            {
+                instruction_init(OPNULL),
+                instruction_init(OPPOP)
+            },
+            NULL
+        },
+        {
+            // a global bound again is not a constant, even before that
+            "let n = 1;\n"
+            "fn() { n };\n"
+            "let n = n + 1;",
+            8,
+            {
+                instruction_init(OPCONSTANT, 0),
+                instruction_init(OPSETGLOBAL, 0),
+                instruction_init(OPCLOSURE, 1, 0),
+                instruction_init(OPPOP),
+                instruction_init(OPGETGLOBAL, 0),
+                instruction_init(OPCONSTANT, 0),
+                instruction_init(OPADD),
+                instruction_init(OPSETGLOBAL, 0)
+            },
+            create_constant_pool(2,
+                (monkey_object_t *) create_monkey_int(1),
+                (monkey_object_t *) create_monkey_compiled_fn(
+                    create_compiled_fn_instructions(2,
+                        instruction_init(OPGETGLOBAL, 0),
+                        instruction_init(OPRETURNVALUE)), 0, 0))
+        },
+        {
+            // a block that binds a name is kept, the name is used after it
+            "fn() { if (false) { let q = 5; }; q };",
+            2,
+            {
+                instruction_init(OPCLOSURE, 1, 0),
+                instruction_init(OPPOP)
+            },
+            create_constant_pool(2,
+                (monkey_object_t *) create_monkey_int(5),
+                (monkey_object_t *) create_monkey_compiled_fn(
+                    create_compiled_fn_instructions(10,
+                        instruction_init(OPFALSE),
+                        instruction_init(OPJMPFALSE, 13),
+                        instruction_init(OPCONSTANT, 0),
+                        instruction_init(OPSETLOCAL, 0),
+                        instruction_init(OPNULL),
+                        instruction_init(OPJMP, 14),
+                        instruction_init(OPNULL),
+                        instruction_init(OPPOP),
+                        instruction_init(OPGETLOCAL, 0),
+                        instruction_init(OPRETURNVALUE)), 1, 0))
+        },
+        {
+            // errors are left for the vm to report
+            "1 / 0; 1 + true",
+            8,
+            {
+                instruction_init(OPCONSTANT, 0),
+                instruction_init(OPCONSTANT, 1),
+                instruction_init(OPDIV),
+                instruction_init(OPPOP),
+                instruction_init(OPCONSTANT, 0),
+                instruction_init(OPTRUE),
+                instruction_init(OPADD),
+                instruction_init(OPPOP)
+            },
+            create_constant_pool(2,
+                (monkey_object_t *) create_monkey_int(1),
+                (monkey_object_t *) create_monkey_int(0))
+        }
+    };
+    print_test_separator_line();
+    printf("Testing constant folding\n");
+    size_t ntests = sizeof(tests) / sizeof(tests[0]);
+    run_compiler_tests_with(ntests, tests, false, true);
+}
+
+static void
+test_inlining(void)
+{
+    compiler_test tests[] = {
+        {
+            "let add = fn(a, b) { a + b };\n"
+            "add(1, 2);",
+            10,
+            {
+                instruction_init(OPCLOSURE, 0, 0),
+                instruction_init(OPSETGLOBAL, 0),
+                instruction_init(OPCONSTANT, 1),
+                instruction_init(OPCONSTANT, 2),
+                instruction_init(OPSETGLOBAL, 1),
+                instruction_init(OPSETGLOBAL, 2),
+                instruction_init(OPGETGLOBAL, 2),
+                instruction_init(OPGETGLOBAL, 1),
+                instruction_init(OPADD),
+                instruction_init(OPPOP)
+            },
+            create_constant_pool(3,
+                (monkey_object_t *) create_monkey_compiled_fn(
+                    create_compiled_fn_instructions(4,
+                        instruction_init(OPGETLOCAL, 0),
+                        instruction_init(OPGETLOCAL, 1),
+                        instruction_init(OPADD),
+                        instruction_init(OPRETURNVALUE)), 2, 2),
+                (monkey_object_t *) create_monkey_int(1),
+                (monkey_object_t *) create_monkey_int(2))
+        },
+        {
+            // the argument lives in a local of the caller
+            "let inc = fn(x) { x + 1 };\n"
+            "fn(y) { inc(y) };",
+            4,
+            {
+                instruction_init(OPCLOSURE, 1, 0),
+                instruction_init(OPSETGLOBAL, 0),
+                instruction_init(OPCLOSURE, 2, 0),
+                instruction_init(OPPOP)
+            },
+            create_constant_pool(3,
+                (monkey_object_t *) create_monkey_int(1),
+                (monkey_object_t *) create_monkey_compiled_fn(
+                    create_compiled_fn_instructions(4,
+                        instruction_init(OPGETLOCAL, 0),
+                        instruction_init(OPCONSTANT, 0),
+                        instruction_init(OPADD),
+                        instruction_init(OPRETURNVALUE)), 1, 1),
+                (monkey_object_t *) create_monkey_compiled_fn(
+                    create_compiled_fn_instructions(6,
+                        instruction_init(OPGETLOCAL, 0),
+                        instruction_init(OPSETLOCAL, 1),
+                        instruction_init(OPGETLOCAL, 1),
+                        instruction_init(OPCONSTANT, 0),
+                        instruction_init(OPADD),
+                        instruction_init(OPRETURNVALUE)), 2, 1))
+        },
+        {
+            // recursive functions are called
+            "let f = fn(n) { f(n) };\n"
+            "f(1);",
+            6,
+            {
+                instruction_init(OPCLOSURE, 0, 0),
+                instruction_init(OPSETGLOBAL, 0),
+                instruction_init(OPGETGLOBAL, 0),
+                instruction_init(OPCONSTANT, 1),
+                instruction_init(OPCALL, 1),
+                instruction_init(OPPOP)
+            },
+            create_constant_pool(2,
+                (monkey_object_t *) create_monkey_compiled_fn(
+                    create_compiled_fn_instructions(4,
+                        instruction_init(OPCURRENTCLOSURE),
+                        instruction_init(OPGETLOCAL, 0),
+                        instruction_init(OPTAILCALL, 1),
+                        instruction_init(OPRETURNVALUE)), 1, 1),
+                (monkey_object_t *) create_monkey_int(1))
+        }
+    };
+    print_test_separator_line();
+    printf("Testing inlining\n");
+    size_t ntests = sizeof(tests) / sizeof(tests[0]);
+    run_compiler_tests_with(ntests, tests, false, true);
+}
+
+static void
+test_peephole_optimizer(void)
+{
+    compiler_test tests[] = {
+        {
+            "let g = fn(y) { y };\n"
+            "let f = fn(x) { if (x == 1) { -g(x) } else { x - 2 } };",
+            4,
+            {
+                instruction_init(OPCLOSURE, 0, 0),
+                instruction_init(OPSETGLOBAL, 0),
+                instruction_init(OPCLOSURE, 3, 0),
+                instruction_init(OPSETGLOBAL, 1)
+            },
+            create_constant_pool(4,
+                (monkey_object_t *) create_monkey_compiled_fn(
+                    create_compiled_fn_instructions(2,
+                        instruction_init(OPGETLOCAL, 0),
+                        instruction_init(OPRETURNVALUE)), 1, 1),
+                (monkey_object_t *) create_monkey_int(1),
+                (monkey_object_t *) create_monkey_int(2),
+                (monkey_object_t *) create_monkey_compiled_fn(
+                    create_compiled_fn_instructions(6,
+                        instruction_init(OPLOCALCONSTEQUALJMPFALSE, 0, 1, 14),
+                        instruction_init(OPGLOBALLOCALCALL, 0, 0),
+                        instruction_init(OPMINUS),
+                        instruction_init(OPJMP, 18),
+                        instruction_init(OPLOCALCONSTSUB, 0, 2),
+                        instruction_init(OPRETURNVALUE)), 1, 1))
+        },
+        {
+            // a jump into the middle of a sequence keeps it from being fused
+            "let f = fn(x) { (if (x) { x } else { x }) - 1 };",
+            2,
+            {
+                instruction_init(OPCLOSURE, 1, 0),
+                instruction_init(OPSETGLOBAL, 0)
+            },
+            create_constant_pool(2,
+                (monkey_object_t *) create_monkey_int(1),
+                (monkey_object_t *) create_monkey_compiled_fn(
+                    create_compiled_fn_instructions(8,
+                        instruction_init(OPGETLOCAL, 0),
+                        instruction_init(OPJMPFALSE, 10),
+                        instruction_init(OPGETLOCAL, 0),
+                        instruction_init(OPJMP, 12),
+                        instruction_init(OPGETLOCAL, 0),
+                        instruction_init(OPCONSTANT, 0),
+                        instruction_init(OPSUB),
+                        instruction_init(OPRETURNVALUE)), 1, 1))
+        }
+    };
+    print_test_separator_line();
+    printf("Testing peephole optimizer\n");
+    size_t ntests = sizeof(tests) / sizeof(tests[0]);
+    run_compiler_tests_with(ntests, tests, true, false);
+}
+
 int
 main(int argc, char **argv)
 {
@@ -1124,4 +1662,11 @@ main(int argc, char **argv)
     test_builtins();
     test_closures();
     test_recursive_functions();
+    test_tail_calls();
+    test_while_loops();
+    test_logical_operators();
+    test_constant_deduplication();
+    test_constant_folding();
+    test_inlining();
+    test_peephole_optimizer();
 }
\ No newline at end of file
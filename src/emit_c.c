@@ -0,0 +1,564 @@
+/*-
+ * Copyright (c) 2019 Abhinav Upadhyay <er.abhinav.upadhyay@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "builtins.h"
+#include "cmonkey_utils.h"
+#include "compiler.h"
+#include "emit_c.h"
+#include "object.h"
+#include "opcode.h"
+#include "verifier.h"
+
+#define UNREACHABLE SIZE_MAX
+#define MAIN SIZE_MAX
+
+typedef struct emitter_t {
+    FILE *out; // the body of the function being translated
+    cm_array_list *constants;
+    size_t index; // of the function in the constants, MAIN for the program
+    monkey_compiled_fn_t *fn;
+    size_t nslots; // stack slots the body uses
+    _Bool loops; // whether a tail call jumps back to the start
+} emitter_t;
+
+static int
+fail(char **errmsg, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    if (vasprintf(errmsg, fmt, args) == -1)
+        err(EXIT_FAILURE, "malloc failed");
+    va_end(args);
+    return -1;
+}
+
+static size_t
+get_operand(uint8_t *bytes, size_t pos, size_t n)
+{
+    opcode_definition_t op_def = opcode_definition_lookup(bytes[pos]);
+    size_t offset = pos + 1;
+    for (size_t i = 0; i < n; i++)
+        offset += op_def.operand_widths[i];
+    return decode_instructions_to_sizet(bytes + offset, op_def.operand_widths[n]);
+}
+
+static void
+slot(emitter_t *e, size_t i)
+{
+    if (i >= e->nslots)
+        e->nslots = i + 1;
+    fprintf(e->out, "s%zu", i);
+}
+
+/* the n slots from first on as an array, the way the runtime takes them */
+static void
+slots(emitter_t *e, size_t first, size_t n)
+{
+    if (n == 0) {
+        fprintf(e->out, "NULL");
+        return;
+    }
+    fprintf(e->out, "(monkey_object_t *[]) {");
+    for (size_t i = 0; i < n; i++) {
+        if (i > 0)
+            fprintf(e->out, ", ");
+        slot(e, first + i);
+    }
+    fprintf(e->out, "}");
+}
+
+static void
+emit_long(FILE *out, long value)
+{
+    if (value == LONG_MIN)
+        fprintf(out, "(-%ldL - 1)", LONG_MAX);
+    else
+        fprintf(out, "%ldL", value);
+}
+
+/* ints are built in place, other constants are made once by main */
+static void
+emit_constant(emitter_t *e, size_t index)
+{
+    monkey_object_t *obj = e->constants->array[index];
+    if (get_monkey_object_type(obj) != MONKEY_INT) {
+        fprintf(e->out, "copy_monkey_object(constants[%zu])", index);
+        return;
+    }
+    long value = get_monkey_int_value(obj);
+    fprintf(e->out, fits_tagged_int(value)? "tag_int(": "create_monkey_int_value(");
+    emit_long(e->out, value);
+    fprintf(e->out, ")");
+}
+
+static void
+emit_string(FILE *out, const char *s, size_t length)
+{
+    fprintf(out, "\"");
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = s[i];
+        if (c == '"' || c == '\\' || c == '?' || c < ' ' || c > '~')
+            fprintf(out, "\\%03o", c);
+        else
+            fprintf(out, "%c", c);
+    }
+    fprintf(out, "\"");
+}
+
+/* drops the references in the slots below depth */
+static void
+emit_free_slots(emitter_t *e, size_t depth, const char *indent)
+{
+    for (size_t i = 0; i < depth; i++) {
+        fprintf(e->out, "%sfree_monkey_object(", indent);
+        slot(e, i);
+        fprintf(e->out, ");\n");
+    }
+}
+
+static void
+emit_binary(emitter_t *e, size_t depth, const char *call)
+{
+    fprintf(e->out, "    ");
+    slot(e, depth - 2);
+    fprintf(e->out, " = %s", call);
+    slot(e, depth - 2);
+    fprintf(e->out, ", ");
+    slot(e, depth - 1);
+    fprintf(e->out, ");\n");
+}
+
+static void
+emit_call(emitter_t *e, size_t depth, size_t nargs)
+{
+    size_t callee = depth - nargs - 1;
+    fprintf(e->out, "    ");
+    slot(e, callee);
+    fprintf(e->out, " = native_call(");
+    slot(e, callee);
+    fprintf(e->out, ", ");
+    slots(e, callee + 1, nargs);
+    fprintf(e->out, ", %zu);\n", nargs);
+}
+
+/*
+ * A function calling itself in tail position becomes a loop: the arguments
+ * replace the locals and it starts over.
+ */
+static void
+emit_tail_call(emitter_t *e, size_t depth, size_t nargs)
+{
+    size_t callee = depth - nargs - 1;
+    if (e->index != MAIN && nargs == e->fn->num_args) {
+        e->loops = true;
+        fprintf(e->out, "    if (");
+        slot(e, callee);
+        fprintf(e->out, " == (monkey_object_t *) self) {\n");
+        emit_free_slots(e, callee + 1, "        ");
+        for (size_t i = 0; i < e->fn->num_locals; i++)
+            fprintf(e->out, "        free_monkey_object(l%zu);\n", i);
+        for (size_t i = 0; i < e->fn->num_locals; i++) {
+            fprintf(e->out, "        l%zu = ", i);
+            if (i < nargs)
+                slot(e, callee + 1 + i);
+            else
+                fprintf(e->out, "(monkey_object_t *) create_monkey_null()");
+            fprintf(e->out, ";\n");
+        }
+        fprintf(e->out, "        goto ENTRY;\n    }\n");
+    }
+    emit_call(e, depth, nargs);
+}
+
+static void
+emit_instruction(emitter_t *e, uint8_t *bytes, size_t pos, size_t depth)
+{
+    FILE *out = e->out;
+    opcode_t op = bytes[pos];
+    opcode_definition_t op_def = opcode_definition_lookup(op);
+    size_t operands[3] = {0, 0, 0};
+    for (size_t i = 0; i < 3 && op_def.operand_widths[i] != 0; i++)
+        operands[i] = get_operand(bytes, pos, i);
+    size_t a = operands[0], b = operands[1], c = operands[2];
+
+    switch (op) {
+    case OPCONSTANT:
+        fprintf(out, "    ");
+        slot(e, depth);
+        fprintf(out, " = ");
+        emit_constant(e, a);
+        fprintf(out, ";\n");
+        break;
+    case OPTRUE:
+    case OPFALSE:
+    case OPNULL:
+    case OPCURRENTCLOSURE:
+    case OPGETGLOBAL:
+    case OPGETLOCAL:
+    case OPGETFREE:
+    case OPGETBUILTIN:
+        fprintf(out, "    ");
+        slot(e, depth);
+        if (op == OPTRUE)
+            fprintf(out, " = (monkey_object_t *) &MONKEY_TRUE_OBJ;\n");
+        else if (op == OPFALSE)
+            fprintf(out, " = (monkey_object_t *) &MONKEY_FALSE_OBJ;\n");
+        else if (op == OPNULL)
+            fprintf(out, " = (monkey_object_t *) create_monkey_null();\n");
+        else if (op == OPCURRENTCLOSURE)
+            fprintf(out, " = copy_monkey_object((monkey_object_t *) self);\n");
+        else if (op == OPGETGLOBAL)
+            fprintf(out, " = copy_monkey_object(globals[%zu]);\n", a);
+        else if (op == OPGETLOCAL)
+            fprintf(out, " = copy_monkey_object(l%zu);\n", a);
+        else if (op == OPGETFREE)
+            fprintf(out, " = copy_monkey_object(self->free_variables[%zu]);\n", a);
+        else
+            fprintf(out, " = (monkey_object_t *) get_builtins(\"%s\");\n",
+                get_builtins_name(a));
+        break;
+    case OPADD:
+    case OPADDINT:
+        emit_binary(e, depth, "native_add(");
+        break;
+    case OPSUB:
+    case OPSUBINT:
+        emit_binary(e, depth, "native_sub(");
+        break;
+    case OPMUL:
+    case OPMULINT:
+        emit_binary(e, depth, "native_binary_op(OPMUL, ");
+        break;
+    case OPDIV:
+        emit_binary(e, depth, "native_binary_op(OPDIV, ");
+        break;
+    case OPMOD:
+        emit_binary(e, depth, "native_binary_op(OPMOD, ");
+        break;
+    case OPEQUAL:
+    case OPEQUALINT:
+        emit_binary(e, depth, "native_equal(");
+        break;
+    case OPNOTEQUAL:
+    case OPNOTEQUALINT:
+        emit_binary(e, depth, "native_not_equal(");
+        break;
+    case OPGREATERTHAN:
+    case OPGREATERTHANINT:
+        emit_binary(e, depth, "native_greater_than(");
+        break;
+    case OPLESSTHAN:
+    case OPLESSTHANINT:
+        emit_binary(e, depth, "native_less_than(");
+        break;
+    case OPLESSEQUAL:
+    case OPLESSEQUALINT:
+        emit_binary(e, depth, "native_less_equal(");
+        break;
+    case OPGREATEREQUAL:
+    case OPGREATEREQUALINT:
+        emit_binary(e, depth, "native_greater_equal(");
+        break;
+    case OPINDEX:
+        emit_binary(e, depth, "native_index(");
+        break;
+    case OPMINUS:
+    case OPBANG:
+        fprintf(out, "    ");
+        slot(e, depth - 1);
+        fprintf(out, " = %s(", op == OPMINUS? "native_minus": "native_bang");
+        slot(e, depth - 1);
+        fprintf(out, ");\n");
+        break;
+    case OPPOP:
+        /* like the vm, the program's result is the last value it pops */
+        fprintf(out, e->index == MAIN? "    native_set(&last, ": "    free_monkey_object(");
+        slot(e, depth - 1);
+        fprintf(out, ");\n");
+        break;
+    case OPSETGLOBAL:
+        if (e->index == MAIN) {
+            fprintf(out, "    native_set(&last, copy_monkey_object(");
+            slot(e, depth - 1);
+            fprintf(out, "));\n");
+        }
+        fprintf(out, "    native_set(&globals[%zu], ", a);
+        slot(e, depth - 1);
+        fprintf(out, ");\n");
+        break;
+    case OPSETLOCAL:
+        fprintf(out, "    native_set(&l%zu, ", a);
+        slot(e, depth - 1);
+        fprintf(out, ");\n");
+        break;
+    case OPJMP:
+        fprintf(out, "    goto L%zu;\n", a);
+        break;
+    case OPJMPFALSE:
+        fprintf(out, "    if (!native_pop_truthy(");
+        slot(e, depth - 1);
+        fprintf(out, "))\n        goto L%zu;\n", a);
+        break;
+    case OPARRAY:
+    case OPHASH:
+        fprintf(out, "    ");
+        slot(e, depth - a);
+        fprintf(out, " = %s(", op == OPARRAY? "native_array": "native_hash");
+        slots(e, depth - a, a);
+        fprintf(out, ", %zu);\n", a);
+        break;
+    case OPCALL:
+        emit_call(e, depth, a);
+        break;
+    case OPTAILCALL:
+        emit_tail_call(e, depth, a);
+        break;
+    case OPRETURNVALUE:
+        fprintf(out, "    result = ");
+        slot(e, depth - 1);
+        fprintf(out, ";\n");
+        emit_free_slots(e, depth - 1, "    ");
+        fprintf(out, "    goto RETURN;\n");
+        break;
+    case OPRETURN:
+        fprintf(out, "    result = (monkey_object_t *) create_monkey_null();\n");
+        emit_free_slots(e, depth, "    ");
+        fprintf(out, "    goto RETURN;\n");
+        break;
+    case OPCLOSURE:
+        fprintf(out, "    ");
+        slot(e, depth - b);
+        if (b == 0)
+            fprintf(out, " = native_constant_closure(&closures[%zu], "
+                "(monkey_compiled_fn_t *) constants[%zu]);\n", a, a);
+        else {
+            fprintf(out, " = native_closure((monkey_compiled_fn_t *) constants[%zu], ", a);
+            slots(e, depth - b, b);
+            fprintf(out, ", %zu);\n", b);
+        }
+        break;
+    case OPLOCALCONSTADD:
+    case OPLOCALCONSTSUB:
+        fprintf(out, "    ");
+        slot(e, depth);
+        fprintf(out, " = %s(copy_monkey_object(l%zu), ",
+            op == OPLOCALCONSTADD? "native_add": "native_sub", a);
+        emit_constant(e, b);
+        fprintf(out, ");\n");
+        break;
+    case OPLOCALCONSTEQUALJMPFALSE:
+        fprintf(out, "    if (!native_pop_truthy(native_equal(copy_monkey_object(l%zu), ", a);
+        emit_constant(e, b);
+        fprintf(out, ")))\n        goto L%zu;\n", c);
+        break;
+    case OPGLOBALLOCALCALL:
+        fprintf(out, "    ");
+        slot(e, depth);
+        fprintf(out, " = native_call(copy_monkey_object(globals[%zu]), "
+            "(monkey_object_t *[]) {copy_monkey_object(l%zu)}, 1);\n", a, b);
+        break;
+    }
+}
+
+static _Bool
+is_jump(opcode_t op)
+{
+    return op == OPJMP || op == OPJMPFALSE || op == OPLOCALCONSTEQUALJMPFALSE;
+}
+
+/*
+ * Translates a function, or the program itself. The verifier worked out
+ * the depth of the stack before every instruction, which names the slot
+ * each one reads and writes.
+ */
+static void
+emit_function(FILE *out, cm_array_list *constants, size_t index, monkey_compiled_fn_t *fn,
+    size_t *depths)
+{
+    emitter_t e;
+    char *body;
+    size_t body_size;
+    uint8_t *bytes = fn->instructions->bytes;
+    size_t length = fn->instructions->length;
+    _Bool *targets = calloc(length + 1, sizeof(*targets));
+    if (targets == NULL)
+        err(EXIT_FAILURE, "malloc failed");
+    for (size_t pos = 0; pos < length; pos += get_instruction_length(bytes[pos])) {
+        if (depths[pos] != UNREACHABLE && is_jump(bytes[pos]))
+            targets[get_operand(bytes, pos, bytes[pos] == OPLOCALCONSTEQUALJMPFALSE? 2: 0)] = true;
+    }
+
+    e.constants = constants;
+    e.index = index;
+    e.fn = fn;
+    e.nslots = 0;
+    e.loops = false;
+    e.out = open_memstream(&body, &body_size);
+    if (e.out == NULL)
+        err(EXIT_FAILURE, "open_memstream failed");
+    for (size_t pos = 0; pos <= length; pos += get_instruction_length(bytes[pos])) {
+        if (targets[pos])
+            fprintf(e.out, "L%zu: ;\n", pos);
+        if (pos == length)
+            break;
+        if (depths[pos] != UNREACHABLE)
+            emit_instruction(&e, bytes, pos, depths[pos]);
+    }
+    fclose(e.out);
+    free(targets);
+
+    if (index == MAIN)
+        fprintf(out, "static monkey_object_t *\nrun(void)\n{\n"
+            "    monkey_object_t *last = NULL;\n");
+    else
+        fprintf(out, "static monkey_object_t *\nfn%zu(monkey_closure_t *self, "
+            "monkey_object_t **args)\n{\n    monkey_object_t *result;\n", index);
+    for (size_t i = 0; i < fn->num_locals; i++) {
+        if (i < fn->num_args)
+            fprintf(out, "    monkey_object_t *l%zu = args[%zu];\n", i, i);
+        else
+            fprintf(out, "    monkey_object_t *l%zu = (monkey_object_t *) create_monkey_null();\n", i);
+    }
+    for (size_t i = 0; i < e.nslots; i++)
+        fprintf(out, "    monkey_object_t *s%zu;\n", i);
+    if (e.loops)
+        fprintf(out, "ENTRY:\n");
+    fwrite(body, 1, body_size, out);
+    free(body);
+    if (index == MAIN)
+        fprintf(out, "    return last;\n}\n\n");
+    else {
+        fprintf(out, "RETURN:\n");
+        for (size_t i = 0; i < fn->num_locals; i++)
+            fprintf(out, "    free_monkey_object(l%zu);\n", i);
+        fprintf(out, "    return result;\n}\n\n");
+    }
+}
+
+static void
+emit_program(FILE *out, bytecode_t *bytecode, monkey_compiled_fn_t *main_fn, size_t **depths)
+{
+    cm_array_list *constants = bytecode->constants_pool;
+    size_t nconstants = constants == NULL? 0: constants->length;
+    monkey_object_t *obj;
+    monkey_compiled_fn_t *fn;
+    monkey_string_t *str;
+
+    fprintf(out, "/* generated by monkeyvm --emit-c */\n\n#include \"native.h\"\n\n");
+    fprintf(out, "static monkey_object_t *globals[%zu];\n", bytecode->num_globals + 1);
+    fprintf(out, "static monkey_object_t *constants[%zu];\n", nconstants + 1);
+    fprintf(out, "static monkey_closure_t *closures[%zu];\n\n", nconstants + 1);
+    for (size_t i = 0; i < nconstants; i++) {
+        obj = constants->array[i];
+        if (get_monkey_object_type(obj) != MONKEY_COMPILED_FUNCTION)
+            continue;
+        fn = (monkey_compiled_fn_t *) obj;
+        fprintf(out, "static monkey_object_t *fn%zu(monkey_closure_t *, monkey_object_t **);\n", i);
+        fprintf(out, "static uint8_t bytecode%zu[] = {", i);
+        for (size_t j = 0; j < fn->instructions->length; j++)
+            fprintf(out, "%s%s%u", j == 0? "": ",", j % 16 == 0? "\n    ": " ",
+                fn->instructions->bytes[j]);
+        fprintf(out, "\n};\n");
+    }
+    fprintf(out, "\n");
+
+    for (size_t i = 0; i < nconstants; i++) {
+        if (depths[i + 1] != NULL)
+            emit_function(out, constants, i, constants->array[i], depths[i + 1]);
+    }
+    emit_function(out, constants, MAIN, main_fn, depths[0]);
+
+    fprintf(out, "int\nmain(void)\n{\n");
+    for (size_t i = 0; i < nconstants; i++) {
+        obj = constants->array[i];
+        switch (get_monkey_object_type(obj)) {
+        case MONKEY_COMPILED_FUNCTION:
+            fn = (monkey_compiled_fn_t *) obj;
+            fprintf(out, "    constants[%zu] = (monkey_object_t *) native_function(fn%zu, "
+                "bytecode%zu, sizeof(bytecode%zu), %zu, %zu);\n", i, i, i, i,
+                fn->num_locals, fn->num_args);
+            break;
+        case MONKEY_STRING:
+            str = (monkey_string_t *) obj;
+            fprintf(out, "    constants[%zu] = (monkey_object_t *) create_monkey_string(", i);
+            emit_string(out, str->value, str->length);
+            fprintf(out, ", %zu);\n", str->length);
+            break;
+        default:
+            break;
+        }
+    }
+    fprintf(out, "    native_print_result(run());\n    return 0;\n}\n");
+}
+
+/*
+ * Writes the C translation of the bytecode to path. Returns -1 with
+ * *errmsg set if the bytecode does not verify or the file can't be
+ * written.
+ */
+int
+emit_c(bytecode_t *bytecode, const char *path, char **errmsg)
+{
+    cm_array_list *constants = bytecode->constants_pool;
+    size_t nconstants = constants == NULL? 0: constants->length;
+    size_t **depths = NULL;
+    int ret = 0;
+    FILE *out;
+
+    /* the instructions stay with the bytecode */
+    monkey_compiled_fn_t *main_fn = create_monkey_compiled_fn(bytecode->instructions, 0, 0);
+    vm_error_t vm_err = verify_bytecode_depths(main_fn, constants, bytecode->num_globals,
+        &depths);
+    if (vm_err.code != VM_ERROR_NONE) {
+        ret = fail(errmsg, "%s", vm_err.msg);
+        free(vm_err.msg);
+        goto DONE;
+    }
+    if ((out = fopen(path, "w")) == NULL) {
+        ret = fail(errmsg, "%s: %s", path, strerror(errno));
+        goto DONE;
+    }
+    emit_program(out, bytecode, main_fn, depths);
+    if (ferror(out) | fclose(out))
+        ret = fail(errmsg, "%s: write failed", path);
+DONE:
+    for (size_t i = 0; i <= nconstants && depths != NULL; i++)
+        free(depths[i]);
+    free(depths);
+    main_fn->instructions = NULL;
+    free_monkey_object(main_fn);
+    return ret;
+}
@@ -0,0 +1,154 @@
+/*-
+ * Copyright (c) 2019 Abhinav Upadhyay <er.abhinav.upadhyay@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "compiler.h"
+#include "emit_c.h"
+#include "lexer.h"
+#include "object.h"
+#include "parser.h"
+#include "test_utils.h"
+
+/*
+ * The generated programs are built against bin/libcmonkey.a, the tests run
+ * from the top of the tree after make.
+ */
+typedef struct emit_c_test {
+    const char *input;
+    const char *expected_output;
+} emit_c_test;
+
+static void
+translate_to(const char *input, const char *path)
+{
+    char *errmsg;
+    lexer_t *lexer = lexer_init(input);
+    parser_t *parser = parser_init(lexer);
+    program_t *program = parse_program(parser);
+    compiler_t *compiler = compiler_init();
+    compiler_error_t error = compile(compiler, (node_t *) program);
+    if (error.code != COMPILER_ERROR_NONE)
+        errx(EXIT_FAILURE, "compilation failed for input %s with error %s\n",
+            input, error.msg);
+    bytecode_t *bytecode = get_bytecode(compiler);
+    peephole_optimize(bytecode);
+    test(emit_c(bytecode, path, &errmsg) == 0, "emit_c failed: %s\n", errmsg);
+    instructions_free(bytecode->instructions);
+    bytecode_free(bytecode);
+    parser_free(parser);
+    program_free(program);
+    compiler_free(compiler);
+}
+
+static char *
+run_command(const char *command)
+{
+    char buf[4096];
+    size_t length = 0, n;
+    FILE *out = popen(command, "r");
+    if (out == NULL)
+        err(EXIT_FAILURE, "popen failed");
+    while ((n = fread(buf + length, 1, sizeof(buf) - 1 - length, out)) > 0)
+        length += n;
+    buf[length] = 0;
+    test(pclose(out) == 0, "%s failed, output:\n%s\n", command, buf);
+    return strdup(buf);
+}
+
+static void
+test_native_programs(void)
+{
+    emit_c_test tests[] = {
+        {"1 + 2 * 3", "7\n"},
+        {"let s = \"mon\"; s + \"key\"", "monkey\n"},
+        {"4611686018427387903 + 1", "4611686018427387904\n"},
+        {"if (1 > 2) { 10 }", ""},
+        {
+            "let fib = fn(n) { if (n < 2) { n } else { fib(n - 1) + fib(n - 2) } };\n"
+            "fib(20);",
+            "6765\n"
+        },
+        {
+            "let adder = fn(x) { fn(y) { x + y } };\n"
+            "let add2 = adder(2);\n"
+            "puts(add2(3) + len([1, 2]));\n"
+            "type(add2)",
+            "7\nCLOSURE\n"
+        },
+        {
+            "let sum = fn(n, acc) { if (n == 0) { acc } else { sum(n - 1, acc + n) } };\n"
+            "sum(100000, 0)",
+            "5000050000\n"
+        },
+        {
+            "let h = {\"one\": 1, 2: [true, -3]};\n"
+            "let f = fn(k) { let v = h[k]; v };\n"
+            "[f(\"one\"), f(2)[1], !f(2)[0], rest(f(2))]",
+            "[1, -3, false, [-3]]\n"
+        }
+    };
+    print_test_separator_line();
+    printf("Testing bytecode translated to C\n");
+    const char *cc = getenv("CC") == NULL? "cc": getenv("CC");
+    char c_path[] = "/tmp/emit_c_tests.XXXXXX.c";
+    int fd = mkstemps(c_path, 2);
+    if (fd == -1)
+        err(EXIT_FAILURE, "mkstemps failed");
+    close(fd);
+    char *exe_path = strndup(c_path, strlen(c_path) - 2);
+    char *build, *output;
+    if (exe_path == NULL ||
+            asprintf(&build, "%s -Isrc -o %s %s bin/libcmonkey.a 2>&1", cc, exe_path, c_path) == -1)
+        err(EXIT_FAILURE, "malloc failed");
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        printf("Testing translation of %s\n", tests[i].input);
+        translate_to(tests[i].input, c_path);
+        free(run_command(build));
+        output = run_command(exe_path);
+        test(strcmp(output, tests[i].expected_output) == 0,
+            "Expected output %s, got %s\n", tests[i].expected_output, output);
+        free(output);
+    }
+    unlink(c_path);
+    unlink(exe_path);
+    free(exe_path);
+    free(build);
+}
+
+int
+main(int argc, char **argv)
+{
+    test_native_programs();
+    return 0;
+}
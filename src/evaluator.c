@@ -44,72 +44,89 @@ is_error(monkey_object_t *obj)
 }
 
 static monkey_object_t *
-eval_boolean_infix_expression(const char *operator,
+eval_boolean_infix_expression(token_type op, const char *operator,
     monkey_bool_t *left_value, monkey_bool_t *right_value)
 {
     _Bool result;
-    if (strcmp(operator, "&&") == 0)
+    switch (op) {
+    case AND:
         result = left_value->value && right_value->value;
-    else if (strcmp(operator, "||") == 0)
+        break;
+    case OR:
         result = left_value->value || right_value->value;
-    else if (strcmp(operator, "==") == 0)
+        break;
+    case EQ:
         result = left_value->value == right_value->value;
-    else if (strcmp(operator, "!=") == 0)
+        break;
+    case NOT_EQ:
         result = left_value->value != right_value->value;
-    else
+        break;
+    default:
         return (monkey_object_t *) create_monkey_error("unknown operator: %s %s %s",
             get_type_name(left_value->object.type), operator,
             get_type_name(right_value->object.type));
+    }
     return (monkey_object_t *) create_monkey_bool(result);
 }
 
 static monkey_object_t *
-eval_integer_infix_expression(const char *operator,
+eval_integer_infix_expression(token_type op, const char *operator,
     monkey_int_t *left_value,
     monkey_int_t *right_value)
 {
     long result;
-    if (strcmp(operator, "+") == 0)
+    switch (op) {
+    case PLUS:
         result = left_value->value + right_value->value;
-    else if (strcmp(operator, "-") == 0)
+        break;
+    case MINUS:
         result = left_value->value - right_value->value;
-    else if (strcmp(operator, "*") == 0)
+        break;
+    case ASTERISK:
         result = left_value->value * right_value->value;
-    else if (strcmp(operator, "/") == 0)
-        if (right_value->value != 0)
-            result = left_value->value / right_value->value;
-        else
+        break;
+    case SLASH:
+        if (right_value->value == 0)
+            return (monkey_object_t *) create_monkey_error("division by 0 not allowed");
+        result = left_value->value / right_value->value;
+        break;
+    case PERCENT:
+        if (right_value->value == 0)
             return (monkey_object_t *) create_monkey_error("division by 0 not allowed");
-    else if (strcmp(operator, "<") == 0)
+        result = left_value->value % right_value->value;
+        break;
+    case LT:
         return (monkey_object_t *)
             create_monkey_bool(left_value->value < right_value->value);
-    else if (strcmp(operator, ">") == 0)
+    case GT:
         return (monkey_object_t *)
             create_monkey_bool(left_value->value > right_value->value);
-    else if (strcmp(operator, "==") == 0)
+    case LT_EQ:
+        return (monkey_object_t *)
+            create_monkey_bool(left_value->value <= right_value->value);
+    case GT_EQ:
+        return (monkey_object_t *)
+            create_monkey_bool(left_value->value >= right_value->value);
+    case EQ:
         return (monkey_object_t *)
-            (monkey_object_t *) create_monkey_bool(left_value->value == right_value->value);
-    else if (strcmp(operator, "!=") == 0)
+            create_monkey_bool(left_value->value == right_value->value);
+    case NOT_EQ:
         return (monkey_object_t *)
             create_monkey_bool(left_value->value != right_value->value);
-    else if (strcmp(operator, "%") == 0)
-    if (right_value->value != 0)
-        result = left_value->value % right_value->value;
-    else
-        return (monkey_object_t *) create_monkey_error("division by 0 not allowed");
-    else
+    default:
         return (monkey_object_t *) create_monkey_error("unknown operator: %s %s %s",
             get_type_name(left_value->object.type), operator,
             get_type_name(right_value->object.type));
+    }
     return (monkey_object_t *) create_monkey_int(result);
 }
 
 static monkey_object_t *
-eval_string_infix_expression(const char *operator,
+eval_string_infix_expression(token_type op, const char *operator,
     monkey_string_t *left_value,
     monkey_string_t *right_value)
 {
-    if (strcmp(operator, "+") == 0) {
+    if (op == PLUS) {
         size_t new_len = left_value->length + right_value->length;
         char *new_string = malloc(new_len + 1);
         memcpy(new_string, left_value->value, left_value->length);
@@ -121,14 +138,14 @@ eval_string_infix_expression(const char *operator,
         return (monkey_object_t *) new_string_obj;
     }
 
-    if (strcmp(operator, "==") == 0) {
+    if (op == EQ) {
         if (strcmp(left_value->value, right_value->value) == 0)
             return (monkey_object_t *) create_monkey_bool(true);
         else
             return (monkey_object_t *) create_monkey_bool(false);
     }
 
-    if (strcmp(operator, "!=") == 0) {
+    if (op == NOT_EQ) {
         if (strcmp(left_value->value, right_value->value) == 0)
             return (monkey_object_t *) create_monkey_bool(false);
         else
@@ -167,11 +184,11 @@ eval_bang_expression(monkey_object_t *right_value)
 }
 
 static monkey_object_t *
-eval_prefix_epxression(const char *operator, monkey_object_t *right_value)
+eval_prefix_epxression(token_type op, const char *operator, monkey_object_t *right_value)
 {
-    if (strcmp(operator, "!") == 0) {
+    if (op == BANG) {
         return eval_bang_expression(right_value);
-    } else if (strcmp(operator, "-") == 0) {
+    } else if (op == MINUS) {
         return eval_minus_prefix_expression(right_value);
     }
     return (monkey_object_t *) create_monkey_error("unknown operator: %s%s",
@@ -179,26 +196,26 @@ eval_prefix_epxression(const char *operator, monkey_object_t *right_value)
 }
 
 static monkey_object_t *
-eval_infix_expression(const char *operator,
+eval_infix_expression(token_type op, const char *operator,
     monkey_object_t *left_value,
     monkey_object_t *right_value)
 {
     if (left_value->type == MONKEY_INT && right_value->type == MONKEY_INT)
-        return eval_integer_infix_expression(operator,
+        return eval_integer_infix_expression(op, operator,
             (monkey_int_t *) left_value,
             (monkey_int_t *) right_value);
     if (left_value->type == MONKEY_STRING && right_value->type == MONKEY_STRING)
-        return eval_string_infix_expression(operator,
+        return eval_string_infix_expression(op, operator,
             (monkey_string_t *) left_value,
             (monkey_string_t *) right_value);
     if (left_value->type == MONKEY_BOOL && right_value->type == MONKEY_BOOL)
-        return eval_boolean_infix_expression(operator,
+        return eval_boolean_infix_expression(op, operator,
             (monkey_bool_t *) left_value,
             (monkey_bool_t *) right_value);
-    if (strcmp(operator, "==") == 0)
+    if (op == EQ)
         return (monkey_object_t *)
             create_monkey_bool(left_value == right_value);
-    if (strcmp(operator, "!=") == 0)
+    if (op == NOT_EQ)
         return (monkey_object_t *)
             create_monkey_bool(left_value != right_value);
     if (left_value->type != right_value->type)
@@ -317,6 +334,8 @@ apply_function(monkey_object_t *function_obj, cm_list *arguments_list)
             }
             function_value = monkey_eval((node_t *) function->body, extended_env);
             env_free(extended_env);
+            if (function_value == NULL)
+                return (monkey_object_t *) create_monkey_null();
             if (function_value->type == MONKEY_RETURN_VALUE) {
                 ret_value = (monkey_return_value_t *) function_value;
                 ret = copy_monkey_object(ret_value->value);
@@ -393,15 +412,23 @@ eval_while_expression(while_expression_t *while_exp, environment_t *env)
         return condition;
     while (is_truthy(condition)) {
         result = monkey_eval((node_t *) while_exp->body, env);
-        if (is_error(result)) {
+        if (result != NULL && (is_error(result) || result->type == MONKEY_RETURN_VALUE)) {
             free_monkey_object(condition);
             return result;
         }
         free_monkey_object(condition);
         condition = monkey_eval((node_t *) while_exp->condition, env);
-        if (is_truthy(condition))
+        if (is_error(condition)) {
+            if (result != NULL)
+                free_monkey_object(result);
+            return condition;
+        }
+        if (is_truthy(condition) && result != NULL) {
             free_monkey_object(result);
+            result = NULL;
+        }
     }
+    free_monkey_object(condition);
     if (result == NULL)
         return (monkey_object_t *) create_monkey_null();
     return result;
@@ -476,7 +503,7 @@ eval_expression(expression_t *exp, environment_t *env)
             right_value = monkey_eval((node_t *) prefix_exp->right, env);
             if (is_error(right_value))
                 return right_value;
-            exp_value = eval_prefix_epxression(prefix_exp->operator, right_value);
+            exp_value = eval_prefix_epxression(prefix_exp->op, prefix_exp->operator, right_value);
             free_monkey_object(right_value);
             return exp_value;
         case INFIX_EXPRESSION:
@@ -489,7 +516,7 @@ eval_expression(expression_t *exp, environment_t *env)
                 free_monkey_object(left_value);
                 return right_value;
             }
-            exp_value = eval_infix_expression(infix_exp->operator, left_value, right_value);
+            exp_value = eval_infix_expression(infix_exp->op, infix_exp->operator, left_value, right_value);
             free_monkey_object(left_value);
             free_monkey_object(right_value);
             return exp_value;
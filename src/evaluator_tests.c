@@ -114,6 +114,10 @@ test_eval_bool_expression(void)
         {"1 > 2", false},
         {"1 < 1", false},
         {"1 > 1", false},
+        {"1 <= 1", true},
+        {"2 <= 1", false},
+        {"1 >= 1", true},
+        {"1 >= 2", false},
         {"1 == 1", true},
         {"1 != 1", false},
         {"1 == 2", false},
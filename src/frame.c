@@ -27,35 +27,30 @@
  * SUCH DAMAGE.
  */
 
-#include <err.h>
 #include <stdlib.h>
 
 #include "frame.h"
 
-frame_t *
-frame_init(monkey_closure_t *cl, size_t bp)
+/*
+ * The frame borrows the reference to the closure held by the callee slot of
+ * the stack (the slot just below bp), which stays put for the whole call.
+ * frame_free releases that reference when the frame is popped. Calls
+ * of globals may leave the slot borrowing the reference of the global
+ * instead, which borrowed_cl records.
+ */
+void
+frame_init(frame_t *frame, monkey_closure_t *cl, size_t bp)
 {
-    frame_t *frame;
-    frame = malloc(sizeof(*frame));
-    if (frame == NULL)
-        err(EXIT_FAILURE, "malloc failed");
-    frame->cl = (monkey_closure_t *) copy_monkey_object((monkey_object_t *) cl);
-    if (frame->cl == NULL)
-        fprintf(stderr, "cl is null\n");
+    frame->cl = cl;
+    frame->ins = cl->fn->instructions->bytes;
     frame->ip = 0;
     frame->bp = bp;
-    return frame;
+    frame->borrowed_cl = false;
 }
 
 void
 frame_free(frame_t *frame)
 {
-    free_monkey_object(frame->cl);
-    free(frame);
+    if (!frame->borrowed_cl)
+        free_monkey_object(frame->cl);
 }
-
-// instructions_t *
-// get_frame_instructions(frame_t *frame)
-// {
-//     return frame->cl->fn->instructions;
-// }
\ No newline at end of file
@@ -33,13 +33,19 @@
 #include "opcode.h"
 #include "object.h"
 
+/*
+ * Frames are stored by value in the vm's frame array, the fields used on
+ * every instruction are kept together at the front.
+ */
 typedef struct frame_t {
-    monkey_closure_t *cl;
+    uint8_t *ins;
     size_t ip;
     size_t bp;
+    monkey_closure_t *cl;
+    _Bool borrowed_cl; // the callee slot borrows the reference of a global
 } frame_t;
 
-frame_t *frame_init(monkey_closure_t *, size_t);
+void frame_init(frame_t *, monkey_closure_t *, size_t);
 void frame_free(frame_t *);
 #define get_frame_instructions(frame) frame->cl->fn->instructions
 
@@ -0,0 +1,675 @@
+/*-
+ * Copyright (c) 2019 Abhinav Upadhyay <er.abhinav.upadhyay@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * A template JIT: each instruction of a hot function is translated on its
+ * own into x86-64 code working on the vm's stack exactly like the
+ * interpreter does. Integer arithmetic, comparisons, locals and jumps are
+ * inlined with a fast path for tagged ints. Everything else calls a helper
+ * of the vm, and calls and returns go back to the interpreter, which then
+ * enters the generated code of the next frame.
+ */
+
+#include <err.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "jit.h"
+#include "opcode.h"
+
+#ifdef VM_JIT
+
+enum {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+/* registers that hold their value for the whole function */
+#define VM_REG RBX
+#define FRAME_REG R12
+#define ERR_REG R13
+
+/* condition codes */
+#define CC_O 0x0
+#define CC_E 0x4
+#define CC_NE 0x5
+#define CC_L 0xc
+#define CC_GE 0xd
+#define CC_LE 0xe
+#define CC_G 0xf
+
+/* opcodes of the r/m64, r64 forms */
+#define ALU_ADD 0x01
+#define ALU_AND 0x21
+#define ALU_SUB 0x29
+#define ALU_CMP 0x39
+#define ALU_MOV 0x89
+
+/* the /digit of the r/m64, imm8 forms */
+#define IMM_ADD 0
+#define IMM_SUB 5
+
+/* jump targets that are not instructions of the function */
+#define LABEL_ERROR SIZE_MAX
+#define LABEL_RETURN (SIZE_MAX - 1)
+
+#define STACK_OFFSET ((int32_t) offsetof(vm_t, stack))
+#define SP_OFFSET ((int32_t) offsetof(vm_t, sp))
+#define BP_OFFSET ((int32_t) offsetof(frame_t, bp))
+
+typedef struct jit_fixup_t {
+    size_t pos; // of the rel32 to patch
+    size_t target; // bytecode offset, or one of the LABEL_ values
+} jit_fixup_t;
+
+typedef struct jit_t {
+    uint8_t *code;
+    size_t length;
+    size_t size;
+    jit_fixup_t *fixups;
+    size_t nfixups;
+    size_t fixups_size;
+    size_t *labels; // code offset of each instruction, by bytecode offset
+    size_t error_label;
+    size_t return_label;
+    const jit_runtime_t *runtime;
+} jit_t;
+
+static void
+emit_byte(jit_t *jit, uint8_t b)
+{
+    if (jit->length == jit->size) {
+        jit->size *= 2;
+        jit->code = realloc(jit->code, jit->size);
+        if (jit->code == NULL)
+            err(EXIT_FAILURE, "malloc failed");
+    }
+    jit->code[jit->length++] = b;
+}
+
+static void
+emit_u32(jit_t *jit, uint32_t v)
+{
+    for (size_t i = 0; i < 4; i++)
+        emit_byte(jit, (v >> (i * 8)) & 0xff);
+}
+
+static void
+emit_u64(jit_t *jit, uint64_t v)
+{
+    for (size_t i = 0; i < 8; i++)
+        emit_byte(jit, (v >> (i * 8)) & 0xff);
+}
+
+static void
+emit_rex(jit_t *jit, int reg, int index, int base)
+{
+    emit_byte(jit, 0x48 | ((reg & 8) >> 1) | ((index & 8) >> 2) | ((base & 8) >> 3));
+}
+
+/* [base + index * 8 + disp], index < 0 for none */
+static void
+emit_mem(jit_t *jit, int reg, int base, int index, int32_t disp)
+{
+    if (index < 0 && (base & 7) != RSP) {
+        emit_byte(jit, 0x80 | ((reg & 7) << 3) | (base & 7));
+    } else {
+        emit_byte(jit, 0x80 | ((reg & 7) << 3) | RSP);
+        emit_byte(jit, index < 0? 0x20 | (base & 7): 0xc0 | ((index & 7) << 3) | (base & 7));
+    }
+    emit_u32(jit, (uint32_t) disp);
+}
+
+static void
+emit_load(jit_t *jit, int dst, int base, int index, int32_t disp)
+{
+    emit_rex(jit, dst, index < 0? 0: index, base);
+    emit_byte(jit, 0x8b);
+    emit_mem(jit, dst, base, index, disp);
+}
+
+static void
+emit_store(jit_t *jit, int base, int index, int32_t disp, int src)
+{
+    emit_rex(jit, src, index < 0? 0: index, base);
+    emit_byte(jit, 0x89);
+    emit_mem(jit, src, base, index, disp);
+}
+
+static void
+emit_mov_imm(jit_t *jit, int dst, uint64_t imm)
+{
+    emit_rex(jit, 0, 0, dst);
+    emit_byte(jit, 0xb8 + (dst & 7));
+    emit_u64(jit, imm);
+}
+
+static void
+emit_alu(jit_t *jit, uint8_t op, int dst, int src)
+{
+    emit_rex(jit, src, 0, dst);
+    emit_byte(jit, op);
+    emit_byte(jit, 0xc0 | ((src & 7) << 3) | (dst & 7));
+}
+
+static void
+emit_alu_imm(jit_t *jit, int op, int dst, int8_t imm)
+{
+    emit_rex(jit, 0, 0, dst);
+    emit_byte(jit, 0x83);
+    emit_byte(jit, 0xc0 | (op << 3) | (dst & 7));
+    emit_byte(jit, (uint8_t) imm);
+}
+
+static void
+emit_cmov(jit_t *jit, int cc, int dst, int src)
+{
+    emit_rex(jit, dst, 0, src);
+    emit_byte(jit, 0x0f);
+    emit_byte(jit, 0x40 + cc);
+    emit_byte(jit, 0xc0 | ((dst & 7) << 3) | (src & 7));
+}
+
+/* test reg32, 1: whether the value is a tagged int */
+static void
+emit_test_tag(jit_t *jit, int reg)
+{
+    if (reg & 8)
+        emit_byte(jit, 0x41);
+    emit_byte(jit, 0xf7);
+    emit_byte(jit, 0xc0 | (reg & 7));
+    emit_u32(jit, 1);
+}
+
+/* returns the position of the rel32 to patch */
+static size_t
+emit_jcc(jit_t *jit, int cc)
+{
+    emit_byte(jit, 0x0f);
+    emit_byte(jit, 0x80 + cc);
+    emit_u32(jit, 0);
+    return jit->length - 4;
+}
+
+static size_t
+emit_jmp(jit_t *jit)
+{
+    emit_byte(jit, 0xe9);
+    emit_u32(jit, 0);
+    return jit->length - 4;
+}
+
+static void
+patch(jit_t *jit, size_t pos, size_t target)
+{
+    uint32_t rel = (uint32_t) (target - (pos + 4));
+    memcpy(jit->code + pos, &rel, sizeof(rel));
+}
+
+/* points the jump at the code emitted next */
+static void
+patch_here(jit_t *jit, size_t pos)
+{
+    patch(jit, pos, jit->length);
+}
+
+static void
+add_fixup(jit_t *jit, size_t pos, size_t target)
+{
+    if (jit->nfixups == jit->fixups_size) {
+        jit->fixups_size *= 2;
+        jit->fixups = reallocarray(jit->fixups, jit->fixups_size, sizeof(*jit->fixups));
+        if (jit->fixups == NULL)
+            err(EXIT_FAILURE, "malloc failed");
+    }
+    jit->fixups[jit->nfixups].pos = pos;
+    jit->fixups[jit->nfixups].target = target;
+    jit->nfixups++;
+}
+
+static void
+emit_call(jit_t *jit, jit_helper_t helper, size_t a, size_t b)
+{
+    emit_alu(jit, ALU_MOV, RDI, VM_REG);
+    emit_alu(jit, ALU_MOV, RSI, FRAME_REG);
+    emit_mov_imm(jit, RDX, a);
+    emit_mov_imm(jit, RCX, b);
+    emit_alu(jit, ALU_MOV, R8, ERR_REG);
+    emit_mov_imm(jit, RAX, (uintptr_t) helper);
+    emit_byte(jit, 0xff); // call rax
+    emit_byte(jit, 0xd0);
+}
+
+/* calls the helper of the instruction, leaving the function if it fails */
+static void
+emit_helper(jit_t *jit, opcode_t op, size_t a, size_t b)
+{
+    emit_call(jit, jit->runtime->ops[op], a, b);
+    emit_byte(jit, 0x85); // test eax, eax
+    emit_byte(jit, 0xc0);
+    add_fixup(jit, emit_jcc(jit, CC_NE), LABEL_ERROR);
+}
+
+/* returns to the interpreter, at the instruction at pos */
+static void
+emit_exit(jit_t *jit, size_t pos)
+{
+    emit_byte(jit, 0xb8); // mov eax, imm32
+    emit_u32(jit, (uint32_t) pos);
+    add_fixup(jit, emit_jmp(jit), LABEL_RETURN);
+}
+
+/* rcx = sp, rdx = stack */
+static void
+emit_load_sp(jit_t *jit)
+{
+    emit_load(jit, RCX, VM_REG, -1, SP_OFFSET);
+    emit_load(jit, RDX, VM_REG, -1, STACK_OFFSET);
+}
+
+/* sets sp to rcx + n */
+static void
+emit_store_sp(jit_t *jit, int8_t n)
+{
+    emit_alu_imm(jit, IMM_ADD, RCX, n);
+    emit_store(jit, VM_REG, -1, SP_OFFSET, RCX);
+}
+
+static void
+emit_push_rax(jit_t *jit)
+{
+    emit_load_sp(jit);
+    emit_store(jit, RDX, RCX, 0, RAX);
+    emit_store_sp(jit, 1);
+}
+
+/* rax = left, rsi = right, the two values on top of the stack */
+static void
+emit_load_operands(jit_t *jit)
+{
+    emit_load_sp(jit);
+    emit_load(jit, RAX, RDX, RCX, -16);
+    emit_load(jit, RSI, RDX, RCX, -8);
+}
+
+/* replaces the two operands with rax */
+static void
+emit_store_result(jit_t *jit)
+{
+    emit_store(jit, RDX, RCX, -16, RAX);
+    emit_store_sp(jit, -1);
+}
+
+/* rax = the local */
+static void
+emit_load_local(jit_t *jit, size_t index)
+{
+    emit_load(jit, RDX, VM_REG, -1, STACK_OFFSET);
+    emit_load(jit, RCX, FRAME_REG, -1, BP_OFFSET);
+    emit_load(jit, RAX, RDX, RCX, (int32_t) (index * sizeof(monkey_object_t *)));
+}
+
+/* the tagged representation of an int constant that has one */
+static _Bool
+get_tagged_constant(cm_array_list *constants, size_t index, uintptr_t *tagged)
+{
+    monkey_object_t *obj = constants->array[index];
+    if (get_monkey_object_type(obj) != MONKEY_INT || !fits_tagged_int(get_monkey_int_value(obj)))
+        return false;
+    *tagged = (uintptr_t) tag_int(get_monkey_int_value(obj));
+    return true;
+}
+
+/*
+ * Pops the condition and jumps to target if it is falsy, the booleans are
+ * checked inline.
+ */
+static void
+emit_jump_if_false(jit_t *jit, size_t target)
+{
+    size_t not_false, not_true, done;
+    emit_load_sp(jit);
+    emit_load(jit, RAX, RDX, RCX, -8);
+    emit_mov_imm(jit, RSI, (uintptr_t) create_monkey_bool(false));
+    emit_alu(jit, ALU_CMP, RAX, RSI);
+    not_false = emit_jcc(jit, CC_NE);
+    emit_store_sp(jit, -1);
+    add_fixup(jit, emit_jmp(jit), target);
+    patch_here(jit, not_false);
+    emit_mov_imm(jit, RSI, (uintptr_t) create_monkey_bool(true));
+    emit_alu(jit, ALU_CMP, RAX, RSI);
+    not_true = emit_jcc(jit, CC_NE);
+    emit_store_sp(jit, -1);
+    done = emit_jmp(jit);
+    patch_here(jit, not_true);
+    emit_call(jit, jit->runtime->pop_truthy, 0, 0);
+    emit_byte(jit, 0x85); // test eax, eax
+    emit_byte(jit, 0xc0);
+    add_fixup(jit, emit_jcc(jit, CC_E), target);
+    patch_here(jit, done);
+}
+
+static int
+get_condition_code(opcode_t op)
+{
+    switch (op) {
+    case OPEQUALINT:
+        return CC_E;
+    case OPNOTEQUALINT:
+        return CC_NE;
+    case OPGREATERTHANINT:
+        return CC_G;
+    case OPLESSTHANINT:
+        return CC_L;
+    case OPLESSEQUALINT:
+        return CC_LE;
+    default:
+        return CC_GE;
+    }
+}
+
+/*
+ * Tagged ints keep their order and overflow exactly when the untagged
+ * result doesn't fit a tagged int, so they are added, subtracted and
+ * compared as they are. Anything else takes the helper.
+ */
+static void
+emit_int_op(jit_t *jit, opcode_t op)
+{
+    size_t not_ints, overflow = SIZE_MAX, done;
+    emit_load_operands(jit);
+    emit_alu(jit, ALU_MOV, RDI, RAX);
+    emit_alu(jit, ALU_AND, RDI, RSI);
+    emit_test_tag(jit, RDI);
+    not_ints = emit_jcc(jit, CC_E);
+    switch (op) {
+    case OPADDINT:
+        emit_alu_imm(jit, IMM_SUB, RAX, 1);
+        emit_alu(jit, ALU_ADD, RAX, RSI);
+        overflow = emit_jcc(jit, CC_O);
+        break;
+    case OPSUBINT:
+        emit_alu(jit, ALU_SUB, RAX, RSI);
+        overflow = emit_jcc(jit, CC_O);
+        emit_alu_imm(jit, IMM_ADD, RAX, 1);
+        break;
+    default:
+        emit_alu(jit, ALU_CMP, RAX, RSI);
+        emit_mov_imm(jit, RAX, (uintptr_t) create_monkey_bool(false));
+        emit_mov_imm(jit, RDI, (uintptr_t) create_monkey_bool(true));
+        emit_cmov(jit, get_condition_code(op), RAX, RDI);
+        break;
+    }
+    emit_store_result(jit);
+    done = emit_jmp(jit);
+    patch_here(jit, not_ints);
+    if (overflow != SIZE_MAX)
+        patch_here(jit, overflow);
+    emit_helper(jit, op, 0, 0);
+    patch_here(jit, done);
+}
+
+static void
+emit_get_local(jit_t *jit, size_t index)
+{
+    size_t not_int, done;
+    emit_load_local(jit, index);
+    emit_test_tag(jit, RAX);
+    not_int = emit_jcc(jit, CC_E);
+    emit_push_rax(jit);
+    done = emit_jmp(jit);
+    patch_here(jit, not_int);
+    emit_helper(jit, OPGETLOCAL, index, 0);
+    patch_here(jit, done);
+}
+
+static void
+emit_local_const_op(jit_t *jit, opcode_t op, size_t local, size_t constant, uintptr_t tagged)
+{
+    size_t not_int, overflow, done;
+    emit_load_local(jit, local);
+    emit_test_tag(jit, RAX);
+    not_int = emit_jcc(jit, CC_E);
+    emit_mov_imm(jit, RSI, tagged - 1);
+    emit_alu(jit, op == OPLOCALCONSTADD? ALU_ADD: ALU_SUB, RAX, RSI);
+    overflow = emit_jcc(jit, CC_O);
+    emit_push_rax(jit);
+    done = emit_jmp(jit);
+    patch_here(jit, not_int);
+    patch_here(jit, overflow);
+    emit_helper(jit, op, local, constant);
+    patch_here(jit, done);
+}
+
+static void
+emit_local_const_equal_jump(jit_t *jit, size_t local, size_t constant, size_t target,
+    _Bool has_tag, uintptr_t tagged)
+{
+    size_t not_int = SIZE_MAX, done = SIZE_MAX;
+    if (has_tag) {
+        /* a tagged int equals the constant only if it is the same word */
+        emit_load_local(jit, local);
+        emit_test_tag(jit, RAX);
+        not_int = emit_jcc(jit, CC_E);
+        emit_mov_imm(jit, RSI, tagged);
+        emit_alu(jit, ALU_CMP, RAX, RSI);
+        add_fixup(jit, emit_jcc(jit, CC_NE), target);
+        done = emit_jmp(jit);
+        patch_here(jit, not_int);
+    }
+    emit_helper(jit, OPLOCALCONSTEQUALJMPFALSE, local, constant);
+    emit_jump_if_false(jit, target);
+    if (has_tag)
+        patch_here(jit, done);
+}
+
+static size_t
+get_operand(uint8_t *bytes, size_t pos, size_t n)
+{
+    opcode_definition_t op_def = opcode_definition_lookup(bytes[pos]);
+    size_t offset = pos + 1;
+    if (op_def.operand_widths[n] == 0)
+        return 0;
+    for (size_t i = 0; i < n; i++)
+        offset += op_def.operand_widths[i];
+    return decode_instructions_to_sizet(bytes + offset, op_def.operand_widths[n]);
+}
+
+static void
+emit_instruction(jit_t *jit, uint8_t *bytes, size_t pos, cm_array_list *constants)
+{
+    opcode_t op = bytes[pos];
+    uintptr_t tagged = 0;
+    _Bool has_tag;
+    switch (op) {
+    case OPCONSTANT:
+        if (get_tagged_constant(constants, get_operand(bytes, pos, 0), &tagged)) {
+            emit_mov_imm(jit, RAX, tagged);
+            emit_push_rax(jit);
+        } else
+            emit_helper(jit, op, get_operand(bytes, pos, 0), 0);
+        break;
+    case OPTRUE:
+        emit_mov_imm(jit, RAX, (uintptr_t) create_monkey_bool(true));
+        emit_push_rax(jit);
+        break;
+    case OPFALSE:
+        emit_mov_imm(jit, RAX, (uintptr_t) create_monkey_bool(false));
+        emit_push_rax(jit);
+        break;
+    case OPNULL:
+        emit_mov_imm(jit, RAX, (uintptr_t) create_monkey_null());
+        emit_push_rax(jit);
+        break;
+    case OPGETLOCAL:
+        emit_get_local(jit, get_operand(bytes, pos, 0));
+        break;
+    case OPADDINT:
+    case OPSUBINT:
+    case OPEQUALINT:
+    case OPNOTEQUALINT:
+    case OPGREATERTHANINT:
+    case OPLESSTHANINT:
+    case OPLESSEQUALINT:
+    case OPGREATEREQUALINT:
+        emit_int_op(jit, op);
+        break;
+    case OPJMP:
+        add_fixup(jit, emit_jmp(jit), get_operand(bytes, pos, 0));
+        break;
+    case OPJMPFALSE:
+        emit_jump_if_false(jit, get_operand(bytes, pos, 0));
+        break;
+    case OPLOCALCONSTADD:
+    case OPLOCALCONSTSUB:
+        if (get_tagged_constant(constants, get_operand(bytes, pos, 1), &tagged))
+            emit_local_const_op(jit, op, get_operand(bytes, pos, 0),
+                get_operand(bytes, pos, 1), tagged);
+        else
+            emit_helper(jit, op, get_operand(bytes, pos, 0), get_operand(bytes, pos, 1));
+        break;
+    case OPLOCALCONSTEQUALJMPFALSE:
+        has_tag = get_tagged_constant(constants, get_operand(bytes, pos, 1), &tagged);
+        emit_local_const_equal_jump(jit, get_operand(bytes, pos, 0),
+            get_operand(bytes, pos, 1), get_operand(bytes, pos, 2), has_tag, tagged);
+        break;
+    default:
+        if (jit->runtime->ops[op] != NULL)
+            emit_helper(jit, op, get_operand(bytes, pos, 0), get_operand(bytes, pos, 1));
+        else
+            emit_exit(jit, pos);
+        break;
+    }
+}
+
+/*
+ * Translates the function and attaches the code to it. The code is laid
+ * out as the function, followed by the table of the code address of every
+ * instruction it can be entered at. If no executable memory can be had
+ * the function stays interpreted.
+ */
+void
+jit_compile(monkey_compiled_fn_t *fn, cm_array_list *constants, const jit_runtime_t *runtime)
+{
+    uint8_t *bytes = fn->instructions->bytes;
+    size_t length = fn->instructions->length;
+    size_t table_pos, code_size, map_size, trap_label;
+    uint8_t *map;
+    uint64_t *table;
+    jit_t jit;
+
+    jit.size = 64 * (length + 1);
+    jit.length = 0;
+    jit.code = malloc(jit.size);
+    jit.fixups_size = 16;
+    jit.nfixups = 0;
+    jit.fixups = malloc(jit.fixups_size * sizeof(*jit.fixups));
+    jit.labels = malloc((length + 1) * sizeof(*jit.labels));
+    jit.runtime = runtime;
+    if (jit.code == NULL || jit.fixups == NULL || jit.labels == NULL)
+        err(EXIT_FAILURE, "malloc failed");
+
+    /* push rbx; push r12; push r13, which also aligns the stack for calls */
+    emit_byte(&jit, 0x53);
+    emit_byte(&jit, 0x41);
+    emit_byte(&jit, 0x54);
+    emit_byte(&jit, 0x41);
+    emit_byte(&jit, 0x55);
+    emit_alu(&jit, ALU_MOV, VM_REG, RDI);
+    emit_alu(&jit, ALU_MOV, FRAME_REG, RSI);
+    emit_alu(&jit, ALU_MOV, ERR_REG, RCX);
+    /* mov rax, table; jmp [rax + rdx * 8] */
+    emit_mov_imm(&jit, RAX, 0);
+    table_pos = jit.length - 8;
+    emit_byte(&jit, 0xff);
+    emit_byte(&jit, 0x24);
+    emit_byte(&jit, 0xd0);
+
+    for (size_t pos = 0; pos < length; pos += get_instruction_length(bytes[pos])) {
+        jit.labels[pos] = jit.length;
+        emit_instruction(&jit, bytes, pos, constants);
+    }
+    jit.labels[length] = jit.length;
+    emit_exit(&jit, length);
+
+    jit.error_label = jit.length;
+    emit_mov_imm(&jit, RAX, SIZE_MAX);
+    jit.return_label = jit.length;
+    emit_byte(&jit, 0x41); // pop r13
+    emit_byte(&jit, 0x5d);
+    emit_byte(&jit, 0x41); // pop r12
+    emit_byte(&jit, 0x5c);
+    emit_byte(&jit, 0x5b); // pop rbx
+    emit_byte(&jit, 0xc3); // ret
+    trap_label = jit.length;
+    emit_byte(&jit, 0x0f); // ud2, for offsets inside an instruction
+    emit_byte(&jit, 0x0b);
+
+    for (size_t i = 0; i < jit.nfixups; i++) {
+        size_t target = jit.fixups[i].target;
+        if (target == LABEL_ERROR)
+            target = jit.error_label;
+        else if (target == LABEL_RETURN)
+            target = jit.return_label;
+        else
+            target = jit.labels[target];
+        patch(&jit, jit.fixups[i].pos, target);
+    }
+
+    code_size = (jit.length + 7) & ~(size_t) 7;
+    map_size = code_size + (length + 1) * sizeof(*table);
+    map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED)
+        goto DONE;
+    table = (uint64_t *) (map + code_size);
+    for (size_t i = 0; i <= length; i++)
+        table[i] = (uintptr_t) map + trap_label;
+    for (size_t pos = 0; pos < length; pos += get_instruction_length(bytes[pos]))
+        table[pos] = (uintptr_t) map + jit.labels[pos];
+    table[length] = (uintptr_t) map + jit.labels[length];
+    uint64_t table_addr = (uintptr_t) table;
+    memcpy(jit.code + table_pos, &table_addr, sizeof(table_addr));
+    memcpy(map, jit.code, jit.length);
+    if (mprotect(map, map_size, PROT_READ | PROT_EXEC) == -1) {
+        munmap(map, map_size);
+        goto DONE;
+    }
+    fn->jit_code = map;
+    fn->jit_size = map_size;
+
+DONE:
+    free(jit.code);
+    free(jit.fixups);
+    free(jit.labels);
+}
+
+#endif
@@ -0,0 +1,69 @@
+/*-
+ * Copyright (c) 2019 Abhinav Upadhyay <er.abhinav.upadhyay@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef JIT_H
+#define JIT_H
+
+#include "cmonkey_utils.h"
+#include "frame.h"
+#include "object.h"
+#include "vm.h"
+
+/*
+ * The JIT emits System V x86-64 code, elsewhere functions are always
+ * interpreted.
+ */
+#if defined(__x86_64__) && !defined(VM_NO_JIT)
+#define VM_JIT
+#endif
+
+#define JIT_THRESHOLD 1000 // calls before monkeyvm --jit compiles a function
+
+/*
+ * Runs one instruction the generated code doesn't inline, with its two
+ * operands. Returns non-zero with err set if the instruction failed.
+ */
+typedef int (*jit_helper_t)(vm_t *, frame_t *, size_t, size_t, vm_error_t *);
+
+/*
+ * Generated code runs the frame from ip until an instruction only the
+ * interpreter runs, whose offset it returns, or SIZE_MAX with err set.
+ */
+typedef size_t (*jit_code_t)(vm_t *, frame_t *, size_t, vm_error_t *);
+
+typedef struct jit_runtime_t {
+    jit_helper_t ops[256]; // by opcode, NULL for the ones the interpreter runs
+    jit_helper_t pop_truthy; // pops the top of the stack, returns whether it is truthy
+} jit_runtime_t;
+
+#ifdef VM_JIT
+void jit_compile(monkey_compiled_fn_t *, cm_array_list *, const jit_runtime_t *);
+#endif
+
+#endif
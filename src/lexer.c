@@ -195,13 +195,25 @@ lexer_next_token(lexer_t *l)
 		read_char(l);
 		break;
 	case '<':
-		t->literal = strdup("<");
-		t->type = LT;
+		if (l->input[l->read_offset] == '=') {
+			t->literal = strdup("<=");
+			t->type = LT_EQ;
+			read_char(l);
+		} else {
+			t->literal = strdup("<");
+			t->type = LT;
+		}
 		read_char(l);
 		break;
 	case '>':
-		t->literal = strdup(">");
-		t->type = GT;
+		if (l->input[l->read_offset] == '=') {
+			t->literal = strdup(">=");
+			t->type = GT_EQ;
+			read_char(l);
+		} else {
+			t->literal = strdup(">");
+			t->type = GT;
+		}
 		read_char(l);
 		break;
 	case 0:
@@ -69,7 +69,8 @@ main(int argc, char **argv)
 			 "while (x > 10) {\n"\
 			 "let x = x - 1;\n"\
 			 "}\n"\
-			 "x % y;\n";
+			 "x % y;\n"\
+			 "x <= y >= z;\n";
 
 	token_t tests[] = {
 		{ LET, "let"},
@@ -201,6 +202,12 @@ main(int argc, char **argv)
 		{PERCENT, "%"},
 		{IDENT, "y"},
 		{SEMICOLON, ";"},
+		{IDENT, "x"},
+		{LT_EQ, "<="},
+		{IDENT, "y"},
+		{GT_EQ, ">="},
+		{IDENT, "z"},
+		{SEMICOLON, ";"},
 		{ END_OF_FILE, "" }
 	};
 
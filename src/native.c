@@ -0,0 +1,233 @@
+/*-
+ * Copyright (c) 2019 Abhinav Upadhyay <er.abhinav.upadhyay@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <err.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "builtins.h"
+#include "cmonkey_utils.h"
+#include "native.h"
+#include "object.h"
+#include "opcode.h"
+#include "vm.h"
+
+/* the native stack is the call stack, calls nest as deep as vm frames */
+static size_t depth;
+
+void
+native_fail(vm_error_t vm_err)
+{
+    errx(EXIT_FAILURE, "%s", vm_err.msg);
+}
+
+static _Noreturn void
+fail(const char *fmt, ...)
+{
+    vm_error_t vm_err;
+    va_list args;
+    va_start(args, fmt);
+    if (vasprintf(&vm_err.msg, fmt, args) == -1)
+        err(EXIT_FAILURE, "malloc failed");
+    va_end(args);
+    native_fail(vm_err);
+}
+
+/*
+ * Builds the function object of a translated function. The bytecode stays
+ * in the program's data, it only serves comparing functions.
+ */
+monkey_compiled_fn_t *
+native_function(native_fn_t code, uint8_t *bytes, size_t length, size_t num_locals,
+    size_t num_args)
+{
+    instructions_t *ins = malloc(sizeof(*ins));
+    if (ins == NULL)
+        err(EXIT_FAILURE, "malloc failed");
+    ins->bytes = bytes;
+    ins->length = length;
+    ins->size = length;
+    ins->mapped = true;
+    monkey_compiled_fn_t *fn = create_monkey_compiled_fn(ins, num_locals, num_args);
+    fn->native_fn = (void *) code;
+    return fn;
+}
+
+monkey_object_t *
+native_call(monkey_object_t *callee, monkey_object_t **args, size_t nargs)
+{
+    monkey_object_t *result;
+    monkey_closure_t *closure;
+    cm_list *list;
+    switch (get_monkey_object_type(callee)) {
+    case MONKEY_CLOSURE:
+        closure = (monkey_closure_t *) callee;
+        if (closure->fn->num_args != nargs)
+            fail("wrong number of arguments: want=%zu, got=%zu", closure->fn->num_args, nargs);
+        if (depth == MAX_FRAMES)
+            fail("maximum call depth of %d exceeded", MAX_FRAMES);
+        depth++;
+        result = ((native_fn_t) closure->fn->native_fn)(closure, args);
+        depth--;
+        break;
+    case MONKEY_BUILTIN:
+        list = cm_list_init();
+        for (size_t i = 0; i < nargs; i++)
+            cm_list_add(list, args[i]);
+        result = ((monkey_builtin_t *) callee)->function(list);
+        cm_list_free(list, free_monkey_object);
+        break;
+    default:
+        fail("Calling non-function");
+    }
+    free_monkey_object(callee);
+    return result;
+}
+
+#define NATIVE_CHECK(call) do { \
+        vm_error_t vm_err = (call); \
+        if (vm_err.code != VM_ERROR_NONE) \
+            native_fail(vm_err); \
+    } while (0)
+
+monkey_object_t *
+native_binary_op(opcode_t op, monkey_object_t *left, monkey_object_t *right)
+{
+    monkey_object_t *result;
+    NATIVE_CHECK(vm_binary_op(op, left, right, &result));
+    free_monkey_object(left);
+    free_monkey_object(right);
+    return result;
+}
+
+monkey_object_t *
+native_comparison_op(opcode_t op, monkey_object_t *left, monkey_object_t *right)
+{
+    monkey_object_t *result;
+    NATIVE_CHECK(vm_comparison_op(op, left, right, &result));
+    free_monkey_object(left);
+    free_monkey_object(right);
+    return result;
+}
+
+monkey_object_t *
+native_minus(monkey_object_t *operand)
+{
+    monkey_object_t *result;
+    NATIVE_CHECK(vm_minus_operator(operand, &result));
+    free_monkey_object(operand);
+    return result;
+}
+
+monkey_object_t *
+native_bang(monkey_object_t *operand)
+{
+    monkey_object_t *result;
+    NATIVE_CHECK(vm_bang_operator(operand, &result));
+    free_monkey_object(operand);
+    return result;
+}
+
+monkey_object_t *
+native_index(monkey_object_t *left, monkey_object_t *index)
+{
+    monkey_object_t *result;
+    NATIVE_CHECK(vm_index_expression(left, index, &result));
+    free_monkey_object(left);
+    free_monkey_object(index);
+    return result;
+}
+
+monkey_object_t *
+native_array(monkey_object_t **elements, size_t n)
+{
+    cm_array_list *list = cm_array_list_init(n, NULL);
+    for (size_t i = 0; i < n; i++)
+        cm_array_list_add(list, elements[i]);
+    return (monkey_object_t *) create_monkey_array(list);
+}
+
+monkey_object_t *
+native_hash(monkey_object_t **items, size_t n)
+{
+    cm_hash_table *table = cm_hash_table_init(monkey_object_hash,
+        monkey_object_equals, NULL, NULL);
+    for (size_t i = 0; i < n; i += 2)
+        cm_hash_table_put(table, items[i], items[i + 1]);
+    return (monkey_object_t *) create_monkey_hash(table);
+}
+
+monkey_object_t *
+native_closure(monkey_compiled_fn_t *fn, monkey_object_t **free_variables, size_t n)
+{
+    return (monkey_object_t *) create_monkey_closure(fn, free_variables, n);
+}
+
+/*
+ * A function without free variables gets a single closure, built the first
+ * time the program reaches it.
+ */
+monkey_object_t *
+native_constant_closure(monkey_closure_t **cache, monkey_compiled_fn_t *fn)
+{
+    if (*cache == NULL)
+        *cache = create_monkey_closure(fn, NULL, 0);
+    return copy_monkey_object((monkey_object_t *) *cache);
+}
+
+_Bool
+native_pop_truthy(monkey_object_t *obj)
+{
+    _Bool truthy = vm_is_truthy(obj);
+    free_monkey_object(obj);
+    return truthy;
+}
+
+void
+native_set(monkey_object_t **slot, monkey_object_t *value)
+{
+    if (*slot != NULL)
+        free_monkey_object(*slot);
+    *slot = value;
+}
+
+/* what monkeyvm prints after running a file: the last value popped */
+void
+native_print_result(monkey_object_t *last)
+{
+    if (last == NULL)
+        return;
+    if (get_monkey_object_type(last) != MONKEY_NULL) {
+        char *s = inspect(last);
+        printf("%s\n", s);
+        free(s);
+    }
+    free_monkey_object(last);
+}
@@ -0,0 +1,92 @@
+/*-
+ * Copyright (c) 2019 Abhinav Upadhyay <er.abhinav.upadhyay@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef NATIVE_H
+#define NATIVE_H
+
+#include "builtins.h"
+#include "object.h"
+#include "opcode.h"
+#include "vm.h"
+
+/*
+ * The runtime of the C programs monkeyc --emit-c translates bytecode to.
+ * Every compiled function becomes a native_fn_t, called with its closure
+ * and its arguments. The functions here do what the instructions do in the
+ * vm and take over the references they are passed, the way the vm takes
+ * them off its stack. There is no stack to unwind, an error prints its
+ * message and exits.
+ */
+typedef monkey_object_t *(*native_fn_t)(monkey_closure_t *, monkey_object_t **);
+
+_Noreturn void native_fail(vm_error_t);
+monkey_compiled_fn_t *native_function(native_fn_t, uint8_t *, size_t, size_t, size_t);
+monkey_object_t *native_call(monkey_object_t *, monkey_object_t **, size_t);
+monkey_object_t *native_binary_op(opcode_t, monkey_object_t *, monkey_object_t *);
+monkey_object_t *native_comparison_op(opcode_t, monkey_object_t *, monkey_object_t *);
+monkey_object_t *native_minus(monkey_object_t *);
+monkey_object_t *native_bang(monkey_object_t *);
+monkey_object_t *native_index(monkey_object_t *, monkey_object_t *);
+monkey_object_t *native_array(monkey_object_t **, size_t);
+monkey_object_t *native_hash(monkey_object_t **, size_t);
+monkey_object_t *native_closure(monkey_compiled_fn_t *, monkey_object_t **, size_t);
+monkey_object_t *native_constant_closure(monkey_closure_t **, monkey_compiled_fn_t *);
+_Bool native_pop_truthy(monkey_object_t *);
+void native_set(monkey_object_t **, monkey_object_t *);
+void native_print_result(monkey_object_t *);
+
+/* small ints are added, subtracted and compared inline */
+#define NATIVE_INT_OP(name, op, expr) static inline monkey_object_t * \
+    name(monkey_object_t *left, monkey_object_t *right) \
+    { \
+        if (is_tagged_int(left) && is_tagged_int(right)) { \
+            long l = tagged_int_value(left), r = tagged_int_value(right); \
+            return expr; \
+        } \
+        return native_binary_op(op, left, right); \
+    }
+#define NATIVE_COMPARISON_OP(name, op, cmp) static inline monkey_object_t * \
+    name(monkey_object_t *left, monkey_object_t *right) \
+    { \
+        if (is_tagged_int(left) && is_tagged_int(right)) \
+            return (monkey_object_t *) (tagged_int_value(left) cmp tagged_int_value(right)? \
+                &MONKEY_TRUE_OBJ: &MONKEY_FALSE_OBJ); \
+        return native_comparison_op(op, left, right); \
+    }
+
+NATIVE_INT_OP(native_add, OPADD, fits_tagged_int(l + r)? tag_int(l + r): create_monkey_int_value(l + r))
+NATIVE_INT_OP(native_sub, OPSUB, fits_tagged_int(l - r)? tag_int(l - r): create_monkey_int_value(l - r))
+NATIVE_COMPARISON_OP(native_equal, OPEQUAL, ==)
+NATIVE_COMPARISON_OP(native_not_equal, OPNOTEQUAL, !=)
+NATIVE_COMPARISON_OP(native_greater_than, OPGREATERTHAN, >)
+NATIVE_COMPARISON_OP(native_less_than, OPLESSTHAN, <)
+NATIVE_COMPARISON_OP(native_less_equal, OPLESSEQUAL, <=)
+NATIVE_COMPARISON_OP(native_greater_equal, OPGREATEREQUAL, >=)
+
+#endif
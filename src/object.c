@@ -33,6 +33,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 
 #include "cmonkey_utils.h"
 #include "parser.h"
@@ -43,6 +44,82 @@ const monkey_bool_t MONKEY_TRUE_OBJ = {{MONKEY_BOOL, inspect, monkey_object_hash
 const monkey_bool_t MONKEY_FALSE_OBJ = {{MONKEY_BOOL, inspect, monkey_object_hash, monkey_object_equals, 1}, false};
 const monkey_null_t MONKEY_NULL_OBJ = {{MONKEY_NULL, inspect, NULL, NULL, 1}};
 
+#define NPOOLS (OBJECT_POOL_MAX_SIZE / OBJECT_POOL_ALIGN)
+#define pool_index(size) (((size) + OBJECT_POOL_ALIGN - 1) / OBJECT_POOL_ALIGN - 1)
+
+/*
+ * A size class: freed objects are linked through their first word, fresh
+ * ones are bumped out of the current slab. Slabs are never given back.
+ */
+typedef struct object_pool_t {
+    void *free_list;
+    char *slab_next;
+    char *slab_end;
+} object_pool_t;
+
+static _Thread_local object_pool_t pools[NPOOLS];
+static _Thread_local monkey_alloc_stats_t alloc_stats;
+
+void *
+monkey_object_alloc(monkey_object_type type, size_t size)
+{
+    void *obj;
+    alloc_stats.allocations[type]++;
+#ifndef OBJECT_NO_POOLS
+    if (size <= OBJECT_POOL_MAX_SIZE) {
+        object_pool_t *pool = &pools[pool_index(size)];
+        size_t class_size = (pool_index(size) + 1) * OBJECT_POOL_ALIGN;
+        if (pool->free_list != NULL) {
+            obj = pool->free_list;
+            pool->free_list = *(void **) obj;
+            alloc_stats.pool_hits[type]++;
+            return obj;
+        }
+        if (pool->slab_next == pool->slab_end) {
+            pool->slab_next = malloc(OBJECT_POOL_SLAB_SIZE);
+            if (pool->slab_next == NULL)
+                err(EXIT_FAILURE, "malloc failed");
+            pool->slab_end = pool->slab_next +
+                OBJECT_POOL_SLAB_SIZE / class_size * class_size;
+        }
+        obj = pool->slab_next;
+        pool->slab_next += class_size;
+        return obj;
+    }
+#endif
+    obj = malloc(size);
+    if (obj == NULL)
+        err(EXIT_FAILURE, "malloc failed");
+    return obj;
+}
+
+/*
+ * Takes the size the object was allocated with, it goes on the free list of
+ * the calling thread.
+ */
+void
+monkey_object_dealloc(void *obj, size_t size)
+{
+#ifndef OBJECT_NO_POOLS
+    if (size <= OBJECT_POOL_MAX_SIZE) {
+        object_pool_t *pool = &pools[pool_index(size)];
+        *(void **) obj = pool->free_list;
+        pool->free_list = obj;
+        return;
+    }
+#endif
+    free(obj);
+}
+
+/*
+ * The counters of the calling thread.
+ */
+const monkey_alloc_stats_t *
+get_monkey_alloc_stats(void)
+{
+    return &alloc_stats;
+}
+
 static char *
 monkey_function_inspect(monkey_object_t *obj)
 {
@@ -68,7 +145,7 @@ join_expressions_list(cm_array_list *list)
     int ret;
     for (size_t i = 0; i < list->length; i++) {
         elem = (monkey_object_t *) list->array[i];
-        elem_string = elem->inspect(elem);
+        elem_string = inspect(elem);
         if (string == NULL) {
             ret = asprintf(&temp, "%s", elem_string);
         } else {
@@ -103,8 +180,8 @@ join_expressions_table(cm_hash_table *table)
             entry_node = entry_node->next;
             key_obj = (monkey_object_t *) entry->key;
             value_obj = (monkey_object_t *) entry->value;
-            key_string = key_obj->inspect(key_obj);
-            value_string = value_obj->inspect(value_obj);
+            key_string = inspect(key_obj);
+            value_string = inspect(value_obj);
             if (string == NULL)
                 ret = asprintf(&temp, "%s: %s", key_string, value_string);
             else {
@@ -141,6 +218,9 @@ inspect(monkey_object_t *obj)
     char *elements_string = NULL;
     int ret;
 
+    if (is_tagged_int(obj))
+        return long_to_string(tagged_int_value(obj));
+
     switch (obj->type)
     {
         case MONKEY_INT:
@@ -239,8 +319,10 @@ monkey_object_equals(void *o1, void *o2)
 {
     monkey_object_t *obj1 = (monkey_object_t *) o1;
     monkey_object_t *obj2 = (monkey_object_t *) o2;
-    if (obj1->type != obj2->type)
+    if (get_monkey_object_type(obj1) != get_monkey_object_type(obj2))
         return false;
+    if (is_tagged_int(obj1) || is_tagged_int(obj2))
+        return get_monkey_int_value(obj1) == get_monkey_int_value(obj2);
 
     monkey_array_t *array1;
     monkey_array_t *array2;
@@ -325,6 +407,11 @@ monkey_object_hash(void *object)
     monkey_string_t *str_obj;
     monkey_int_t *int_obj;
     monkey_bool_t *bool_obj;
+    long int_value;
+    if (is_tagged_int(monkey_object)) {
+        int_value = tagged_int_value(monkey_object);
+        return int_hash_function(&int_value);
+    }
     switch (monkey_object->type) {
         case MONKEY_STRING:
             str_obj = (monkey_string_t *) object;
@@ -342,22 +429,21 @@ monkey_object_hash(void *object)
     }
 }
 
+/*
+ * Takes over the references to the free variables.
+ */
 monkey_closure_t *
-create_monkey_closure(monkey_compiled_fn_t *fn, cm_array_list *free_variables)
+create_monkey_closure(monkey_compiled_fn_t *fn, monkey_object_t **free_variables,
+    size_t free_variables_count)
 {
     monkey_closure_t *closure;
-    closure = malloc(sizeof(*closure));
-    if (closure == NULL)
-        err(EXIT_FAILURE, "malloc failed");
+    closure = monkey_object_alloc(MONKEY_CLOSURE,
+        sizeof(*closure) + free_variables_count * sizeof(*closure->free_variables));
     fn->object.refcount++;
     closure->fn = fn;
-    if (free_variables != NULL) {
-        for (size_t i = 0; i < free_variables->length; i++)
-            closure->free_variables[i] = (monkey_object_t *) free_variables->array[i];
-        closure->free_variables_count = free_variables->length;
-    } else {
-        closure->free_variables_count = 0;
-    }
+    for (size_t i = 0; i < free_variables_count; i++)
+        closure->free_variables[i] = free_variables[i];
+    closure->free_variables_count = free_variables_count;
     closure->object.inspect = inspect;
     closure->object.type = MONKEY_CLOSURE;
     closure->object.hash = NULL;
@@ -370,9 +456,7 @@ monkey_int_t *
 create_monkey_int(long value)
 {
     monkey_int_t *int_obj;
-    int_obj = malloc(sizeof(*int_obj));
-    if (int_obj == NULL)
-        err(EXIT_FAILURE, "malloc failed");
+    int_obj = monkey_object_alloc(MONKEY_INT, sizeof(*int_obj));
     int_obj->object.inspect = inspect;
     int_obj->object.type = MONKEY_INT;
     int_obj->object.hash = monkey_object_hash;
@@ -382,16 +466,32 @@ create_monkey_int(long value)
     return int_obj;
 }
 
+/*
+ * Returns a tagged integer when the value fits, otherwise falls back to a
+ * heap allocated monkey_int_t.
+ */
+monkey_object_t *
+create_monkey_int_value(long value)
+{
+    if (fits_tagged_int(value))
+        return tag_int(value);
+    return (monkey_object_t *) create_monkey_int(value);
+}
+
 monkey_compiled_fn_t *
 create_monkey_compiled_fn(instructions_t *ins, size_t num_locals, size_t num_args)
 {
     monkey_compiled_fn_t *compiled_fn;
-    compiled_fn = malloc(sizeof(*compiled_fn));
-    if (compiled_fn == NULL)
-        err(EXIT_FAILURE, "malloc failed");
+    compiled_fn = monkey_object_alloc(MONKEY_COMPILED_FUNCTION, sizeof(*compiled_fn));
     compiled_fn->instructions = ins;
     compiled_fn->num_locals = num_locals;
     compiled_fn->num_args = num_args;
+    compiled_fn->max_stack = 0;
+    compiled_fn->call_caches = NULL;
+    compiled_fn->calls = 0;
+    compiled_fn->jit_code = NULL;
+    compiled_fn->jit_size = 0;
+    compiled_fn->native_fn = NULL;
     compiled_fn->object.type = MONKEY_COMPILED_FUNCTION;
     compiled_fn->object.inspect = inspect;
     compiled_fn->object.equals = monkey_object_equals;
@@ -404,9 +504,7 @@ monkey_return_value_t *
 create_monkey_return_value(monkey_object_t *value)
 {
     monkey_return_value_t *ret;
-    ret = malloc(sizeof(*ret));
-    if (ret == NULL)
-        errx(EXIT_FAILURE, "malloc failed");
+    ret = monkey_object_alloc(MONKEY_RETURN_VALUE, sizeof(*ret));
     ret->value = value;
     ret->object.type = MONKEY_RETURN_VALUE;
     ret->object.inspect = inspect;
@@ -421,9 +519,7 @@ create_monkey_error(const char *fmt, ...)
 {
     monkey_error_t *error;
     char *message = NULL;
-    error = malloc(sizeof(*error));
-    if (error == NULL)
-        errx(EXIT_FAILURE, "malloc failed");
+    error = monkey_object_alloc(MONKEY_ERROR, sizeof(*error));
     error->object.type = MONKEY_ERROR;
     error->object.inspect = inspect;
     error->object.hash = NULL;
@@ -445,7 +541,7 @@ free_monkey_function_object(monkey_function_t *function_obj)
 {
     free_statement((statement_t *) function_obj->body);
     cm_list_free(function_obj->parameters, free_expression);
-    free(function_obj);
+    monkey_object_dealloc(function_obj, sizeof(*function_obj));
 }
 
 void
@@ -460,6 +556,8 @@ free_monkey_object(void *v)
     monkey_compiled_fn_t *compiled_fn;
     monkey_closure_t *closure;
 
+    if (is_tagged_int(object))
+        return;
     switch (object->type) {
         case MONKEY_BOOL:
         case MONKEY_NULL:
@@ -468,7 +566,7 @@ free_monkey_object(void *v)
         case MONKEY_INT:
             object->refcount--;
             if (object->refcount == 0)
-                free((monkey_int_t *) object);
+                monkey_object_dealloc(object, sizeof(monkey_int_t));
             break;    
         case MONKEY_ERROR:
             object->refcount--;
@@ -476,7 +574,7 @@ free_monkey_object(void *v)
                 break;
             err_obj = (monkey_error_t *) object;
             free(err_obj->message);
-            free(err_obj);
+            monkey_object_dealloc(err_obj, sizeof(*err_obj));
             break;
         case MONKEY_FUNCTION:
             object->refcount--;
@@ -488,14 +586,14 @@ free_monkey_object(void *v)
             return_value = (monkey_return_value_t *) object;
             free_monkey_object(return_value->value);
             if (object->refcount == 0)
-                free(return_value);
+                monkey_object_dealloc(return_value, sizeof(*return_value));
             break;
         case MONKEY_STRING:
             object->refcount--;
             if (object->refcount == 0) {
                 str_obj = (monkey_string_t *) object;
                 free(str_obj->value);
-                free(str_obj);
+                monkey_object_dealloc(str_obj, sizeof(*str_obj));
             }
             break;
         case MONKEY_ARRAY:
@@ -505,7 +603,7 @@ free_monkey_object(void *v)
                 free_monkey_object((monkey_object_t *) array->elements->array[i]);
             if (object->refcount == 0) {
                 cm_array_list_free(array->elements);
-                free(array);
+                monkey_object_dealloc(array, sizeof(*array));
             }
             break;
         case MONKEY_HASH:
@@ -523,7 +621,7 @@ free_monkey_object(void *v)
 
             if (object->refcount == 0) {
                 cm_hash_table_free(hash_obj->pairs);
-                free(hash_obj);
+                monkey_object_dealloc(hash_obj, sizeof(*hash_obj));
             }
             cm_array_list_free(keys);
             break;
@@ -532,7 +630,10 @@ free_monkey_object(void *v)
             if (object->refcount == 0) {
                 compiled_fn = (monkey_compiled_fn_t *) object;
                 instructions_free(compiled_fn->instructions);
-                free(compiled_fn);
+                free(compiled_fn->call_caches);
+                if (compiled_fn->jit_code != NULL)
+                    munmap(compiled_fn->jit_code, compiled_fn->jit_size);
+                monkey_object_dealloc(compiled_fn, sizeof(*compiled_fn));
             }
             break;
         case MONKEY_CLOSURE:
@@ -544,7 +645,8 @@ free_monkey_object(void *v)
                 free_monkey_object(free_var);
             }
             if (object->refcount == 0) {
-                free(closure);
+                monkey_object_dealloc(closure, sizeof(*closure) +
+                    closure->free_variables_count * sizeof(*closure->free_variables));
             }
             break;
         default:
@@ -564,6 +666,9 @@ copy_monkey_object(monkey_object_t *object)
     if (object == NULL)
         return (monkey_object_t *) create_monkey_null();
 
+    if (is_tagged_int(object))
+        return object;
+
     if (object->type == MONKEY_BOOL || object->type == MONKEY_NULL || object->type == MONKEY_BUILTIN)
         return object;
     
@@ -579,13 +684,15 @@ copy_monkey_object(monkey_object_t *object)
     if (object->type == MONKEY_HASH) {
         monkey_hash_t *hash = (monkey_hash_t *) object;
         cm_array_list *keys = cm_hash_table_get_keys(hash->pairs);
-        for (size_t i = 0; i < keys->length; i++) {
-            monkey_object_t *k = (monkey_object_t *) keys->array[i];
-            monkey_object_t *v = (monkey_object_t *) cm_hash_table_get(hash->pairs, (void *) k);
-            copy_monkey_object(v);
-            copy_monkey_object(k);
+        if (keys != NULL) {
+            for (size_t i = 0; i < keys->length; i++) {
+                monkey_object_t *k = (monkey_object_t *) keys->array[i];
+                monkey_object_t *v = (monkey_object_t *) cm_hash_table_get(hash->pairs, (void *) k);
+                copy_monkey_object(v);
+                copy_monkey_object(k);
+            }
+            cm_array_list_free(keys);
         }
-        cm_array_list_free(keys);
     }
 
     if (object->type == MONKEY_CLOSURE) {
@@ -603,9 +710,7 @@ monkey_function_t *
 create_monkey_function(cm_list *parameters, block_statement_t *body, environment_t *env)
 {
     monkey_function_t *function;
-    function = malloc(sizeof(*function));
-    if (function == NULL)
-        errx(EXIT_FAILURE, "malloc failed");
+    function = monkey_object_alloc(MONKEY_FUNCTION, sizeof(*function));
     function->parameters = copy_parameters(parameters);
     function->body = (block_statement_t *) copy_statement((statement_t *) body);
     function->env = env;
@@ -621,9 +726,7 @@ monkey_string_t *
 create_monkey_string(const char *value, size_t length)
 {
     monkey_string_t *string_obj;
-    string_obj = malloc(sizeof(*string_obj));
-    if (string_obj == NULL)
-        err(EXIT_FAILURE, "malloc failed");
+    string_obj = monkey_object_alloc(MONKEY_STRING, sizeof(*string_obj));
     if (value != NULL) {
         string_obj->value = malloc(sizeof(*value) * (length + 1));
         if (value == NULL)
@@ -662,9 +765,7 @@ create_monkey_builtin(builtin_fn function)
 monkey_array_t *
 create_monkey_array(cm_array_list *elements)
 {
-    monkey_array_t *array = malloc(sizeof(*array));
-    if (array == NULL)
-        errx(EXIT_FAILURE, "malloc failed");
+    monkey_array_t *array = monkey_object_alloc(MONKEY_ARRAY, sizeof(*array));
     array->object.type = MONKEY_ARRAY;
     array->object.inspect = inspect;
     array->object.hash = NULL;
@@ -677,9 +778,7 @@ create_monkey_array(cm_array_list *elements)
 monkey_hash_t *
 create_monkey_hash(cm_hash_table *pairs)
 {
-    monkey_hash_t *hash_obj = malloc(sizeof(*hash_obj));
-    if (hash_obj == NULL)
-        errx(EXIT_FAILURE, "malloc failed");
+    monkey_hash_t *hash_obj = monkey_object_alloc(MONKEY_HASH, sizeof(*hash_obj));
     hash_obj->object.type = MONKEY_HASH;
     hash_obj->object.inspect = inspect;
     hash_obj->object.hash = NULL;
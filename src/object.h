@@ -30,7 +30,9 @@
 #ifndef OBJECT_H
 #define OBJECT_H
 
+#include <limits.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include "ast.h"
 #include "environment.h"
 #include "opcode.h"
@@ -113,11 +115,25 @@ typedef struct monkey_string_t {
     size_t length;
 } monkey_string_t;
 
+/*
+ * Inline cache of a call site: the function of the closure last called from
+ * there. It holds no reference to it.
+ */
+typedef struct call_cache_t {
+    struct monkey_compiled_fn_t *fn;
+} call_cache_t;
+
 typedef struct monkey_compiled_fn_t {
     monkey_object_t object;
     instructions_t *instructions;
     size_t num_locals;
     size_t num_args;
+    size_t max_stack; // deepest the operand stack gets, set by the verifier
+    call_cache_t *call_caches; // indexed by instruction offset, allocated on first call
+    size_t calls; // counted toward compiling it to machine code
+    void *jit_code; // the machine code, see jit.h
+    size_t jit_size;
+    void *native_fn; // the C monkeyc --emit-c translated it to, see native.h
 } monkey_compiled_fn_t;
 
 typedef monkey_object_t * (*builtin_fn) (cm_list *);
@@ -137,13 +153,36 @@ typedef struct monkey_hash_t {
     cm_hash_table *pairs;
 } monkey_hash_t;
 
+/*
+ * A closure is allocated with room for exactly the variables it captures.
+ */
 typedef struct monkey_closure_t {
     monkey_object_t object;
     monkey_compiled_fn_t *fn;
-    monkey_object_t *free_variables[MAX_FREE_VARIABLES];
     size_t free_variables_count;
+    monkey_object_t *free_variables[];
 } monkey_closure_t;
 
+/*
+ * Objects are carved out of per size class slabs and recycled through free
+ * lists local to the allocating thread instead of going back to malloc.
+ * Objects larger than OBJECT_POOL_MAX_SIZE (closures capturing many
+ * variables) are malloc'ed. Building with -DOBJECT_NO_POOLS makes every
+ * allocation a malloc, e.g. for hunting use after free bugs with ASan.
+ */
+#define OBJECT_POOL_ALIGN 16
+#define OBJECT_POOL_MAX_SIZE 256
+#define OBJECT_POOL_SLAB_SIZE 16384
+
+typedef struct monkey_alloc_stats_t {
+    size_t allocations[MONKEY_CLOSURE + 1]; // by object type
+    size_t pool_hits[MONKEY_CLOSURE + 1]; // allocations reusing a freed object
+} monkey_alloc_stats_t;
+
+void *monkey_object_alloc(monkey_object_type, size_t);
+void monkey_object_dealloc(void *, size_t);
+const monkey_alloc_stats_t *get_monkey_alloc_stats(void);
+
 char *inspect(monkey_object_t *);
 _Bool monkey_object_equals(void *, void *);
 size_t monkey_object_hash(void *); // non-static for tests
@@ -152,11 +191,30 @@ extern const monkey_bool_t MONKEY_TRUE_OBJ;
 extern const monkey_bool_t MONKEY_FALSE_OBJ;
 extern const monkey_null_t MONKEY_NULL_OBJ;
 
-#define create_monkey_bool(val) ((val == true) ? ((monkey_bool_t *)&MONKEY_TRUE_OBJ): ((monkey_bool_t *)&MONKEY_FALSE_OBJ))
+/*
+ * Integers which fit in 63 bits can be stored directly in the object
+ * pointer, with the lowest bit set as the tag. Such tagged integers are not
+ * heap allocated and carry no refcount, similar to the true/false/null
+ * singletons above. All the code which may see them (the vm, builtins and
+ * the generic object functions) must use get_monkey_object_type and
+ * get_monkey_int_value instead of dereferencing the pointer.
+ */
+#define MONKEY_INT_TAG ((uintptr_t) 1)
+#define MONKEY_TAGGED_INT_MAX (LONG_MAX >> 1)
+#define MONKEY_TAGGED_INT_MIN (LONG_MIN >> 1)
+#define is_tagged_int(obj) ((((uintptr_t) (obj)) & MONKEY_INT_TAG) != 0)
+#define tagged_int_value(obj) (((intptr_t) (obj)) >> 1)
+#define tag_int(val) ((monkey_object_t *) ((((uintptr_t) (val)) << 1) | MONKEY_INT_TAG))
+#define fits_tagged_int(val) ((val) >= MONKEY_TAGGED_INT_MIN && (val) <= MONKEY_TAGGED_INT_MAX)
+#define get_monkey_object_type(obj) (is_tagged_int(obj)? MONKEY_INT: ((monkey_object_t *) (obj))->type)
+#define get_monkey_int_value(obj) (is_tagged_int(obj)? tagged_int_value(obj): ((monkey_int_t *) (obj))->value)
+
+#define create_monkey_bool(val) (((val) == true) ? ((monkey_bool_t *)&MONKEY_TRUE_OBJ): ((monkey_bool_t *)&MONKEY_FALSE_OBJ))
 #define create_monkey_null() (&MONKEY_NULL_OBJ)
 
 
 monkey_int_t * create_monkey_int(long);
+monkey_object_t *create_monkey_int_value(long);
 monkey_bool_t *get_monkey_true(void);
 monkey_object_t *copy_monkey_object(monkey_object_t *);
 monkey_return_value_t *create_monkey_return_value(monkey_object_t *);
@@ -167,7 +225,7 @@ monkey_builtin_t *create_monkey_builtin(builtin_fn);
 monkey_array_t *create_monkey_array(cm_array_list *);
 monkey_hash_t *create_monkey_hash(cm_hash_table *);
 monkey_compiled_fn_t *create_monkey_compiled_fn(instructions_t *, size_t, size_t);
-monkey_closure_t *create_monkey_closure(monkey_compiled_fn_t *fn, cm_array_list *);
+monkey_closure_t *create_monkey_closure(monkey_compiled_fn_t *, monkey_object_t **, size_t);
 void free_monkey_object(void *);
 
 #endif
@@ -18,13 +18,13 @@ test_boolean_object(monkey_object_t *object, _Bool expected_value)
 void
 test_integer_object(monkey_object_t *object, long expected_value)
 {
-    test(object->type == MONKEY_INT, "Expected object of type %s, got %s\n",
-        get_type_name(MONKEY_INT), get_type_name(object->type));
+    test(get_monkey_object_type(object) == MONKEY_INT, "Expected object of type %s, got %s\n",
+        get_type_name(MONKEY_INT), get_type_name(get_monkey_object_type(object)));
     
-    monkey_int_t *int_obj = (monkey_int_t *) object;
-    test(int_obj->value == expected_value,
+    long value = get_monkey_int_value(object);
+    test(value == expected_value,
         "Expected integer object value to be %ld, found %ld\n",
-        expected_value, int_obj->value);
+        expected_value, value);
 }
 
 void
@@ -49,8 +49,8 @@ test_string_object(monkey_object_t *obj, char *expected_value, size_t expected_l
 void
 test_monkey_object(monkey_object_t *obj, monkey_object_t *expected)
 {
-    test(obj->type == expected->type, "Expected object of type %s, got %s\n",
-        get_type_name(expected->type), get_type_name(obj->type));
+    test(get_monkey_object_type(obj) == expected->type, "Expected object of type %s, got %s\n",
+        get_type_name(expected->type), get_type_name(get_monkey_object_type(obj)));
     if (expected->type == MONKEY_INT)
         test_integer_object(obj, ((monkey_int_t *) expected)->value);
     else if (expected->type == MONKEY_BOOL)
@@ -119,7 +119,7 @@ test_hash_object(monkey_object_t *actual, monkey_object_t *expected)
             monkey_object_t *key = cm_array_list_get(expected_keys, i);
             monkey_object_t *expected_value = (monkey_object_t *) cm_hash_table_get(expected_hash->pairs, key);
             monkey_object_t *actual_value = (monkey_object_t *) cm_hash_table_get(actual_hash->pairs, key);
-            char *key_string = key->inspect(key);
+            char *key_string = inspect(key);
             test(actual_value != NULL, "No value found for key %s in hash\n", key_string);
             test_monkey_object(actual_value, expected_value);
             free(key_string);
@@ -27,6 +27,8 @@
  * SUCH DAMAGE.
  */
 
+#include <string.h>
+
 #include "object.h"
 #include "test_utils.h"
 
@@ -61,8 +63,85 @@ test_string_hash_key(void)
     free_monkey_object(diff2);
 }
 
+static void
+test_tagged_integers(void)
+{
+    print_test_separator_line();
+    printf("Testing tagged integer objects\n");
+    long values[] = {0, 1, -1, 42, MONKEY_TAGGED_INT_MAX, MONKEY_TAGGED_INT_MIN};
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        monkey_object_t *tagged = create_monkey_int_value(values[i]);
+        monkey_int_t *boxed = create_monkey_int(values[i]);
+        test(is_tagged_int(tagged), "Expected %ld to be stored as a tagged integer\n", values[i]);
+        test(get_monkey_object_type(tagged) == MONKEY_INT, "Expected type %s, got %s\n",
+            get_type_name(MONKEY_INT), get_type_name(get_monkey_object_type(tagged)));
+        test(get_monkey_int_value(tagged) == values[i], "Expected value %ld, got %ld\n",
+            values[i], get_monkey_int_value(tagged));
+        test(monkey_object_equals(tagged, boxed), "Expected tagged and boxed %ld to be equal\n",
+            values[i]);
+        test(monkey_object_hash(tagged) == monkey_object_hash(boxed),
+            "Expected tagged and boxed %ld to have the same hash\n", values[i]);
+        test(copy_monkey_object(tagged) == tagged, "Expected copy of a tagged integer to be itself\n");
+        free_monkey_object(tagged);
+        free_monkey_object(boxed);
+    }
+
+    monkey_object_t *big = create_monkey_int_value(LONG_MAX);
+    test(!is_tagged_int(big), "Expected %ld to be boxed\n", LONG_MAX);
+    test(get_monkey_int_value(big) == LONG_MAX, "Expected value %ld, got %ld\n",
+        LONG_MAX, get_monkey_int_value(big));
+    free_monkey_object(big);
+}
+
+static void
+test_object_pools(void)
+{
+    print_test_separator_line();
+    printf("Testing object pools\n");
+    const monkey_alloc_stats_t *stats = get_monkey_alloc_stats();
+    size_t allocations = stats->allocations[MONKEY_STRING];
+
+    monkey_string_t *first = create_monkey_string("pooled", 6);
+    size_t hits = stats->pool_hits[MONKEY_STRING];
+    free_monkey_object(first);
+    monkey_string_t *second = create_monkey_string("again", 5);
+    test(stats->allocations[MONKEY_STRING] == allocations + 2,
+        "Expected %zu string allocations, got %zu\n", allocations + 2,
+        stats->allocations[MONKEY_STRING]);
+#ifndef OBJECT_NO_POOLS
+    test(stats->pool_hits[MONKEY_STRING] == hits + 1,
+        "Expected %zu string pool hits, got %zu\n", hits + 1,
+        stats->pool_hits[MONKEY_STRING]);
+    test(second == first, "Expected the freed string to be reused\n");
+#endif
+    test(strcmp(second->value, "again") == 0, "Expected again, got %s\n", second->value);
+    free_monkey_object(second);
+
+    /* closures are pooled by the number of variables they capture */
+    monkey_compiled_fn_t *fn = create_monkey_compiled_fn(NULL, 0, 0);
+    monkey_object_t *free_variables[64];
+    for (size_t i = 0; i < 64; i++)
+        free_variables[i] = create_monkey_int_value(i);
+    monkey_closure_t *small = create_monkey_closure(fn, free_variables, 2);
+    monkey_closure_t *large = create_monkey_closure(fn, free_variables, 64);
+    test(large->free_variables[63] == free_variables[63],
+        "Expected the last free variable of a large closure to be kept\n");
+    free_monkey_object(small);
+    free_monkey_object(large);
+    hits = stats->pool_hits[MONKEY_CLOSURE];
+    small = create_monkey_closure(fn, free_variables, 2);
+#ifndef OBJECT_NO_POOLS
+    test(stats->pool_hits[MONKEY_CLOSURE] == hits + 1,
+        "Expected the small closure to come from the pool\n");
+#endif
+    free_monkey_object(small);
+    free_monkey_object(fn);
+}
+
 int
 main(int argc, char **argv)
 {
     test_string_hash_key();
+    test_tagged_integers();
+    test_object_pools();
 }
\ No newline at end of file
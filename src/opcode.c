@@ -36,83 +36,97 @@
 #include "cmonkey_utils.h"
 #include "opcode.h"
 
+/*
+ * Writes an operand big endian into the width bytes at bytes.
+ */
+void
+encode_operand(uint8_t *bytes, size_t operand, size_t width)
+{
+    for (size_t i = width; i > 0; i--) {
+        bytes[i - 1] = operand & 0xff;
+        operand >>= 8;
+    }
+}
+
+/*
+ * Appends an instruction to ins, encoding its operands straight into the
+ * buffer, and returns the position it starts at. The buffer grows
+ * geometrically, so that emitting n bytes costs O(n) and a handful of
+ * reallocations.
+ */
+size_t
+vinstructions_append(instructions_t *ins, opcode_t op, va_list ap)
+{
+    opcode_definition_t op_def;
+    size_t pos = ins->length, length, offset = 1;
+    if (!is_valid_opcode(op))
+        errx(EXIT_FAILURE, "Unsupported opcode %d", op);
+    op_def = opcode_definition_lookup(op);
+    length = get_instruction_length(op);
+    if (ins->size - ins->length < length) {
+        ins->size = ins->size * 2 + length;
+        ins->bytes = reallocarray(ins->bytes, ins->size, sizeof(*ins->bytes));
+        if (ins->bytes == NULL)
+            err(EXIT_FAILURE, "malloc failed");
+    }
+    ins->bytes[pos] = op;
+    for (size_t i = 0; i < MAX_OPERANDS && op_def.operand_widths[i] != 0; i++) {
+        encode_operand(ins->bytes + pos + offset, va_arg(ap, size_t), op_def.operand_widths[i]);
+        offset += op_def.operand_widths[i];
+    }
+    ins->length += length;
+    return pos;
+}
+
+size_t
+instructions_append(instructions_t *ins, opcode_t op, ...)
+{
+    va_list ap;
+    va_start(ap, op);
+    size_t pos = vinstructions_append(ins, op, ap);
+    va_end(ap);
+    return pos;
+}
+
+/*
+ * Rewrites the first operand of the instruction at pos in place.
+ */
+void
+instructions_patch_operand(instructions_t *ins, size_t pos, size_t operand)
+{
+    opcode_definition_t op_def = opcode_definition_lookup(ins->bytes[pos]);
+    encode_operand(ins->bytes + pos + 1, operand, op_def.operand_widths[0]);
+}
+
 instructions_t *
 vinstruction_init(opcode_t op, va_list ap)
 {
     instructions_t *ins;
-    size_t operand;
-    opcode_definition_t op_def;
     ins = malloc(sizeof(*ins));
     if (ins == NULL)
         err(EXIT_FAILURE, "malloc failed");
-    switch (op) {
-    case OPCONSTANT:
-    case OPJMPFALSE:
-    case OPJMP:
-    case OPSETGLOBAL:
-    case OPGETGLOBAL:
-    case OPARRAY:
-    case OPHASH:
-        // these opcodes need only one operand 2 bytes wide
-        operand = va_arg(ap, size_t);
-        uint8_t *boperand = size_t_to_uint8_be(operand, 2);
-        ins->bytes = create_uint8_array(3, op, boperand[0], boperand[1]);
-        ins->length = 3;
-        ins->size = 3;
-        free(boperand);
-        return ins;
-    case OPSETLOCAL:
-    case OPGETLOCAL:
-    case OPCALL:
-    case OPGETBUILTIN:
-    case OPGETFREE:
-        operand = va_arg(ap, size_t);
-        boperand = size_t_to_uint8_be(operand, 1);
-        ins->bytes = create_uint8_array(2, op, boperand[0]);
-        ins->length = 2;
-        ins->size = 2;
-        free(boperand);
-        return ins;
-    case OPCLOSURE:
-        operand = va_arg(ap, size_t);
-        boperand = size_t_to_uint8_be(operand, 2);
-        ins->bytes = create_uint8_array(4, op, boperand[0], boperand[1], 0);
-        free(boperand);
-        operand = va_arg(ap, size_t);
-        boperand = size_t_to_uint8_be(operand, 1);
-        ins->bytes[3] = boperand[0];
-        ins->size = 4;
-        ins->length = 4;
-        free(boperand);
-        return ins;
-    case OPADD:
-    case OPSUB:
-    case OPMUL:
-    case OPDIV:
-    case OPPOP:
-    case OPTRUE:
-    case OPFALSE:
-    case OPGREATERTHAN:
-    case OPEQUAL:
-    case OPNOTEQUAL:
-    case OPMINUS:
-    case OPBANG:
-    case OPNULL:
-    case OPINDEX:
-    case OPRETURNVALUE:
-    case OPRETURN:
-    case OPCURRENTCLOSURE:
-        ins->bytes = create_uint8_array(1, op);
-        ins->length = 1;
-        ins->size = 1;
-        return ins;
-    default:
-        op_def = opcode_definition_lookup(op);
-        errx(EXIT_FAILURE, "Unsupported opcode %s", op_def.name);
-    }
+    ins->bytes = NULL;
+    ins->length = 0;
+    ins->size = 0;
+    ins->mapped = false;
+    vinstructions_append(ins, op, ap);
     return ins;
 }
 
+/*
+ * Returns the size in bytes of an instruction with the given opcode,
+ * including its operands.
+ */
+size_t
+get_instruction_length(opcode_t op)
+{
+    opcode_definition_t op_def = opcode_definition_lookup(op);
+    size_t length = 1;
+    for (size_t i = 0; i < MAX_OPERANDS && op_def.operand_widths[i] != 0; i++)
+        length += op_def.operand_widths[i];
+    return length;
+}
+
 instructions_t *
 instruction_init(opcode_t op, ...)
 {
@@ -137,7 +151,8 @@ copy_instructions(instructions_t *ins)
     // for (size_t i = 0; i < ins->length; i++)
         // ret->bytes[i] = ins->bytes[i];
     ret->length = ins->length;
-    ret->size = ins->size;
+    ret->size = ins->length;
+    ret->mapped = false;
     return ret;
 }
 
@@ -151,6 +166,8 @@ flatten_instructions(size_t n, instructions_t *ins_array[n])
         bytes_len += ins_array[i]->length;
 
     bytes = malloc(sizeof(*bytes) * bytes_len);
+    if (bytes == NULL)
+        err(EXIT_FAILURE, "malloc failed");
     size_t bytes_offset = 0;
     for (size_t i = 0; i < n; i++) {
         instructions_t *ins = ins_array[i];
@@ -162,6 +179,8 @@ flatten_instructions(size_t n, instructions_t *ins_array[n])
         err(EXIT_FAILURE, "malloc failed");
     flat_ins->bytes = bytes;
     flat_ins->length = bytes_len;
+    flat_ins->size = bytes_len;
+    flat_ins->mapped = false;
     return flat_ins;
 }
 
@@ -171,7 +190,7 @@ instructions_free(instructions_t *ins)
 {
     if (ins == NULL)
         return;
-    if (ins->bytes)
+    if (ins->bytes && !ins->mapped)
         free(ins->bytes);
     free(ins);
 }
@@ -211,6 +230,7 @@ instructions_to_string(instructions_t *instructions)
         case OPSETLOCAL:
         case OPGETLOCAL:
         case OPCALL:
+        case OPTAILCALL:
         case OPGETBUILTIN:
         case OPGETFREE:
             operand = be_to_size_t_1(instructions->bytes + i + 1);
@@ -262,9 +282,13 @@ instructions_to_string(instructions_t *instructions)
         case OPSUB:
         case OPMUL:
         case OPDIV:
+        case OPMOD:
         case OPTRUE:
         case OPFALSE:
         case OPGREATERTHAN:
+        case OPLESSTHAN:
+        case OPLESSEQUAL:
+        case OPGREATEREQUAL:
         case OPEQUAL:
         case OPNOTEQUAL:
         case OPMINUS:
@@ -274,6 +298,32 @@ instructions_to_string(instructions_t *instructions)
         case OPRETURN:
         case OPRETURNVALUE:
         case OPCURRENTCLOSURE:
+        case OPADDINT:
+        case OPSUBINT:
+        case OPMULINT:
+        case OPEQUALINT:
+        case OPNOTEQUALINT:
+        case OPGREATERTHANINT:
+        case OPLESSTHANINT:
+        case OPLESSEQUALINT:
+        case OPGREATEREQUALINT:
+            if (string == NULL) {
+                int retval = asprintf(&string, "%04zu %s", i, op_def.name);
+                if (retval == -1)
+                    err(EXIT_FAILURE, "malloc failed");
+            } else {
+                char *temp = NULL;
+                int retval = asprintf(&temp, "%s\n%04zu %s", string, i, op_def.name);
+                if (retval == -1)
+                    err(EXIT_FAILURE, "malloc failed");
+                free(string);
+                string = temp;
+            }
+            break;
+        case OPLOCALCONSTADD:
+        case OPLOCALCONSTSUB:
+        case OPLOCALCONSTEQUALJMPFALSE:
+        case OPGLOBALLOCALCALL:
             if (string == NULL) {
                 int retval = asprintf(&string, "%04zu %s", i, op_def.name);
                 if (retval == -1)
@@ -286,6 +336,16 @@ instructions_to_string(instructions_t *instructions)
                 free(string);
                 string = temp;
             }
+            for (size_t j = 0; j < MAX_OPERANDS && op_def.operand_widths[j] != 0; j++) {
+                char *temp = NULL;
+                operand = decode_instructions_to_sizet(instructions->bytes + i + 1, op_def.operand_widths[j]);
+                int retval = asprintf(&temp, "%s %zu", string, operand);
+                if (retval == -1)
+                    err(EXIT_FAILURE, "malloc failed");
+                free(string);
+                string = temp;
+                i += op_def.operand_widths[j];
+            }
             break;
         case OPPOP:
             if (string == NULL) {
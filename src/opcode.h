@@ -40,6 +40,7 @@ typedef struct instructions_t {
     uint8_t *bytes;
     size_t length;
     size_t size;
+    _Bool mapped; // bytes point into a mapped bytecode file and are not freed
 } instructions_t;
 
 typedef enum opcode_t {
@@ -72,7 +73,27 @@ typedef enum opcode_t {
     OPGETBUILTIN,
     OPCLOSURE,
     OPGETFREE,
-    OPCURRENTCLOSURE
+    OPCURRENTCLOSURE,
+    OPTAILCALL,
+    OPMOD,
+    OPLESSTHAN,
+    OPLESSEQUAL,
+    OPGREATEREQUAL,
+    /* superinstructions produced by peephole_optimize */
+    OPLOCALCONSTADD,
+    OPLOCALCONSTSUB,
+    OPLOCALCONSTEQUALJMPFALSE,
+    OPGLOBALLOCALCALL,
+    /* integer specialized forms the vm rewrites the generic opcodes into */
+    OPADDINT,
+    OPSUBINT,
+    OPMULINT,
+    OPEQUALINT,
+    OPNOTEQUALINT,
+    OPGREATERTHANINT,
+    OPLESSTHANINT,
+    OPLESSEQUALINT,
+    OPGREATEREQUALINT
 } opcode_t;
 
 typedef struct opcode_definition_t {
@@ -112,15 +133,40 @@ static opcode_definition_t opcode_definitions [] = {
     {"OPGETBUILTIN", "get_builtin", {(size_t) 1}},
     {"OPCLOSURE", "closure", {(size_t) 2, (size_t) 1}},
     {"OPGETFREE", "get_free", {(size_t) 1}},
-    {"OPCURRENTCLOSURE", "current_closure", {(size_t) 0}}
+    {"OPCURRENTCLOSURE", "current_closure", {(size_t) 0}},
+    {"OPTAILCALL", "tail_call", {(size_t) 1}},
+    {"OPMOD", "%", {(size_t) 0}},
+    {"OPLESSTHAN", "<", {(size_t) 0}},
+    {"OPLESSEQUAL", "<=", {(size_t) 0}},
+    {"OPGREATEREQUAL", ">=", {(size_t) 0}},
+    {"OPLOCALCONSTADD", "local_const_add", {(size_t) 1, (size_t) 2}},
+    {"OPLOCALCONSTSUB", "local_const_sub", {(size_t) 1, (size_t) 2}},
+    {"OPLOCALCONSTEQUALJMPFALSE", "local_const_equal_jump_if_false", {(size_t) 1, (size_t) 2, (size_t) 2}},
+    {"OPGLOBALLOCALCALL", "global_local_call", {(size_t) 2, (size_t) 1}},
+    {"OPADDINT", "+", {(size_t) 0}},
+    {"OPSUBINT", "-", {(size_t) 0}},
+    {"OPMULINT", "*", {(size_t) 0}},
+    {"OPEQUALINT", "==", {(size_t) 0}},
+    {"OPNOTEQUALINT", "!=", {(size_t) 0}},
+    {"OPGREATERTHANINT", ">", {(size_t) 0}},
+    {"OPLESSTHANINT", "<", {(size_t) 0}},
+    {"OPLESSEQUALINT", "<=", {(size_t) 0}},
+    {"OPGREATEREQUALINT", ">=", {(size_t) 0}}
 };
 
 #define opcode_definition_lookup(op) opcode_definitions[op - 1];
+#define is_valid_opcode(op) ((op) != 0 && \
+    (op) <= sizeof(opcode_definitions) / sizeof(opcode_definitions[0]))
 #define decode_instructions_to_sizet(bytes, nbytes) nbytes == 1? (bytes)[0]: be_to_size_t(bytes, nbytes)
 
 instructions_t *instruction_init(opcode_t, ...);
 instructions_t *vinstruction_init(opcode_t, va_list);
+size_t instructions_append(instructions_t *, opcode_t, ...);
+size_t vinstructions_append(instructions_t *, opcode_t, va_list);
+void instructions_patch_operand(instructions_t *, size_t, size_t);
+void encode_operand(uint8_t *, size_t, size_t);
 void instructions_free(instructions_t *);
+size_t get_instruction_length(opcode_t);
 char *instructions_to_string(instructions_t *);
 instructions_t * flatten_instructions(size_t n, instructions_t *ins_array[n]);
 void concat_instructions(instructions_t *, instructions_t *);
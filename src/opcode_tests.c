@@ -76,6 +76,24 @@ test_instruction_init(void)
             OPCLOSURE, {(size_t) 65534, (size_t) 255},
             4,
             create_uint8_array(4, OPCLOSURE, 255, 254, 255)
+        },
+        {
+            "Test OPLOCALCONSTSUB 255 65534",
+            OPLOCALCONSTSUB, {(size_t) 255, (size_t) 65534},
+            4,
+            create_uint8_array(4, OPLOCALCONSTSUB, 255, 255, 254)
+        },
+        {
+            "Test OPLOCALCONSTEQUALJMPFALSE 1 2 65534",
+            OPLOCALCONSTEQUALJMPFALSE, {(size_t) 1, (size_t) 2, (size_t) 65534},
+            6,
+            create_uint8_array(6, OPLOCALCONSTEQUALJMPFALSE, 1, 0, 2, 255, 254)
+        },
+        {
+            "Test OPGLOBALLOCALCALL 65534 3",
+            OPGLOBALLOCALCALL, {(size_t) 65534, (size_t) 3},
+            4,
+            create_uint8_array(4, OPGLOBALLOCALCALL, 255, 254, 3)
         }
     };
     print_test_separator_line();
@@ -86,10 +104,7 @@ test_instruction_init(void)
         test t = test_cases[i];
         printf("%s\n", t.desc);
         instructions_t *actual;
-        if (t.op != OPCLOSURE)
-            actual = instruction_init(t.op, t.operands[0]);
-        else
-            actual = instruction_init(t.op, t.operands[0], t.operands[1]);
+        actual = instruction_init(t.op, t.operands[0], t.operands[1], t.operands[2]);
         size_t actual_len = actual->length;
         size_t expected_len = t.expected_instructions_len;
         test(actual_len == expected_len, "Expected instruction length %zu, found %zu\n", expected_len, actual_len);
@@ -102,21 +117,23 @@ test_instruction_init(void)
 static void
 test_instructions_string(void)
 {
-    instructions_t *ins_array[5] = {
+    instructions_t *ins_array[6] = {
         instruction_init(OPADD),
         instruction_init(OPCONSTANT, 2),
         instruction_init(OPCONSTANT, 65535),
         instruction_init(OPGETLOCAL, 1),
-        instruction_init(OPCLOSURE, 65535, 255)
+        instruction_init(OPCLOSURE, 65535, 255),
+        instruction_init(OPLOCALCONSTEQUALJMPFALSE, 1, 2, 65535)
     };
 
     const char *expected_string = "0000 OPADD\n" \
         "0001 OPCONSTANT 2\n" \
         "0004 OPCONSTANT 65535\n" \
         "0007 OPGETLOCAL 1\n" \
-        "0009 OPCLOSURE 65535 255";
+        "0009 OPCLOSURE 65535 255\n" \
+        "0013 OPLOCALCONSTEQUALJMPFALSE 1 2 65535";
     
-    instructions_t *flat_ins = flatten_instructions(5, ins_array);
+    instructions_t *flat_ins = flatten_instructions(6, ins_array);
     char *string = instructions_to_string(flat_ins);
     print_test_separator_line();
     printf("Testing instructions_to_string\n");
@@ -128,6 +145,28 @@ test_instructions_string(void)
     instructions_free(ins_array[2]);
     instructions_free(ins_array[3]);
     instructions_free(ins_array[4]);
+    instructions_free(ins_array[5]);
+}
+
+static void
+test_instructions_append(void)
+{
+    instructions_t ins = {NULL, 0, 0};
+    uint8_t expected[] = {OPJMPFALSE, 1, 2, OPPOP, OPCLOSURE, 0, 3, 4, OPJMP, 0, 7};
+    print_test_separator_line();
+    printf("Testing instructions append and patch\n");
+    size_t jmpfalse_pos = instructions_append(&ins, OPJMPFALSE, 9999);
+    instructions_append(&ins, OPPOP);
+    instructions_append(&ins, OPCLOSURE, 3, 4);
+    size_t jmp_pos = instructions_append(&ins, OPJMP, 9999);
+    test(jmpfalse_pos == 0 && jmp_pos == 8, "Expected positions 0 and 8, found %zu and %zu\n",
+        jmpfalse_pos, jmp_pos);
+    instructions_patch_operand(&ins, jmpfalse_pos, 258);
+    instructions_patch_operand(&ins, jmp_pos, 7);
+    test(ins.length == sizeof(expected), "Expected length %zu, found %zu\n", sizeof(expected), ins.length);
+    test(ins.size >= ins.length, "Buffer size %zu smaller than length %zu\n", ins.size, ins.length);
+    test_instructions(ins.length, expected, ins.bytes);
+    free(ins.bytes);
 }
 
 int
@@ -135,5 +174,6 @@ main(int argc, char **argv)
 {
     test_instruction_init();
     test_instructions_string();
+    test_instructions_append();
     return 0;
 }
\ No newline at end of file
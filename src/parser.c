@@ -68,6 +68,8 @@ static expression_t * parse_index_expression(parser_t *, expression_t *);
      NULL, //PERCENT
      NULL, //LT
      NULL, //GT
+     NULL, //LT_EQ
+     NULL, //GT_EQ
      NULL, //EQ
      NULL, //NOT_EQ
      NULL, // AND
@@ -106,6 +108,8 @@ static expression_t * parse_index_expression(parser_t *, expression_t *);
      parse_infix_expression, // PERCENT
      parse_infix_expression, //LT
      parse_infix_expression, //GT
+     parse_infix_expression, //LT_EQ
+     parse_infix_expression, //GT_EQ
      parse_infix_expression, //EQ
      parse_infix_expression, //NOT_EQ
      parse_infix_expression, //AND
@@ -159,6 +163,8 @@ precedence(token_type tok_type)
            return EQUALS;
         case LT:
         case GT:
+        case LT_EQ:
+        case GT_EQ:
             return LESSGREATER;
         case PLUS:
         case MINUS:
@@ -638,18 +644,105 @@ program_string(void *prog_ptr)
     return prog_string;
 }
 
+/*
+ * AST allocation helpers. When the parser has an arena every node, token,
+ * literal and list of the program is bump allocated out of it and
+ * program_free releases them all at once, otherwise they come from malloc
+ * and are freed node by node.
+ */
+static void *
+parser_alloc(parser_t *parser, size_t size)
+{
+    void *p;
+    if (parser->arena != NULL)
+        return cm_arena_alloc(parser->arena, size);
+    p = malloc(size);
+    if (p == NULL)
+        errx(EXIT_FAILURE, "malloc failed");
+    return p;
+}
+
+static char *
+parser_strdup(parser_t *parser, const char *s)
+{
+    char *copy;
+    if (parser->arena != NULL)
+        return cm_arena_strdup(parser->arena, s);
+    copy = strdup(s);
+    if (copy == NULL)
+        errx(EXIT_FAILURE, "malloc failed");
+    return copy;
+}
+
+static token_t *
+parser_token_copy(parser_t *parser, token_t *tok)
+{
+    token_t *copy;
+    if (parser->arena == NULL) {
+        copy = token_copy(tok);
+        if (copy == NULL)
+            errx(EXIT_FAILURE, "malloc failed");
+        return copy;
+    }
+    copy = cm_arena_alloc(parser->arena, sizeof(*copy));
+    copy->type = tok->type;
+    copy->literal = cm_arena_strdup(parser->arena, tok->literal);
+    return copy;
+}
+
+static cm_list *
+parser_list_init(parser_t *parser)
+{
+    if (parser->arena != NULL)
+        return cm_list_init_arena(parser->arena);
+    return cm_list_init();
+}
+
+static statement_t **
+grow_statements(parser_t *parser, statement_t **statements, size_t old_size, size_t new_size)
+{
+    if (parser->arena != NULL)
+        return cm_arena_realloc(parser->arena, statements,
+            old_size * sizeof(*statements), new_size * sizeof(*statements));
+    return reallocarray(statements, new_size, sizeof(*statements));
+}
+
+/*
+ * Nodes dropped because of a parse error only need to be freed when they
+ * were malloc'ed, arena nodes go away with the rest of the program.
+ */
+static void
+discard_expression(parser_t *parser, expression_t *exp)
+{
+    if (parser->arena == NULL)
+        free_expression(exp);
+}
+
+static void
+discard_statement(parser_t *parser, statement_t *stmt)
+{
+    if (parser->arena == NULL)
+        free_statement(stmt);
+}
+
+static void
+cleanup_hash_table(void *table)
+{
+    cm_hash_table_free((cm_hash_table *) table);
+}
+
+static void
+cleanup_array_list(void *list)
+{
+    cm_array_list_free((cm_array_list *) list);
+}
+
 static letstatement_t *
 create_letstatement(parser_t *parser)
 {
     letstatement_t *let_stmt;
-    let_stmt = malloc(sizeof(*let_stmt));
-    if (let_stmt == NULL)
-        errx(EXIT_FAILURE, "malloc failed");
-    let_stmt->token = token_copy(parser->cur_tok);
-    if (let_stmt->token == NULL) {
-        free(let_stmt);
-        errx(EXIT_FAILURE, "malloc failed");
-    }
+    let_stmt = parser_alloc(parser, sizeof(*let_stmt));
+    let_stmt->token = parser_token_copy(parser, parser->cur_tok);
     let_stmt->statement.statement_type = LET_STATEMENT;
     let_stmt->statement.node.token_literal = letstatement_token_literal;
     let_stmt->statement.node.string = letstatement_string;
@@ -663,14 +756,8 @@ static return_statement_t *
 create_return_statement(parser_t *parser)
 {
     return_statement_t *ret_stmt;
-    ret_stmt = malloc(sizeof(*ret_stmt));
-    if (ret_stmt == NULL)
-        errx(EXIT_FAILURE, "malloc failed");
-    ret_stmt->token = token_copy(parser->cur_tok);
-    if (ret_stmt->token == NULL) {
-        free(ret_stmt);
-        errx(EXIT_FAILURE, "malloc failed");
-    }
+    ret_stmt = parser_alloc(parser, sizeof(*ret_stmt));
+    ret_stmt->token = parser_token_copy(parser, parser->cur_tok);
     ret_stmt->return_value = NULL;
     ret_stmt->statement.statement_type = RETURN_STATEMENT;
     ret_stmt->statement.node.token_literal = return_statement_token_literal;
@@ -683,14 +770,8 @@ static expression_statement_t *
 create_expression_statement(parser_t *parser)
 {
     expression_statement_t *exp_stmt;
-    exp_stmt = malloc(sizeof(*exp_stmt));
-    if (exp_stmt == NULL)
-        errx(EXIT_FAILURE, "malloc failed");
-    exp_stmt->token = token_copy(parser->cur_tok);
-    if (exp_stmt->token == NULL) {
-        free(exp_stmt);
-        errx(EXIT_FAILURE, "malloc failed");
-    }
+    exp_stmt = parser_alloc(parser, sizeof(*exp_stmt));
+    exp_stmt->token = parser_token_copy(parser, parser->cur_tok);
     exp_stmt->expression = NULL;
     exp_stmt->statement.statement_type = EXPRESSION_STATEMENT;
     exp_stmt->statement.node.token_literal = expression_statement_token_literal;
@@ -703,21 +784,16 @@ static block_statement_t *
 create_block_statement(parser_t *parser)
 {
     block_statement_t *block_stmt;
-    block_stmt = malloc(sizeof(*block_stmt));
-    if (block_stmt == NULL)
-        errx(EXIT_FAILURE, "malloc failed");
+    block_stmt = parser_alloc(parser, sizeof(*block_stmt));
     block_stmt->statement.node.string = block_statement_string;
     block_stmt->statement.node.token_literal = block_statement_token_literal;
     block_stmt->statement.node.type = STATEMENT;
     block_stmt->statement.statement_type = BLOCK_STATEMENT;
     block_stmt->array_size = 8;
-    block_stmt->statements = calloc(block_stmt->array_size, sizeof(*block_stmt->statements));
-    if (block_stmt->statements == NULL) {
-        free(block_stmt);
-        errx(EXIT_FAILURE, "malloc failed");
-    }
+    block_stmt->statements = parser_alloc(parser,
+        block_stmt->array_size * sizeof(*block_stmt->statements));
     block_stmt->nstatements = 0;
-    block_stmt->token = token_copy(parser->cur_tok);
+    block_stmt->token = parser_token_copy(parser, parser->cur_tok);
     return block_stmt;
 }
 
@@ -725,15 +801,13 @@ static function_literal_t *
 create_function_literal(parser_t *parser)
 {
     function_literal_t *func;
-    func = malloc(sizeof(*func));
-    if (func == NULL)
-        errx(EXIT_FAILURE, "malloc failed");
+    func = parser_alloc(parser, sizeof(*func));
     func->expression.node.string = function_literal_string;
     func->expression.node.token_literal = function_literal_token_literal;
     func->expression.node.type = EXPRESSION;
     func->expression.expression_type = FUNCTION_LITERAL;
-    func->parameters = cm_list_init();
-    func->token = token_copy(parser->cur_tok);
+    func->parameters = parser_list_init(parser);
+    func->token = parser_token_copy(parser, parser->cur_tok);
     func->body = NULL;
     func->name = NULL;
     return func;
@@ -743,20 +817,14 @@ static call_expression_t *
 create_call_expression(parser_t *parser)
 {
     call_expression_t *call_exp;
-    call_exp = malloc(sizeof(*call_exp));
-    if (call_exp == NULL)
-        errx(EXIT_FAILURE, "malloc failed");
+    call_exp = parser_alloc(parser, sizeof(*call_exp));
 
     call_exp->expression.node.token_literal = call_expression_token_literal;
     call_exp->expression.node.string = call_expression_string;
     call_exp->expression.node.type = EXPRESSION;
     call_exp->expression.expression_type = CALL_EXPRESSION;
-    call_exp->arguments = cm_list_init();
-    if (call_exp->arguments == NULL)
-        errx(EXIT_FAILURE, "malloc failed");
-    call_exp->token = token_copy(parser->peek_tok);
-    if (call_exp->token == NULL)
-        errx(EXIT_FAILURE, "malloc failed");
+    call_exp->arguments = parser_list_init(parser);
+    call_exp->token = parser_token_copy(parser, parser->peek_tok);
     call_exp->function = NULL;
     return call_exp;
 }
@@ -768,6 +836,7 @@ parser_free(parser_t *parser)
     token_free(parser->cur_tok);
     token_free(parser->peek_tok);
     cm_list_free(parser->errors, NULL);
+    cm_arena_free(parser->arena);
     free(parser);
 }
 
@@ -776,7 +845,11 @@ program_free(program_t *program)
 {
     if (program == NULL)
         return;
-    
+    if (program->arena != NULL) {
+        cm_arena_free(program->arena);
+        return;
+    }
+
     for (int i = 0; i < program->nstatements; i++) {
         statement_t *stmt = program->statements[i];
         if (stmt)
@@ -1058,11 +1131,26 @@ parser_init(lexer_t *l)
     parser->cur_tok = NULL;
     parser->peek_tok = NULL;
     parser->errors = NULL;
+    parser->arena = NULL;
     parser_next_token(parser);
     parser_next_token(parser);
     return parser;
 }
 
+/*
+ * Like parser_init, but the programs it parses are arena backed: all
+ * their nodes are bump allocated and program_free releases them in one go.
+ */
+parser_t *
+parser_init_arena(lexer_t *l)
+{
+    parser_t *parser = parser_init(l);
+    if (parser == NULL)
+        return NULL;
+    parser->arena = cm_arena_init();
+    return parser;
+}
+
 void
 parser_next_token(parser_t *parser)
 {
@@ -1073,12 +1161,12 @@ parser_next_token(parser_t *parser)
 }
 
 static int
-add_statement_to_program(program_t *program, statement_t *stmt)
+add_statement_to_program(parser_t *parser, program_t *program, statement_t *stmt)
 {
     if (program->nstatements == program->array_size) {
         size_t new_size = program->array_size * 2;
-        program->statements = reallocarray(program->statements,
-            new_size, sizeof(*program->statements));
+        program->statements = grow_statements(parser, program->statements,
+            program->array_size, new_size);
         if (program->statements == NULL)
             return 1;
         program->array_size = new_size;
@@ -1088,12 +1176,12 @@ add_statement_to_program(program_t *program, statement_t *stmt)
 }
 
 static int
-add_statement_to_block(block_statement_t *block_stmt, statement_t *stmt)
+add_statement_to_block(parser_t *parser, block_statement_t *block_stmt, statement_t *stmt)
 {
     if (block_stmt->nstatements == block_stmt->array_size) {
         size_t new_size = block_stmt->array_size * 2;
-        block_stmt->statements = reallocarray(block_stmt->statements,
-            new_size, sizeof(*block_stmt->statements));
+        block_stmt->statements = grow_statements(parser, block_stmt->statements,
+            block_stmt->array_size, new_size);
         if (block_stmt->statements == NULL)
             return 1;
         block_stmt->array_size = new_size;
@@ -1137,24 +1225,13 @@ static identifier_t *
 create_identifier(parser_t *parser)
 {
     identifier_t *ident;
-    ident = malloc(sizeof(*ident));
-    if (ident == NULL)
-        errx(EXIT_FAILURE, "malloc failed");
-    ident->token = token_copy(parser->cur_tok);
-    if (ident->token == NULL) {
-        free(ident);
-        errx(EXIT_FAILURE, "malloc failed");
-    }
+    ident = parser_alloc(parser, sizeof(*ident));
+    ident->token = parser_token_copy(parser, parser->cur_tok);
     ident->expression.node.token_literal = ident_token_literal;
     ident->expression.expression_type = IDENTIFIER_EXPRESSION;
     ident->expression.node.string = identifier_string;
     ident->expression.node.type = EXPRESSION;
-    ident->value = strdup(parser->cur_tok->literal);
-    if (ident->value == NULL) {
-        token_free(ident->token);
-        free(ident);
-        errx(EXIT_FAILURE, "malloc failed");
-    }
+    ident->value = parser_strdup(parser, parser->cur_tok->literal);
     return ident;
 }
 
@@ -1208,23 +1285,21 @@ parse_letstatement(parser_t *parser)
         errx(EXIT_FAILURE, "malloc failed"); // returning NULL would indicate no valid token
     
     if (!expect_peek(parser, IDENT)) {
-        free_statement((statement_t *) let_stmt);
+        discard_statement(parser, (statement_t *) let_stmt);
         return NULL;
     }
 
     identifier_t *ident = (identifier_t *) parse_identifier_expression(parser);
     let_stmt->name = ident;
     if (!expect_peek(parser, ASSIGN)) {
-        free_statement((statement_t *) let_stmt);
+        discard_statement(parser, (statement_t *) let_stmt);
         return NULL;
     }
     parser_next_token(parser);
     let_stmt->value = parse_expression(parser, LOWEST);
     if (let_stmt->value->expression_type == FUNCTION_LITERAL) {
         function_literal_t *fn_literal = (function_literal_t *) let_stmt->value;
-        fn_literal->name = strdup(let_stmt->name->value);
-        if (fn_literal->name == NULL)
-            err(EXIT_FAILURE, "malloc failed");
+        fn_literal->name = parser_strdup(parser, let_stmt->name->value);
     }
     if (parser->peek_tok->type == SEMICOLON)
         parser_next_token(parser);
@@ -1261,6 +1336,22 @@ program_init(void)
         return NULL;
     }
     program->nstatements = 0;
+    program->arena = NULL;
+    return program;
+}
+
+static program_t *
+program_init_arena(cm_arena *arena)
+{
+    program_t *program = cm_arena_alloc(arena, sizeof(*program));
+    program->node.token_literal = program_token_literal;
+    program->node.string = program_string;
+    program->node.type = PROGRAM;
+    program->array_size = 64;
+    program->statements = cm_arena_alloc(arena,
+        program->array_size * sizeof(*program->statements));
+    program->nstatements = 0;
+    program->arena = NULL;
     return program;
 }
 
@@ -1268,13 +1359,17 @@ program_t *
 parse_program(parser_t *parser)
 {
     
-    program_t *program = program_init();
+    program_t *program;
+    if (parser->arena != NULL)
+        program = program_init_arena(parser->arena);
+    else
+        program = program_init();
     if (program == NULL)
         errx(EXIT_FAILURE, "malloc failed");
     while (parser->cur_tok->type != END_OF_FILE) {
         statement_t *stmt = parser_parse_statement(parser);
         if (stmt != NULL) {
-            int status = add_statement_to_program(program, stmt);
+            int status = add_statement_to_program(parser, program, stmt);
             if (status != 0) {
                 program_free(program);
                 return NULL;
@@ -1282,6 +1377,11 @@ parse_program(parser_t *parser)
         }
         parser_next_token(parser);
     }
+    if (parser->arena != NULL) {
+        /* the program owns the arena now, the next one gets a fresh one */
+        program->arena = parser->arena;
+        parser->arena = cm_arena_init();
+    }
     return program;
 }
 
@@ -1339,14 +1439,12 @@ parse_integer_expression(parser_t *parser)
         trace("parse_integer_expression");
     #endif
     integer_t *int_exp;
-    int_exp = malloc(sizeof(*int_exp));
-    if (int_exp == NULL)
-        errx(EXIT_FAILURE, "malloc failed");
+    int_exp = parser_alloc(parser, sizeof(*int_exp));
     int_exp->expression.node.token_literal = int_exp_token_literal;
     int_exp->expression.node.string = integer_string;
     int_exp->expression.node.type = EXPRESSION;
     int_exp->expression.expression_type = INTEGER_EXPRESSION;
-    int_exp->token = token_copy(parser->cur_tok);
+    int_exp->token = parser_token_copy(parser, parser->cur_tok);
     errno = 0;
     char *ep;
     int_exp->value = strtol(parser->cur_tok->literal, &ep, 10);
@@ -1372,18 +1470,14 @@ parse_string_expression(parser_t *parser)
         trace("parse_string_expression");
     #endif
     string_t *string;
-    string = malloc(sizeof(*string));
-    if (string == NULL)
-        errx(EXIT_FAILURE, "malloc failed");
+    string = parser_alloc(parser, sizeof(*string));
     string->expression.node.string = string_string;
     string->expression.node.token_literal = string_token_literal;
     string->expression.node.type = EXPRESSION;
     string->expression.expression_type = STRING_EXPRESSION;
-    string->token = token_copy(parser->cur_tok);
-    string->value = strdup(parser->cur_tok->literal);
+    string->token = parser_token_copy(parser, parser->cur_tok);
+    string->value = parser_strdup(parser, parser->cur_tok->literal);
     string->length = strlen(parser->cur_tok->literal);
-    if (string->value == NULL)
-        errx(EXIT_FAILURE, "malloc failed");
     #ifdef TRACE
         untrace("parse_string_expression");
     #endif
@@ -1397,17 +1491,14 @@ parse_prefix_expression(parser_t *parser)
         trace("parse_prefix_expression");
     #endif
     prefix_expression_t *prefix_exp;
-    prefix_exp = malloc(sizeof(*prefix_exp));
-    if (prefix_exp == NULL)
-        errx(EXIT_FAILURE, "malloc failed");
+    prefix_exp = parser_alloc(parser, sizeof(*prefix_exp));
     prefix_exp->expression.expression_type = PREFIX_EXPRESSION;
     prefix_exp->expression.node.string = prefix_expression_string;
     prefix_exp->expression.node.token_literal = prefix_expression_token_literal;
     prefix_exp->expression.node.type = EXPRESSION;
-    prefix_exp->token = token_copy(parser->cur_tok);
-    prefix_exp->operator = strdup(parser->cur_tok->literal);
-    if (prefix_exp->operator == NULL)
-        errx(EXIT_FAILURE, "malloc failed");
+    prefix_exp->token = parser_token_copy(parser, parser->cur_tok);
+    prefix_exp->operator = parser_strdup(parser, parser->cur_tok->literal);
+    prefix_exp->op = parser->cur_tok->type;
     parser_next_token(parser);
     prefix_exp->right = parse_expression(parser, PREFIX);
 
@@ -1424,16 +1515,15 @@ parse_infix_expression(parser_t *parser, expression_t *left)
         trace("parse_infix_expression");
     #endif
     infix_expression_t *infix_exp;
-    infix_exp = malloc(sizeof(*infix_exp));
-    if (infix_exp == NULL)
-        errx(EXIT_FAILURE, "malloc failed");
+    infix_exp = parser_alloc(parser, sizeof(*infix_exp));
     infix_exp->expression.expression_type = INFIX_EXPRESSION;
     infix_exp->expression.node.string = infix_expression_string;
     infix_exp->expression.node.token_literal = infix_expression_token_literal;
     infix_exp->expression.node.type = EXPRESSION;
     infix_exp->left = left;
-    infix_exp->operator = strdup(parser->cur_tok->literal);
-    infix_exp->token = token_copy(parser->cur_tok);
+    infix_exp->operator = parser_strdup(parser, parser->cur_tok->literal);
+    infix_exp->op = parser->cur_tok->type;
+    infix_exp->token = parser_token_copy(parser, parser->cur_tok);
     operator_precedence_t precedence = cur_precedence(parser);
     parser_next_token(parser);
     infix_exp->right = parse_expression(parser, precedence);
@@ -1444,33 +1534,46 @@ parse_infix_expression(parser_t *parser, expression_t *left)
     return (expression_t *) infix_exp;
 }
 
+static void
+init_hash_literal(hash_literal_t *hash_exp, token_t *token, cm_hash_table *pairs)
+{
+    hash_exp->token = token;
+    hash_exp->expression.node.string = hash_literal_string;
+    hash_exp->expression.node.token_literal = hash_literal_token_literal;
+    hash_exp->expression.node.type = EXPRESSION;
+    hash_exp->expression.expression_type = HASH_LITERAL;
+    hash_exp->pairs = pairs;
+}
+
 static hash_literal_t *
 create_hash_literal(token_t *cur_tok)
 {
     hash_literal_t *hash_exp = malloc(sizeof(*hash_exp));
     if (hash_exp == NULL)
         errx(EXIT_FAILURE, "malloc failed");
-    hash_exp->token = token_copy(cur_tok);
-    hash_exp->expression.node.string = hash_literal_string;
-    hash_exp->expression.node.token_literal = hash_literal_token_literal;
-    hash_exp->expression.node.type = EXPRESSION;
-    hash_exp->expression.expression_type = HASH_LITERAL;
-    hash_exp->pairs = cm_hash_table_init(pointer_hash_function,
-        pointer_equals, free_expression, free_expression);
+    init_hash_literal(hash_exp, token_copy(cur_tok),
+        cm_hash_table_init(pointer_hash_function, pointer_equals,
+            free_expression, free_expression));
     return hash_exp;
 }
 
 static expression_t *
 parse_hash_literal(parser_t *parser)
 {
-    hash_literal_t *hash_exp = create_hash_literal(parser->cur_tok);
+    hash_literal_t *hash_exp;
+    if (parser->arena != NULL) {
+        /* the keys and values live in the arena, only the table needs freeing */
+        hash_exp = parser_alloc(parser, sizeof(*hash_exp));
+        init_hash_literal(hash_exp, parser_token_copy(parser, parser->cur_tok),
+            cm_hash_table_init(pointer_hash_function, pointer_equals, NULL, NULL));
+        cm_arena_add_cleanup(parser->arena, cleanup_hash_table, hash_exp->pairs);
+    } else
+        hash_exp = create_hash_literal(parser->cur_tok);
     while (parser->peek_tok->type != RBRACE) {
         parser_next_token(parser);
         expression_t *key = parse_expression(parser, LOWEST);
         if (!expect_peek(parser, COLON)) {
-            cm_hash_table_free(hash_exp->pairs);
-            token_free(hash_exp->token);
-            free(hash_exp);
+            discard_expression(parser, (expression_t *) hash_exp);
             return NULL;
         }
 
@@ -1478,15 +1581,13 @@ parse_hash_literal(parser_t *parser)
         expression_t *value = parse_expression(parser, LOWEST);
         cm_hash_table_put(hash_exp->pairs, key, value);
         if (parser->peek_tok->type != RBRACE && !expect_peek(parser, COMMA)) {
-            cm_hash_table_free(hash_exp->pairs);
-            token_free(hash_exp->token);
-            free(hash_exp);
+            discard_expression(parser, (expression_t *) hash_exp);
             return NULL;
         }
     }
 
     if (!expect_peek(parser, RBRACE)) {
-        free_hash_literal(hash_exp);
+        discard_expression(parser, (expression_t *) hash_exp);
         return NULL;
     }
     return (expression_t *) hash_exp;
@@ -1499,10 +1600,8 @@ parse_boolean_expression(parser_t *parser)
         trace("parse_boolean_expression");
     #endif
     boolean_expression_t *bool_exp;
-    bool_exp = malloc(sizeof(*bool_exp));
-    if (bool_exp == NULL)
-        errx(EXIT_FAILURE, "malloc failed");
-    bool_exp->token = token_copy(parser->cur_tok);
+    bool_exp = parser_alloc(parser, sizeof(*bool_exp));
+    bool_exp->token = parser_token_copy(parser, parser->cur_tok);
     bool_exp->expression.expression_type = BOOLEAN_EXPRESSION;
     bool_exp->expression.node.token_literal = boolean_expression_token_literal;
     bool_exp->expression.node.string = boolean_expression_string;
@@ -1521,7 +1620,12 @@ parse_boolean_expression(parser_t *parser)
 static cm_array_list *
 parse_expression_list(parser_t *parser, token_type stop_token_type)
 {
-    cm_array_list *expression_list = cm_array_list_init(4, free_expression);
+    cm_array_list *expression_list;
+    if (parser->arena != NULL) {
+        expression_list = cm_array_list_init(4, NULL);
+        cm_arena_add_cleanup(parser->arena, cleanup_array_list, expression_list);
+    } else
+        expression_list = cm_array_list_init(4, free_expression);
     if (parser->peek_tok->type == stop_token_type) {
         parser_next_token(parser);
         return expression_list;
@@ -1538,7 +1642,8 @@ parse_expression_list(parser_t *parser, token_type stop_token_type)
     }
 
     if (!expect_peek(parser, stop_token_type)) {
-        cm_array_list_free(expression_list);
+        if (parser->arena == NULL)
+            cm_array_list_free(expression_list);
         return NULL;
     }
     return expression_list;
@@ -1553,7 +1658,7 @@ parse_grouped_expression(parser_t *parser)
     parser_next_token(parser);
     expression_t *exp = parse_expression(parser, LOWEST);
     if (!expect_peek(parser, RPAREN)) {
-        free_expression(exp);
+        discard_expression(parser, exp);
         exp = NULL;
     }
 
@@ -1570,11 +1675,9 @@ parse_array_literal(parser_t *parser)
         trace("parse_array_literal");
     #endif
     array_literal_t *array;
-    array = malloc(sizeof(*array));
-    if (array == NULL)
-        errx(EXIT_FAILURE, "malloc failed");
+    array = parser_alloc(parser, sizeof(*array));
     array->elements = parse_expression_list(parser, RBRACKET);
-    array->token = token_copy(parser->cur_tok);
+    array->token = parser_token_copy(parser, parser->cur_tok);
     array->expression.node.string = array_literal_string;
     array->expression.node.token_literal = array_literal_token_literal;
     array->expression.node.type = EXPRESSION;
@@ -1592,20 +1695,18 @@ parse_index_expression(parser_t *parser, expression_t *left)
         trace("parse_index_expression");
     #endif
     index_expression_t *index_exp;
-    index_exp = malloc(sizeof(*index_exp));
-    if (index_exp == NULL)
-        errx(EXIT_FAILURE, "malloc failed");
+    index_exp = parser_alloc(parser, sizeof(*index_exp));
     index_exp->expression.node.string = index_exp_string;
     index_exp->expression.node.token_literal = index_exp_token_literal;
     index_exp->expression.node.type = EXPRESSION;
     index_exp->expression.expression_type = INDEX_EXPRESSION;
     index_exp->left = left;
     index_exp->index = NULL;
-    index_exp->token = token_copy(parser->cur_tok);
+    index_exp->token = parser_token_copy(parser, parser->cur_tok);
     parser_next_token(parser);
     index_exp->index = parse_expression(parser, LOWEST);
     if (!expect_peek(parser, RBRACKET)) {
-        free_index_expression(index_exp);
+        discard_expression(parser, (expression_t *) index_exp);
         index_exp = NULL;
     }
     #ifdef TRACE
@@ -1625,7 +1726,7 @@ parse_block_statement(parser_t *parser)
     while (parser->cur_tok->type != RBRACE && parser->cur_tok->type != END_OF_FILE) {
         statement_t *stmt = parser_parse_statement(parser);
         if (stmt != NULL)
-            add_statement_to_block(block_stmt, stmt);
+            add_statement_to_block(parser, block_stmt, stmt);
         parser_next_token(parser);
     }
     #ifdef TRACE
@@ -1641,30 +1742,27 @@ parse_while_expression(parser_t *parser)
         trace("parse_while_expression");
     #endif
     while_expression_t *while_exp;
-    while_exp = malloc(sizeof(*while_exp));
-    if (while_exp == NULL)
-        err(EXIT_FAILURE, "malloc failed");
+    while_exp = parser_alloc(parser, sizeof(*while_exp));
     while_exp->expression.node.string = while_expression_string;
     while_exp->expression.node.token_literal = while_expression_token_literal;
     while_exp->expression.node.type = EXPRESSION;
     while_exp->expression.expression_type = WHILE_EXPRESSION;
-    while_exp->token = token_copy(parser->cur_tok);
+    while_exp->token = parser_token_copy(parser, parser->cur_tok);
     while_exp->condition = NULL;
     while_exp->body = NULL;
 
     if (!expect_peek(parser, LPAREN)) {
-        token_free(while_exp->token);
-        free(while_exp);
+        discard_expression(parser, (expression_t *) while_exp);
         return NULL;
     }
     parser_next_token(parser);
     while_exp->condition = parse_expression(parser, LOWEST);
     if (!expect_peek(parser, RPAREN)) {
-        free_while_expression(while_exp);
+        discard_expression(parser, (expression_t *) while_exp);
         return NULL;
     }
     if (!expect_peek(parser, LBRACE)) {
-        free_while_expression(while_exp);
+        discard_expression(parser, (expression_t *) while_exp);
         return NULL;
     }
 
@@ -1682,34 +1780,31 @@ parse_if_expression(parser_t *parser)
         trace("parse_if_expression");
     #endif
     if_expression_t *if_exp;
-    if_exp = malloc(sizeof(*if_exp));
-    if (if_exp == NULL)
-        errx(EXIT_FAILURE, "malloc failed");
+    if_exp = parser_alloc(parser, sizeof(*if_exp));
 
     if_exp->expression.node.string = if_expression_string;
     if_exp->expression.node.token_literal = if_expression_token_literal;
     if_exp->expression.node.type = EXPRESSION;
     if_exp->expression.expression_type = IF_EXPRESSION;
-    if_exp->token = token_copy(parser->cur_tok);
+    if_exp->token = parser_token_copy(parser, parser->cur_tok);
     if_exp->condition = NULL;
     if_exp->alternative = NULL;
     if_exp->consequence = NULL;
 
     if (!expect_peek(parser, LPAREN)) {
-        token_free(if_exp->token);
-        free(if_exp);
+        discard_expression(parser, (expression_t *) if_exp);
         return NULL;
     }
 
     parser_next_token(parser);
     if_exp->condition = parse_expression(parser, LOWEST);
     if (!expect_peek(parser, RPAREN)) {
-        free_if_expression(if_exp);
+        discard_expression(parser, (expression_t *) if_exp);
         return NULL;
     }
 
     if (!expect_peek(parser, LBRACE)) {
-        free_if_expression(if_exp);
+        discard_expression(parser, (expression_t *) if_exp);
         return NULL;
     }
 
@@ -1718,7 +1813,7 @@ parse_if_expression(parser_t *parser)
     if (parser->peek_tok->type == ELSE) {
         parser_next_token(parser);
         if (!expect_peek(parser, LBRACE)) {
-            free_if_expression(if_exp);
+            discard_expression(parser, (expression_t *) if_exp);
             return NULL;
         }
         if_exp->alternative = parse_block_statement(parser);
@@ -1748,7 +1843,8 @@ parse_function_parameters(parser_t * parser, function_literal_t *function)
     }
 
     if (!expect_peek(parser, RPAREN)) {
-        cm_list_free(function->parameters, free_identifier);
+        if (parser->arena == NULL)
+            cm_list_free(function->parameters, free_identifier);
         function->parameters = NULL;
         return;
     }
@@ -1762,19 +1858,17 @@ parse_function_literal(parser_t *parser)
     #endif
     function_literal_t *function = create_function_literal(parser);
     if (!expect_peek(parser, LPAREN)) {
-        free_function_literal(function);
+        discard_expression(parser, (expression_t *) function);
         return NULL;
     }
     parse_function_parameters(parser, function);
     if (function->parameters == NULL) {
-        free_function_literal(function);
+        discard_expression(parser, (expression_t *) function);
         return NULL;
     }
 
     if (!expect_peek(parser, LBRACE)) {
-        cm_list_free(function->parameters, free_identifier);
-        token_free(function->token);
-        free(function);
+        discard_expression(parser, (expression_t *) function);
         return NULL;
     }
 
@@ -1804,7 +1898,8 @@ parse_call_arguments(parser_t *parser, call_expression_t *call_exp)
     }
 
     if (!expect_peek(parser, RPAREN)) {
-        cm_list_free(call_exp->arguments, free_expression);
+        if (parser->arena == NULL)
+            cm_list_free(call_exp->arguments, free_expression);
         call_exp->arguments = NULL;
         return;
     }
@@ -1819,7 +1914,7 @@ parse_call_expression(parser_t *parser, expression_t *function)
     call_expression_t *call_exp = create_call_expression(parser);
     parse_call_arguments(parser, call_exp);
     if (call_exp->arguments == NULL) {
-        free_call_expression(call_exp);
+        discard_expression(parser, (expression_t *) call_exp);
         return NULL;
     }
     call_exp->function = function;
@@ -1878,6 +1973,7 @@ copy_prefix_expression(expression_t *exp)
     copy->operator = strdup(prefix_exp->operator);
     if (copy->operator == NULL)
         errx(EXIT_FAILURE, "malloc failed");
+    copy->op = prefix_exp->op;
     copy->right = copy_expression(prefix_exp->right);
     return (expression_t *) copy;
 }
@@ -1897,6 +1993,7 @@ copy_infix_expression(expression_t *exp)
     copy->operator = strdup(infix_exp->operator);
     if (copy->operator == NULL)
         errx(EXIT_FAILURE, "malloc failed");
+    copy->op = infix_exp->op;
     copy->left = copy_expression(infix_exp->left);
     copy->right = copy_expression(infix_exp->right);
     return (expression_t *) copy;
@@ -1939,6 +2036,23 @@ copy_if_expression(expression_t *exp)
     return (expression_t *) copy;
 }
 
+static expression_t *
+copy_while_expression(expression_t *exp)
+{
+    while_expression_t *while_exp = (while_expression_t *) exp;
+    while_expression_t *copy = malloc(sizeof(*copy));
+    if (copy == NULL)
+        errx(EXIT_FAILURE, "malloc failed");
+    copy->expression.node.string = while_exp->expression.node.string;
+    copy->expression.node.token_literal = while_exp->expression.node.token_literal;
+    copy->expression.node.type = EXPRESSION;
+    copy->expression.expression_type = WHILE_EXPRESSION;
+    copy->token = token_copy(while_exp->token);
+    copy->condition = copy_expression(while_exp->condition);
+    copy->body = (block_statement_t *) copy_statement((statement_t *) while_exp->body);
+    return (expression_t *) copy;
+}
+
 cm_list *
 copy_parameters(cm_list *parameters)
 {
@@ -2072,6 +2186,8 @@ copy_expression(expression_t *exp)
             return copy_boolean_expression(exp);
         case IF_EXPRESSION:
             return copy_if_expression(exp);
+        case WHILE_EXPRESSION:
+            return copy_while_expression(exp);
         case FUNCTION_LITERAL:
             return copy_function_literal(exp);
         case CALL_EXPRESSION:
@@ -39,6 +39,7 @@ typedef struct parser_t {
     token_t *cur_tok;
     token_t *peek_tok;
     cm_list *errors;
+    cm_arena *arena; // AST nodes are allocated from it, if not NULL
  } parser_t;
 
  typedef enum operator_precedence_t {
@@ -57,6 +58,7 @@ typedef expression_t * (*prefix_parse_fn)(parser_t *);
 typedef expression_t * (*infix_parse_fn)(parser_t *, expression_t *);
 
 parser_t * parser_init(lexer_t *);
+parser_t * parser_init_arena(lexer_t *);
 void parser_next_token(parser_t *);
 program_t *parse_program(parser_t *);
 statement_t *parser_parse_statement(parser_t *);
@@ -1080,27 +1080,34 @@ test_parsing_hash_literal_bool_keys(void)
         "Expected HASH_LITERAL expression, found %s\n",
         get_expression_type_name(exp_stmt->expression->expression_type));
     hash_literal_t *hash_exp = (hash_literal_t *) exp_stmt->expression;
-    for(size_t i = 0; i < hash_exp->pairs->nkeys; i++) {
+    test(hash_exp->pairs->nkeys == 2,
+        "Expected 2 entries in hash literal, found %zu\n",
+        hash_exp->pairs->nkeys);
+    /* the keys are hashed by address, so they may share a slot */
+    for (size_t i = 0; i < hash_exp->pairs->used_slots->length; i++) {
         size_t *index = (size_t *) hash_exp->pairs->used_slots->array[i];
-        cm_hash_entry *entry = (cm_hash_entry *) hash_exp->pairs->table[*index]->head->data;
-        expression_t *key_exp = (expression_t *) entry->key;
-        test(key_exp->expression_type == BOOLEAN_EXPRESSION,
-            "Expected BOOLEAN_EXPRESSION as key, found %s\n",
-            get_expression_type_name(key_exp->expression_type));
-        expression_t *value_exp = (expression_t *) entry->value;
-        test(value_exp->expression_type == INTEGER_EXPRESSION,
-            "Expected INTEGER_EXPRESSION as value, found %s\n",
-            get_expression_type_name(value_exp->expression_type));
-        boolean_expression_t *bool_key = (boolean_expression_t *) key_exp;
-        integer_t *int_value = (integer_t *) value_exp;
-        if (bool_key->value) {
-            test(int_value->value == 1,
-                "Expected value for key true to be 1, found %ld\n",
-                int_value->value);
-        } else {
-            test(int_value->value == 2,
-                "Expected value for key false to be 2, found %ld\n",
-                int_value->value);
+        for (cm_list_node *node = hash_exp->pairs->table[*index]->head; node != NULL;
+            node = node->next) {
+            cm_hash_entry *entry = (cm_hash_entry *) node->data;
+            expression_t *key_exp = (expression_t *) entry->key;
+            test(key_exp->expression_type == BOOLEAN_EXPRESSION,
+                "Expected BOOLEAN_EXPRESSION as key, found %s\n",
+                get_expression_type_name(key_exp->expression_type));
+            expression_t *value_exp = (expression_t *) entry->value;
+            test(value_exp->expression_type == INTEGER_EXPRESSION,
+                "Expected INTEGER_EXPRESSION as value, found %s\n",
+                get_expression_type_name(value_exp->expression_type));
+            boolean_expression_t *bool_key = (boolean_expression_t *) key_exp;
+            integer_t *int_value = (integer_t *) value_exp;
+            if (bool_key->value) {
+                test(int_value->value == 1,
+                    "Expected value for key true to be 1, found %ld\n",
+                    int_value->value);
+            } else {
+                test(int_value->value == 2,
+                    "Expected value for key false to be 2, found %ld\n",
+                    int_value->value);
+            }
         }
     }
     parser_free(parser);
@@ -1120,7 +1127,7 @@ test_parsing_hash_literal_with_expression_values(void)
     print_test_separator_line();
     printf("Testing parsing of hash literal with expressions in values\n");
     cm_hash_table *expected = cm_hash_table_init(string_hash_function,
-        string_equals, NULL, free_expression);
+        string_equals, NULL, NULL);
     cm_hash_table_put(expected, "one", &((expected_value ) {"+", "0", "1"}));
     cm_hash_table_put(expected, "two", &((expected_value) {"-", "10", "8"}));
     cm_hash_table_put(expected, "three", &((expected_value) {"/", "15", "5"}));
@@ -1254,6 +1261,77 @@ test_parsing_while_expression(void)
     parser_free(parser);
 }
 
+static program_t *
+parse_with_arena(const char *input, _Bool use_arena, parser_t **parser)
+{
+    lexer_t *lexer = lexer_init(input);
+    *parser = use_arena ? parser_init_arena(lexer): parser_init(lexer);
+    program_t *program = parse_program(*parser);
+    check_parser_errors(*parser);
+    return program;
+}
+
+static void
+test_arena_parse(void)
+{
+    print_test_separator_line();
+    printf("Testing arena backed parsing\n");
+    char *input = NULL;
+    char *temp = NULL;
+    asprintf(&input, "let add = fn(x, y) { let a = x; let b = y; let c = a; let d = b; "\
+        "let e = c; let f = d; let g = e; let h = f; g + h; };\n"\
+        "let xs = [1, 2 * 3, \"four\", [5]];\n"\
+        "while (i < 10) { if (xs[0] > 1) { add(i, -1) } else { puts(\"no\") } };\n");
+    if (input == NULL)
+        err(EXIT_FAILURE, "malloc failed");
+    /* more statements than the initial size of the program's array */
+    for (int i = 0; i < 100; i++) {
+        asprintf(&temp, "%slet v%d = add(%d, v%d);\n", input, i, i, i);
+        if (temp == NULL)
+            err(EXIT_FAILURE, "malloc failed");
+        free(input);
+        input = temp;
+    }
+
+    parser_t *parser, *arena_parser;
+    expression_statement_t *exp_stmt;
+    program_t *program = parse_with_arena(input, false, &parser);
+    program_t *arena_program = parse_with_arena(input, true, &arena_parser);
+    test(program->arena == NULL, "Expected a malloc backed program\n");
+    test(arena_program->arena != NULL, "Expected an arena backed program\n");
+    test(arena_program->nstatements == program->nstatements,
+        "Expected %zu statements, got %zu\n", program->nstatements,
+        arena_program->nstatements);
+    char *expected = program->node.string(program);
+    char *actual = arena_program->node.string(arena_program);
+    test(strcmp(expected, actual) == 0, "Expected program %s, got %s\n",
+        expected, actual);
+    free(expected);
+    free(actual);
+    program_free(program);
+    program_free(arena_program);
+    parser_free(parser);
+
+    /* the parser keeps handing out fresh arenas to the programs it parses */
+    arena_program = parse_program(arena_parser);
+    test(arena_program->arena != NULL && arena_program->nstatements == 0,
+        "Expected an empty arena backed program\n");
+    program_free(arena_program);
+    parser_free(arena_parser);
+    free(input);
+
+    program = parse_with_arena("{\"k\": true, 1: !false}", true, &parser);
+    exp_stmt = (expression_statement_t *) program->statements[0];
+    test(exp_stmt->expression->expression_type == HASH_LITERAL,
+        "Expected HASH_LITERAL, got %s\n",
+        get_expression_type_name(exp_stmt->expression->expression_type));
+    hash_literal_t *hash_exp = (hash_literal_t *) exp_stmt->expression;
+    test(hash_exp->pairs->nkeys == 2, "Expected 2 pairs, got %zu\n",
+        hash_exp->pairs->nkeys);
+    program_free(program);
+    parser_free(parser);
+}
+
 int
 main(int argc, char **argv)
 {
@@ -1282,6 +1360,7 @@ main(int argc, char **argv)
     test_parsing_hash_literal_bool_keys();
     test_parsing_while_expression();
     test_function_literal_with_name();
+    test_arena_parse();
     printf("All tests passed\n");
 
 }
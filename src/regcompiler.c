@@ -0,0 +1,957 @@
+/*-
+ * Copyright (c) 2019 Abhinav Upadhyay <er.abhinav.upadhyay@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <err.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "builtins.h"
+#include "cmonkey_utils.h"
+#include "compiler.h"
+#include "object.h"
+#include "regcompiler.h"
+#include "symbol_table.h"
+
+const regopcode_definition_t regopcode_definitions[] = {
+    {"RLOADK", "load_constant"},
+    {"RLOADTRUE", "true"},
+    {"RLOADFALSE", "false"},
+    {"RLOADNULL", "null"},
+    {"RMOVE", "move"},
+    {"RGETGLOBAL", "get_global"},
+    {"RSETGLOBAL", "set_global"},
+    {"RGETFREE", "get_free"},
+    {"RGETBUILTIN", "get_builtin"},
+    {"RCURRENTCLOSURE", "current_closure"},
+    {"RADD", "+"},
+    {"RSUB", "-"},
+    {"RMUL", "*"},
+    {"RDIV", "/"},
+    {"RMOD", "%"},
+    {"REQUAL", "=="},
+    {"RNOTEQUAL", "!="},
+    {"RGREATERTHAN", ">"},
+    {"RLESSTHAN", "<"},
+    {"RLESSEQUAL", "<="},
+    {"RGREATEREQUAL", ">="},
+    {"RMINUS", "-"},
+    {"RBANG", "not"},
+    {"RJMP", "jump"},
+    {"RJMPFALSE", "jump_if_false"},
+    {"RARRAY", "array"},
+    {"RHASH", "hash"},
+    {"RINDEX", "index"},
+    {"RCALL", "call"},
+    {"RRETURN", "return_value"},
+    {"RRETURNNULL", "return"},
+    {"RCLOSURE", "closure"},
+    {"RPOP", "pop"}
+};
+
+#define CONSTANTS_POOL_INIT_SIZE 16
+#define SCOPE_CODE_INIT_SIZE 64
+#define MAX_WIDE_OPERAND 0xffff
+
+static compiler_error_t compile_expression_to(regcompiler_t *, expression_t *, size_t);
+static compiler_error_t compile_statement(regcompiler_t *, statement_t *);
+
+static char *
+get_err_msg(const char *s, ...)
+{
+    char *msg = NULL;
+    va_list ap;
+    va_start(ap, s);
+    int retval = vasprintf(&msg, s, ap);
+    va_end(ap);
+    if (retval == -1)
+        err(EXIT_FAILURE, "malloc failed");
+    return msg;
+}
+
+static regcompilation_scope_t *
+regscope_init(regcompilation_scope_t *outer, size_t first_temp)
+{
+    regcompilation_scope_t *scope;
+    scope = malloc(sizeof(*scope));
+    if (scope == NULL)
+        err(EXIT_FAILURE, "malloc failed");
+    scope->outer = outer;
+    scope->code = NULL;
+    scope->length = 0;
+    scope->size = 0;
+    scope->first_temp = first_temp;
+    scope->next_temp = first_temp;
+    scope->max_registers = first_temp;
+    return scope;
+}
+
+static void
+regscope_free(regcompilation_scope_t *scope)
+{
+    free(scope->code);
+    free(scope);
+}
+
+regcompiler_t *
+regcompiler_init(void)
+{
+    regcompiler_t *compiler;
+    compiler = malloc(sizeof(*compiler));
+    if (compiler == NULL)
+        err(EXIT_FAILURE, "malloc failed");
+    compiler->constants_pool = NULL;
+    compiler->symbol_table = symbol_table_init();
+    for (size_t i = 0; i < get_builtins_count(); i++) {
+        char *builtin_name = (char *) get_builtins_name(i);
+        if (builtin_name == NULL)
+            break;
+        symbol_define_builtin(compiler->symbol_table, i, builtin_name);
+    }
+    compiler->scope = regscope_init(NULL, 0);
+    return compiler;
+}
+
+void
+regcompiler_free(regcompiler_t *compiler)
+{
+    regcompilation_scope_t *scope = compiler->scope;
+    while (scope != NULL) {
+        regcompilation_scope_t *outer = scope->outer;
+        regscope_free(scope);
+        scope = outer;
+    }
+    if (compiler->constants_pool)
+        cm_array_list_free(compiler->constants_pool);
+    symbol_table_t *table = compiler->symbol_table;
+    while (table != NULL) {
+        symbol_table_t *outer = table->outer;
+        free_symbol_table(table);
+        table = outer;
+    }
+    free(compiler);
+}
+
+static size_t
+emit_word(regcompiler_t *compiler, reginstruction_t word)
+{
+    regcompilation_scope_t *scope = compiler->scope;
+    if (scope->length == scope->size) {
+        scope->size = scope->size == 0? SCOPE_CODE_INIT_SIZE: scope->size * 2;
+        scope->code = reallocarray(scope->code, scope->size, sizeof(*scope->code));
+        if (scope->code == NULL)
+            err(EXIT_FAILURE, "malloc failed");
+    }
+    scope->code[scope->length] = word;
+    return scope->length++;
+}
+
+#define emit_abc(compiler, op, a, b, c) emit_word(compiler, REG_ABC(op, a, b, c))
+#define emit_abx(compiler, op, a, bx) emit_word(compiler, REG_ABX(op, a, bx))
+
+static void
+patch_bx(regcompiler_t *compiler, size_t pos, size_t bx)
+{
+    reginstruction_t ins = compiler->scope->code[pos];
+    compiler->scope->code[pos] = REG_ABX(REG_OP(ins), REG_A(ins), bx);
+}
+
+static compiler_error_t
+check_wide_operand(size_t operand, const char *what)
+{
+    compiler_error_t error = {COMPILER_ERROR_NONE, NULL};
+    if (operand > MAX_WIDE_OPERAND) {
+        error.code = COMPILER_TOO_MANY_REGISTERS;
+        error.msg = get_err_msg("too many %s for the register backend: %zu", what, operand);
+    }
+    return error;
+}
+
+/*
+ * Temporaries are allocated and released in stack order, n consecutive
+ * registers at a time.
+ */
+static compiler_error_t
+alloc_temps(regcompiler_t *compiler, size_t n, size_t *reg)
+{
+    compiler_error_t error = {COMPILER_ERROR_NONE, NULL};
+    regcompilation_scope_t *scope = compiler->scope;
+    if (scope->next_temp + n > MAX_REGISTERS) {
+        error.code = COMPILER_TOO_MANY_REGISTERS;
+        error.msg = get_err_msg("expression needs more than %d registers", MAX_REGISTERS);
+        return error;
+    }
+    *reg = scope->next_temp;
+    scope->next_temp += n;
+    if (scope->next_temp > scope->max_registers)
+        scope->max_registers = scope->next_temp;
+    return error;
+}
+
+#define release_temps(compiler, mark) (compiler)->scope->next_temp = (mark)
+
+static size_t
+add_constant(regcompiler_t *compiler, monkey_object_t *obj)
+{
+    if (compiler->constants_pool == NULL)
+        compiler->constants_pool = cm_array_list_init(CONSTANTS_POOL_INIT_SIZE, free_monkey_object);
+    cm_array_list_add(compiler->constants_pool, obj);
+    return compiler->constants_pool->length - 1;
+}
+
+static size_t count_lets_in_expression(expression_t *);
+
+static size_t
+count_lets_in_statement(statement_t *statement)
+{
+    block_statement_t *block_stmt;
+    size_t count = 0;
+    switch (statement->statement_type) {
+    case LET_STATEMENT:
+        return 1 + count_lets_in_expression(((letstatement_t *) statement)->value);
+    case RETURN_STATEMENT:
+        return count_lets_in_expression(((return_statement_t *) statement)->return_value);
+    case EXPRESSION_STATEMENT:
+        return count_lets_in_expression(((expression_statement_t *) statement)->expression);
+    case BLOCK_STATEMENT:
+        block_stmt = (block_statement_t *) statement;
+        for (size_t i = 0; i < block_stmt->nstatements; i++)
+            count += count_lets_in_statement(block_stmt->statements[i]);
+        return count;
+    }
+    return 0;
+}
+
+/*
+ * Upper bound on the number of let bindings an expression can introduce in
+ * the enclosing function, used to place the temporaries above the locals.
+ * Nested function literals have their own registers and are not counted.
+ */
+static size_t
+count_lets_in_expression(expression_t *exp)
+{
+    if_expression_t *if_exp;
+    while_expression_t *while_exp;
+    infix_expression_t *infix_exp;
+    call_expression_t *call_exp;
+    array_literal_t *array_exp;
+    index_expression_t *index_exp;
+    hash_literal_t *hash_exp;
+    cm_array_list *keys;
+    cm_list_node *node;
+    size_t count = 0;
+    if (exp == NULL)
+        return 0;
+    switch (exp->expression_type) {
+    case PREFIX_EXPRESSION:
+        return count_lets_in_expression(((prefix_expression_t *) exp)->right);
+    case INFIX_EXPRESSION:
+        infix_exp = (infix_expression_t *) exp;
+        return count_lets_in_expression(infix_exp->left) +
+            count_lets_in_expression(infix_exp->right);
+    case IF_EXPRESSION:
+        if_exp = (if_expression_t *) exp;
+        count = count_lets_in_expression(if_exp->condition) +
+            count_lets_in_statement((statement_t *) if_exp->consequence);
+        if (if_exp->alternative != NULL)
+            count += count_lets_in_statement((statement_t *) if_exp->alternative);
+        return count;
+    case WHILE_EXPRESSION:
+        while_exp = (while_expression_t *) exp;
+        return count_lets_in_expression(while_exp->condition) +
+            count_lets_in_statement((statement_t *) while_exp->body);
+    case CALL_EXPRESSION:
+        call_exp = (call_expression_t *) exp;
+        count = count_lets_in_expression(call_exp->function);
+        for (node = call_exp->arguments->head; node != NULL; node = node->next)
+            count += count_lets_in_expression((expression_t *) node->data);
+        return count;
+    case ARRAY_LITERAL:
+        array_exp = (array_literal_t *) exp;
+        for (size_t i = 0; i < array_exp->elements->length; i++)
+            count += count_lets_in_expression(array_exp->elements->array[i]);
+        return count;
+    case INDEX_EXPRESSION:
+        index_exp = (index_expression_t *) exp;
+        return count_lets_in_expression(index_exp->left) +
+            count_lets_in_expression(index_exp->index);
+    case HASH_LITERAL:
+        hash_exp = (hash_literal_t *) exp;
+        keys = cm_hash_table_get_keys(hash_exp->pairs);
+        if (keys == NULL)
+            return 0;
+        for (size_t i = 0; i < keys->length; i++) {
+            count += count_lets_in_expression(keys->array[i]);
+            count += count_lets_in_expression(cm_hash_table_get(hash_exp->pairs, keys->array[i]));
+        }
+        cm_array_list_free(keys);
+        return count;
+    default:
+        return 0;
+    }
+}
+
+static compiler_error_t
+load_symbol(regcompiler_t *compiler, symbol_t *symbol, size_t dst)
+{
+    compiler_error_t none_error = {COMPILER_ERROR_NONE, NULL};
+    switch (symbol->scope) {
+    case GLOBAL:
+        emit_abx(compiler, RGETGLOBAL, dst, symbol->index);
+        break;
+    case LOCAL:
+        if (symbol->index != dst)
+            emit_abc(compiler, RMOVE, dst, symbol->index, 0);
+        break;
+    case BUILTIN:
+        emit_abc(compiler, RGETBUILTIN, dst, symbol->index, 0);
+        break;
+    case FREE:
+        emit_abc(compiler, RGETFREE, dst, symbol->index, 0);
+        break;
+    case FUNCTION_SCOPE:
+        emit_abc(compiler, RCURRENTCLOSURE, dst, 0, 0);
+        break;
+    }
+    return none_error;
+}
+
+static compiler_error_t
+resolve_identifier(regcompiler_t *compiler, identifier_t *ident_exp, symbol_t **sym)
+{
+    compiler_error_t error = {COMPILER_ERROR_NONE, NULL};
+    *sym = symbol_resolve(compiler->symbol_table, ident_exp->value);
+    if (*sym == NULL) {
+        error.code = COMPILER_UNDEFINED_VARIABLE;
+        error.msg = get_err_msg("undefined variable: %s\n", ident_exp->value);
+    }
+    return error;
+}
+
+/*
+ * Compiles the expression into some register and returns it in reg. Local
+ * variables are used in place, anything else goes into a new temporary
+ * which stays allocated for the caller to release.
+ */
+static compiler_error_t
+compile_expression_any(regcompiler_t *compiler, expression_t *exp, size_t *reg)
+{
+    compiler_error_t error;
+    symbol_t *sym;
+    if (exp->expression_type == IDENTIFIER_EXPRESSION) {
+        error = resolve_identifier(compiler, (identifier_t *) exp, &sym);
+        if (error.code != COMPILER_ERROR_NONE)
+            return error;
+        if (sym->scope == LOCAL) {
+            *reg = sym->index;
+            return error;
+        }
+    }
+    error = alloc_temps(compiler, 1, reg);
+    if (error.code != COMPILER_ERROR_NONE)
+        return error;
+    return compile_expression_to(compiler, exp, *reg);
+}
+
+/*
+ * Like compile_expression_any, but for an operand that is read only after
+ * rest has run. A let in rest can rebind a local to its own register, so in
+ * that case the local is copied into a temporary first.
+ */
+static compiler_error_t
+compile_operand_any(regcompiler_t *compiler, expression_t *exp, expression_t *rest,
+    size_t *reg)
+{
+    compiler_error_t error;
+    if (count_lets_in_expression(rest) == 0)
+        return compile_expression_any(compiler, exp, reg);
+    error = alloc_temps(compiler, 1, reg);
+    if (error.code != COMPILER_ERROR_NONE)
+        return error;
+    return compile_expression_to(compiler, exp, *reg);
+}
+
+static compiler_error_t
+compile_block_to(regcompiler_t *compiler, block_statement_t *block, size_t dst)
+{
+    compiler_error_t error = {COMPILER_ERROR_NONE, NULL};
+    statement_t *stmt;
+    for (size_t i = 0; i < block->nstatements; i++) {
+        stmt = block->statements[i];
+        if (i == block->nstatements - 1 && stmt->statement_type == EXPRESSION_STATEMENT)
+            return compile_expression_to(compiler,
+                ((expression_statement_t *) stmt)->expression, dst);
+        error = compile_statement(compiler, stmt);
+        if (error.code != COMPILER_ERROR_NONE)
+            return error;
+    }
+    emit_abc(compiler, RLOADNULL, dst, 0, 0);
+    return error;
+}
+
+/*
+ * && and || short-circuit: the right side is only run when the left one
+ * does not settle the result, which is then false for && and true for ||.
+ */
+static compiler_error_t
+compile_logical_to(regcompiler_t *compiler, infix_expression_t *infix_exp, size_t dst)
+{
+    compiler_error_t error;
+    size_t left, jmpfalse_pos, jmp_pos;
+    _Bool is_and = infix_exp->op == AND;
+    size_t mark = compiler->scope->next_temp;
+    error = compile_expression_any(compiler, infix_exp->left, &left);
+    if (error.code != COMPILER_ERROR_NONE)
+        return error;
+    release_temps(compiler, mark);
+    jmpfalse_pos = emit_abx(compiler, RJMPFALSE, left, 0);
+    if (is_and)
+        error = compile_expression_to(compiler, infix_exp->right, dst);
+    else
+        emit_abc(compiler, RLOADTRUE, dst, 0, 0);
+    if (error.code != COMPILER_ERROR_NONE)
+        return error;
+    jmp_pos = emit_abx(compiler, RJMP, 0, 0);
+    patch_bx(compiler, jmpfalse_pos, compiler->scope->length);
+    if (is_and)
+        emit_abc(compiler, RLOADFALSE, dst, 0, 0);
+    else
+        error = compile_expression_to(compiler, infix_exp->right, dst);
+    if (error.code != COMPILER_ERROR_NONE)
+        return error;
+    patch_bx(compiler, jmp_pos, compiler->scope->length);
+    return check_wide_operand(compiler->scope->length, "instructions");
+}
+
+static compiler_error_t
+compile_infix_to(regcompiler_t *compiler, infix_expression_t *infix_exp, size_t dst)
+{
+    compiler_error_t error;
+    size_t left, right;
+    regopcode_t op;
+    switch (infix_exp->op) {
+    case AND:
+    case OR:
+        return compile_logical_to(compiler, infix_exp, dst);
+    case PLUS:
+        op = RADD;
+        break;
+    case MINUS:
+        op = RSUB;
+        break;
+    case ASTERISK:
+        op = RMUL;
+        break;
+    case SLASH:
+        op = RDIV;
+        break;
+    case PERCENT:
+        op = RMOD;
+        break;
+    case LT:
+        op = RLESSTHAN;
+        break;
+    case GT:
+        op = RGREATERTHAN;
+        break;
+    case LT_EQ:
+        op = RLESSEQUAL;
+        break;
+    case GT_EQ:
+        op = RGREATEREQUAL;
+        break;
+    case EQ:
+        op = REQUAL;
+        break;
+    case NOT_EQ:
+        op = RNOTEQUAL;
+        break;
+    default:
+        error.code = COMPILER_UNKNOWN_OPERATOR;
+        error.msg = get_err_msg("Unknown operator %s", infix_exp->operator);
+        return error;
+    }
+    size_t mark = compiler->scope->next_temp;
+    error = compile_operand_any(compiler, infix_exp->left, infix_exp->right, &left);
+    if (error.code != COMPILER_ERROR_NONE)
+        return error;
+    error = compile_expression_any(compiler, infix_exp->right, &right);
+    if (error.code != COMPILER_ERROR_NONE)
+        return error;
+    emit_abc(compiler, op, dst, left, right);
+    release_temps(compiler, mark);
+    return error;
+}
+
+static compiler_error_t
+compile_if_to(regcompiler_t *compiler, if_expression_t *if_exp, size_t dst)
+{
+    compiler_error_t error;
+    size_t condition, jmpfalse_pos, jmp_pos;
+    size_t mark = compiler->scope->next_temp;
+    error = compile_expression_any(compiler, if_exp->condition, &condition);
+    if (error.code != COMPILER_ERROR_NONE)
+        return error;
+    release_temps(compiler, mark);
+    jmpfalse_pos = emit_abx(compiler, RJMPFALSE, condition, 0);
+    error = compile_block_to(compiler, if_exp->consequence, dst);
+    if (error.code != COMPILER_ERROR_NONE)
+        return error;
+    jmp_pos = emit_abx(compiler, RJMP, 0, 0);
+    patch_bx(compiler, jmpfalse_pos, compiler->scope->length);
+    if (if_exp->alternative != NULL)
+        error = compile_block_to(compiler, if_exp->alternative, dst);
+    else
+        emit_abc(compiler, RLOADNULL, dst, 0, 0);
+    if (error.code != COMPILER_ERROR_NONE)
+        return error;
+    patch_bx(compiler, jmp_pos, compiler->scope->length);
+    return check_wide_operand(compiler->scope->length, "instructions");
+}
+
+/*
+ * The value of the last run of the body is kept in a temporary until the
+ * loop is done, so that binding the loop with let to a variable the loop
+ * reads only replaces the variable at the end.
+ */
+static compiler_error_t
+compile_while_to(regcompiler_t *compiler, while_expression_t *while_exp, size_t dst)
+{
+    compiler_error_t error;
+    size_t value, condition, loop_start, jmpfalse_pos, body_mark;
+    size_t mark = compiler->scope->next_temp;
+    error = alloc_temps(compiler, 1, &value);
+    if (error.code != COMPILER_ERROR_NONE)
+        return error;
+    emit_abc(compiler, RLOADNULL, value, 0, 0);
+    loop_start = compiler->scope->length;
+    body_mark = compiler->scope->next_temp;
+    error = compile_expression_any(compiler, while_exp->condition, &condition);
+    if (error.code != COMPILER_ERROR_NONE)
+        return error;
+    release_temps(compiler, body_mark);
+    jmpfalse_pos = emit_abx(compiler, RJMPFALSE, condition, 0);
+    error = compile_block_to(compiler, while_exp->body, value);
+    if (error.code != COMPILER_ERROR_NONE)
+        return error;
+    emit_abx(compiler, RJMP, 0, loop_start);
+    patch_bx(compiler, jmpfalse_pos, compiler->scope->length);
+    emit_abc(compiler, RMOVE, dst, value, 0);
+    release_temps(compiler, mark);
+    return check_wide_operand(compiler->scope->length, "instructions");
+}
+
+static int
+compare_hash_keys(const void *v1, const void *v2)
+{
+    node_t *n1 = (node_t *) v1;
+    node_t *n2 = (node_t *) v2;
+    char *s1 = n1->string(n1);
+    char *s2 = n2->string(n2);
+    int ret = strcmp(s1, s2);
+    free(s1);
+    free(s2);
+    return ret;
+}
+
+static compiler_error_t
+compile_hash_to(regcompiler_t *compiler, hash_literal_t *hash_exp, size_t dst)
+{
+    compiler_error_t error = {COMPILER_ERROR_NONE, NULL};
+    size_t base = 0;
+    size_t mark = compiler->scope->next_temp;
+    size_t nkeys = hash_exp->pairs->nkeys;
+    cm_array_list *keys = cm_hash_table_get_keys(hash_exp->pairs);
+    if (keys != NULL) {
+        error = alloc_temps(compiler, 2 * nkeys, &base);
+        if (error.code != COMPILER_ERROR_NONE) {
+            cm_array_list_free(keys);
+            return error;
+        }
+        cm_array_list_sort(keys, sizeof(node_t *), compare_hash_keys);
+        for (size_t i = 0; i < keys->length; i++) {
+            expression_t *key = (expression_t *) cm_array_list_get(keys, i);
+            expression_t *value = (expression_t *) cm_hash_table_get(hash_exp->pairs, key);
+            error = compile_expression_to(compiler, key, base + 2 * i);
+            if (error.code == COMPILER_ERROR_NONE)
+                error = compile_expression_to(compiler, value, base + 2 * i + 1);
+            if (error.code != COMPILER_ERROR_NONE) {
+                cm_array_list_free(keys);
+                return error;
+            }
+        }
+        cm_array_list_free(keys);
+    }
+    emit_abc(compiler, RHASH, dst, base, 2 * nkeys);
+    release_temps(compiler, mark);
+    return error;
+}
+
+static compiler_error_t
+compile_call_to(regcompiler_t *compiler, call_expression_t *call_exp, size_t dst)
+{
+    compiler_error_t error;
+    size_t base;
+    size_t nargs = call_exp->arguments->length;
+    size_t mark = compiler->scope->next_temp;
+    cm_list_node *node;
+    /* the callee and the arguments must sit in consecutive registers */
+    error = alloc_temps(compiler, nargs + 1, &base);
+    if (error.code != COMPILER_ERROR_NONE)
+        return error;
+    error = compile_expression_to(compiler, call_exp->function, base);
+    if (error.code != COMPILER_ERROR_NONE)
+        return error;
+    size_t i = 1;
+    for (node = call_exp->arguments->head; node != NULL; node = node->next) {
+        error = compile_expression_to(compiler, (expression_t *) node->data, base + i++);
+        if (error.code != COMPILER_ERROR_NONE)
+            return error;
+    }
+    emit_abc(compiler, RCALL, base, nargs, 0);
+    if (base != dst)
+        emit_abc(compiler, RMOVE, dst, base, 0);
+    release_temps(compiler, mark);
+    return error;
+}
+
+static compiler_error_t
+compile_function_to(regcompiler_t *compiler, function_literal_t *func_exp, size_t dst)
+{
+    compiler_error_t error;
+    size_t nparams = func_exp->parameters->length;
+    size_t nlocals = nparams + count_lets_in_statement((statement_t *) func_exp->body);
+    if (nlocals > MAX_REGISTERS) {
+        error.code = COMPILER_TOO_MANY_REGISTERS;
+        error.msg = get_err_msg("function has more than %d locals", MAX_REGISTERS);
+        return error;
+    }
+    compiler->scope = regscope_init(compiler->scope, nlocals);
+    compiler->symbol_table = enclosed_symbol_table_init(compiler->symbol_table);
+    if (func_exp->name != NULL)
+        symbol_define_function(compiler->symbol_table, func_exp->name);
+    cm_list_node *param_list_node = func_exp->parameters->head;
+    while (param_list_node != NULL) {
+        identifier_t *param = (identifier_t *) param_list_node->data;
+        symbol_define(compiler->symbol_table, param->value);
+        param_list_node = param_list_node->next;
+    }
+
+    block_statement_t *body = func_exp->body;
+    for (size_t i = 0; i < body->nstatements; i++) {
+        statement_t *stmt = body->statements[i];
+        if (i == body->nstatements - 1 && stmt->statement_type == EXPRESSION_STATEMENT) {
+            size_t reg;
+            error = compile_expression_any(compiler,
+                ((expression_statement_t *) stmt)->expression, &reg);
+            if (error.code != COMPILER_ERROR_NONE)
+                return error;
+            emit_abc(compiler, RRETURN, reg, 0, 0);
+        } else {
+            error = compile_statement(compiler, stmt);
+            if (error.code != COMPILER_ERROR_NONE)
+                return error;
+        }
+    }
+    if (body->nstatements == 0 ||
+        body->statements[body->nstatements - 1]->statement_type != EXPRESSION_STATEMENT)
+        emit_abc(compiler, RRETURNNULL, 0, 0, 0);
+
+    regcompilation_scope_t *scope = compiler->scope;
+    symbol_table_t *table = compiler->symbol_table;
+    instructions_t *ins = malloc(sizeof(*ins));
+    if (ins == NULL)
+        err(EXIT_FAILURE, "malloc failed");
+    ins->length = scope->length * sizeof(reginstruction_t);
+    ins->size = ins->length;
+    ins->mapped = false;
+    ins->bytes = (uint8_t *) scope->code;
+    scope->code = NULL;
+    monkey_compiled_fn_t *compiled_fn = create_monkey_compiled_fn(ins,
+        scope->max_registers, nparams);
+    compiler->scope = scope->outer;
+    compiler->symbol_table = table->outer;
+    regscope_free(scope);
+
+    size_t free_base = 0;
+    size_t nfree = table->free_symbols->length;
+    size_t mark = compiler->scope->next_temp;
+    error = alloc_temps(compiler, nfree, &free_base);
+    if (error.code != COMPILER_ERROR_NONE) {
+        free_symbol_table(table);
+        free_monkey_object(compiled_fn);
+        return error;
+    }
+    for (size_t i = 0; i < nfree; i++)
+        load_symbol(compiler, cm_array_list_get(table->free_symbols, i), free_base + i);
+    free_symbol_table(table);
+    size_t constant_idx = add_constant(compiler, (monkey_object_t *) compiled_fn);
+    error = check_wide_operand(constant_idx, "constants");
+    if (error.code != COMPILER_ERROR_NONE)
+        return error;
+    emit_abx(compiler, RCLOSURE, dst, constant_idx);
+    emit_abc(compiler, 0, 0, free_base, nfree);
+    release_temps(compiler, mark);
+    return error;
+}
+
+static compiler_error_t
+compile_expression_to(regcompiler_t *compiler, expression_t *exp, size_t dst)
+{
+    compiler_error_t error = {COMPILER_ERROR_NONE, NULL};
+    prefix_expression_t *prefix_exp;
+    string_t *str_exp;
+    array_literal_t *array_exp;
+    index_expression_t *index_exp;
+    symbol_t *sym;
+    size_t constant_idx, reg, base, left;
+    size_t mark = compiler->scope->next_temp;
+    switch (exp->expression_type) {
+    case INTEGER_EXPRESSION:
+        constant_idx = add_constant(compiler,
+            (monkey_object_t *) create_monkey_int(((integer_t *) exp)->value));
+        error = check_wide_operand(constant_idx, "constants");
+        if (error.code != COMPILER_ERROR_NONE)
+            return error;
+        emit_abx(compiler, RLOADK, dst, constant_idx);
+        break;
+    case STRING_EXPRESSION:
+        str_exp = (string_t *) exp;
+        constant_idx = add_constant(compiler,
+            (monkey_object_t *) create_monkey_string(str_exp->value, strlen(str_exp->value)));
+        error = check_wide_operand(constant_idx, "constants");
+        if (error.code != COMPILER_ERROR_NONE)
+            return error;
+        emit_abx(compiler, RLOADK, dst, constant_idx);
+        break;
+    case BOOLEAN_EXPRESSION:
+        if (((boolean_expression_t *) exp)->value)
+            emit_abc(compiler, RLOADTRUE, dst, 0, 0);
+        else
+            emit_abc(compiler, RLOADFALSE, dst, 0, 0);
+        break;
+    case IDENTIFIER_EXPRESSION:
+        error = resolve_identifier(compiler, (identifier_t *) exp, &sym);
+        if (error.code != COMPILER_ERROR_NONE)
+            return error;
+        return load_symbol(compiler, sym, dst);
+    case PREFIX_EXPRESSION:
+        prefix_exp = (prefix_expression_t *) exp;
+        if (prefix_exp->op != MINUS && prefix_exp->op != BANG) {
+            error.code = COMPILER_UNKNOWN_OPERATOR;
+            error.msg = get_err_msg("Unknown operator %s", prefix_exp->operator);
+            return error;
+        }
+        error = compile_expression_any(compiler, prefix_exp->right, &reg);
+        if (error.code != COMPILER_ERROR_NONE)
+            return error;
+        emit_abc(compiler, prefix_exp->op == MINUS? RMINUS: RBANG, dst, reg, 0);
+        break;
+    case INFIX_EXPRESSION:
+        return compile_infix_to(compiler, (infix_expression_t *) exp, dst);
+    case IF_EXPRESSION:
+        return compile_if_to(compiler, (if_expression_t *) exp, dst);
+    case WHILE_EXPRESSION:
+        return compile_while_to(compiler, (while_expression_t *) exp, dst);
+    case ARRAY_LITERAL:
+        array_exp = (array_literal_t *) exp;
+        error = alloc_temps(compiler, array_exp->elements->length, &base);
+        if (error.code != COMPILER_ERROR_NONE)
+            return error;
+        for (size_t i = 0; i < array_exp->elements->length; i++) {
+            error = compile_expression_to(compiler, array_exp->elements->array[i], base + i);
+            if (error.code != COMPILER_ERROR_NONE)
+                return error;
+        }
+        emit_abc(compiler, RARRAY, dst, base, array_exp->elements->length);
+        break;
+    case HASH_LITERAL:
+        return compile_hash_to(compiler, (hash_literal_t *) exp, dst);
+    case INDEX_EXPRESSION:
+        index_exp = (index_expression_t *) exp;
+        error = compile_operand_any(compiler, index_exp->left, index_exp->index, &left);
+        if (error.code != COMPILER_ERROR_NONE)
+            return error;
+        error = compile_expression_any(compiler, index_exp->index, &reg);
+        if (error.code != COMPILER_ERROR_NONE)
+            return error;
+        emit_abc(compiler, RINDEX, dst, left, reg);
+        break;
+    case FUNCTION_LITERAL:
+        return compile_function_to(compiler, (function_literal_t *) exp, dst);
+    case CALL_EXPRESSION:
+        return compile_call_to(compiler, (call_expression_t *) exp, dst);
+    default:
+        error.code = COMPILER_UNKNOWN_OPERATOR;
+        error.msg = get_err_msg("expression type %d not supported by the register backend",
+            (int) exp->expression_type);
+        return error;
+    }
+    release_temps(compiler, mark);
+    return error;
+}
+
+static compiler_error_t
+compile_statement(regcompiler_t *compiler, statement_t *statement)
+{
+    compiler_error_t error = {COMPILER_ERROR_NONE, NULL};
+    letstatement_t *let_stmt;
+    block_statement_t *block_stmt;
+    symbol_t *sym;
+    size_t reg;
+    size_t mark = compiler->scope->next_temp;
+    switch (statement->statement_type) {
+    case EXPRESSION_STATEMENT:
+        error = compile_expression_any(compiler,
+            ((expression_statement_t *) statement)->expression, &reg);
+        if (error.code != COMPILER_ERROR_NONE)
+            return error;
+        /* only the main program needs the value of a statement */
+        if (compiler->scope->outer == NULL)
+            emit_abc(compiler, RPOP, reg, 0, 0);
+        break;
+    case LET_STATEMENT:
+        let_stmt = (letstatement_t *) statement;
+        sym = symbol_bind(compiler->symbol_table, let_stmt->name->value);
+        if (sym->scope == GLOBAL) {
+            error = compile_expression_any(compiler, let_stmt->value, &reg);
+            if (error.code != COMPILER_ERROR_NONE)
+                return error;
+            emit_abx(compiler, RSETGLOBAL, reg, sym->index);
+        } else {
+            error = compile_expression_to(compiler, let_stmt->value, sym->index);
+            if (error.code != COMPILER_ERROR_NONE)
+                return error;
+        }
+        break;
+    case RETURN_STATEMENT:
+        error = compile_expression_any(compiler,
+            ((return_statement_t *) statement)->return_value, &reg);
+        if (error.code != COMPILER_ERROR_NONE)
+            return error;
+        emit_abc(compiler, RRETURN, reg, 0, 0);
+        break;
+    case BLOCK_STATEMENT:
+        block_stmt = (block_statement_t *) statement;
+        for (size_t i = 0; i < block_stmt->nstatements; i++) {
+            error = compile_statement(compiler, block_stmt->statements[i]);
+            if (error.code != COMPILER_ERROR_NONE)
+                return error;
+        }
+        break;
+    }
+    release_temps(compiler, mark);
+    return error;
+}
+
+compiler_error_t
+regcompile(regcompiler_t *compiler, program_t *program)
+{
+    compiler_error_t error = {COMPILER_ERROR_NONE, NULL};
+    for (size_t i = 0; i < program->nstatements; i++) {
+        error = compile_statement(compiler, program->statements[i]);
+        if (error.code != COMPILER_ERROR_NONE)
+            return error;
+    }
+    return error;
+}
+
+/*
+ * The instructions of the main program are returned in the bytecode. The main
+ * program always gets a window of MAX_REGISTERS registers in the vm.
+ */
+bytecode_t *
+regcompiler_get_bytecode(regcompiler_t *compiler)
+{
+    bytecode_t *bytecode;
+    instructions_t *ins;
+    bytecode = malloc(sizeof(*bytecode));
+    if (bytecode == NULL)
+        err(EXIT_FAILURE, "malloc failed");
+    ins = malloc(sizeof(*ins));
+    if (ins == NULL)
+        err(EXIT_FAILURE, "malloc failed");
+    ins->length = compiler->scope->length * sizeof(reginstruction_t);
+    ins->size = ins->length;
+    ins->mapped = false;
+    ins->bytes = malloc(ins->length == 0? 1: ins->length);
+    if (ins->bytes == NULL)
+        err(EXIT_FAILURE, "malloc failed");
+    memcpy(ins->bytes, compiler->scope->code, ins->length);
+    bytecode->instructions = ins;
+    bytecode->constants_pool = compiler->constants_pool;
+    bytecode->num_globals = compiler->symbol_table->nentries;
+    return bytecode;
+}
+
+char *
+reginstructions_to_string(instructions_t *instructions)
+{
+    char *string = NULL;
+    char *temp = NULL;
+    reginstruction_t *code = (reginstruction_t *) instructions->bytes;
+    size_t count = get_reginstructions_count(instructions);
+    for (size_t i = 0; i < count; i++) {
+        reginstruction_t ins = code[i];
+        regopcode_t op = REG_OP(ins);
+        int retval;
+        if (op < RLOADK || op > RPOP)
+            retval = asprintf(&temp, "%s%04zu INVALID %u", string? string: "", i, op);
+        else {
+            regopcode_definition_t op_def = regopcode_definition_lookup(op);
+            switch (op) {
+            case RLOADK:
+            case RGETGLOBAL:
+            case RSETGLOBAL:
+            case RJMPFALSE:
+                retval = asprintf(&temp, "%s%04zu %s %u %u\n", string? string: "", i,
+                    op_def.name, REG_A(ins), REG_BX(ins));
+                break;
+            case RJMP:
+                retval = asprintf(&temp, "%s%04zu %s %u\n", string? string: "", i,
+                    op_def.name, REG_BX(ins));
+                break;
+            case RCLOSURE:
+                retval = asprintf(&temp, "%s%04zu %s %u %u %u %u\n", string? string: "", i,
+                    op_def.name, REG_A(ins), REG_BX(ins), REG_B(code[i + 1]), REG_C(code[i + 1]));
+                i++;
+                break;
+            default:
+                retval = asprintf(&temp, "%s%04zu %s %u %u %u\n", string? string: "", i,
+                    op_def.name, REG_A(ins), REG_B(ins), REG_C(ins));
+                break;
+            }
+        }
+        if (retval == -1)
+            err(EXIT_FAILURE, "malloc failed");
+        free(string);
+        string = temp;
+    }
+    return string? string: strdup("");
+}
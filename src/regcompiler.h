@@ -0,0 +1,136 @@
+/*-
+ * Copyright (c) 2019 Abhinav Upadhyay <er.abhinav.upadhyay@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef REGCOMPILER_H
+#define REGCOMPILER_H
+
+#include <stdint.h>
+
+#include "ast.h"
+#include "cmonkey_utils.h"
+#include "compiler.h"
+#include "object.h"
+#include "symbol_table.h"
+
+/*
+ * Register machine backend.
+ *
+ * Every instruction is a 32 bit word: the opcode in the low 8 bits followed
+ * by three 8 bit operands A, B and C, or by A and a 16 bit operand Bx which
+ * takes the place of B and C. Registers are numbered per function: the
+ * parameters come first, then the let bindings of the function, then the
+ * temporaries. Globals, constants and free variables are addressed by Bx
+ * or B the same way the stack machine addresses them.
+ *
+ * The code of a function is stored in the bytes of the instructions_t of a
+ * monkey_compiled_fn_t, with num_locals holding the number of registers the
+ * function needs.
+ */
+typedef uint32_t reginstruction_t;
+
+#define MAX_REGISTERS 256
+
+#define REG_OP(i) ((i) & 0xff)
+#define REG_A(i) (((i) >> 8) & 0xff)
+#define REG_B(i) (((i) >> 16) & 0xff)
+#define REG_C(i) (((i) >> 24) & 0xff)
+#define REG_BX(i) ((i) >> 16)
+#define REG_ABC(op, a, b, c) ((reginstruction_t) (op) | ((reginstruction_t) (a) << 8) | \
+    ((reginstruction_t) (b) << 16) | ((reginstruction_t) (c) << 24))
+#define REG_ABX(op, a, bx) ((reginstruction_t) (op) | ((reginstruction_t) (a) << 8) | \
+    ((reginstruction_t) (bx) << 16))
+
+typedef enum regopcode_t {
+    RLOADK = 1,     // R[A] = K[Bx]
+    RLOADTRUE,      // R[A] = true
+    RLOADFALSE,     // R[A] = false
+    RLOADNULL,      // R[A] = null
+    RMOVE,          // R[A] = R[B]
+    RGETGLOBAL,     // R[A] = G[Bx]
+    RSETGLOBAL,     // G[Bx] = R[A]
+    RGETFREE,       // R[A] = free_variables[B]
+    RGETBUILTIN,    // R[A] = builtins[B]
+    RCURRENTCLOSURE,// R[A] = current closure
+    RADD,           // R[A] = R[B] + R[C]
+    RSUB,           // R[A] = R[B] - R[C]
+    RMUL,           // R[A] = R[B] * R[C]
+    RDIV,           // R[A] = R[B] / R[C]
+    RMOD,           // R[A] = R[B] % R[C]
+    REQUAL,         // R[A] = R[B] == R[C]
+    RNOTEQUAL,      // R[A] = R[B] != R[C]
+    RGREATERTHAN,   // R[A] = R[B] > R[C]
+    RLESSTHAN,      // R[A] = R[B] < R[C]
+    RLESSEQUAL,     // R[A] = R[B] <= R[C]
+    RGREATEREQUAL,  // R[A] = R[B] >= R[C]
+    RMINUS,         // R[A] = -R[B]
+    RBANG,          // R[A] = !R[B]
+    RJMP,           // ip = Bx
+    RJMPFALSE,      // if !R[A] then ip = Bx
+    RARRAY,         // R[A] = [R[B], ... R[B + C - 1]]
+    RHASH,          // R[A] = {R[B]: R[B + 1], ... } with C keys and values
+    RINDEX,         // R[A] = R[B][R[C]]
+    RCALL,          // R[A] = R[A](R[A + 1], ... R[A + B])
+    RRETURN,        // return R[A]
+    RRETURNNULL,    // return null
+    RCLOSURE,       // R[A] = closure(K[Bx]), next word: free variables in R[B] .. R[B + C - 1]
+    RPOP            // last popped value = R[A]
+} regopcode_t;
+
+typedef struct regopcode_definition_t {
+    const char *name;
+    const char *desc;
+} regopcode_definition_t;
+
+extern const regopcode_definition_t regopcode_definitions[];
+
+#define regopcode_definition_lookup(op) regopcode_definitions[(op) - 1]
+
+typedef struct regcompilation_scope_t {
+    struct regcompilation_scope_t *outer;
+    reginstruction_t *code;
+    size_t length;
+    size_t size;
+    size_t first_temp; // registers below this one belong to parameters and locals
+    size_t next_temp;
+    size_t max_registers;
+} regcompilation_scope_t;
+
+typedef struct regcompiler_t {
+    cm_array_list *constants_pool;
+    symbol_table_t *symbol_table;
+    regcompilation_scope_t *scope;
+} regcompiler_t;
+
+regcompiler_t *regcompiler_init(void);
+void regcompiler_free(regcompiler_t *);
+compiler_error_t regcompile(regcompiler_t *, program_t *);
+bytecode_t *regcompiler_get_bytecode(regcompiler_t *);
+char *reginstructions_to_string(instructions_t *);
+#define get_reginstructions_count(ins) ((ins)->length / sizeof(reginstruction_t))
+#endif
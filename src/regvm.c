@@ -0,0 +1,724 @@
+/*-
+ * Copyright (c) 2019 Abhinav Upadhyay <er.abhinav.upadhyay@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <err.h>
+#include <stdarg.h>
+#include <stdlib.h>
+
+#include "builtins.h"
+#include "object.h"
+#include "regcompiler.h"
+#include "regvm.h"
+
+static char *
+get_err_msg(const char *s, ...)
+{
+    char *msg = NULL;
+    va_list ap;
+    va_start(ap, s);
+    int retval = vasprintf(&msg, s, ap);
+    va_end(ap);
+    if (retval == -1)
+        err(EXIT_FAILURE, "malloc failed");
+    return msg;
+}
+
+#define get_current_frame(vm) (&vm->frames[vm->frame_index - 1])
+
+static regframe_t *
+push_frame(regvm_t *vm)
+{
+    if (vm->frame_index == vm->frames_size) {
+        if (vm->frames_size == MAX_FRAMES)
+            return NULL;
+        vm->frames_size *= 2;
+        if (vm->frames_size > MAX_FRAMES)
+            vm->frames_size = MAX_FRAMES;
+        vm->frames = reallocarray(vm->frames, vm->frames_size, sizeof(*vm->frames));
+        if (vm->frames == NULL)
+            err(EXIT_FAILURE, "malloc failed");
+    }
+    return &vm->frames[vm->frame_index++];
+}
+
+static void
+regframe_init(regframe_t *frame, monkey_closure_t *cl, size_t base)
+{
+    frame->cl = cl;
+    frame->code = (reginstruction_t *) cl->fn->instructions->bytes;
+    frame->ncode = get_reginstructions_count(cl->fn->instructions);
+    frame->ip = 0;
+    frame->base = base;
+}
+
+/*
+ * Every register holds a reference of its own, unused registers hold null.
+ */
+static void
+ensure_registers(regvm_t *vm, size_t count)
+{
+    size_t old_size = vm->registers_size;
+    if (count <= old_size)
+        return;
+    while (vm->registers_size < count)
+        vm->registers_size *= 2;
+    vm->registers = reallocarray(vm->registers, vm->registers_size, sizeof(*vm->registers));
+    if (vm->registers == NULL)
+        err(EXIT_FAILURE, "malloc failed");
+    for (size_t i = old_size; i < vm->registers_size; i++)
+        vm->registers[i] = (monkey_object_t *) create_monkey_null();
+}
+
+regvm_t *
+regvm_init(bytecode_t *bytecode)
+{
+    regvm_t *vm;
+    vm = malloc(sizeof(*vm));
+    if (vm == NULL)
+        err(EXIT_FAILURE, "malloc failed");
+    vm->registers = malloc(REGVM_INITIAL_REGISTERS * sizeof(*vm->registers));
+    if (vm->registers == NULL)
+        err(EXIT_FAILURE, "malloc failed");
+    vm->registers_size = REGVM_INITIAL_REGISTERS;
+    for (size_t i = 0; i < vm->registers_size; i++)
+        vm->registers[i] = (monkey_object_t *) create_monkey_null();
+    monkey_compiled_fn_t *main_fn = create_monkey_compiled_fn(bytecode->instructions,
+        MAX_REGISTERS, 0);
+    monkey_closure_t *main_closure = create_monkey_closure(main_fn, NULL, 0);
+    free_monkey_object(main_fn);
+    vm->frames = malloc(INITIAL_FRAMES * sizeof(*vm->frames));
+    if (vm->frames == NULL)
+        err(EXIT_FAILURE, "malloc failed");
+    vm->frames_size = INITIAL_FRAMES;
+    vm->frame_index = 0;
+    /* the main frame owns the only reference to main_closure */
+    regframe_init(push_frame(vm), main_closure, 0);
+    vm->constants = bytecode->constants_pool;
+    vm->globals_size = bytecode->num_globals;
+    vm->globals = calloc(vm->globals_size == 0? 1: vm->globals_size, sizeof(*vm->globals));
+    if (vm->globals == NULL)
+        err(EXIT_FAILURE, "malloc failed");
+    vm->last_popped = NULL;
+    return vm;
+}
+
+void
+regvm_free(regvm_t *vm)
+{
+    for (size_t i = 0; i < vm->registers_size; i++)
+        free_monkey_object(vm->registers[i]);
+    free(vm->registers);
+    for (size_t i = 0; i < vm->globals_size; i++) {
+        if (vm->globals[i] != NULL)
+            free_monkey_object(vm->globals[i]);
+    }
+    free(vm->globals);
+    if (vm->last_popped != NULL)
+        free_monkey_object(vm->last_popped);
+    /* other frames borrow their closure from the callee register */
+    free_monkey_object(vm->frames[0].cl);
+    free(vm->frames);
+    free(vm);
+}
+
+/*
+ * Returns the value of the last expression statement of the program, the
+ * caller takes over the reference.
+ */
+monkey_object_t *
+regvm_last_popped_stack_elem(regvm_t *vm)
+{
+    monkey_object_t *obj = vm->last_popped;
+    vm->last_popped = NULL;
+    return obj;
+}
+
+static monkey_object_t *
+load_constant(regvm_t *vm, size_t const_index)
+{
+    monkey_object_t *constant = cm_array_list_get(vm->constants, const_index);
+    if (constant->type == MONKEY_INT && fits_tagged_int(((monkey_int_t *) constant)->value))
+        return tag_int(((monkey_int_t *) constant)->value);
+    return copy_monkey_object(constant);
+}
+
+static vm_error_t
+execute_binary_op(regopcode_t op, monkey_object_t *left, monkey_object_t *right,
+    monkey_object_t **result)
+{
+    vm_error_t vm_err = {VM_ERROR_NONE, NULL};
+    regopcode_definition_t op_def = regopcode_definition_lookup(op);
+    char *str = NULL;
+    if (get_monkey_object_type(left) == MONKEY_INT && get_monkey_object_type(right) == MONKEY_INT) {
+        long leftval = get_monkey_int_value(left);
+        long rightval = get_monkey_int_value(right);
+        switch (op) {
+        case RADD:
+            *result = create_monkey_int_value(leftval + rightval);
+            break;
+        case RSUB:
+            *result = create_monkey_int_value(leftval - rightval);
+            break;
+        case RMUL:
+            *result = create_monkey_int_value(leftval * rightval);
+            break;
+        case RDIV:
+        case RMOD:
+            if (rightval == 0) {
+                vm_err.code = VM_DIVISION_BY_ZERO;
+                vm_err.msg = get_err_msg("division by 0 not allowed");
+                return vm_err;
+            }
+            /* LONG_MIN / -1 overflows, its quotient is its own negation */
+            if (rightval == -1)
+                *result = create_monkey_int_value(op == RDIV?
+                    (long) (0UL - (unsigned long) leftval): 0);
+            else
+                *result = create_monkey_int_value(op == RDIV?
+                    leftval / rightval: leftval % rightval);
+            break;
+        default:
+            vm_err.code = VM_UNSUPPORTED_OPERATOR;
+            vm_err.msg = get_err_msg("opcode %s not supported for integer operands", op_def.name);
+        }
+    } else if (get_monkey_object_type(left) == MONKEY_STRING &&
+        get_monkey_object_type(right) == MONKEY_STRING) {
+        monkey_string_t *leftstr = (monkey_string_t *) left;
+        monkey_string_t *rightstr = (monkey_string_t *) right;
+        if (op != RADD) {
+            vm_err.code = VM_UNSUPPORTED_OPERATOR;
+            vm_err.msg = get_err_msg("opcode %s not support for string operands", op_def.name);
+            return vm_err;
+        }
+        if ((asprintf(&str, "%s%s", leftstr->value, rightstr->value)) == -1)
+            err(EXIT_FAILURE, "malloc failed");
+        *result = (monkey_object_t *) create_monkey_string(str,
+            leftstr->length + rightstr->length);
+        free(str);
+    } else {
+        vm_err.code = VM_UNSUPPORTED_OPERAND;
+        vm_err.msg = get_err_msg("'%s' operation not supported with types %s and %s",
+            op_def.desc, get_type_name(get_monkey_object_type(left)),
+            get_type_name(get_monkey_object_type(right)));
+    }
+    return vm_err;
+}
+
+static vm_error_t
+execute_comparison_op(regopcode_t op, monkey_object_t *left, monkey_object_t *right,
+    monkey_object_t **result)
+{
+    vm_error_t vm_err = {VM_ERROR_NONE, NULL};
+    _Bool value = false;
+    if (get_monkey_object_type(left) == MONKEY_INT && get_monkey_object_type(right) == MONKEY_INT) {
+        long leftval = get_monkey_int_value(left);
+        long rightval = get_monkey_int_value(right);
+        if (op == RGREATERTHAN)
+            value = leftval > rightval;
+        else if (op == RLESSTHAN)
+            value = leftval < rightval;
+        else if (op == RLESSEQUAL)
+            value = leftval <= rightval;
+        else if (op == RGREATEREQUAL)
+            value = leftval >= rightval;
+        else if (op == REQUAL)
+            value = leftval == rightval;
+        else
+            value = leftval != rightval;
+    } else if (get_monkey_object_type(left) == MONKEY_BOOL &&
+        get_monkey_object_type(right) == MONKEY_BOOL) {
+        if (op == REQUAL)
+            value = left == right;
+        else if (op == RNOTEQUAL)
+            value = left != right;
+    } else {
+        vm_err.code = VM_UNSUPPORTED_OPERAND;
+        vm_err.msg = get_err_msg("Unsupported operand types %s and %s",
+            get_type_name(get_monkey_object_type(left)),
+            get_type_name(get_monkey_object_type(right)));
+        return vm_err;
+    }
+    *result = (monkey_object_t *) create_monkey_bool(value);
+    return vm_err;
+}
+
+static vm_error_t
+execute_bang_operator(monkey_object_t *operand, monkey_object_t **result)
+{
+    vm_error_t vm_err = {VM_ERROR_NONE, NULL};
+    if (get_monkey_object_type(operand) == MONKEY_NULL)
+        *result = (monkey_object_t *) create_monkey_bool(true);
+    else if (get_monkey_object_type(operand) == MONKEY_BOOL)
+        *result = (monkey_object_t *) create_monkey_bool(!((monkey_bool_t *) operand)->value);
+    else {
+        vm_err.code = VM_UNSUPPORTED_OPERAND;
+        vm_err.msg = get_err_msg("'!' operator not supported for %s type operands",
+            get_type_name(get_monkey_object_type(operand)));
+    }
+    return vm_err;
+}
+
+static vm_error_t
+execute_minus_operator(monkey_object_t *operand, monkey_object_t **result)
+{
+    vm_error_t vm_err = {VM_ERROR_NONE, NULL};
+    if (get_monkey_object_type(operand) != MONKEY_INT) {
+        vm_err.code = VM_UNSUPPORTED_OPERAND;
+        vm_err.msg = get_err_msg("'-' operator not supported for %s type operands",
+            get_type_name(get_monkey_object_type(operand)));
+        return vm_err;
+    }
+    *result = create_monkey_int_value(-get_monkey_int_value(operand));
+    return vm_err;
+}
+
+static vm_error_t
+execute_index_expression(monkey_object_t *left, monkey_object_t *index,
+    monkey_object_t **result)
+{
+    vm_error_t vm_err = {VM_ERROR_NONE, NULL};
+    monkey_array_t *array;
+    monkey_string_t *str;
+    monkey_object_t *value;
+    long idx;
+    switch (get_monkey_object_type(left)) {
+    case MONKEY_ARRAY:
+        if (get_monkey_object_type(index) != MONKEY_INT) {
+            vm_err.code = VM_UNSUPPORTED_OPERATOR;
+            vm_err.msg = get_err_msg("unsupported index operator type %s for array object",
+                get_type_name(get_monkey_object_type(index)));
+            return vm_err;
+        }
+        array = (monkey_array_t *) left;
+        idx = get_monkey_int_value(index);
+        if (idx < 0 || idx >= array->elements->length)
+            *result = (monkey_object_t *) create_monkey_null();
+        else
+            *result = copy_monkey_object(cm_array_list_get(array->elements, idx));
+        return vm_err;
+    case MONKEY_STRING:
+        if (get_monkey_object_type(index) != MONKEY_INT) {
+            vm_err.code = VM_UNSUPPORTED_OPERATOR;
+            vm_err.msg = get_err_msg("unsupported index operator type %s for string object",
+                get_type_name(get_monkey_object_type(index)));
+            return vm_err;
+        }
+        str = (monkey_string_t *) left;
+        idx = get_monkey_int_value(index);
+        if (idx < 0 || (size_t) idx >= str->length)
+            *result = (monkey_object_t *) create_monkey_null();
+        else
+            *result = (monkey_object_t *) create_monkey_string(&str->value[idx], 1);
+        return vm_err;
+    case MONKEY_HASH:
+        value = cm_hash_table_get(((monkey_hash_t *) left)->pairs, index);
+        if (value == NULL)
+            *result = (monkey_object_t *) create_monkey_null();
+        else
+            *result = copy_monkey_object(value);
+        return vm_err;
+    default:
+        vm_err.code = VM_UNSUPPORTED_OPERATOR;
+        vm_err.msg = get_err_msg("index operator not supported for %s",
+            get_type_name(get_monkey_object_type(left)));
+        return vm_err;
+    }
+}
+
+static _Bool
+is_truthy(monkey_object_t *condition)
+{
+    if (is_tagged_int(condition))
+        return true;
+    switch (get_monkey_object_type(condition)) {
+    case MONKEY_BOOL:
+        return ((monkey_bool_t *) condition)->value;
+    case MONKEY_NULL:
+        return false;
+    default:
+        return true;
+    }
+}
+
+static monkey_object_t *
+build_array(monkey_object_t **regs, size_t size)
+{
+    cm_array_list *list = cm_array_list_init(size, NULL);
+    for (size_t i = 0; i < size; i++)
+        cm_array_list_add(list, copy_monkey_object(regs[i]));
+    return (monkey_object_t *) create_monkey_array(list);
+}
+
+static monkey_object_t *
+build_hash(monkey_object_t **regs, size_t size)
+{
+    cm_hash_table *table = cm_hash_table_init(monkey_object_hash,
+        monkey_object_equals, NULL, NULL);
+    for (size_t i = 0; i < size; i += 2)
+        cm_hash_table_put(table, copy_monkey_object(regs[i]), copy_monkey_object(regs[i + 1]));
+    return (monkey_object_t *) create_monkey_hash(table);
+}
+
+static vm_error_t
+build_closure(regvm_t *vm, size_t const_index, monkey_object_t **free_regs,
+    size_t num_free_vars, monkey_object_t **result)
+{
+    vm_error_t vm_err = {VM_ERROR_NONE, NULL};
+    monkey_object_t *obj = (monkey_object_t *) cm_array_list_get(vm->constants, const_index);
+    if (obj->type != MONKEY_COMPILED_FUNCTION) {
+        vm_err.code = VM_NON_FUNCTION;
+        vm_err.msg = get_err_msg("not a function: %s\n", get_type_name(obj->type));
+        return vm_err;
+    }
+    monkey_closure_t *closure = create_monkey_closure((monkey_compiled_fn_t *) obj,
+        free_regs, num_free_vars);
+    /* the registers keep their references */
+    for (size_t i = 0; i < num_free_vars; i++)
+        copy_monkey_object(closure->free_variables[i]);
+    *result = (monkey_object_t *) closure;
+    return vm_err;
+}
+
+/*
+ * Builtins borrow their arguments, the registers keep their references.
+ */
+static monkey_object_t *
+call_builtin(monkey_builtin_t *callee, monkey_object_t **args, size_t num_args)
+{
+    cm_list *arg_list = cm_list_init();
+    for (size_t i = 0; i < num_args; i++)
+        cm_list_add(arg_list, args[i]);
+    monkey_object_t *result = callee->function(arg_list);
+    cm_list_free(arg_list, NULL);
+    return result;
+}
+
+static vm_error_t
+call_closure(regvm_t *vm, monkey_closure_t *closure, size_t base, size_t num_args)
+{
+    vm_error_t vm_err = {VM_ERROR_NONE, NULL};
+    if (closure->fn->num_args != num_args) {
+        vm_err.code = VM_WRONG_NUMBER_ARGUMENTS;
+        vm_err.msg = get_err_msg("wrong number of arguments: want=%zu, got=%zu",
+            closure->fn->num_args, num_args);
+        return vm_err;
+    }
+    regframe_t *new_frame = push_frame(vm);
+    if (new_frame == NULL) {
+        vm_err.code = VM_STACKOVERFLOW;
+        vm_err.msg = get_err_msg("maximum call depth of %d exceeded", MAX_FRAMES);
+        return vm_err;
+    }
+    ensure_registers(vm, base + closure->fn->num_locals);
+    regframe_init(new_frame, closure, base);
+    return vm_err;
+}
+
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(VM_NO_COMPUTED_GOTO)
+#define VM_COMPUTED_GOTO
+#endif
+
+#ifdef VM_COMPUTED_GOTO
+#define VM_TARGET(op) TARGET_##op: case op
+#define VM_DEFAULT_TARGET TARGET_INVALID: default
+#define VM_DISPATCH() do { \
+        if (ip >= ncode) \
+            goto END; \
+        i = code[ip++]; \
+        goto *dispatch_table[REG_OP(i)]; \
+    } while (0)
+#else
+#define VM_TARGET(op) case op
+#define VM_DEFAULT_TARGET default
+#define VM_DISPATCH() continue
+#endif
+
+/* reload the cached frame state after a call or a return */
+#define VM_LOAD_FRAME() do { \
+        current_frame = get_current_frame(vm); \
+        code = current_frame->code; \
+        ncode = current_frame->ncode; \
+        ip = current_frame->ip; \
+        R = vm->registers + current_frame->base; \
+    } while (0)
+
+#define VM_CHECK_ERROR(e) do { \
+        if ((e).code != VM_ERROR_NONE) \
+            return (e); \
+    } while (0)
+
+/* store a new reference into a register, releasing the old one */
+#define REG_SET(r, obj) do { \
+        monkey_object_t *old_ = R[r]; \
+        R[r] = (obj); \
+        free_monkey_object(old_); \
+    } while (0)
+
+vm_error_t
+regvm_run(regvm_t *vm)
+{
+#ifdef VM_COMPUTED_GOTO
+    static void *dispatch_table[256] = {
+        [0 ... 255] = &&TARGET_INVALID,
+        [RLOADK] = &&TARGET_RLOADK,
+        [RLOADTRUE] = &&TARGET_RLOADTRUE,
+        [RLOADFALSE] = &&TARGET_RLOADFALSE,
+        [RLOADNULL] = &&TARGET_RLOADNULL,
+        [RMOVE] = &&TARGET_RMOVE,
+        [RGETGLOBAL] = &&TARGET_RGETGLOBAL,
+        [RSETGLOBAL] = &&TARGET_RSETGLOBAL,
+        [RGETFREE] = &&TARGET_RGETFREE,
+        [RGETBUILTIN] = &&TARGET_RGETBUILTIN,
+        [RCURRENTCLOSURE] = &&TARGET_RCURRENTCLOSURE,
+        [RADD] = &&TARGET_RADD,
+        [RSUB] = &&TARGET_RSUB,
+        [RMUL] = &&TARGET_RMUL,
+        [RDIV] = &&TARGET_RDIV,
+        [RMOD] = &&TARGET_RMOD,
+        [REQUAL] = &&TARGET_REQUAL,
+        [RNOTEQUAL] = &&TARGET_RNOTEQUAL,
+        [RGREATERTHAN] = &&TARGET_RGREATERTHAN,
+        [RLESSTHAN] = &&TARGET_RLESSTHAN,
+        [RLESSEQUAL] = &&TARGET_RLESSEQUAL,
+        [RGREATEREQUAL] = &&TARGET_RGREATEREQUAL,
+        [RMINUS] = &&TARGET_RMINUS,
+        [RBANG] = &&TARGET_RBANG,
+        [RJMP] = &&TARGET_RJMP,
+        [RJMPFALSE] = &&TARGET_RJMPFALSE,
+        [RARRAY] = &&TARGET_RARRAY,
+        [RHASH] = &&TARGET_RHASH,
+        [RINDEX] = &&TARGET_RINDEX,
+        [RCALL] = &&TARGET_RCALL,
+        [RRETURN] = &&TARGET_RRETURN,
+        [RRETURNNULL] = &&TARGET_RRETURNNULL,
+        [RCLOSURE] = &&TARGET_RCLOSURE,
+        [RPOP] = &&TARGET_RPOP
+    };
+#endif
+    vm_error_t vm_err;
+    monkey_object_t *left;
+    monkey_object_t *right;
+    monkey_object_t *result;
+    monkey_object_t *callee;
+    monkey_object_t *old;
+    regframe_t *popped_frame;
+    size_t base;
+    _Bool truth;
+    regframe_t *current_frame;
+    reginstruction_t *code;
+    size_t ncode;
+    size_t ip;
+    reginstruction_t i;
+    monkey_object_t **R;
+
+    VM_LOAD_FRAME();
+    for (;;) {
+        if (ip >= ncode)
+            goto END;
+        i = code[ip++];
+        switch (REG_OP(i)) {
+        VM_TARGET(RLOADK):
+            REG_SET(REG_A(i), load_constant(vm, REG_BX(i)));
+            VM_DISPATCH();
+        VM_TARGET(RLOADTRUE):
+            REG_SET(REG_A(i), (monkey_object_t *) create_monkey_bool(true));
+            VM_DISPATCH();
+        VM_TARGET(RLOADFALSE):
+            REG_SET(REG_A(i), (monkey_object_t *) create_monkey_bool(false));
+            VM_DISPATCH();
+        VM_TARGET(RLOADNULL):
+            REG_SET(REG_A(i), (monkey_object_t *) create_monkey_null());
+            VM_DISPATCH();
+        VM_TARGET(RMOVE):
+            REG_SET(REG_A(i), copy_monkey_object(R[REG_B(i)]));
+            VM_DISPATCH();
+        VM_TARGET(RGETGLOBAL):
+            REG_SET(REG_A(i), copy_monkey_object(vm->globals[REG_BX(i)]));
+            VM_DISPATCH();
+        VM_TARGET(RSETGLOBAL):
+            old = vm->globals[REG_BX(i)];
+            vm->globals[REG_BX(i)] = copy_monkey_object(R[REG_A(i)]);
+            if (old != NULL)
+                free_monkey_object(old);
+            VM_DISPATCH();
+        VM_TARGET(RGETFREE):
+            REG_SET(REG_A(i), copy_monkey_object(current_frame->cl->free_variables[REG_B(i)]));
+            VM_DISPATCH();
+        VM_TARGET(RGETBUILTIN):
+            REG_SET(REG_A(i), (monkey_object_t *) get_builtins(get_builtins_name(REG_B(i))));
+            VM_DISPATCH();
+        VM_TARGET(RCURRENTCLOSURE):
+            REG_SET(REG_A(i), copy_monkey_object((monkey_object_t *) current_frame->cl));
+            VM_DISPATCH();
+        VM_TARGET(RADD):
+            left = R[REG_B(i)];
+            right = R[REG_C(i)];
+            if (is_tagged_int(left) && is_tagged_int(right)) {
+                REG_SET(REG_A(i), create_monkey_int_value(tagged_int_value(left) +
+                    tagged_int_value(right)));
+                VM_DISPATCH();
+            }
+            goto BINARY_OP;
+        VM_TARGET(RSUB):
+            left = R[REG_B(i)];
+            right = R[REG_C(i)];
+            if (is_tagged_int(left) && is_tagged_int(right)) {
+                REG_SET(REG_A(i), create_monkey_int_value(tagged_int_value(left) -
+                    tagged_int_value(right)));
+                VM_DISPATCH();
+            }
+            goto BINARY_OP;
+        VM_TARGET(RMUL):
+        VM_TARGET(RDIV):
+        VM_TARGET(RMOD):
+            left = R[REG_B(i)];
+            right = R[REG_C(i)];
+BINARY_OP:
+            vm_err = execute_binary_op(REG_OP(i), left, right, &result);
+            VM_CHECK_ERROR(vm_err);
+            REG_SET(REG_A(i), result);
+            VM_DISPATCH();
+        VM_TARGET(REQUAL):
+        VM_TARGET(RNOTEQUAL):
+        VM_TARGET(RGREATERTHAN):
+        VM_TARGET(RLESSTHAN):
+        VM_TARGET(RLESSEQUAL):
+        VM_TARGET(RGREATEREQUAL):
+            left = R[REG_B(i)];
+            right = R[REG_C(i)];
+            if (is_tagged_int(left) && is_tagged_int(right)) {
+                if (REG_OP(i) == RGREATERTHAN)
+                    truth = tagged_int_value(left) > tagged_int_value(right);
+                else if (REG_OP(i) == RLESSTHAN)
+                    truth = tagged_int_value(left) < tagged_int_value(right);
+                else if (REG_OP(i) == RLESSEQUAL)
+                    truth = tagged_int_value(left) <= tagged_int_value(right);
+                else if (REG_OP(i) == RGREATEREQUAL)
+                    truth = tagged_int_value(left) >= tagged_int_value(right);
+                else
+                    truth = (left == right) == (REG_OP(i) == REQUAL);
+                result = (monkey_object_t *) create_monkey_bool(truth);
+            } else {
+                vm_err = execute_comparison_op(REG_OP(i), left, right, &result);
+                VM_CHECK_ERROR(vm_err);
+            }
+            REG_SET(REG_A(i), result);
+            VM_DISPATCH();
+        VM_TARGET(RMINUS):
+            vm_err = execute_minus_operator(R[REG_B(i)], &result);
+            VM_CHECK_ERROR(vm_err);
+            REG_SET(REG_A(i), result);
+            VM_DISPATCH();
+        VM_TARGET(RBANG):
+            vm_err = execute_bang_operator(R[REG_B(i)], &result);
+            VM_CHECK_ERROR(vm_err);
+            REG_SET(REG_A(i), result);
+            VM_DISPATCH();
+        VM_TARGET(RJMP):
+            ip = REG_BX(i);
+            VM_DISPATCH();
+        VM_TARGET(RJMPFALSE):
+            if (!is_truthy(R[REG_A(i)]))
+                ip = REG_BX(i);
+            VM_DISPATCH();
+        VM_TARGET(RARRAY):
+            REG_SET(REG_A(i), build_array(R + REG_B(i), REG_C(i)));
+            VM_DISPATCH();
+        VM_TARGET(RHASH):
+            REG_SET(REG_A(i), build_hash(R + REG_B(i), REG_C(i)));
+            VM_DISPATCH();
+        VM_TARGET(RINDEX):
+            vm_err = execute_index_expression(R[REG_B(i)], R[REG_C(i)], &result);
+            VM_CHECK_ERROR(vm_err);
+            REG_SET(REG_A(i), result);
+            VM_DISPATCH();
+        VM_TARGET(RCALL):
+            callee = R[REG_A(i)];
+            switch (get_monkey_object_type(callee)) {
+            case MONKEY_CLOSURE:
+                current_frame->ip = ip;
+                base = current_frame->base + REG_A(i) + 1;
+                vm_err = call_closure(vm, (monkey_closure_t *) callee, base, REG_B(i));
+                VM_CHECK_ERROR(vm_err);
+                VM_LOAD_FRAME();
+                break;
+            case MONKEY_BUILTIN:
+                result = call_builtin((monkey_builtin_t *) callee, R + REG_A(i) + 1, REG_B(i));
+                REG_SET(REG_A(i), result);
+                break;
+            default:
+                vm_err.code = VM_NON_FUNCTION;
+                vm_err.msg = get_err_msg("Calling non-function\n");
+                return vm_err;
+            }
+            VM_DISPATCH();
+        VM_TARGET(RRETURN):
+        VM_TARGET(RRETURNNULL):
+            if (REG_OP(i) == RRETURN)
+                result = copy_monkey_object(R[REG_A(i)]);
+            else
+                result = (monkey_object_t *) create_monkey_null();
+            if (vm->frame_index == 1) {
+                /* a return at the top level ends the program */
+                if (vm->last_popped != NULL)
+                    free_monkey_object(vm->last_popped);
+                vm->last_popped = result;
+                ip = ncode;
+                goto END;
+            }
+            popped_frame = &vm->frames[--vm->frame_index];
+            /* the callee register holds the closure of the popped frame */
+            old = vm->registers[popped_frame->base - 1];
+            vm->registers[popped_frame->base - 1] = result;
+            free_monkey_object(old);
+            VM_LOAD_FRAME();
+            VM_DISPATCH();
+        VM_TARGET(RCLOSURE):
+            vm_err = build_closure(vm, REG_BX(i), R + REG_B(code[ip]), REG_C(code[ip]), &result);
+            VM_CHECK_ERROR(vm_err);
+            ip++;
+            REG_SET(REG_A(i), result);
+            VM_DISPATCH();
+        VM_TARGET(RPOP):
+            if (vm->last_popped != NULL)
+                free_monkey_object(vm->last_popped);
+            vm->last_popped = copy_monkey_object(R[REG_A(i)]);
+            VM_DISPATCH();
+        VM_DEFAULT_TARGET:
+            vm_err.code = VM_UNSUPPORTED_OPERATOR;
+            vm_err.msg = get_err_msg("Unsupported opcode %u", REG_OP(i));
+            return vm_err;
+        }
+    }
+END:
+    current_frame->ip = ip;
+    vm_err.code = VM_ERROR_NONE;
+    vm_err.msg = NULL;
+    return vm_err;
+}
@@ -0,0 +1,72 @@
+/*-
+ * Copyright (c) 2019 Abhinav Upadhyay <er.abhinav.upadhyay@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef REGVM_H
+#define REGVM_H
+
+#include <stdlib.h>
+#include "cmonkey_utils.h"
+#include "compiler.h"
+#include "object.h"
+#include "regcompiler.h"
+#include "vm.h"
+
+#define REGVM_INITIAL_REGISTERS 1024
+
+/*
+ * A call frame of the register machine. The registers of the frame start at
+ * base, with the callee sitting in the register just below it, which is
+ * where the return value goes.
+ */
+typedef struct regframe_t {
+    monkey_closure_t *cl;
+    reginstruction_t *code;
+    size_t ncode;
+    size_t ip;
+    size_t base;
+} regframe_t;
+
+typedef struct regvm_t {
+    monkey_object_t **registers;
+    size_t registers_size;
+    regframe_t *frames;
+    size_t frames_size;
+    size_t frame_index;
+    cm_array_list *constants;
+    monkey_object_t **globals;
+    size_t globals_size;
+    monkey_object_t *last_popped;
+} regvm_t;
+
+regvm_t *regvm_init(bytecode_t *);
+void regvm_free(regvm_t *);
+monkey_object_t *regvm_last_popped_stack_elem(regvm_t *);
+vm_error_t regvm_run(regvm_t *);
+
+#endif
@@ -119,7 +119,7 @@ execute_file(const char *filename)
 	}
 	program_string = cm_array_string_list_join(lines, "\n");
 	l = lexer_init(program_string);
-	parser = parser_init(l);
+	parser = parser_init_arena(l);
 	program = parse_program(parser);
 	free(program_string);
 
@@ -182,7 +182,7 @@ repl(void)
 
 		program_string = cm_array_string_list_join(lines, "\n");
 		l = lexer_init(program_string);
-		parser = parser_init(l);
+		parser = parser_init_arena(l);
 		program = parse_program(parser);
 
 		if (parser->errors) {
@@ -0,0 +1,650 @@
+/*-
+ * Copyright (c) 2019 Abhinav Upadhyay <er.abhinav.upadhyay@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "builtins.h"
+#include "cmonkey_utils.h"
+#include "compiler.h"
+#include "object.h"
+#include "snapshot.h"
+#include "symbol_table.h"
+#include "vm.h"
+
+#define MNKS_HEADER_SIZE 48 // magic, version and the five counts
+#define MNKS_NOBJECTS_OFFSET 8
+
+static char *
+get_err_msg(const char *s, ...)
+{
+    char *msg = NULL;
+    va_list ap;
+    va_start(ap, s);
+    int retval = vasprintf(&msg, s, ap);
+    va_end(ap);
+    if (retval == -1)
+        err(EXIT_FAILURE, "malloc failed");
+    return msg;
+}
+
+static void
+put_uint(FILE *file, uint64_t value, size_t width)
+{
+    for (size_t i = 0; i < width; i++)
+        putc((int) ((value >> (8 * i)) & 0xff), file);
+}
+
+static void
+put_bytes(FILE *file, const void *bytes, size_t length)
+{
+    put_uint(file, length, 8);
+    if (length > 0)
+        fwrite(bytes, 1, length, file);
+}
+
+typedef struct snapshot_writer_t {
+    FILE *file;
+    cm_hash_table *refs; // the ref of each object written so far
+    size_t nobjects;
+    monkey_object_t *unsupported; // the value that could not be saved, if any
+} snapshot_writer_t;
+
+static size_t
+get_builtin_index(monkey_object_t *obj)
+{
+    size_t i;
+    for (i = 0; i < get_builtins_count() && get_builtins_name(i) != NULL; i++) {
+        if ((monkey_object_t *) get_builtins(get_builtins_name(i)) == obj)
+            break;
+    }
+    return i;
+}
+
+/*
+ * Writes the object after everything it refers to and returns its ref, 0
+ * if it or something it reaches can not be saved.
+ */
+static uint64_t
+put_object(snapshot_writer_t *writer, monkey_object_t *obj)
+{
+    uint64_t ref, *refs = NULL;
+    size_t nrefs = 0;
+    cm_array_list *keys = NULL;
+    monkey_array_t *array = NULL;
+    monkey_hash_t *hash = NULL;
+    monkey_closure_t *closure = NULL;
+    monkey_compiled_fn_t *fn;
+    monkey_string_t *str;
+    mnks_object_kind kind;
+
+    if ((ref = (uintptr_t) cm_hash_table_get(writer->refs, obj)) != 0)
+        return ref;
+    monkey_object_type type = get_monkey_object_type(obj);
+    switch (type) {
+    case MONKEY_ARRAY:
+        array = (monkey_array_t *) obj;
+        nrefs = array->elements->length;
+        break;
+    case MONKEY_HASH:
+        hash = (monkey_hash_t *) obj;
+        keys = cm_hash_table_get_keys(hash->pairs);
+        nrefs = keys == NULL? 0: 2 * keys->length;
+        break;
+    case MONKEY_CLOSURE:
+        closure = (monkey_closure_t *) obj;
+        nrefs = closure->free_variables_count + 1;
+        break;
+    case MONKEY_BUILTIN:
+        if (get_builtin_index(obj) == get_builtins_count() ||
+                get_builtins_name(get_builtin_index(obj)) == NULL) {
+            writer->unsupported = obj;
+            return 0;
+        }
+        break;
+    case MONKEY_INT:
+    case MONKEY_BOOL:
+    case MONKEY_NULL:
+    case MONKEY_STRING:
+    case MONKEY_COMPILED_FUNCTION:
+        break;
+    default:
+        writer->unsupported = obj;
+        return 0;
+    }
+
+    if (nrefs > 0 && (refs = malloc(nrefs * sizeof(*refs))) == NULL)
+        err(EXIT_FAILURE, "malloc failed");
+    for (size_t i = 0; i < nrefs; i++) {
+        monkey_object_t *child;
+        if (type == MONKEY_ARRAY)
+            child = array->elements->array[i];
+        else if (type == MONKEY_HASH)
+            child = i % 2 == 0? keys->array[i / 2]:
+                cm_hash_table_get(hash->pairs, keys->array[i / 2]);
+        else
+            child = i == 0? (monkey_object_t *) closure->fn: closure->free_variables[i - 1];
+        if ((refs[i] = put_object(writer, child)) == 0) {
+            free(refs);
+            if (keys != NULL)
+                cm_array_list_free(keys);
+            return 0;
+        }
+    }
+    if (keys != NULL)
+        cm_array_list_free(keys);
+
+    switch (type) {
+    case MONKEY_INT:
+        put_uint(writer->file, MNKS_INT, 1);
+        put_uint(writer->file, (uint64_t) get_monkey_int_value(obj), 8);
+        break;
+    case MONKEY_STRING:
+        str = (monkey_string_t *) obj;
+        put_uint(writer->file, MNKS_STRING, 1);
+        put_bytes(writer->file, str->value, str->length);
+        break;
+    case MONKEY_BOOL:
+        kind = ((monkey_bool_t *) obj)->value? MNKS_TRUE: MNKS_FALSE;
+        put_uint(writer->file, kind, 1);
+        break;
+    case MONKEY_NULL:
+        put_uint(writer->file, MNKS_NULL, 1);
+        break;
+    case MONKEY_BUILTIN:
+        put_uint(writer->file, MNKS_BUILTIN, 1);
+        put_uint(writer->file, get_builtin_index(obj), 8);
+        break;
+    case MONKEY_COMPILED_FUNCTION:
+        fn = (monkey_compiled_fn_t *) obj;
+        put_uint(writer->file, MNKS_FUNCTION, 1);
+        put_uint(writer->file, fn->num_locals, 8);
+        put_uint(writer->file, fn->num_args, 8);
+        put_bytes(writer->file, fn->instructions->bytes, fn->instructions->length);
+        break;
+    case MONKEY_ARRAY:
+    case MONKEY_HASH:
+        put_uint(writer->file, type == MONKEY_ARRAY? MNKS_ARRAY: MNKS_HASH, 1);
+        put_uint(writer->file, type == MONKEY_ARRAY? nrefs: nrefs / 2, 8);
+        for (size_t i = 0; i < nrefs; i++)
+            put_uint(writer->file, refs[i], 8);
+        break;
+    default:
+        put_uint(writer->file, MNKS_CLOSURE, 1);
+        put_uint(writer->file, refs[0], 8);
+        put_uint(writer->file, nrefs - 1, 8);
+        for (size_t i = 1; i < nrefs; i++)
+            put_uint(writer->file, refs[i], 8);
+        break;
+    }
+    free(refs);
+    ref = ++writer->nobjects;
+    cm_hash_table_put(writer->refs, obj, (void *) (uintptr_t) ref);
+    return ref;
+}
+
+static symbol_table_t *
+get_global_symbol_table(symbol_table_t *table)
+{
+    while (table->outer != NULL)
+        table = table->outer;
+    return table;
+}
+
+/*
+ * Writes the objects the constants and the globals reach, then refs to
+ * them, then the global symbols.
+ */
+static int
+put_snapshot(snapshot_writer_t *writer, compiler_t *compiler, vm_t *vm)
+{
+    cm_array_list *constants = compiler->constants_pool;
+    symbol_table_t *table = get_global_symbol_table(compiler->symbol_table);
+    cm_array_list *symbols = cm_hash_table_get_values(table->store);
+    size_t nconstants = constants->length, nsymbols = 0;
+    uint64_t *refs = calloc(nconstants + vm->globals_size + 1, sizeof(*refs));
+    int ret = 0;
+    if (refs == NULL)
+        err(EXIT_FAILURE, "malloc failed");
+    for (size_t i = 0; i < symbols->length; i++) {
+        symbol_t *sym = symbols->array[i];
+        if (sym->scope == GLOBAL || sym->scope == BUILTIN)
+            nsymbols++;
+    }
+    fwrite(MNKS_MAGIC, 1, 4, writer->file);
+    put_uint(writer->file, MNKS_VERSION, 4);
+    put_uint(writer->file, 0, 8); // nobjects, known at the end
+    put_uint(writer->file, nconstants, 8);
+    put_uint(writer->file, vm->globals_size, 8);
+    put_uint(writer->file, nsymbols, 8);
+    put_uint(writer->file, table->nentries, 8);
+    for (size_t i = 0; i < nconstants + vm->globals_size; i++) {
+        monkey_object_t *obj = i < nconstants? constants->array[i]: vm->globals[i - nconstants];
+        if (obj != NULL && (refs[i] = put_object(writer, obj)) == 0) {
+            ret = -1;
+            goto DONE;
+        }
+    }
+    for (size_t i = 0; i < nconstants + vm->globals_size; i++)
+        put_uint(writer->file, refs[i], 8);
+    for (size_t i = 0; i < symbols->length; i++) {
+        symbol_t *sym = symbols->array[i];
+        if (sym->scope != GLOBAL && sym->scope != BUILTIN)
+            continue;
+        put_uint(writer->file, sym->scope, 1);
+        put_uint(writer->file, sym->index, 8);
+        put_bytes(writer->file, sym->name, strlen(sym->name));
+    }
+    fseek(writer->file, MNKS_NOBJECTS_OFFSET, SEEK_SET);
+    put_uint(writer->file, writer->nobjects, 8);
+DONE:
+    free(refs);
+    cm_array_list_free(symbols);
+    return ret;
+}
+
+/*
+ * Saves the globals of the vm, the constants and the global symbols of the
+ * compiler that compiled the program it ran. Like bytecode_write, the
+ * file only appears under path once complete. Returns 0 on success, -1
+ * with *errmsg set otherwise.
+ */
+int
+snapshot_write(const char *path, compiler_t *compiler, vm_t *vm, char **errmsg)
+{
+    char *tmp_path;
+    int fd;
+    snapshot_writer_t writer;
+    if (asprintf(&tmp_path, "%s.XXXXXX", path) == -1)
+        err(EXIT_FAILURE, "malloc failed");
+    if ((fd = mkstemp(tmp_path)) == -1 || (writer.file = fdopen(fd, "w")) == NULL) {
+        *errmsg = get_err_msg("failed to create %s: %s", tmp_path, strerror(errno));
+        if (fd != -1) {
+            close(fd);
+            unlink(tmp_path);
+        }
+        free(tmp_path);
+        return -1;
+    }
+    mode_t mask = umask(0);
+    umask(mask);
+    fchmod(fd, 0666 & ~mask);
+    writer.refs = cm_hash_table_init(pointer_hash_function, pointer_equals, NULL, NULL);
+    writer.nobjects = 0;
+    writer.unsupported = NULL;
+    int ret = put_snapshot(&writer, compiler, vm);
+    cm_hash_table_free(writer.refs);
+    if (ret == -1) {
+        *errmsg = get_err_msg("values of type %s can not be saved",
+            get_type_name(get_monkey_object_type(writer.unsupported)));
+        fclose(writer.file);
+        unlink(tmp_path);
+    } else if (ferror(writer.file) || fclose(writer.file) != 0 || rename(tmp_path, path) == -1) {
+        *errmsg = get_err_msg("failed to write %s: %s", path, strerror(errno));
+        unlink(tmp_path);
+        ret = -1;
+    }
+    free(tmp_path);
+    return ret;
+}
+
+typedef struct reader_t {
+    uint8_t *p;
+    size_t remaining;
+} reader_t;
+
+static _Bool
+get_uint(reader_t *reader, size_t width, uint64_t *value)
+{
+    if (reader->remaining < width)
+        return false;
+    *value = 0;
+    for (size_t i = 0; i < width; i++)
+        *value |= (uint64_t) reader->p[i] << (8 * i);
+    reader->p += width;
+    reader->remaining -= width;
+    return true;
+}
+
+static _Bool
+get_bytes(reader_t *reader, uint8_t **bytes, size_t *length)
+{
+    uint64_t value;
+    if (!get_uint(reader, 8, &value) || value > reader->remaining)
+        return false;
+    *bytes = reader->p;
+    *length = value;
+    reader->p += value;
+    reader->remaining -= value;
+    return true;
+}
+
+/*
+ * The objects are read into a table indexed by ref, which is how a ref
+ * becomes a pointer again. nobjects is how many are there so far.
+ */
+typedef struct snapshot_reader_t {
+    reader_t reader;
+    monkey_object_t **objects;
+    size_t nobjects;
+} snapshot_reader_t;
+
+/* the object a ref stands for, NULL for a ref to no object written yet */
+static monkey_object_t *
+get_ref(snapshot_reader_t *reader)
+{
+    uint64_t ref;
+    if (!get_uint(&reader->reader, 8, &ref) || ref == 0 || ref > reader->nobjects)
+        return NULL;
+    return reader->objects[ref - 1];
+}
+
+static _Bool
+is_hashable(monkey_object_t *obj)
+{
+    monkey_object_type type = get_monkey_object_type(obj);
+    return type == MONKEY_INT || type == MONKEY_STRING || type == MONKEY_BOOL;
+}
+
+static monkey_object_t *
+get_list(snapshot_reader_t *reader, mnks_object_kind kind)
+{
+    uint64_t length;
+    monkey_object_t *obj, *value;
+    /* every ref takes 8 bytes */
+    if (!get_uint(&reader->reader, 8, &length) ||
+            length > reader->reader.remaining / (kind == MNKS_HASH? 16: 8))
+        return NULL;
+    if (kind == MNKS_ARRAY) {
+        cm_array_list *elements = cm_array_list_init(length == 0? 1: length, NULL);
+        monkey_array_t *array = create_monkey_array(elements);
+        for (uint64_t i = 0; i < length; i++) {
+            if ((obj = get_ref(reader)) == NULL) {
+                free_monkey_object(array);
+                return NULL;
+            }
+            cm_array_list_add(elements, copy_monkey_object(obj));
+        }
+        return (monkey_object_t *) array;
+    }
+    cm_hash_table *pairs = cm_hash_table_init(monkey_object_hash, monkey_object_equals,
+        NULL, NULL);
+    monkey_hash_t *hash = create_monkey_hash(pairs);
+    for (uint64_t i = 0; i < length; i++) {
+        obj = get_ref(reader);
+        value = get_ref(reader);
+        if (obj == NULL || value == NULL || !is_hashable(obj) ||
+                cm_hash_table_get(pairs, obj) != NULL) {
+            free_monkey_object(hash);
+            return NULL;
+        }
+        cm_hash_table_put(pairs, copy_monkey_object(obj), copy_monkey_object(value));
+    }
+    return (monkey_object_t *) hash;
+}
+
+static instructions_t *
+map_instructions(uint8_t *bytes, size_t length)
+{
+    instructions_t *ins = malloc(sizeof(*ins));
+    if (ins == NULL)
+        err(EXIT_FAILURE, "malloc failed");
+    ins->bytes = bytes;
+    ins->length = length;
+    ins->size = length;
+    ins->mapped = true;
+    return ins;
+}
+
+static monkey_object_t *
+get_closure(snapshot_reader_t *reader)
+{
+    uint64_t nfree;
+    monkey_object_t *fn = get_ref(reader);
+    monkey_object_t *free_variables[MAX_FREE_VARIABLES];
+    if (fn == NULL || get_monkey_object_type(fn) != MONKEY_COMPILED_FUNCTION ||
+            !get_uint(&reader->reader, 8, &nfree) || nfree > MAX_FREE_VARIABLES)
+        return NULL;
+    for (uint64_t i = 0; i < nfree; i++) {
+        if ((free_variables[i] = get_ref(reader)) == NULL)
+            return NULL;
+    }
+    for (uint64_t i = 0; i < nfree; i++)
+        copy_monkey_object(free_variables[i]);
+    return (monkey_object_t *) create_monkey_closure((monkey_compiled_fn_t *) fn,
+        free_variables, nfree);
+}
+
+static monkey_object_t *
+get_object(snapshot_reader_t *reader)
+{
+    uint64_t kind, value, num_locals, num_args;
+    uint8_t *bytes;
+    size_t length;
+    if (!get_uint(&reader->reader, 1, &kind))
+        return NULL;
+    switch (kind) {
+    case MNKS_INT:
+        if (!get_uint(&reader->reader, 8, &value))
+            return NULL;
+        return create_monkey_int_value((long) value);
+    case MNKS_STRING:
+        if (!get_bytes(&reader->reader, &bytes, &length))
+            return NULL;
+        return (monkey_object_t *) create_monkey_string((const char *) bytes, length);
+    case MNKS_TRUE:
+        return (monkey_object_t *) create_monkey_bool(true);
+    case MNKS_FALSE:
+        return (monkey_object_t *) create_monkey_bool(false);
+    case MNKS_NULL:
+        return (monkey_object_t *) create_monkey_null();
+    case MNKS_BUILTIN:
+        if (!get_uint(&reader->reader, 8, &value) || value >= get_builtins_count() ||
+                get_builtins_name(value) == NULL)
+            return NULL;
+        return (monkey_object_t *) get_builtins(get_builtins_name(value));
+    case MNKS_ARRAY:
+    case MNKS_HASH:
+        return get_list(reader, kind);
+    case MNKS_FUNCTION:
+        if (!get_uint(&reader->reader, 8, &num_locals) ||
+                !get_uint(&reader->reader, 8, &num_args) ||
+                !get_bytes(&reader->reader, &bytes, &length))
+            return NULL;
+        return (monkey_object_t *) create_monkey_compiled_fn(map_instructions(bytes, length),
+            num_locals, num_args);
+    case MNKS_CLOSURE:
+        return get_closure(reader);
+    default:
+        return NULL;
+    }
+}
+
+/* the global symbols, defined with the indexes they had */
+static symbol_table_t *
+get_symbol_table(reader_t *reader, uint64_t nsymbols, uint64_t nentries)
+{
+    uint64_t scope, index;
+    uint8_t *bytes;
+    size_t length;
+    symbol_table_t *table = symbol_table_init();
+    table->nentries = nentries;
+    for (uint64_t i = 0; i < nsymbols; i++) {
+        if (!get_uint(reader, 1, &scope) || (scope != GLOBAL && scope != BUILTIN) ||
+                !get_uint(reader, 8, &index) || index > UINT16_MAX ||
+                !get_bytes(reader, &bytes, &length) || memchr(bytes, 0, length) != NULL) {
+            free_symbol_table(table);
+            return NULL;
+        }
+        char *name = strndup((const char *) bytes, length);
+        if (name == NULL)
+            err(EXIT_FAILURE, "malloc failed");
+        cm_hash_table_put(table->store, name, symbol_init(name, scope, index));
+    }
+    return table;
+}
+
+/*
+ * Maps a file written by snapshot_write and rebuilds the objects in it.
+ * Returns NULL with *errmsg set if the file can not be read or was not
+ * written by this version.
+ */
+snapshot_t *
+snapshot_map(const char *path, char **errmsg)
+{
+    struct stat sb;
+    snapshot_reader_t reader;
+    uint64_t version = 0, nobjects = 0, nconstants = 0, nglobals = 0;
+    uint64_t nsymbols = 0, nentries = 0;
+    monkey_object_t *obj;
+    snapshot_t *snapshot;
+    int fd = open(path, O_RDONLY);
+    if (fd == -1 || fstat(fd, &sb) == -1) {
+        *errmsg = get_err_msg("failed to open %s: %s", path, strerror(errno));
+        if (fd != -1)
+            close(fd);
+        return NULL;
+    }
+    if ((size_t) sb.st_size < MNKS_HEADER_SIZE) {
+        *errmsg = get_err_msg("%s is not a monkey snapshot", path);
+        close(fd);
+        return NULL;
+    }
+    void *addr = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        *errmsg = get_err_msg("failed to map %s: %s", path, strerror(errno));
+        return NULL;
+    }
+    snapshot = calloc(1, sizeof(*snapshot));
+    if (snapshot == NULL)
+        err(EXIT_FAILURE, "malloc failed");
+    snapshot->addr = addr;
+    snapshot->length = sb.st_size;
+    reader.reader.p = addr;
+    reader.reader.remaining = sb.st_size;
+    reader.objects = NULL;
+    reader.nobjects = 0;
+    if (memcmp(reader.reader.p, MNKS_MAGIC, 4) != 0) {
+        *errmsg = get_err_msg("%s is not a monkey snapshot", path);
+        goto FAIL;
+    }
+    reader.reader.p += 4;
+    reader.reader.remaining -= 4;
+    get_uint(&reader.reader, 4, &version);
+    if (version != MNKS_VERSION) {
+        *errmsg = get_err_msg("%s has version %u, expected %u", path,
+            (unsigned) version, (unsigned) MNKS_VERSION);
+        goto FAIL;
+    }
+    get_uint(&reader.reader, 8, &nobjects);
+    get_uint(&reader.reader, 8, &nconstants);
+    get_uint(&reader.reader, 8, &nglobals);
+    get_uint(&reader.reader, 8, &nsymbols);
+    get_uint(&reader.reader, 8, &nentries);
+    /* every object takes at least a byte, every ref 8 */
+    if (nobjects > reader.reader.remaining ||
+            nconstants + nglobals > reader.reader.remaining / 8 || nentries > UINT16_MAX)
+        goto TRUNCATED;
+    reader.objects = malloc((nobjects + 1) * sizeof(*reader.objects));
+    if (reader.objects == NULL)
+        err(EXIT_FAILURE, "malloc failed");
+    while (reader.nobjects < nobjects) {
+        if ((obj = get_object(&reader)) == NULL)
+            goto TRUNCATED;
+        reader.objects[reader.nobjects++] = obj;
+    }
+
+    snapshot->constants = cm_array_list_init(nconstants == 0? 1: nconstants,
+        free_monkey_object);
+    for (uint64_t i = 0; i < nconstants; i++) {
+        if ((obj = get_ref(&reader)) == NULL)
+            goto TRUNCATED;
+        /* the compiler keeps its int constants boxed */
+        if (is_tagged_int(obj))
+            obj = (monkey_object_t *) create_monkey_int(tagged_int_value(obj));
+        else
+            obj = copy_monkey_object(obj);
+        cm_array_list_add(snapshot->constants, obj);
+    }
+    snapshot->globals = calloc(nglobals + 1, sizeof(*snapshot->globals));
+    if (snapshot->globals == NULL)
+        err(EXIT_FAILURE, "malloc failed");
+    for (; snapshot->nglobals < nglobals; snapshot->nglobals++) {
+        uint64_t ref;
+        if (!get_uint(&reader.reader, 8, &ref) || ref > reader.nobjects)
+            goto TRUNCATED;
+        if (ref != 0)
+            snapshot->globals[snapshot->nglobals] = copy_monkey_object(reader.objects[ref - 1]);
+    }
+    if ((snapshot->symbol_table = get_symbol_table(&reader.reader, nsymbols, nentries)) == NULL)
+        goto TRUNCATED;
+    /* what the constants and the globals do not refer to goes */
+    for (size_t i = 0; i < reader.nobjects; i++)
+        free_monkey_object(reader.objects[i]);
+    free(reader.objects);
+    return snapshot;
+
+TRUNCATED:
+    *errmsg = get_err_msg("%s is truncated or corrupt", path);
+FAIL:
+    for (size_t i = 0; i < reader.nobjects; i++)
+        free_monkey_object(reader.objects[i]);
+    free(reader.objects);
+    snapshot_free(snapshot);
+    return NULL;
+}
+
+/*
+ * Releases what the snapshot holds and the mapping, after the vms running
+ * on it are freed.
+ */
+void
+snapshot_free(snapshot_t *snapshot)
+{
+    if (snapshot->symbol_table != NULL)
+        free_symbol_table(snapshot->symbol_table);
+    if (snapshot->constants != NULL)
+        cm_array_list_free(snapshot->constants);
+    for (size_t i = 0; i < snapshot->nglobals; i++) {
+        if (snapshot->globals[i] != NULL)
+            free_monkey_object(snapshot->globals[i]);
+    }
+    free(snapshot->globals);
+    munmap(snapshot->addr, snapshot->length);
+    free(snapshot);
+}
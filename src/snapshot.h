@@ -0,0 +1,101 @@
+/*-
+ * Copyright (c) 2019 Abhinav Upadhyay <er.abhinav.upadhyay@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stddef.h>
+#include "cmonkey_utils.h"
+#include "compiler.h"
+#include "object.h"
+#include "symbol_table.h"
+#include "vm.h"
+
+/*
+ * The state a program leaves behind (.mnks files): the values of its
+ * globals, with everything they reach, and what the compiler needs to
+ * compile more code against them. All the integers are little endian:
+ *
+ *   "MNKS" version:u32 nobjects:u64 nconstants:u64 nglobals:u64
+ *   nsymbols:u64 nentries:u64
+ *   nobjects times: kind:u8 followed by
+ *     MNKS_INT       value:i64
+ *     MNKS_STRING    length:u64 bytes
+ *     MNKS_TRUE, MNKS_FALSE, MNKS_NULL
+ *     MNKS_BUILTIN   index:u64
+ *     MNKS_ARRAY     length:u64 length refs
+ *     MNKS_HASH      npairs:u64 npairs times key:ref value:ref
+ *     MNKS_FUNCTION  num_locals:u64 num_args:u64 length:u64 bytes
+ *     MNKS_CLOSURE   fn:ref nfree:u64 nfree refs
+ *   nconstants refs, the constants pool
+ *   nglobals refs, 0 for a global never assigned
+ *   nsymbols times: scope:u8 index:u64 name:length:u64 bytes
+ *
+ * A ref is a u64, one more than the index of an object written before the
+ * one referring to it, so an object shared by several others is saved
+ * once. The symbols are those of the global scope, nentries is how many
+ * globals it defined.
+ */
+#define MNKS_MAGIC "MNKS"
+#define MNKS_VERSION 1
+#define MNKS_EXTENSION ".mnks"
+
+typedef enum mnks_object_kind {
+    MNKS_INT = 1,
+    MNKS_STRING,
+    MNKS_TRUE,
+    MNKS_FALSE,
+    MNKS_NULL,
+    MNKS_BUILTIN,
+    MNKS_ARRAY,
+    MNKS_HASH,
+    MNKS_FUNCTION,
+    MNKS_CLOSURE
+} mnks_object_kind;
+
+/*
+ * A snapshot loaded back. The instructions of its functions point into the
+ * mapping, which is private like that of a bytecode file. The symbol table
+ * and the constants go to compiler_init_with_state and the globals to
+ * vm_init_with_state, which take copies of them.
+ */
+typedef struct snapshot_t {
+    symbol_table_t *symbol_table;
+    cm_array_list *constants;
+    monkey_object_t **globals;
+    size_t nglobals;
+    void *addr;
+    size_t length;
+} snapshot_t;
+
+int snapshot_write(const char *, compiler_t *, vm_t *, char **);
+snapshot_t *snapshot_map(const char *, char **);
+void snapshot_free(snapshot_t *);
+
+#endif
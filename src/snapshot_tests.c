@@ -0,0 +1,226 @@
+/*-
+ * Copyright (c) 2019 Abhinav Upadhyay <er.abhinav.upadhyay@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "compiler.h"
+#include "lexer.h"
+#include "object.h"
+#include "object_test_utils.h"
+#include "parser.h"
+#include "snapshot.h"
+#include "test_utils.h"
+#include "vm.h"
+
+typedef struct snapshot_test {
+    const char *prelude;
+    const char *input;
+    monkey_object_t *expected;
+} snapshot_test;
+
+static char *
+get_tmp_path(void)
+{
+    char *path = strdup("/tmp/snapshot_tests.XXXXXX");
+    if (path == NULL)
+        err(EXIT_FAILURE, "malloc failed");
+    int fd = mkstemp(path);
+    if (fd == -1)
+        err(EXIT_FAILURE, "mkstemp failed");
+    close(fd);
+    return path;
+}
+
+static void
+write_file(const char *path, const void *bytes, size_t length)
+{
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+        err(EXIT_FAILURE, "Failed to open file %s", path);
+    fwrite(bytes, 1, length, file);
+    fclose(file);
+}
+
+/*
+ * Compiles and runs the input, on top of the snapshot if there is one, and
+ * saves a snapshot of what it leaves to path unless that is NULL. Returns
+ * the last value popped.
+ */
+static monkey_object_t *
+run(const char *input, snapshot_t *snapshot, const char *path)
+{
+    char *errmsg;
+    lexer_t *lexer = lexer_init(input);
+    parser_t *parser = parser_init(lexer);
+    program_t *program = parse_program(parser);
+    compiler_t *compiler = snapshot == NULL? compiler_init():
+        compiler_init_with_state(snapshot->symbol_table, snapshot->constants);
+    compiler_error_t error = compile(compiler, (node_t *) program);
+    if (error.code != COMPILER_ERROR_NONE)
+        errx(EXIT_FAILURE, "compilation failed for input %s with error %s\n",
+            input, error.msg);
+    bytecode_t *bytecode = get_bytecode(compiler);
+    peephole_optimize(bytecode);
+    vm_t *vm = snapshot == NULL? vm_init(bytecode):
+        vm_init_with_state(bytecode, snapshot->globals, snapshot->nglobals);
+    vm_error_t vm_error = vm_run(vm);
+    test(vm_error.code == VM_ERROR_NONE, "vm error: %s\n", vm_error.msg);
+    monkey_object_t *top = vm_last_popped_stack_elem(vm);
+    if (path != NULL) {
+        test(snapshot_write(path, compiler, vm, &errmsg) == 0, "snapshot_write failed: %s\n",
+            errmsg);
+    }
+    vm_free(vm);
+    bytecode_free(bytecode);
+    parser_free(parser);
+    program_free(program);
+    compiler_free(compiler);
+    return top;
+}
+
+static void
+test_restore(void)
+{
+    snapshot_test tests[] = {
+        {"let x = 40;", "x + 2", (monkey_object_t *) create_monkey_int(42)},
+        {"let s = \"mon\";", "s + \"key\"", (monkey_object_t *) create_monkey_string("monkey", 6)},
+        {
+            "let big = 4611686018427387904; let t = true;",
+            "if (t) { big - 1 }",
+            (monkey_object_t *) create_monkey_int(4611686018427387903)
+        },
+        {
+            "let table = {\"one\": 1, 2: [10, 20], true: \"yes\"};",
+            "table[\"one\"] + table[2][1] + len(table[true])",
+            (monkey_object_t *) create_monkey_int(24)
+        },
+        {
+            "let fib = fn(n) { if (n < 2) { n } else { fib(n - 1) + fib(n - 2) } };",
+            "fib(15)",
+            (monkey_object_t *) create_monkey_int(610)
+        },
+        {
+            "let adder = fn(x) { fn(y) { x + y } }; let add2 = adder(2); let l = len;",
+            "let add3 = adder(3); add2(1) + add3(1) + l([1])",
+            (monkey_object_t *) create_monkey_int(8)
+        },
+        {
+            "let a = [1, 2]; let b = [a, a]; let x = 1; let x = 5;",
+            "len(b[0]) + len(b[1]) + x",
+            (monkey_object_t *) create_monkey_int(9)
+        }
+    };
+    print_test_separator_line();
+    printf("Testing snapshots\n");
+    char *path = get_tmp_path();
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        char *errmsg;
+        printf("Testing %s restored from the snapshot of %s\n", tests[i].input,
+            tests[i].prelude);
+        monkey_object_t *top = run(tests[i].prelude, NULL, path);
+        free_monkey_object(top);
+        snapshot_t *snapshot = snapshot_map(path, &errmsg);
+        test(snapshot != NULL, "snapshot_map failed: %s\n", errmsg);
+        top = run(tests[i].input, snapshot, NULL);
+        test_monkey_object(top, tests[i].expected);
+        free_monkey_object(top);
+        free_monkey_object(tests[i].expected);
+        snapshot_free(snapshot);
+    }
+    unlink(path);
+    free(path);
+}
+
+static void
+test_shared_objects(void)
+{
+    char *errmsg;
+    print_test_separator_line();
+    printf("Testing objects reached twice are restored once\n");
+    char *path = get_tmp_path();
+    free_monkey_object(run("let a = [\"shared\"]; let b = [a, a];", NULL, path));
+    snapshot_t *snapshot = snapshot_map(path, &errmsg);
+    test(snapshot != NULL, "snapshot_map failed: %s\n", errmsg);
+    test(snapshot->nglobals >= 2, "Expected 2 globals, got %zu\n", snapshot->nglobals);
+    monkey_array_t *b = (monkey_array_t *) snapshot->globals[1];
+    test(b->elements->array[0] == b->elements->array[1],
+        "Expected both elements to be the same array\n");
+    test(b->elements->array[0] == snapshot->globals[0],
+        "Expected the elements to be the global a\n");
+    snapshot_free(snapshot);
+    unlink(path);
+    free(path);
+}
+
+static void
+test_invalid_files(void)
+{
+    static const uint8_t bad_magic[48] = "MNKX";
+    static const uint8_t bad_version[48] = {'M', 'N', 'K', 'S', 0xff};
+    /* claims an object and has none */
+    static const uint8_t truncated[48] = {'M', 'N', 'K', 'S', MNKS_VERSION, [8] = 1};
+    /* an array referring to itself */
+    static const uint8_t bad_ref[66] = {'M', 'N', 'K', 'S', MNKS_VERSION, [8] = 1,
+        [48] = MNKS_ARRAY, 1, [57] = 1};
+    struct {
+        const void *bytes;
+        size_t length;
+    } tests[] = {
+        {"", 0},
+        {bad_magic, sizeof(bad_magic)},
+        {bad_version, sizeof(bad_version)},
+        {truncated, sizeof(truncated)},
+        {bad_ref, sizeof(bad_ref)}
+    };
+    print_test_separator_line();
+    printf("Testing invalid snapshots\n");
+    char *path = get_tmp_path();
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        char *errmsg = NULL;
+        write_file(path, tests[i].bytes, tests[i].length);
+        test(snapshot_map(path, &errmsg) == NULL, "Expected file %zu to be rejected\n", i);
+        printf("%s\n", errmsg);
+        free(errmsg);
+    }
+    unlink(path);
+    free(path);
+}
+
+int
+main(int argc, char **argv)
+{
+    test_restore();
+    test_shared_objects();
+    test_invalid_files();
+    return 0;
+}
@@ -68,6 +68,21 @@ symbol_define(symbol_table_t *table, char *name)
     return s;
 }
 
+/*
+ * Returns the variable a let statement binds. A name that already is a
+ * variable of this scope is assigned again rather than redefined, the way
+ * the evaluator overwrites it in its environment, so that loops can update
+ * their variables.
+ */
+symbol_t *
+symbol_bind(symbol_table_t *table, char *name)
+{
+    symbol_t *s = cm_hash_table_get(table->store, name);
+    if (s != NULL && (s->scope == GLOBAL || s->scope == LOCAL))
+        return s;
+    return symbol_define(table, name);
+}
+
 symbol_t *
 symbol_define_function(symbol_table_t *table, char *name)
 {
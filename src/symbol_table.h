@@ -67,6 +67,7 @@ typedef struct symbol_table_t {
 symbol_table_t *symbol_table_init(void);
 symbol_table_t *enclosed_symbol_table_init(symbol_table_t *);
 symbol_t *symbol_define(symbol_table_t *, char *);
+symbol_t *symbol_bind(symbol_table_t *, char *);
 symbol_t *symbol_define_builtin(symbol_table_t *, size_t, char *);
 symbol_t *symbol_define_function(symbol_table_t *, char *);
 symbol_t *symbol_resolve(symbol_table_t *, const char *);
@@ -136,6 +136,42 @@ test_shadowing_function_name(void)
     free_symbol(expected);
 }
 
+static void
+test_bind(void)
+{
+    print_test_separator_line();
+    printf("Testing binding of names already defined\n");
+    symbol_table_t *global = symbol_table_init();
+    symbol_table_t *local = enclosed_symbol_table_init(global);
+    symbol_define(global, "a");
+    symbol_define(global, "b");
+    symbol_t *expected_global = symbol_init("b", GLOBAL, 1);
+    compare_symbols(expected_global, symbol_bind(global, "b"));
+    test(global->nentries == 2, "Expected 2 entries in the global table, found %u\n",
+        global->nentries);
+
+    symbol_define(local, "c");
+    symbol_define_function(local, "f");
+    symbol_t *expected_locals[] = {
+        symbol_init("c", LOCAL, 0),
+        symbol_init("a", LOCAL, 1),
+        symbol_init("f", LOCAL, 2)
+    };
+    /* a global of the outer table and the function name get new locals */
+    compare_symbols(expected_locals[0], symbol_bind(local, "c"));
+    compare_symbols(expected_locals[1], symbol_bind(local, "a"));
+    compare_symbols(expected_locals[2], symbol_bind(local, "f"));
+    compare_symbols(expected_locals[1], symbol_bind(local, "a"));
+    test(local->nentries == 3, "Expected 3 entries in the local table, found %u\n",
+        local->nentries);
+
+    free_symbol(expected_global);
+    for (size_t i = 0; i < sizeof(expected_locals) / sizeof(expected_locals[0]); i++)
+        free_symbol(expected_locals[i]);
+    free_symbol_table(local);
+    free_symbol_table(global);
+}
+
 static void
 test_resolve_unresolvable_free(void)
 {
@@ -400,5 +436,6 @@ main(int argc, char **argv)
     test_resolve_unresolvable_free();
     test_define_and_resolve_function_name();
     test_shadowing_function_name();
+    test_bind();
     return 0;
 }
\ No newline at end of file
@@ -49,6 +49,8 @@ typedef enum token_type {
 	PERCENT,
 	LT,
 	GT,
+	LT_EQ,
+	GT_EQ,
 	EQ,
 	NOT_EQ,
 	AND,
@@ -95,6 +97,8 @@ static const char *token_names[] = {
 	"PERCENT",
 	"LT",
 	"GT",
+	"LT_EQ",
+	"GT_EQ",
 	"EQ",
 	"NOT_EQ",
 	"AND",
@@ -0,0 +1,420 @@
+/*-
+ * Copyright (c) 2019 Abhinav Upadhyay <er.abhinav.upadhyay@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <err.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "builtins.h"
+#include "cmonkey_utils.h"
+#include "object.h"
+#include "opcode.h"
+#include "verifier.h"
+#include "vm.h"
+
+#define UNKNOWN SIZE_MAX
+
+/*
+ * What the instructions of a program may refer to.
+ */
+typedef struct verifier_t {
+    cm_array_list *constants;
+    size_t nconstants;
+    size_t nglobals;
+    size_t nbuiltins;
+    size_t *nfree; // free variables of each function constant, UNKNOWN if never closed over
+} verifier_t;
+
+static vm_error_t
+invalid_bytecode(const char *s, ...)
+{
+    vm_error_t vm_err = {VM_INVALID_BYTECODE, NULL};
+    va_list ap;
+    va_start(ap, s);
+    int retval = vasprintf(&vm_err.msg, s, ap);
+    va_end(ap);
+    if (retval == -1)
+        err(EXIT_FAILURE, "malloc failed");
+    return vm_err;
+}
+
+static size_t
+get_operand(uint8_t *bytes, size_t pos, size_t n)
+{
+    opcode_definition_t op_def = opcode_definition_lookup(bytes[pos]);
+    size_t offset = pos + 1;
+    for (size_t i = 0; i < n; i++)
+        offset += op_def.operand_widths[i];
+    return decode_instructions_to_sizet(bytes + offset, op_def.operand_widths[n]);
+}
+
+static _Bool
+is_compiled_fn(verifier_t *verifier, size_t const_index)
+{
+    monkey_object_t *obj = verifier->constants->array[const_index];
+    return get_monkey_object_type(obj) == MONKEY_COMPILED_FUNCTION;
+}
+
+/*
+ * Checks that the instructions decode up to their end and marks where each
+ * one starts. OPCLOSURE must name a function constant and close over the
+ * same number of variables everywhere, the function reads them by index.
+ */
+static vm_error_t
+decode_function(verifier_t *verifier, monkey_compiled_fn_t *fn, _Bool *starts)
+{
+    vm_error_t vm_err = {VM_ERROR_NONE, NULL};
+    uint8_t *bytes = fn->instructions->bytes;
+    size_t length = fn->instructions->length;
+    size_t const_index, nfree;
+    for (size_t pos = 0; pos < length; pos += get_instruction_length(bytes[pos])) {
+        if (!is_valid_opcode(bytes[pos]))
+            return invalid_bytecode("invalid opcode %u at %zu", bytes[pos], pos);
+        if (length - pos < get_instruction_length(bytes[pos]))
+            return invalid_bytecode("truncated instruction at %zu", pos);
+        starts[pos] = true;
+        if (bytes[pos] != OPCLOSURE)
+            continue;
+        const_index = get_operand(bytes, pos, 0);
+        nfree = get_operand(bytes, pos, 1);
+        if (const_index >= verifier->nconstants || !is_compiled_fn(verifier, const_index))
+            return invalid_bytecode("closure of constant %zu, not a function, at %zu",
+                const_index, pos);
+        if (verifier->nfree[const_index] != UNKNOWN && verifier->nfree[const_index] != nfree)
+            return invalid_bytecode("function %zu closed over %zu and %zu variables",
+                const_index, verifier->nfree[const_index], nfree);
+        verifier->nfree[const_index] = nfree;
+    }
+    return vm_err;
+}
+
+/*
+ * Follows every path through the function, checking the operands and that
+ * the stack has the same depth whichever way an instruction is reached.
+ * Records the deepest the stack gets in fn->max_stack, and hands out the
+ * depth before each instruction if depthsp is not NULL.
+ */
+static vm_error_t
+check_function(verifier_t *verifier, monkey_compiled_fn_t *fn, size_t nfree, _Bool is_main,
+    size_t **depthsp)
+{
+    vm_error_t vm_err = {VM_ERROR_NONE, NULL};
+    uint8_t *bytes = fn->instructions->bytes;
+    size_t length = fn->instructions->length;
+    size_t *depths, *worklist;
+    size_t nwork = 0, max_stack = 0;
+    _Bool *starts;
+
+    if (fn->num_args > fn->num_locals)
+        return invalid_bytecode("function takes %zu arguments but has %zu locals",
+            fn->num_args, fn->num_locals);
+    starts = calloc(length + 1, sizeof(*starts));
+    depths = malloc((length + 1) * sizeof(*depths));
+    worklist = malloc((length + 1) * sizeof(*worklist));
+    if (starts == NULL || depths == NULL || worklist == NULL)
+        err(EXIT_FAILURE, "malloc failed");
+    vm_err = decode_function(verifier, fn, starts);
+    if (vm_err.code != VM_ERROR_NONE)
+        goto DONE;
+    starts[length] = true;
+    for (size_t i = 0; i <= length; i++)
+        depths[i] = UNKNOWN;
+    depths[0] = 0;
+    worklist[nwork++] = 0;
+
+    while (nwork > 0) {
+        size_t pos = worklist[--nwork];
+        size_t depth = depths[pos];
+        size_t pops = 0, pushes = 0, peak = 0, target = UNKNOWN;
+        size_t index = 0, limit = 0;
+        _Bool falls_through = true;
+        const char *kind = NULL;
+        if (pos == length) {
+            if (!is_main) {
+                vm_err = invalid_bytecode("function runs past its last instruction");
+                goto DONE;
+            }
+            continue;
+        }
+        opcode_t op = bytes[pos];
+        switch (op) {
+        case OPCONSTANT:
+            index = get_operand(bytes, pos, 0);
+            limit = verifier->nconstants;
+            kind = "constant";
+            pushes = 1;
+            break;
+        case OPTRUE:
+        case OPFALSE:
+        case OPNULL:
+        case OPCURRENTCLOSURE:
+            pushes = 1;
+            break;
+        case OPADD:
+        case OPSUB:
+        case OPMUL:
+        case OPDIV:
+        case OPMOD:
+        case OPEQUAL:
+        case OPNOTEQUAL:
+        case OPGREATERTHAN:
+        case OPLESSTHAN:
+        case OPLESSEQUAL:
+        case OPGREATEREQUAL:
+        case OPADDINT:
+        case OPSUBINT:
+        case OPMULINT:
+        case OPEQUALINT:
+        case OPNOTEQUALINT:
+        case OPGREATERTHANINT:
+        case OPLESSTHANINT:
+        case OPLESSEQUALINT:
+        case OPGREATEREQUALINT:
+        case OPINDEX:
+            pops = 2;
+            pushes = 1;
+            break;
+        case OPMINUS:
+        case OPBANG:
+            pops = 1;
+            pushes = 1;
+            break;
+        case OPPOP:
+            pops = 1;
+            break;
+        case OPJMP:
+            target = get_operand(bytes, pos, 0);
+            falls_through = false;
+            break;
+        case OPJMPFALSE:
+            target = get_operand(bytes, pos, 0);
+            pops = 1;
+            break;
+        case OPSETGLOBAL:
+        case OPGETGLOBAL:
+            index = get_operand(bytes, pos, 0);
+            limit = verifier->nglobals;
+            kind = "global";
+            pops = op == OPSETGLOBAL;
+            pushes = op == OPGETGLOBAL;
+            break;
+        case OPSETLOCAL:
+        case OPGETLOCAL:
+            index = get_operand(bytes, pos, 0);
+            limit = fn->num_locals;
+            kind = "local";
+            pops = op == OPSETLOCAL;
+            pushes = op == OPGETLOCAL;
+            break;
+        case OPGETFREE:
+            index = get_operand(bytes, pos, 0);
+            limit = nfree;
+            kind = "free variable";
+            pushes = 1;
+            break;
+        case OPGETBUILTIN:
+            index = get_operand(bytes, pos, 0);
+            limit = verifier->nbuiltins;
+            kind = "builtin";
+            pushes = 1;
+            break;
+        case OPARRAY:
+        case OPHASH:
+            pops = get_operand(bytes, pos, 0);
+            pushes = 1;
+            if (op == OPHASH && pops % 2 != 0) {
+                vm_err = invalid_bytecode("hash of %zu keys and values at %zu", pops, pos);
+                goto DONE;
+            }
+            break;
+        case OPCALL:
+        case OPTAILCALL:
+            pops = get_operand(bytes, pos, 0) + 1;
+            pushes = 1;
+            break;
+        case OPRETURNVALUE:
+        case OPRETURN:
+            if (is_main) {
+                vm_err = invalid_bytecode("return outside of a function at %zu", pos);
+                goto DONE;
+            }
+            pops = op == OPRETURNVALUE;
+            falls_through = false;
+            break;
+        case OPCLOSURE:
+            pops = get_operand(bytes, pos, 1);
+            pushes = 1;
+            break;
+        case OPLOCALCONSTADD:
+        case OPLOCALCONSTSUB:
+        case OPLOCALCONSTEQUALJMPFALSE:
+            /* the slow paths push the local and the constant */
+            if (get_operand(bytes, pos, 0) >= fn->num_locals ||
+                    get_operand(bytes, pos, 1) >= verifier->nconstants) {
+                vm_err = invalid_bytecode("operand out of range at %zu", pos);
+                goto DONE;
+            }
+            peak = 2;
+            pushes = op != OPLOCALCONSTEQUALJMPFALSE;
+            if (op == OPLOCALCONSTEQUALJMPFALSE)
+                target = get_operand(bytes, pos, 2);
+            break;
+        case OPGLOBALLOCALCALL:
+            /* pushes the global and the local, then calls */
+            if (get_operand(bytes, pos, 0) >= verifier->nglobals ||
+                    get_operand(bytes, pos, 1) >= fn->num_locals) {
+                vm_err = invalid_bytecode("operand out of range at %zu", pos);
+                goto DONE;
+            }
+            peak = 2;
+            pushes = 1;
+            break;
+        default:
+            vm_err = invalid_bytecode("unsupported opcode %u at %zu", op, pos);
+            goto DONE;
+        }
+        if (kind != NULL && index >= limit) {
+            vm_err = invalid_bytecode("%s %zu out of range at %zu", kind, index, pos);
+            goto DONE;
+        }
+        if (depth < pops) {
+            vm_err = invalid_bytecode("stack underflow at %zu", pos);
+            goto DONE;
+        }
+        size_t next_depth = depth - pops + pushes;
+        if (depth + peak > max_stack)
+            max_stack = depth + peak;
+        if (next_depth > max_stack)
+            max_stack = next_depth;
+
+        size_t successors[2];
+        size_t nsuccessors = 0;
+        if (falls_through)
+            successors[nsuccessors++] = pos + get_instruction_length(op);
+        if (target != UNKNOWN) {
+            if (target > length || !starts[target]) {
+                vm_err = invalid_bytecode("jump to %zu at %zu", target, pos);
+                goto DONE;
+            }
+            successors[nsuccessors++] = target;
+        }
+        for (size_t i = 0; i < nsuccessors; i++) {
+            size_t next = successors[i];
+            if (depths[next] == UNKNOWN) {
+                depths[next] = next_depth;
+                worklist[nwork++] = next;
+            } else if (depths[next] != next_depth) {
+                vm_err = invalid_bytecode("stack depth %zu and %zu at %zu",
+                    depths[next], next_depth, next);
+                goto DONE;
+            }
+        }
+    }
+    fn->max_stack = max_stack;
+    if (depthsp != NULL) {
+        *depthsp = depths;
+        depths = NULL;
+    }
+
+DONE:
+    free(starts);
+    free(depths);
+    free(worklist);
+    return vm_err;
+}
+
+/*
+ * Checks a program before the vm runs it: every instruction decodes, every
+ * index it carries is in range, jumps land on instructions, the stack
+ * never underflows and has a fixed depth at each instruction. This is what
+ * lets the vm run without checking any of it, and sizes the stack each
+ * function needs so that pushes need no check either.
+ */
+vm_error_t
+verify_bytecode(monkey_compiled_fn_t *main_fn, cm_array_list *constants, size_t nglobals)
+{
+    return verify_bytecode_depths(main_fn, constants, nglobals, NULL);
+}
+
+/*
+ * Like verify_bytecode, also handing out the stack depth before each
+ * instruction: depths[0] for main and depths[i + 1] for constant i, NULL
+ * for the constants that are not functions. SIZE_MAX marks instructions
+ * no path reaches. The caller frees the arrays.
+ */
+vm_error_t
+verify_bytecode_depths(monkey_compiled_fn_t *main_fn, cm_array_list *constants, size_t nglobals,
+    size_t ***depthsp)
+{
+    vm_error_t vm_err = {VM_ERROR_NONE, NULL};
+    verifier_t verifier;
+    _Bool *starts;
+    verifier.constants = constants;
+    verifier.nconstants = constants == NULL? 0: constants->length;
+    verifier.nglobals = nglobals;
+    verifier.nbuiltins = 0;
+    while (verifier.nbuiltins < get_builtins_count() &&
+            get_builtins_name(verifier.nbuiltins) != NULL)
+        verifier.nbuiltins++;
+    verifier.nfree = malloc((verifier.nconstants + 1) * sizeof(*verifier.nfree));
+    if (verifier.nfree == NULL)
+        err(EXIT_FAILURE, "malloc failed");
+    for (size_t i = 0; i < verifier.nconstants; i++)
+        verifier.nfree[i] = UNKNOWN;
+
+    /* the number of free variables of a function comes from its closures */
+    for (size_t i = 0; i < verifier.nconstants && vm_err.code == VM_ERROR_NONE; i++) {
+        if (!is_compiled_fn(&verifier, i))
+            continue;
+        monkey_compiled_fn_t *fn = constants->array[i];
+        starts = calloc(fn->instructions->length + 1, sizeof(*starts));
+        if (starts == NULL)
+            err(EXIT_FAILURE, "malloc failed");
+        vm_err = decode_function(&verifier, fn, starts);
+        free(starts);
+    }
+    if (depthsp != NULL) {
+        *depthsp = calloc(verifier.nconstants + 1, sizeof(**depthsp));
+        if (*depthsp == NULL)
+            err(EXIT_FAILURE, "malloc failed");
+    }
+    if (vm_err.code == VM_ERROR_NONE)
+        vm_err = check_function(&verifier, main_fn, 0, true,
+            depthsp == NULL? NULL: &(*depthsp)[0]);
+    for (size_t i = 0; i < verifier.nconstants && vm_err.code == VM_ERROR_NONE; i++) {
+        if (is_compiled_fn(&verifier, i))
+            vm_err = check_function(&verifier, constants->array[i],
+                verifier.nfree[i] == UNKNOWN? 0: verifier.nfree[i], false,
+                depthsp == NULL? NULL: &(*depthsp)[i + 1]);
+    }
+    free(verifier.nfree);
+    return vm_err;
+}
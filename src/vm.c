@@ -29,11 +29,14 @@
 
 #include <err.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "builtins.h"
 #include "compiler.h"
 #include "object.h"
+#include "jit.h"
 #include "opcode.h"
+#include "verifier.h"
 #include "vm.h"
 
 static char *
@@ -55,19 +58,34 @@ get_err_msg(const char *s, ...)
 //     return vm->frames[vm->frame_index - 1];
 // }
 
-#define get_current_frame(vm) vm->frames[vm->frame_index - 1]
+#define get_current_frame(vm) (&vm->frames[vm->frame_index - 1])
 
-static void
-push_frame(vm_t *vm, frame_t *frame)
+/*
+ * Returns a slot for a new frame on top of the frame array, growing the
+ * array as needed up to MAX_FRAMES. The returned pointer, as well as any
+ * other frame pointer, is only valid until the next push.
+ */
+static frame_t *
+push_frame(vm_t *vm)
 {
-    vm->frames[vm->frame_index++] = frame;
+    if (vm->frame_index == vm->frames_size) {
+        if (vm->frames_size == MAX_FRAMES)
+            return NULL;
+        vm->frames_size *= 2;
+        if (vm->frames_size > MAX_FRAMES)
+            vm->frames_size = MAX_FRAMES;
+        vm->frames = reallocarray(vm->frames, vm->frames_size, sizeof(*vm->frames));
+        if (vm->frames == NULL)
+            err(EXIT_FAILURE, "malloc failed");
+    }
+    return &vm->frames[vm->frame_index++];
 }
 
 static frame_t *
 pop_frame(vm_t *vm)
 {
     vm->frame_index--;
-    frame_t *f = vm->frames[vm->frame_index];
+    frame_t *f = &vm->frames[vm->frame_index];
     for (size_t i = 0; i < f->cl->fn->num_locals; i++)
         free_monkey_object(vm->stack[f->bp + i]);
 
@@ -82,29 +100,49 @@ vm_init(bytecode_t *bytecode)
     if (vm == NULL)
         err(EXIT_FAILURE, "malloc failed");
     monkey_compiled_fn_t *main_fn = create_monkey_compiled_fn(bytecode->instructions, 0, 0);
-    monkey_closure_t *main_closure = create_monkey_closure(main_fn, NULL);
-    frame_t *main_frame = frame_init(main_closure, 0);
-    vm->frames[0] = main_frame;
-    vm->frame_index = 1;
+    monkey_closure_t *main_closure = create_monkey_closure(main_fn, NULL, 0);
+    vm->frames = malloc(INITIAL_FRAMES * sizeof(*vm->frames));
+    if (vm->frames == NULL)
+        err(EXIT_FAILURE, "malloc failed");
+    vm->frames_size = INITIAL_FRAMES;
+    vm->frame_index = 0;
+    /* the main frame owns the only reference to main_closure */
+    frame_init(push_frame(vm), main_closure, 0);
     vm->constants = bytecode->constants_pool;
+    vm->constant_closures_size = vm->constants == NULL? 0: vm->constants->length;
+    vm->constant_closures = calloc(vm->constant_closures_size + 1, sizeof(*vm->constant_closures));
+    /*
+     * The stack starts small and grows on push, the globals are sized
+     * for the bindings the compiler defined.
+     */
+    vm->stack = calloc(INITIAL_STACK_SIZE, sizeof(*vm->stack));
+    vm->stack_size = INITIAL_STACK_SIZE;
     vm->sp = 0;
-    for (size_t i = 0; i < GLOBALS_SIZE; i++)
-        vm->globals[i] = NULL;
-    free_monkey_object(main_closure);
+    vm->jit_threshold = 0;
+    vm->globals_size = bytecode->num_globals;
+    vm->globals = calloc(vm->globals_size == 0? 1: vm->globals_size, sizeof(*vm->globals));
+    if (vm->stack == NULL || vm->globals == NULL || vm->constant_closures == NULL)
+        err(EXIT_FAILURE, "malloc failed");
     free_monkey_object(main_fn);
     // free(main_fn);
     return vm;
 }
 
 vm_t *
-vm_init_with_state(bytecode_t *bytecode, monkey_object_t *globals[GLOBALS_SIZE])
+vm_init_with_state(bytecode_t *bytecode, monkey_object_t **globals, size_t nglobals)
 {
     vm_t *vm = vm_init(bytecode);
-    for (size_t i = 0; i < GLOBALS_SIZE; i++) {
+    if (nglobals > vm->globals_size) {
+        vm->globals = reallocarray(vm->globals, nglobals, sizeof(*vm->globals));
+        if (vm->globals == NULL)
+            err(EXIT_FAILURE, "malloc failed");
+        vm->globals_size = nglobals;
+    }
+    for (size_t i = 0; i < nglobals; i++) {
         if (globals[i] != NULL)
             vm->globals[i] = copy_monkey_object(globals[i]);
         else
-            break;
+            vm->globals[i] = NULL;
     }
     return vm;
 }
@@ -112,49 +150,92 @@ vm_init_with_state(bytecode_t *bytecode, monkey_object_t *globals[GLOBALS_SIZE])
 void
 vm_free(vm_t *vm)
 {
+    /*
+     * Callee slots of frames entered through OPGLOBALLOCALCALL borrow the
+     * reference of the global, take them off the stack before it is released.
+     */
+    for (size_t i = 1; i < vm->frame_index; i++) {
+        if (vm->frames[i].borrowed_cl)
+            vm->stack[vm->frames[i].bp - 1] = (monkey_object_t *) create_monkey_null();
+    }
     for (size_t i = 0; i < vm->sp; i++) {
         free_monkey_object(vm->stack[i]);
     }
-    for (size_t i = 0; i < GLOBALS_SIZE; i++) {
+    for (size_t i = 0; i < vm->globals_size; i++) {
         if (vm->globals[i] != NULL)
             free_monkey_object(vm->globals[i]);
-        else
-            break;
     }
-    for (size_t i = 0; i < vm->frame_index; i++)
-        frame_free(vm->frames[i]);
+    /*
+     * Frames other than the main frame borrow their closure from the
+     * stack, which has been released above.
+     */
+    frame_free(&vm->frames[0]);
+    for (size_t i = 0; i < vm->constant_closures_size; i++) {
+        if (vm->constant_closures[i] != NULL)
+            free_monkey_object(vm->constant_closures[i]);
+    }
+    free(vm->frames);
+    free(vm->stack);
+    free(vm->globals);
+    free(vm->constant_closures);
     free(vm);
 }
 
 monkey_object_t *
 vm_last_popped_stack_elem(vm_t *vm)
 {
-    return vm->stack[vm->sp];
+    return vm->sp < vm->stack_size? vm->stack[vm->sp]: NULL;
 }
 
-#define vm_push_copy(vm, obj) vm->stack[vm->sp++] = copy_monkey_object(obj)
-#define vm_push(vm, obj) (vm->stack[vm->sp++] = obj)
+/*
+ * Makes room for n more values on top of the stack. Values are only ever
+ * reached through vm->stack and an index, so the stack can move.
+ */
+static void
+grow_stack(vm_t *vm, size_t n)
+{
+    size_t new_size = vm->stack_size;
+    while (new_size < vm->sp + n)
+        new_size *= 2;
+    vm->stack = reallocarray(vm->stack, new_size, sizeof(*vm->stack));
+    if (vm->stack == NULL)
+        err(EXIT_FAILURE, "malloc failed");
+    vm->stack_size = new_size;
+}
+
+#define vm_reserve(vm, n) do { \
+        if ((vm)->sp + (n) > (vm)->stack_size) \
+            grow_stack(vm, n); \
+    } while (0)
+/*
+ * Frames reserve the stack the verifier found their function needs when
+ * they are entered, so pushes don't check for room.
+ */
+#define vm_push_copy(vm, obj) do { \
+        (vm)->stack[(vm)->sp++] = copy_monkey_object(obj); \
+    } while (0)
+#define vm_push(vm, obj) do { \
+        (vm)->stack[(vm)->sp++] = (obj); \
+    } while (0)
 
 
 static vm_error_t
 vm_push_closure(vm_t *vm, size_t const_index, size_t num_free_vars)
 {
     vm_error_t vm_err = {VM_ERROR_NONE, NULL};
-    monkey_object_t *obj = (monkey_object_t *) cm_array_list_get(vm->constants, const_index);
-    if (obj->type != MONKEY_COMPILED_FUNCTION) {
-        vm_err.code = VM_NON_FUNCTION;
-        vm_err.msg = get_err_msg("not a function: %s\n", get_type_name(obj->type));
+    monkey_compiled_fn_t *fn = (monkey_compiled_fn_t *) vm->constants->array[const_index];
+    monkey_closure_t *closure;
+    if (num_free_vars == 0) {
+        /* closures capturing nothing are all the same, build one per function */
+        closure = vm->constant_closures[const_index];
+        if (closure == NULL)
+            closure = vm->constant_closures[const_index] = create_monkey_closure(fn, NULL, 0);
+        vm_push_copy(vm, (monkey_object_t *) closure);
         return vm_err;
     }
-    cm_array_list *free_vars = cm_array_list_init(num_free_vars, NULL);
-    for (size_t i = 0; i < num_free_vars; i++) {
-        monkey_object_t *free_var = vm->stack[vm->sp - num_free_vars + i];
-        cm_array_list_add(free_vars, free_var);
-    }
+    /* the closure takes over the references the stack held */
     vm->sp -= num_free_vars;
-    monkey_compiled_fn_t *fn = (monkey_compiled_fn_t *) obj;
-    monkey_closure_t *closure = create_monkey_closure(fn, free_vars);
-    cm_array_list_free(free_vars);
+    closure = create_monkey_closure(fn, vm->stack + vm->sp, num_free_vars);
     vm_push(vm, (monkey_object_t *) closure);
     return vm_err;
 }
@@ -170,27 +251,50 @@ vm_pop(vm_t *vm)
 static monkey_object_t *
 get_constant(vm_t *vm, size_t const_index)
 {
-    return (monkey_object_t *) cm_array_list_get(vm->constants, const_index);
+    return (monkey_object_t *) vm->constants->array[const_index];
+}
+
+/*
+ * Integer constants are kept boxed in the constants pool, the stack gets
+ * the tagged form so that arithmetic on them never touches the heap.
+ */
+static void
+vm_push_constant(vm_t *vm, monkey_object_t *constant)
+{
+    if (constant->type == MONKEY_INT && fits_tagged_int(((monkey_int_t *) constant)->value))
+        vm_push(vm, tag_int(((monkey_int_t *) constant)->value));
+    else
+        vm_push_copy(vm, constant);
 }
 
 static vm_error_t
-execute_binary_int_op(vm_t *vm, opcode_t op, long leftval, long rightval)
+binary_int_op(opcode_t op, long leftval, long rightval, monkey_object_t **result)
 {
-    long result;
+    long value;
     vm_error_t error = {VM_ERROR_NONE, NULL};
     opcode_definition_t op_def;
     switch (op) {
     case OPADD:
-        result = leftval + rightval;
+        value = leftval + rightval;
         break;
     case OPSUB:
-        result = leftval - rightval;
+        value = leftval - rightval;
         break;
     case OPMUL:
-        result = leftval * rightval;
+        value = leftval * rightval;
         break;
     case OPDIV:
-        result = leftval / rightval;
+    case OPMOD:
+        if (rightval == 0) {
+            error.code = VM_DIVISION_BY_ZERO;
+            error.msg = get_err_msg("division by 0 not allowed");
+            return error;
+        }
+        /* LONG_MIN / -1 overflows, its quotient is its own negation */
+        if (rightval == -1)
+            value = op == OPDIV? (long) (0UL - (unsigned long) leftval): 0;
+        else
+            value = op == OPDIV? leftval / rightval: leftval % rightval;
         break;
     default:
         op_def = opcode_definition_lookup(op);
@@ -198,15 +302,15 @@ execute_binary_int_op(vm_t *vm, opcode_t op, long leftval, long rightval)
         error.msg = get_err_msg("opcode %s not supported for integer operands", op_def.name);
         return error;
     }
-    monkey_object_t *result_obj = (monkey_object_t *) create_monkey_int(result);
-    vm_push(vm, result_obj);
+    *result = create_monkey_int_value(value);
     return error;
 }
 
 static vm_error_t
-execute_binary_string_op(vm_t *vm, opcode_t op, monkey_string_t *leftval, monkey_string_t *rightval)
+binary_string_op(opcode_t op, monkey_string_t *leftval, monkey_string_t *rightval,
+    monkey_object_t **result)
 {
-    char *result = NULL;
+    char *value = NULL;
     vm_error_t error = {VM_ERROR_NONE, NULL};
     opcode_definition_t op_def;
     if (op != OPADD) {
@@ -215,55 +319,76 @@ execute_binary_string_op(vm_t *vm, opcode_t op, monkey_string_t *leftval, monkey
         error.msg = get_err_msg("opcode %s not support for string operands", op_def.name);
         return error;
     }
-    if ((asprintf(&result, "%s%s", leftval->value, rightval->value)) == -1)
+    if ((asprintf(&value, "%s%s", leftval->value, rightval->value)) == -1)
         err(EXIT_FAILURE, "malloc failed");
-    monkey_object_t *result_obj = (monkey_object_t *) create_monkey_string(result, leftval->length + rightval->length);
-    free(result);
-    vm_push(vm, result_obj);
+    *result = (monkey_object_t *) create_monkey_string(value, leftval->length + rightval->length);
+    free(value);
     return error;
 }
 
-static vm_error_t
-execute_binary_op(vm_t *vm, opcode_t op)
+vm_error_t
+vm_binary_op(opcode_t op, monkey_object_t *left, monkey_object_t *right, monkey_object_t **result)
 {
-    monkey_object_t *right = vm_pop(vm);
-    monkey_object_t *left = vm_pop(vm);
     vm_error_t vm_err;
-    if (left->type == MONKEY_INT && right->type == MONKEY_INT) {
-        long leftval = ((monkey_int_t *) left)->value;
-        long rightval = ((monkey_int_t *) right)->value;
-        vm_err = execute_binary_int_op(vm, op, leftval, rightval);
-    } else if (left->type == MONKEY_STRING && right->type == MONKEY_STRING) {
-        vm_err = execute_binary_string_op(vm, op, (monkey_string_t *) left, (monkey_string_t *) right);
+    if (get_monkey_object_type(left) == MONKEY_INT && get_monkey_object_type(right) == MONKEY_INT) {
+        long leftval = get_monkey_int_value(left);
+        long rightval = get_monkey_int_value(right);
+        vm_err = binary_int_op(op, leftval, rightval, result);
+    } else if (get_monkey_object_type(left) == MONKEY_STRING && get_monkey_object_type(right) == MONKEY_STRING) {
+        vm_err = binary_string_op(op, (monkey_string_t *) left, (monkey_string_t *) right, result);
     }else {
         vm_err.code = VM_UNSUPPORTED_OPERAND;
         opcode_definition_t op_def = opcode_definition_lookup(op);
         vm_err.msg = get_err_msg("'%s' operation not supported with types %s and %s",
-            op_def.desc, get_type_name(left->type), get_type_name(right->type));
+            op_def.desc, get_type_name(get_monkey_object_type(left)), get_type_name(get_monkey_object_type(right)));
     }
+    return vm_err;
+}
+
+static vm_error_t
+execute_binary_op(vm_t *vm, opcode_t op)
+{
+    monkey_object_t *result;
+    monkey_object_t *right = vm_pop(vm);
+    monkey_object_t *left = vm_pop(vm);
+    vm_error_t vm_err = vm_binary_op(op, left, right, &result);
     free_monkey_object(left);
     free_monkey_object(right);
+    if (vm_err.code == VM_ERROR_NONE)
+        vm_push(vm, result);
     return vm_err;
 }
 
 static vm_error_t
-execute_integer_comparison(vm_t *vm, opcode_t op, long left, long right)
+integer_comparison(opcode_t op, long left, long right, monkey_object_t **result)
 {
-    _Bool result = false;
+    _Bool value = false;
     vm_error_t error = {VM_ERROR_NONE, NULL};
     opcode_definition_t op_def;
     switch (op) {
     case OPGREATERTHAN:
         if (left > right)
-            result = true;
+            value = true;
+        break;
+    case OPLESSTHAN:
+        if (left < right)
+            value = true;
+        break;
+    case OPLESSEQUAL:
+        if (left <= right)
+            value = true;
+        break;
+    case OPGREATEREQUAL:
+        if (left >= right)
+            value = true;
         break;
     case OPEQUAL:
         if (left == right)
-            result = true;
+            value = true;
         break;
     case OPNOTEQUAL:
         if (left != right)
-            result = true;
+            value = true;
         break;
     default:
         op_def = opcode_definition_lookup(op);
@@ -271,142 +396,197 @@ execute_integer_comparison(vm_t *vm, opcode_t op, long left, long right)
         error.msg = get_err_msg("Unsupported opcode %s for integer operands", op_def.name);
         return error;
     }
-    vm_push(vm, (monkey_object_t *) create_monkey_bool(result));
+    *result = (monkey_object_t *) create_monkey_bool(value);
     return error;
 }
 
-static vm_error_t
-execute_bang_operator(vm_t *vm)
+vm_error_t
+vm_bang_operator(monkey_object_t *operand, monkey_object_t **result)
 {
-    monkey_object_t *operand = vm_pop(vm);
     monkey_bool_t *bool_operand;
     vm_error_t vm_err;
-    if (operand->type != MONKEY_BOOL && operand->type != MONKEY_NULL) {
+    if (get_monkey_object_type(operand) != MONKEY_BOOL && get_monkey_object_type(operand) != MONKEY_NULL) {
         vm_err.code = VM_UNSUPPORTED_OPERAND;
         vm_err.msg = get_err_msg("'!' operator not supported for %s type operands",
-            get_type_name(operand->type));
+            get_type_name(get_monkey_object_type(operand)));
         return vm_err;
     }
-    if (operand->type == MONKEY_NULL)
+    if (get_monkey_object_type(operand) == MONKEY_NULL)
         bool_operand = create_monkey_bool(false);
     else
         bool_operand = (monkey_bool_t *) operand;
-    vm_push(vm, (monkey_object_t *) create_monkey_bool(!bool_operand->value));
+    *result = (monkey_object_t *) create_monkey_bool(!bool_operand->value);
     vm_err.code = VM_ERROR_NONE;
     vm_err.msg = NULL;
     return vm_err;
 }
 
 static vm_error_t
-execute_minus_operator(vm_t *vm)
+execute_bang_operator(vm_t *vm)
 {
+    monkey_object_t *result;
     monkey_object_t *operand = vm_pop(vm);
+    vm_error_t vm_err = vm_bang_operator(operand, &result);
+    free_monkey_object(operand);
+    if (vm_err.code == VM_ERROR_NONE)
+        vm_push(vm, result);
+    return vm_err;
+}
+
+vm_error_t
+vm_minus_operator(monkey_object_t *operand, monkey_object_t **result)
+{
     vm_error_t vm_err;
-    if (operand->type != MONKEY_INT) {
+    if (get_monkey_object_type(operand) != MONKEY_INT) {
         vm_err.code = VM_UNSUPPORTED_OPERAND;
         vm_err.msg = get_err_msg("'-' operator not supported for %s type operands",
-            get_type_name(operand->type));
+            get_type_name(get_monkey_object_type(operand)));
         return vm_err;
     }
-    monkey_int_t *int_operand = (monkey_int_t *) operand;
-    monkey_int_t *result = create_monkey_int(-int_operand->value);
-    vm_push(vm, (monkey_object_t *) result);
-    free_monkey_object(operand);
+    *result = create_monkey_int_value(-get_monkey_int_value(operand));
     vm_err.code = VM_ERROR_NONE;
     vm_err.msg = NULL;
     return vm_err;
 }
 
 static vm_error_t
-execute_array_index_expression(vm_t *vm, monkey_array_t *left, monkey_int_t *index)
+execute_minus_operator(vm_t *vm)
 {
-    vm_error_t vm_err = {VM_ERROR_NONE, NULL};
-    if (index->value < 0 || index->value >= left->elements->length) {
-        vm_push(vm, (monkey_object_t *) create_monkey_null());
-        return vm_err;
-    }
-    vm_push_copy(vm, cm_array_list_get(left->elements, index->value));
+    monkey_object_t *result;
+    monkey_object_t *operand = vm_pop(vm);
+    vm_error_t vm_err = vm_minus_operator(operand, &result);
+    free_monkey_object(operand);
+    if (vm_err.code == VM_ERROR_NONE)
+        vm_push(vm, result);
     return vm_err;
 }
 
-static vm_error_t
-execute_hash_index_expression(vm_t *vm, monkey_hash_t *left, monkey_object_t *index)
+static monkey_object_t *
+array_index_expression(monkey_array_t *left, long index)
+{
+    if (index < 0 || index >= left->elements->length)
+        return (monkey_object_t *) create_monkey_null();
+    return copy_monkey_object(cm_array_list_get(left->elements, index));
+}
+
+static monkey_object_t *
+hash_index_expression(monkey_hash_t *left, monkey_object_t *index)
 {
-    vm_error_t vm_err = {VM_ERROR_NONE, NULL};
     monkey_object_t *value = cm_hash_table_get(left->pairs, index);
     if (value == NULL)
-        vm_push(vm, (monkey_object_t *) create_monkey_null());
-    else
-        vm_push_copy(vm, value);
-    return vm_err;
+        return (monkey_object_t *) create_monkey_null();
+    return copy_monkey_object(value);
 }
 
-static vm_error_t
-execute_index_expression(vm_t *vm, monkey_object_t *left, monkey_object_t *index)
+static monkey_object_t *
+string_index_expression(monkey_string_t *left, long index)
 {
-    vm_error_t vm_err;
-    if (left->type == MONKEY_ARRAY) {
-        if (index->type != MONKEY_INT) {
+    if (index < 0 || (size_t) index >= left->length)
+        return (monkey_object_t *) create_monkey_null();
+    return (monkey_object_t *) create_monkey_string(&left->value[index], 1);
+}
+
+vm_error_t
+vm_index_expression(monkey_object_t *left, monkey_object_t *index, monkey_object_t **result)
+{
+    vm_error_t vm_err = {VM_ERROR_NONE, NULL};
+    if (get_monkey_object_type(left) == MONKEY_ARRAY) {
+        if (get_monkey_object_type(index) != MONKEY_INT) {
             vm_err.code = VM_UNSUPPORTED_OPERATOR;
             vm_err.msg = get_err_msg("unsupported index operator type %s for array object",
-                get_type_name(index->type));
+                get_type_name(get_monkey_object_type(index)));
             return vm_err;
         }
-        return execute_array_index_expression(vm, (monkey_array_t *) left, (monkey_int_t *) index);
-    } else if (left->type == MONKEY_HASH)
-        return execute_hash_index_expression(vm, (monkey_hash_t *) left, index);
+        *result = array_index_expression((monkey_array_t *) left, get_monkey_int_value(index));
+        return vm_err;
+    } else if (get_monkey_object_type(left) == MONKEY_HASH) {
+        *result = hash_index_expression((monkey_hash_t *) left, index);
+        return vm_err;
+    } else if (get_monkey_object_type(left) == MONKEY_STRING) {
+        if (get_monkey_object_type(index) != MONKEY_INT) {
+            vm_err.code = VM_UNSUPPORTED_OPERATOR;
+            vm_err.msg = get_err_msg("unsupported index operator type %s for string object",
+                get_type_name(get_monkey_object_type(index)));
+            return vm_err;
+        }
+        *result = string_index_expression((monkey_string_t *) left, get_monkey_int_value(index));
+        return vm_err;
+    }
     vm_err.code = VM_UNSUPPORTED_OPERATOR;
-    vm_err.msg = get_err_msg("index operator not supported for %s", get_type_name(left->type));
+    vm_err.msg = get_err_msg("index operator not supported for %s", get_type_name(get_monkey_object_type(left)));
     return vm_err;
 }
 
 static vm_error_t
-execute_comparison_op(vm_t *vm, opcode_t op)
+execute_index_expression(vm_t *vm, monkey_object_t *left, monkey_object_t *index)
+{
+    monkey_object_t *result;
+    vm_error_t vm_err = vm_index_expression(left, index, &result);
+    if (vm_err.code == VM_ERROR_NONE)
+        vm_push(vm, result);
+    return vm_err;
+}
+
+vm_error_t
+vm_comparison_op(opcode_t op, monkey_object_t *left, monkey_object_t *right, monkey_object_t **result)
 {
     vm_error_t error = {VM_ERROR_NONE, NULL};
     opcode_definition_t op_def;
-    monkey_object_t *right = vm_pop(vm);
-    monkey_object_t *left = vm_pop(vm);
-    if (left->type == MONKEY_INT && right->type == MONKEY_INT) {
-        long leftval = ((monkey_int_t *) left)->value;
-        long rightval = ((monkey_int_t *) right)->value;
-        error = execute_integer_comparison(vm, op, leftval, rightval);
-    } else if (left->type == MONKEY_BOOL && right->type == MONKEY_BOOL) {
-        _Bool result = false;
+    if (get_monkey_object_type(left) == MONKEY_INT && get_monkey_object_type(right) == MONKEY_INT) {
+        long leftval = get_monkey_int_value(left);
+        long rightval = get_monkey_int_value(right);
+        error = integer_comparison(op, leftval, rightval, result);
+    } else if (get_monkey_object_type(left) == MONKEY_BOOL && get_monkey_object_type(right) == MONKEY_BOOL) {
+        _Bool value = false;
         switch (op) {
         case OPGREATERTHAN:
-            vm_push(vm, (monkey_object_t *) create_monkey_bool(false));
+        case OPLESSTHAN:
+        case OPLESSEQUAL:
+        case OPGREATEREQUAL:
             break;
         case OPEQUAL:
             if (left == right)
-                result = true;
+                value = true;
             break;
         case OPNOTEQUAL:
             if (left != right)
-                result = true;
+                value = true;
             break;
         default:
             op_def = opcode_definition_lookup(op);
             error.code = VM_UNSUPPORTED_OPERATOR;
             error.msg = get_err_msg("Unsupported opcode %s", op_def.name);
-            goto RETURN;
+            return error;
         }
-        vm_push(vm, (monkey_object_t *) create_monkey_bool(result));
+        *result = (monkey_object_t *) create_monkey_bool(value);
     } else {
         error.code = VM_UNSUPPORTED_OPERAND;
         error.msg = get_err_msg("Unsupported operand types %s and %s",
-            get_type_name(left->type), get_type_name(right->type));
+            get_type_name(get_monkey_object_type(left)), get_type_name(get_monkey_object_type(right)));
     }
-RETURN:
+    return error;
+}
+
+static vm_error_t
+execute_comparison_op(vm_t *vm, opcode_t op)
+{
+    monkey_object_t *result;
+    monkey_object_t *right = vm_pop(vm);
+    monkey_object_t *left = vm_pop(vm);
+    vm_error_t vm_err = vm_comparison_op(op, left, right, &result);
     free_monkey_object(left);
     free_monkey_object(right);
-    return error;
+    if (vm_err.code == VM_ERROR_NONE)
+        vm_push(vm, result);
+    return vm_err;
 }
 
-static _Bool
-is_truthy(monkey_object_t *condition)
+_Bool
+vm_is_truthy(monkey_object_t *condition)
 {
-    switch (condition->type) {
+    if (is_tagged_int(condition))
+        return true;
+    switch (get_monkey_object_type(condition)) {
     case MONKEY_BOOL:
         return ((monkey_bool_t *) condition)->value;
     case MONKEY_NULL:
@@ -452,29 +632,300 @@ call_builtin(vm_t *vm, monkey_builtin_t *callee, size_t num_args)
         cm_list_add(args, top);
     }
     monkey_object_t *result = callee->function(args);
-    cm_list_free(args, NULL);
+    cm_list_free(args, free_monkey_object);
+    vm->sp -= num_args + 1;
     vm_push(vm, result);
     vm_err.code = VM_ERROR_NONE;
     vm_err.msg = NULL;
     return vm_err;
 }
 
+#ifdef VM_JIT
+/*
+ * The instructions generated code doesn't inline run through these, the
+ * way the interpreter runs them. The integer instructions only get here
+ * when an operand is not a tagged int or the result overflows, and take
+ * the generic path without deoptimizing the bytecode.
+ */
+#define JIT_HELPER(name) static int \
+    name(vm_t *vm, frame_t *frame, size_t a, size_t b, vm_error_t *err)
+#define JIT_RETURN_ERROR(e) do { \
+        *err = (e); \
+        return err->code != VM_ERROR_NONE; \
+    } while (0)
+#define JIT_BINARY_OP(name, op) JIT_HELPER(name) { JIT_RETURN_ERROR(execute_binary_op(vm, op)); }
+#define JIT_COMPARISON_OP(name, op) JIT_HELPER(name) { JIT_RETURN_ERROR(execute_comparison_op(vm, op)); }
+
+JIT_BINARY_OP(jit_add, OPADD)
+JIT_BINARY_OP(jit_sub, OPSUB)
+JIT_BINARY_OP(jit_mul, OPMUL)
+JIT_BINARY_OP(jit_div, OPDIV)
+JIT_BINARY_OP(jit_mod, OPMOD)
+JIT_COMPARISON_OP(jit_equal, OPEQUAL)
+JIT_COMPARISON_OP(jit_not_equal, OPNOTEQUAL)
+JIT_COMPARISON_OP(jit_greater_than, OPGREATERTHAN)
+JIT_COMPARISON_OP(jit_less_than, OPLESSTHAN)
+JIT_COMPARISON_OP(jit_less_equal, OPLESSEQUAL)
+JIT_COMPARISON_OP(jit_greater_equal, OPGREATEREQUAL)
+
+JIT_HELPER(jit_constant)
+{
+    vm_push_constant(vm, get_constant(vm, a));
+    return 0;
+}
+
+JIT_HELPER(jit_pop)
+{
+    free_monkey_object(vm_pop(vm));
+    return 0;
+}
+
+JIT_HELPER(jit_minus)
+{
+    JIT_RETURN_ERROR(execute_minus_operator(vm));
+}
+
+JIT_HELPER(jit_bang)
+{
+    JIT_RETURN_ERROR(execute_bang_operator(vm));
+}
+
+JIT_HELPER(jit_set_global)
+{
+    if (vm->globals[a] != NULL)
+        free_monkey_object(vm->globals[a]);
+    vm->globals[a] = vm_pop(vm);
+    return 0;
+}
+
+JIT_HELPER(jit_get_global)
+{
+    vm_push_copy(vm, vm->globals[a]);
+    return 0;
+}
+
+JIT_HELPER(jit_set_local)
+{
+    monkey_object_t *old = vm->stack[frame->bp + a];
+    vm->stack[frame->bp + a] = vm_pop(vm);
+    free_monkey_object(old);
+    return 0;
+}
+
+JIT_HELPER(jit_get_local)
+{
+    vm_push_copy(vm, vm->stack[frame->bp + a]);
+    return 0;
+}
+
+JIT_HELPER(jit_get_free)
+{
+    vm_push_copy(vm, frame->cl->free_variables[a]);
+    return 0;
+}
+
+JIT_HELPER(jit_array)
+{
+    vm_push(vm, (monkey_object_t *) create_monkey_array(build_array(vm, a)));
+    return 0;
+}
+
+JIT_HELPER(jit_hash)
+{
+    vm_push(vm, (monkey_object_t *) create_monkey_hash(build_hash(vm, a)));
+    return 0;
+}
+
+JIT_HELPER(jit_index)
+{
+    monkey_object_t *index = vm_pop(vm);
+    monkey_object_t *left = vm_pop(vm);
+    *err = execute_index_expression(vm, left, index);
+    free_monkey_object(index);
+    free_monkey_object(left);
+    return err->code != VM_ERROR_NONE;
+}
+
+JIT_HELPER(jit_get_builtin)
+{
+    vm_push(vm, (monkey_object_t *) get_builtins(get_builtins_name(a)));
+    return 0;
+}
+
+JIT_HELPER(jit_closure)
+{
+    JIT_RETURN_ERROR(vm_push_closure(vm, a, b));
+}
+
+JIT_HELPER(jit_current_closure)
+{
+    vm_push_copy(vm, (monkey_object_t *) frame->cl);
+    return 0;
+}
+
+JIT_HELPER(jit_local_const_add)
+{
+    vm_push_copy(vm, vm->stack[frame->bp + a]);
+    vm_push_constant(vm, get_constant(vm, b));
+    JIT_RETURN_ERROR(execute_binary_op(vm, OPADD));
+}
+
+JIT_HELPER(jit_local_const_sub)
+{
+    vm_push_copy(vm, vm->stack[frame->bp + a]);
+    vm_push_constant(vm, get_constant(vm, b));
+    JIT_RETURN_ERROR(execute_binary_op(vm, OPSUB));
+}
+
+/* pushes whether the local equals the constant, the code then branches on it */
+JIT_HELPER(jit_local_const_equal)
+{
+    vm_push_copy(vm, vm->stack[frame->bp + a]);
+    vm_push_constant(vm, get_constant(vm, b));
+    JIT_RETURN_ERROR(execute_comparison_op(vm, OPEQUAL));
+}
+
+JIT_HELPER(jit_pop_truthy)
+{
+    monkey_object_t *obj = vm_pop(vm);
+    _Bool truthy = vm_is_truthy(obj);
+    free_monkey_object(obj);
+    return truthy;
+}
+
+/* calls and returns change frames and are left to the interpreter */
+static const jit_runtime_t jit_runtime = {
+    .ops = {
+        [OPCONSTANT] = jit_constant,
+        [OPADD] = jit_add,
+        [OPSUB] = jit_sub,
+        [OPMUL] = jit_mul,
+        [OPDIV] = jit_div,
+        [OPMOD] = jit_mod,
+        [OPPOP] = jit_pop,
+        [OPEQUAL] = jit_equal,
+        [OPNOTEQUAL] = jit_not_equal,
+        [OPGREATERTHAN] = jit_greater_than,
+        [OPLESSTHAN] = jit_less_than,
+        [OPLESSEQUAL] = jit_less_equal,
+        [OPGREATEREQUAL] = jit_greater_equal,
+        [OPMINUS] = jit_minus,
+        [OPBANG] = jit_bang,
+        [OPSETGLOBAL] = jit_set_global,
+        [OPGETGLOBAL] = jit_get_global,
+        [OPARRAY] = jit_array,
+        [OPHASH] = jit_hash,
+        [OPINDEX] = jit_index,
+        [OPSETLOCAL] = jit_set_local,
+        [OPGETLOCAL] = jit_get_local,
+        [OPGETBUILTIN] = jit_get_builtin,
+        [OPCLOSURE] = jit_closure,
+        [OPGETFREE] = jit_get_free,
+        [OPCURRENTCLOSURE] = jit_current_closure,
+        [OPLOCALCONSTADD] = jit_local_const_add,
+        [OPLOCALCONSTSUB] = jit_local_const_sub,
+        [OPLOCALCONSTEQUALJMPFALSE] = jit_local_const_equal,
+        [OPADDINT] = jit_add,
+        [OPSUBINT] = jit_sub,
+        [OPMULINT] = jit_mul,
+        [OPEQUALINT] = jit_equal,
+        [OPNOTEQUALINT] = jit_not_equal,
+        [OPGREATERTHANINT] = jit_greater_than,
+        [OPLESSTHANINT] = jit_less_than,
+        [OPLESSEQUALINT] = jit_less_equal,
+        [OPGREATEREQUALINT] = jit_greater_equal
+    },
+    .pop_truthy = jit_pop_truthy
+};
+#endif
+
+/*
+ * Counts the calls of a function, compiling it to machine code once it
+ * gets hot.
+ */
+static void
+count_call(vm_t *vm, monkey_compiled_fn_t *fn)
+{
+#ifdef VM_JIT
+    if (vm->jit_threshold != 0 && fn->jit_code == NULL && ++fn->calls == vm->jit_threshold)
+        jit_compile(fn, vm->constants, &jit_runtime);
+#endif
+}
+
+/*
+ * Locals past the arguments start out as null, so that a frame returning
+ * before all of its let statements ran releases only what it set.
+ */
+static void
+init_locals(vm_t *vm, frame_t *frame, size_t num_args)
+{
+    vm_reserve(vm, frame->cl->fn->num_locals - num_args + frame->cl->fn->max_stack);
+    for (size_t i = num_args; i < frame->cl->fn->num_locals; i++)
+        vm->stack[frame->bp + i] = (monkey_object_t *) create_monkey_null();
+    vm->sp = frame->bp + frame->cl->fn->num_locals;
+}
+
 static vm_error_t
-call_closure(vm_t *vm, monkey_closure_t *closure, size_t num_args)
+enter_closure(vm_t *vm, monkey_closure_t *closure, size_t num_args)
 {
     vm_error_t vm_err;
-    if (closure->fn->num_args != num_args) {
-        vm_err.code = VM_WRONG_NUMBER_ARGUMENTS;
-        vm_err.msg = get_err_msg("wrong number of arguments: want=%zu, got=%zu",
-            closure->fn->num_args, num_args);
+    frame_t *new_frame = push_frame(vm);
+    if (new_frame == NULL) {
+        vm_err.code = VM_STACKOVERFLOW;
+        vm_err.msg = get_err_msg("maximum call depth of %d exceeded", MAX_FRAMES);
         return vm_err;
     }
-    frame_t *new_frame = frame_init(closure, vm->sp - num_args);
-    push_frame(vm, new_frame);
-    vm->sp = new_frame->bp + closure->fn->num_locals;
+    frame_init(new_frame, closure, vm->sp - num_args);
+    init_locals(vm, new_frame, num_args);
+    count_call(vm, closure->fn);
+    vm_err.code = VM_ERROR_NONE;
+    vm_err.msg = NULL;
+    return vm_err;
+}
+
+static vm_error_t
+wrong_number_of_arguments(monkey_closure_t *closure, size_t num_args)
+{
+    vm_error_t vm_err;
+    vm_err.code = VM_WRONG_NUMBER_ARGUMENTS;
+    vm_err.msg = get_err_msg("wrong number of arguments: want=%zu, got=%zu",
+        closure->fn->num_args, num_args);
+    return vm_err;
+}
+
+static vm_error_t
+call_closure(vm_t *vm, monkey_closure_t *closure, size_t num_args)
+{
+    if (closure->fn->num_args != num_args)
+        return wrong_number_of_arguments(closure, num_args);
+    return enter_closure(vm, closure, num_args);
+}
+
+/*
+ * Replaces the current frame with a call of the closure on the top of the
+ * stack: the callee and its arguments are moved down to the callee slot
+ * and the locals of the current frame, which are released first.
+ */
+static vm_error_t
+tail_call_closure(vm_t *vm, monkey_closure_t *closure, size_t num_args)
+{
+    vm_error_t vm_err;
+    if (closure->fn->num_args != num_args)
+        return wrong_number_of_arguments(closure, num_args);
+    frame_t *frame = get_current_frame(vm);
+    size_t callee_pos = vm->sp - 1 - num_args;
+    for (size_t i = frame->bp; i < callee_pos; i++)
+        free_monkey_object(vm->stack[i]);
+    frame_free(frame);
+    vm->stack[frame->bp - 1] = (monkey_object_t *) closure;
+    memmove(vm->stack + frame->bp, vm->stack + callee_pos + 1,
+        num_args * sizeof(*vm->stack));
+    vm->sp = frame->bp + num_args;
+    frame_init(frame, closure, frame->bp);
+    init_locals(vm, frame, num_args);
+    count_call(vm, closure->fn);
     vm_err.code = VM_ERROR_NONE;
     vm_err.msg = NULL;
-    free_monkey_object(closure);
     return vm_err;
 }
 
@@ -483,7 +934,7 @@ execute_call(vm_t *vm, size_t num_args)
 {
     monkey_object_t *callee = vm->stack[vm->sp - 1 - num_args];
     vm_error_t vm_err;
-    switch (callee->type) {
+    switch (get_monkey_object_type(callee)) {
     case MONKEY_CLOSURE:
         vm_err = call_closure(vm, (monkey_closure_t *) callee, num_args);
         break;
@@ -498,202 +949,595 @@ execute_call(vm_t *vm, size_t num_args)
     return vm_err;
 }
 
+/*
+ * Call sites remember the compiled function of the last closure they
+ * called. A closure of the same function called again skips the type
+ * dispatch and the arity check: the number of arguments is fixed at the
+ * call site, and a function is only cached after it has passed the check
+ * there. The cache holds no reference, compiled functions live in the
+ * constants pool alongside the function owning the cache.
+ */
+static call_cache_t *
+get_call_cache(monkey_compiled_fn_t *fn, size_t offset)
+{
+    if (fn->call_caches == NULL) {
+        fn->call_caches = calloc(fn->instructions->length, sizeof(*fn->call_caches));
+        if (fn->call_caches == NULL)
+            err(EXIT_FAILURE, "malloc failed");
+    }
+    return &fn->call_caches[offset];
+}
+
+static inline _Bool
+call_cache_hit(call_cache_t *cache, monkey_object_t *callee)
+{
+    return get_monkey_object_type(callee) == MONKEY_CLOSURE &&
+        ((monkey_closure_t *) callee)->fn == cache->fn;
+}
+
+static void
+update_call_cache(call_cache_t *cache, monkey_object_t *callee)
+{
+    if (get_monkey_object_type(callee) == MONKEY_CLOSURE)
+        cache->fn = ((monkey_closure_t *) callee)->fn;
+}
+
+static vm_error_t
+execute_cached_call(vm_t *vm, call_cache_t *cache, size_t num_args)
+{
+    monkey_object_t *callee = vm->stack[vm->sp - 1 - num_args];
+    if (call_cache_hit(cache, callee))
+        return enter_closure(vm, (monkey_closure_t *) callee, num_args);
+    vm_error_t vm_err = execute_call(vm, num_args);
+    if (vm_err.code == VM_ERROR_NONE)
+        update_call_cache(cache, callee);
+    return vm_err;
+}
+
+/*
+ * Type quickening: the first time a generic arithmetic or comparison
+ * opcode sees two small ints, it is rewritten in place to its int
+ * specialized form. The specialized handler guards on the operand tags and
+ * turns the instruction back into the generic one when the guard fails.
+ */
+static opcode_t
+get_quickened_opcode(opcode_t op)
+{
+    switch (op) {
+    case OPADD:
+        return OPADDINT;
+    case OPSUB:
+        return OPSUBINT;
+    case OPMUL:
+        return OPMULINT;
+    case OPEQUAL:
+        return OPEQUALINT;
+    case OPNOTEQUAL:
+        return OPNOTEQUALINT;
+    case OPGREATERTHAN:
+        return OPGREATERTHANINT;
+    case OPLESSTHAN:
+        return OPLESSTHANINT;
+    case OPLESSEQUAL:
+        return OPLESSEQUALINT;
+    case OPGREATEREQUAL:
+        return OPGREATEREQUALINT;
+    default:
+        return op;
+    }
+}
+
+static opcode_t
+get_generic_opcode(opcode_t op)
+{
+    switch (op) {
+    case OPADDINT:
+        return OPADD;
+    case OPSUBINT:
+        return OPSUB;
+    case OPMULINT:
+        return OPMUL;
+    case OPEQUALINT:
+        return OPEQUAL;
+    case OPNOTEQUALINT:
+        return OPNOTEQUAL;
+    case OPGREATERTHANINT:
+        return OPGREATERTHAN;
+    case OPLESSTHANINT:
+        return OPLESSTHAN;
+    case OPLESSEQUALINT:
+        return OPLESSEQUAL;
+    case OPGREATEREQUALINT:
+        return OPGREATEREQUAL;
+    default:
+        return op;
+    }
+}
+
+#define vm_peek(vm, n) ((vm)->stack[(vm)->sp - 1 - (n)])
+
+static void
+quicken(vm_t *vm, uint8_t *opcode)
+{
+    if (is_tagged_int(vm_peek(vm, 0)) && is_tagged_int(vm_peek(vm, 1)))
+        *opcode = get_quickened_opcode(*opcode);
+}
+
+/*
+ * With GCC/clang the dispatch loop is direct-threaded: every handler jumps
+ * straight to the handler of the next instruction through a table of label
+ * addresses. Define VM_NO_COMPUTED_GOTO to fall back to the portable
+ * switch based dispatch.
+ */
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(VM_NO_COMPUTED_GOTO)
+#define VM_COMPUTED_GOTO
+#endif
+
+#ifdef VM_COMPUTED_GOTO
+#define VM_TARGET(op) TARGET_##op: case op
+#define VM_DEFAULT_TARGET TARGET_INVALID: default
+#define VM_DISPATCH() do { \
+        if (ip >= ins_len) \
+            goto END; \
+        goto *dispatch_table[ins[ip]]; \
+    } while (0)
+#else
+#define VM_TARGET(op) case op
+#define VM_DEFAULT_TARGET default
+#define VM_DISPATCH() continue
+#endif
+
+/*
+ * Reload the cached frame state after a call or a return. A frame whose
+ * function has been compiled runs its machine code from there up to the
+ * next call or return.
+ */
+#ifdef VM_JIT
+#define VM_RUN_JIT() do { \
+        if (current_frame->cl->fn->jit_code != NULL) { \
+            ip = ((jit_code_t) current_frame->cl->fn->jit_code)(vm, current_frame, ip, &vm_err); \
+            if (ip == SIZE_MAX) \
+                return vm_err; \
+        } \
+    } while (0)
+#else
+#define VM_RUN_JIT()
+#endif
+
+#define VM_LOAD_FRAME() do { \
+        current_frame = get_current_frame(vm); \
+        ins = current_frame->ins; \
+        ins_len = get_frame_instructions(current_frame)->length; \
+        ip = current_frame->ip; \
+        VM_RUN_JIT(); \
+    } while (0)
+
+#define VM_CHECK_ERROR(e) do { \
+        if ((e).code != VM_ERROR_NONE) \
+            return (e); \
+    } while (0)
+
 vm_error_t
 vm_run(vm_t *vm)
 {
+#ifdef VM_COMPUTED_GOTO
+    static void *dispatch_table[256] = {
+        [0 ... 255] = &&TARGET_INVALID,
+        [OPCONSTANT] = &&TARGET_OPCONSTANT,
+        [OPADD] = &&TARGET_OPADD,
+        [OPSUB] = &&TARGET_OPSUB,
+        [OPMUL] = &&TARGET_OPMUL,
+        [OPDIV] = &&TARGET_OPDIV,
+        [OPMOD] = &&TARGET_OPMOD,
+        [OPPOP] = &&TARGET_OPPOP,
+        [OPTRUE] = &&TARGET_OPTRUE,
+        [OPFALSE] = &&TARGET_OPFALSE,
+        [OPEQUAL] = &&TARGET_OPEQUAL,
+        [OPNOTEQUAL] = &&TARGET_OPNOTEQUAL,
+        [OPGREATERTHAN] = &&TARGET_OPGREATERTHAN,
+        [OPLESSTHAN] = &&TARGET_OPLESSTHAN,
+        [OPLESSEQUAL] = &&TARGET_OPLESSEQUAL,
+        [OPGREATEREQUAL] = &&TARGET_OPGREATEREQUAL,
+        [OPMINUS] = &&TARGET_OPMINUS,
+        [OPBANG] = &&TARGET_OPBANG,
+        [OPJMPFALSE] = &&TARGET_OPJMPFALSE,
+        [OPJMP] = &&TARGET_OPJMP,
+        [OPNULL] = &&TARGET_OPNULL,
+        [OPSETGLOBAL] = &&TARGET_OPSETGLOBAL,
+        [OPGETGLOBAL] = &&TARGET_OPGETGLOBAL,
+        [OPARRAY] = &&TARGET_OPARRAY,
+        [OPHASH] = &&TARGET_OPHASH,
+        [OPINDEX] = &&TARGET_OPINDEX,
+        [OPCALL] = &&TARGET_OPCALL,
+        [OPTAILCALL] = &&TARGET_OPTAILCALL,
+        [OPRETURNVALUE] = &&TARGET_OPRETURNVALUE,
+        [OPRETURN] = &&TARGET_OPRETURN,
+        [OPSETLOCAL] = &&TARGET_OPSETLOCAL,
+        [OPGETLOCAL] = &&TARGET_OPGETLOCAL,
+        [OPGETBUILTIN] = &&TARGET_OPGETBUILTIN,
+        [OPCLOSURE] = &&TARGET_OPCLOSURE,
+        [OPGETFREE] = &&TARGET_OPGETFREE,
+        [OPCURRENTCLOSURE] = &&TARGET_OPCURRENTCLOSURE,
+        [OPLOCALCONSTADD] = &&TARGET_OPLOCALCONSTADD,
+        [OPLOCALCONSTSUB] = &&TARGET_OPLOCALCONSTSUB,
+        [OPLOCALCONSTEQUALJMPFALSE] = &&TARGET_OPLOCALCONSTEQUALJMPFALSE,
+        [OPGLOBALLOCALCALL] = &&TARGET_OPGLOBALLOCALCALL,
+        [OPADDINT] = &&TARGET_OPADDINT,
+        [OPSUBINT] = &&TARGET_OPSUBINT,
+        [OPMULINT] = &&TARGET_OPMULINT,
+        [OPEQUALINT] = &&TARGET_OPEQUALINT,
+        [OPNOTEQUALINT] = &&TARGET_OPNOTEQUALINT,
+        [OPGREATERTHANINT] = &&TARGET_OPGREATERTHANINT,
+        [OPLESSTHANINT] = &&TARGET_OPLESSTHANINT,
+        [OPLESSEQUALINT] = &&TARGET_OPLESSEQUALINT,
+        [OPGREATEREQUALINT] = &&TARGET_OPGREATEREQUALINT
+    };
+#endif
     size_t const_index, jmp_pos, sym_index, array_size, hash_size;
     vm_error_t vm_err;
     opcode_definition_t op_def;
     monkey_object_t *top = NULL;
+    monkey_object_t *obj;
     cm_array_list *array_list;
     cm_hash_table *table;
     monkey_array_t *array_obj;
     monkey_hash_t *hash_obj;
     monkey_object_t *index;
     monkey_object_t *left;
+    monkey_object_t *right;
     monkey_object_t *return_value;
-    frame_t *popped_frame = NULL;
-    size_t ip;
+    frame_t *popped_frame;
+    call_cache_t *cache;
     size_t num_args;
     size_t builtin_idx;
     size_t num_free_vars;
-    monkey_closure_t *current_closure;
-    frame_t *current_frame = get_current_frame(vm);
-    while (current_frame->ip < get_frame_instructions(current_frame)->length) {
-        ip = current_frame->ip;
-        instructions_t *current_frame_instructions = get_frame_instructions(current_frame);
-        opcode_t op = current_frame_instructions->bytes[ip];
-        if (top != NULL) {
-            free_monkey_object(top);
-            top = NULL;
-        }
+    long result;
+    _Bool equal;
+    _Bool ordered;
+    frame_t *current_frame;
+    uint8_t *ins;
+    size_t ins_len;
+    size_t ip;
+    opcode_t op;
+
+    /* nothing below checks operands or stack room, the verifier proved them */
+    vm_err = verify_bytecode(vm->frames[0].cl->fn, vm->constants, vm->globals_size);
+    VM_CHECK_ERROR(vm_err);
+    vm_reserve(vm, vm->frames[0].cl->fn->max_stack);
+    VM_LOAD_FRAME();
+    for (;;) {
+        if (ip >= ins_len)
+            goto END;
+        op = ins[ip];
         switch (op) {
-        case OPCONSTANT:
-            const_index = decode_instructions_to_sizet(current_frame_instructions->bytes + ip + 1, 2);
-            current_frame->ip += 2;
-            vm_push_copy(vm, get_constant(vm, const_index));
-            break;
-        case OPADD:
-        case OPSUB:
-        case OPMUL:
-        case OPDIV:
+        VM_TARGET(OPCONSTANT):
+            const_index = decode_instructions_to_sizet(ins + ip + 1, 2);
+            ip += 3;
+            vm_push_constant(vm, get_constant(vm, const_index));
+            VM_DISPATCH();
+        VM_TARGET(OPADD):
+        VM_TARGET(OPSUB):
+        VM_TARGET(OPMUL):
+        VM_TARGET(OPDIV):
+        VM_TARGET(OPMOD):
+            op = ins[ip];
+            quicken(vm, ins + ip);
             vm_err = execute_binary_op(vm, op);
-            if (vm_err.code != VM_ERROR_NONE)
-                return vm_err;
-            break;
-        case OPPOP:
+            VM_CHECK_ERROR(vm_err);
+            ip++;
+            VM_DISPATCH();
+        VM_TARGET(OPPOP):
+            /*
+             * The popped value is kept alive until the next pop so that
+             * vm_last_popped_stack_elem can hand it out after the run.
+             */
+            if (top != NULL)
+                free_monkey_object(top);
             top = vm_pop(vm);
-            break;
-        case OPTRUE:
+            ip++;
+            VM_DISPATCH();
+        VM_TARGET(OPTRUE):
             vm_push(vm, (monkey_object_t *) create_monkey_bool(true));
-            break;
-        case OPFALSE:
+            ip++;
+            VM_DISPATCH();
+        VM_TARGET(OPFALSE):
             vm_push(vm, (monkey_object_t *) create_monkey_bool(false));
-            break;
-        case OPNULL:
+            ip++;
+            VM_DISPATCH();
+        VM_TARGET(OPNULL):
             vm_push(vm, (monkey_object_t *) create_monkey_null());
-            break;
-        case OPGREATERTHAN:
-        case OPEQUAL:
-        case OPNOTEQUAL:
+            ip++;
+            VM_DISPATCH();
+        VM_TARGET(OPGREATERTHAN):
+        VM_TARGET(OPLESSTHAN):
+        VM_TARGET(OPLESSEQUAL):
+        VM_TARGET(OPGREATEREQUAL):
+        VM_TARGET(OPEQUAL):
+        VM_TARGET(OPNOTEQUAL):
+            op = ins[ip];
+            quicken(vm, ins + ip);
             vm_err = execute_comparison_op(vm, op);
-            if (vm_err.code != VM_ERROR_NONE)
-                return vm_err;
-            break;
-        case OPMINUS:
+            VM_CHECK_ERROR(vm_err);
+            ip++;
+            VM_DISPATCH();
+        VM_TARGET(OPMINUS):
             vm_err = execute_minus_operator(vm);
-            if (vm_err.code != VM_ERROR_NONE)
-                return vm_err;
-            break;
-        case OPBANG:
+            VM_CHECK_ERROR(vm_err);
+            ip++;
+            VM_DISPATCH();
+        VM_TARGET(OPBANG):
             vm_err = execute_bang_operator(vm);
-            if (vm_err.code != VM_ERROR_NONE)
-                return vm_err;
-            break;
-        case OPJMP:
-            jmp_pos = decode_instructions_to_sizet(current_frame_instructions->bytes + ip + 1, 2);
-            current_frame->ip = jmp_pos - 1;
-            break;
-        case OPJMPFALSE:
-            jmp_pos = decode_instructions_to_sizet(current_frame_instructions->bytes + ip + 1, 2);
-            current_frame->ip += 2;
-            top = vm_pop(vm);
-            if (!is_truthy(top))
-                current_frame->ip = jmp_pos - 1;
-            break;
-        case OPSETGLOBAL:
-            sym_index = decode_instructions_to_sizet(current_frame_instructions->bytes + ip + 1, 2);
-            current_frame->ip += 2;
+            VM_CHECK_ERROR(vm_err);
+            ip++;
+            VM_DISPATCH();
+        VM_TARGET(OPJMP):
+            ip = decode_instructions_to_sizet(ins + ip + 1, 2);
+            VM_DISPATCH();
+        VM_TARGET(OPJMPFALSE):
+            jmp_pos = decode_instructions_to_sizet(ins + ip + 1, 2);
+            obj = vm_pop(vm);
+            if (vm_is_truthy(obj))
+                ip += 3;
+            else
+                ip = jmp_pos;
+            free_monkey_object(obj);
+            VM_DISPATCH();
+        VM_TARGET(OPSETGLOBAL):
+            sym_index = decode_instructions_to_sizet(ins + ip + 1, 2);
+            ip += 3;
+            if (top != NULL)
+                free_monkey_object(top);
             top = vm_pop(vm);
+            /* a let of a name bound before assigns it again */
+            if (vm->globals[sym_index] != NULL)
+                free_monkey_object(vm->globals[sym_index]);
             vm->globals[sym_index] = copy_monkey_object(top);
-            break;
-        case OPSETLOCAL:
-            sym_index = decode_instructions_to_sizet(current_frame_instructions->bytes + ip + 1, 1);
-            current_frame->ip++;
-            top = vm_pop(vm);
-            vm->stack[current_frame->bp + sym_index] = copy_monkey_object(top);
-            break;
-        case OPGETGLOBAL:
-            sym_index = decode_instructions_to_sizet(current_frame_instructions->bytes + ip + 1, 2);
-            current_frame->ip += 2;
+            VM_DISPATCH();
+        VM_TARGET(OPSETLOCAL):
+            sym_index = decode_instructions_to_sizet(ins + ip + 1, 1);
+            ip += 2;
+            left = vm->stack[current_frame->bp + sym_index];
+            vm->stack[current_frame->bp + sym_index] = vm_pop(vm);
+            free_monkey_object(left);
+            VM_DISPATCH();
+        VM_TARGET(OPGETGLOBAL):
+            sym_index = decode_instructions_to_sizet(ins + ip + 1, 2);
+            ip += 3;
             vm_push_copy(vm, vm->globals[sym_index]);
-            // if (vm_err.code != VM_ERROR_NONE)
-            //     return vm_err;
-            break;
-        case OPGETLOCAL:
-            sym_index = decode_instructions_to_sizet(current_frame_instructions->bytes + ip + 1, 1);
-            current_frame->ip++;
+            VM_DISPATCH();
+        VM_TARGET(OPGETLOCAL):
+            sym_index = decode_instructions_to_sizet(ins + ip + 1, 1);
+            ip += 2;
             vm_push_copy(vm, vm->stack[current_frame->bp + sym_index]);
-            // if (vm_err.code != VM_ERROR_NONE)
-            //     return vm_err;
-            break;
-        case OPGETFREE:
-            sym_index = decode_instructions_to_sizet(current_frame_instructions->bytes + ip + 1, 1);
-            current_frame->ip++;
-            current_closure = get_current_frame(vm)->cl;
-            vm_push_copy(vm, current_closure->free_variables[sym_index]);
-            break;
-        case OPARRAY:
-            array_size = decode_instructions_to_sizet(current_frame_instructions->bytes + ip + 1, 2);
-            current_frame->ip += 2;
+            VM_DISPATCH();
+        VM_TARGET(OPGETFREE):
+            sym_index = decode_instructions_to_sizet(ins + ip + 1, 1);
+            ip += 2;
+            vm_push_copy(vm, current_frame->cl->free_variables[sym_index]);
+            VM_DISPATCH();
+        VM_TARGET(OPARRAY):
+            array_size = decode_instructions_to_sizet(ins + ip + 1, 2);
+            ip += 3;
             array_list = build_array(vm, array_size);
             array_obj = create_monkey_array(array_list);
             vm_push(vm, (monkey_object_t *) array_obj);
-            // if (vm_err.code != VM_ERROR_NONE)
-            //     return vm_err;
-            break;
-        case OPHASH:
-            hash_size = decode_instructions_to_sizet(current_frame_instructions->bytes + ip + 1, 2);
-            current_frame->ip += 2;
+            VM_DISPATCH();
+        VM_TARGET(OPHASH):
+            hash_size = decode_instructions_to_sizet(ins + ip + 1, 2);
+            ip += 3;
             table = build_hash(vm, hash_size);
             hash_obj = create_monkey_hash(table);
             vm_push(vm, (monkey_object_t *) hash_obj);
-            // if (vm_err.code != VM_ERROR_NONE)
-            //     return vm_err;
-            break;
-        case OPINDEX:
+            VM_DISPATCH();
+        VM_TARGET(OPINDEX):
             index = vm_pop(vm);
             left = vm_pop(vm);
             vm_err = execute_index_expression(vm, left, index);
             free_monkey_object(index);
             free_monkey_object(left);
-            if (vm_err.code != VM_ERROR_NONE)
-                return vm_err;
-            break;
-        case OPCALL:
-            num_args = decode_instructions_to_sizet(current_frame_instructions->bytes + ip + 1, 1);
-            current_frame->ip++;
-            vm_err = execute_call(vm, num_args);
-            if (vm_err.code != VM_ERROR_NONE)
-                return vm_err;
-            break;
-        case OPRETURNVALUE:
-            return_value = (monkey_object_t *) vm_pop(vm);
+            VM_CHECK_ERROR(vm_err);
+            ip++;
+            VM_DISPATCH();
+        VM_TARGET(OPCALL):
+            num_args = decode_instructions_to_sizet(ins + ip + 1, 1);
+            current_frame->ip = ip + 2;
+            cache = get_call_cache(current_frame->cl->fn, ip);
+            vm_err = execute_cached_call(vm, cache, num_args);
+            VM_CHECK_ERROR(vm_err);
+            VM_LOAD_FRAME();
+            VM_DISPATCH();
+        VM_TARGET(OPTAILCALL):
+            num_args = decode_instructions_to_sizet(ins + ip + 1, 1);
+            current_frame->ip = ip + 2;
+            obj = vm->stack[vm->sp - 1 - num_args];
+            /* anything but a closure returns here, to the OPRETURNVALUE that follows */
+            if (get_monkey_object_type(obj) == MONKEY_CLOSURE)
+                vm_err = tail_call_closure(vm, (monkey_closure_t *) obj, num_args);
+            else
+                vm_err = execute_call(vm, num_args);
+            VM_CHECK_ERROR(vm_err);
+            VM_LOAD_FRAME();
+            VM_DISPATCH();
+        VM_TARGET(OPRETURNVALUE):
+            return_value = vm_pop(vm);
             popped_frame = pop_frame(vm);
             vm->sp = popped_frame->bp - 1;
+            frame_free(popped_frame);
             vm_push(vm, return_value);
-            break;
-        case OPRETURN:
+            VM_LOAD_FRAME();
+            VM_DISPATCH();
+        VM_TARGET(OPRETURN):
             popped_frame = pop_frame(vm);
             vm->sp = popped_frame->bp - 1;
+            frame_free(popped_frame);
             vm_push(vm, (monkey_object_t *) create_monkey_null());
-            break;
-        case OPGETBUILTIN:
-            builtin_idx = decode_instructions_to_sizet(current_frame_instructions->bytes + ip + 1, 1);
-            current_frame->ip++;
-            const char *builtin_name = get_builtins_name(builtin_idx);
-            monkey_builtin_t *builtin = get_builtins(builtin_name);
-            vm_push(vm, (monkey_object_t *) builtin);
-            break;
-        case OPCLOSURE:
-            const_index = decode_instructions_to_sizet(current_frame_instructions->bytes + ip + 1, 2);
-            current_frame->ip += 2;
-            num_free_vars = decode_instructions_to_sizet(current_frame_instructions->bytes + ip + 3, 1);
-            current_frame->ip++;
-            vm_push_closure(vm, const_index, num_free_vars);
-            // if (vm_err.code != VM_ERROR_NONE)
-            //     return vm_err;
-            break;
-        case OPCURRENTCLOSURE:
-            current_closure = current_frame->cl;
-            vm_push_copy(vm, (monkey_object_t *) current_closure);
-            // if (vm_err.code != VM_ERROR_NONE)
-            //     return vm_err;
-            break;
-        default:
-            op_def = opcode_definition_lookup(op);
+            VM_LOAD_FRAME();
+            VM_DISPATCH();
+        VM_TARGET(OPGETBUILTIN):
+            builtin_idx = decode_instructions_to_sizet(ins + ip + 1, 1);
+            ip += 2;
+            vm_push(vm, (monkey_object_t *) get_builtins(get_builtins_name(builtin_idx)));
+            VM_DISPATCH();
+        VM_TARGET(OPCLOSURE):
+            const_index = decode_instructions_to_sizet(ins + ip + 1, 2);
+            num_free_vars = decode_instructions_to_sizet(ins + ip + 3, 1);
+            ip += 4;
+            vm_err = vm_push_closure(vm, const_index, num_free_vars);
+            VM_CHECK_ERROR(vm_err);
+            VM_DISPATCH();
+        VM_TARGET(OPCURRENTCLOSURE):
+            vm_push_copy(vm, (monkey_object_t *) current_frame->cl);
+            ip++;
+            VM_DISPATCH();
+        VM_TARGET(OPLOCALCONSTADD):
+        VM_TARGET(OPLOCALCONSTSUB):
+            /* the superinstructions skip the stack when both sides are small ints */
+            sym_index = decode_instructions_to_sizet(ins + ip + 1, 1);
+            const_index = decode_instructions_to_sizet(ins + ip + 2, 2);
+            left = vm->stack[current_frame->bp + sym_index];
+            obj = get_constant(vm, const_index);
+            if (is_tagged_int(left) && obj->type == MONKEY_INT) {
+                if (ins[ip] == OPLOCALCONSTADD)
+                    result = tagged_int_value(left) + ((monkey_int_t *) obj)->value;
+                else
+                    result = tagged_int_value(left) - ((monkey_int_t *) obj)->value;
+                vm_push(vm, create_monkey_int_value(result));
+            } else {
+                vm_push_copy(vm, left);
+                vm_push_constant(vm, obj);
+                vm_err = execute_binary_op(vm, ins[ip] == OPLOCALCONSTADD? OPADD: OPSUB);
+                VM_CHECK_ERROR(vm_err);
+            }
+            ip += 4;
+            VM_DISPATCH();
+        VM_TARGET(OPLOCALCONSTEQUALJMPFALSE):
+            sym_index = decode_instructions_to_sizet(ins + ip + 1, 1);
+            const_index = decode_instructions_to_sizet(ins + ip + 2, 2);
+            jmp_pos = decode_instructions_to_sizet(ins + ip + 4, 2);
+            left = vm->stack[current_frame->bp + sym_index];
+            obj = get_constant(vm, const_index);
+            if (is_tagged_int(left) && obj->type == MONKEY_INT)
+                equal = tagged_int_value(left) == ((monkey_int_t *) obj)->value;
+            else {
+                vm_push_copy(vm, left);
+                vm_push_constant(vm, obj);
+                vm_err = execute_comparison_op(vm, OPEQUAL);
+                VM_CHECK_ERROR(vm_err);
+                obj = vm_pop(vm);
+                equal = vm_is_truthy(obj);
+                free_monkey_object(obj);
+            }
+            if (equal)
+                ip += 6;
+            else
+                ip = jmp_pos;
+            VM_DISPATCH();
+        VM_TARGET(OPGLOBALLOCALCALL):
+            obj = vm->globals[decode_instructions_to_sizet(ins + ip + 1, 2)];
+            sym_index = decode_instructions_to_sizet(ins + ip + 3, 1);
+            current_frame->ip = ip + 4;
+            cache = get_call_cache(current_frame->cl->fn, ip);
+            if (call_cache_hit(cache, obj)) {
+                /*
+                 * Globals are only assigned by the main program, never
+                 * while a function runs, so the callee slot can borrow the
+                 * reference of the global for the duration of the call.
+                 */
+                vm_push(vm, obj);
+                vm_push_copy(vm, vm->stack[current_frame->bp + sym_index]);
+                vm_err = enter_closure(vm, (monkey_closure_t *) obj, 1);
+                if (vm_err.code == VM_ERROR_NONE)
+                    get_current_frame(vm)->borrowed_cl = true;
+                else
+                    vm->stack[vm->sp - 2] = (monkey_object_t *) create_monkey_null();
+            } else {
+                vm_push_copy(vm, obj);
+                vm_push_copy(vm, vm->stack[current_frame->bp + sym_index]);
+                vm_err = execute_call(vm, 1);
+                if (vm_err.code == VM_ERROR_NONE)
+                    update_call_cache(cache, obj);
+            }
+            VM_CHECK_ERROR(vm_err);
+            VM_LOAD_FRAME();
+            VM_DISPATCH();
+        VM_TARGET(OPADDINT):
+            left = vm_peek(vm, 1);
+            right = vm_peek(vm, 0);
+            if (!is_tagged_int(left) || !is_tagged_int(right))
+                goto DEOPTIMIZE;
+            vm->sp -= 2;
+            vm_push(vm, create_monkey_int_value(tagged_int_value(left) + tagged_int_value(right)));
+            ip++;
+            VM_DISPATCH();
+        VM_TARGET(OPSUBINT):
+            left = vm_peek(vm, 1);
+            right = vm_peek(vm, 0);
+            if (!is_tagged_int(left) || !is_tagged_int(right))
+                goto DEOPTIMIZE;
+            vm->sp -= 2;
+            vm_push(vm, create_monkey_int_value(tagged_int_value(left) - tagged_int_value(right)));
+            ip++;
+            VM_DISPATCH();
+        VM_TARGET(OPMULINT):
+            left = vm_peek(vm, 1);
+            right = vm_peek(vm, 0);
+            if (!is_tagged_int(left) || !is_tagged_int(right))
+                goto DEOPTIMIZE;
+            vm->sp -= 2;
+            vm_push(vm, create_monkey_int_value(tagged_int_value(left) * tagged_int_value(right)));
+            ip++;
+            VM_DISPATCH();
+        VM_TARGET(OPEQUALINT):
+        VM_TARGET(OPNOTEQUALINT):
+            left = vm_peek(vm, 1);
+            right = vm_peek(vm, 0);
+            if (!is_tagged_int(left) || !is_tagged_int(right))
+                goto DEOPTIMIZE;
+            vm->sp -= 2;
+            /* equal small ints have equal tagged representations */
+            equal = left == right;
+            vm_push(vm, (monkey_object_t *) create_monkey_bool(ins[ip] == OPEQUALINT? equal: !equal));
+            ip++;
+            VM_DISPATCH();
+        VM_TARGET(OPGREATERTHANINT):
+        VM_TARGET(OPLESSTHANINT):
+        VM_TARGET(OPLESSEQUALINT):
+        VM_TARGET(OPGREATEREQUALINT):
+            left = vm_peek(vm, 1);
+            right = vm_peek(vm, 0);
+            if (!is_tagged_int(left) || !is_tagged_int(right))
+                goto DEOPTIMIZE;
+            vm->sp -= 2;
+            if (ins[ip] == OPGREATERTHANINT)
+                ordered = tagged_int_value(left) > tagged_int_value(right);
+            else if (ins[ip] == OPLESSTHANINT)
+                ordered = tagged_int_value(left) < tagged_int_value(right);
+            else if (ins[ip] == OPLESSEQUALINT)
+                ordered = tagged_int_value(left) <= tagged_int_value(right);
+            else
+                ordered = tagged_int_value(left) >= tagged_int_value(right);
+            vm_push(vm, (monkey_object_t *) create_monkey_bool(ordered));
+            ip++;
+            VM_DISPATCH();
+DEOPTIMIZE:
+            ins[ip] = get_generic_opcode(ins[ip]);
+            if (ins[ip] == OPADD || ins[ip] == OPSUB || ins[ip] == OPMUL)
+                vm_err = execute_binary_op(vm, ins[ip]);
+            else
+                vm_err = execute_comparison_op(vm, ins[ip]);
+            VM_CHECK_ERROR(vm_err);
+            ip++;
+            VM_DISPATCH();
+        VM_DEFAULT_TARGET:
+            op_def = opcode_definition_lookup(ins[ip]);
             vm_err.code = VM_UNSUPPORTED_OPERATOR;
             vm_err.msg = get_err_msg("Unsupported opcode %s", op_def.name);
             return vm_err;
         }
-        if (popped_frame == current_frame) {
-            frame_free(popped_frame);
-            popped_frame = NULL;
-        } else
-            current_frame->ip++;
-        current_frame = get_current_frame(vm);
     }
+END:
+    current_frame->ip = ip;
     vm_err.code = VM_ERROR_NONE;
     vm_err.msg = NULL;
     return vm_err;
-}
\ No newline at end of file
+}
@@ -37,9 +37,10 @@
 #include "object.h"
 #include "opcode.h"
 
-#define STACKSIZE 2048
-#define GLOBALS_SIZE 65536
+#define INITIAL_STACK_SIZE 256
+#define GLOBALS_SIZE 65536 // the most globals an operand can address
 #define MAX_FRAMES 1024
+#define INITIAL_FRAMES 64
 
 typedef enum vm_error_code {
     VM_ERROR_NONE,
@@ -47,7 +48,9 @@ typedef enum vm_error_code {
     VM_UNSUPPORTED_OPERAND,
     VM_UNSUPPORTED_OPERATOR,
     VM_NON_FUNCTION,
-    VM_WRONG_NUMBER_ARGUMENTS
+    VM_WRONG_NUMBER_ARGUMENTS,
+    VM_DIVISION_BY_ZERO,
+    VM_INVALID_BYTECODE
 } vm_error_code;
 
 static const char *VM_ERROR_DESC[] = {
@@ -56,7 +59,9 @@ static const char *VM_ERROR_DESC[] = {
     "UNSUPPORTED_OPERAND",
     "UNSUPPORTED_OPERATOR",
     "VM_NON_FUNCTION",
-    "VM_WRONG_NUMBER_OF_ARGUMENTS"
+    "VM_WRONG_NUMBER_OF_ARGUMENTS",
+    "VM_DIVISION_BY_ZERO",
+    "VM_INVALID_BYTECODE"
 };
 
 typedef struct vm_error_t {
@@ -67,18 +72,36 @@ typedef struct vm_error_t {
 #define get_vm_error_desc(err) VM_ERROR_DESC[err]
 
 typedef struct vm_t {
-    frame_t *frames[MAX_FRAMES];
+    frame_t *frames;
+    size_t frames_size;
     size_t frame_index;
     cm_array_list *constants;
-    monkey_object_t *stack[STACKSIZE];
-    monkey_object_t *globals[GLOBALS_SIZE];
+    monkey_closure_t **constant_closures; // of the functions without free variables, by constant index
+    size_t constant_closures_size;
+    monkey_object_t **stack;
+    size_t stack_size;
+    monkey_object_t **globals;
+    size_t globals_size;
     size_t sp;
+    size_t jit_threshold; // calls before a function is compiled to machine code, 0 for never
 } vm_t;
 
 vm_t *vm_init(bytecode_t *);
-vm_t *vm_init_with_state(bytecode_t *, monkey_object_t *[GLOBALS_SIZE]);
+vm_t *vm_init_with_state(bytecode_t *, monkey_object_t **, size_t);
 void vm_free(vm_t *);
 monkey_object_t *vm_last_popped_stack_elem(vm_t *);
 vm_error_t vm_run(vm_t *);
 
+/*
+ * What the instructions do, on values instead of the stack, for code that
+ * runs compiled programs without the vm. The operands are only borrowed,
+ * the result is a new reference.
+ */
+vm_error_t vm_binary_op(opcode_t, monkey_object_t *, monkey_object_t *, monkey_object_t **);
+vm_error_t vm_comparison_op(opcode_t, monkey_object_t *, monkey_object_t *, monkey_object_t **);
+vm_error_t vm_bang_operator(monkey_object_t *, monkey_object_t **);
+vm_error_t vm_minus_operator(monkey_object_t *, monkey_object_t **);
+vm_error_t vm_index_expression(monkey_object_t *, monkey_object_t *, monkey_object_t **);
+_Bool vm_is_truthy(monkey_object_t *);
+
 #endif
\ No newline at end of file
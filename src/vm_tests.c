@@ -31,11 +31,13 @@
 #include <string.h>
 
 #include "compiler.h"
+#include "jit.h"
 #include "lexer.h"
 #include "token.h"
 #include "object_test_utils.h"
 #include "parser.h"
 #include "test_utils.h"
+#include "verifier.h"
 #include "vm.h"
 
 typedef struct vm_testcase {
@@ -71,33 +73,87 @@ dump_bytecode(bytecode_t *bytecode)
     }
 }
 
+/*
+ * Everything a compiled and run test program leaves behind, freed with
+ * free_test_run. The caller owns error.msg.
+ */
+typedef struct test_run_t {
+    parser_t *parser;
+    program_t *program;
+    compiler_t *compiler;
+    bytecode_t *bytecode;
+    vm_t *vm;
+    vm_error_t error;
+} test_run_t;
+
+static test_run_t
+compile_and_run(const char *input, _Bool peephole, _Bool fold, _Bool inline_functions,
+    size_t jit_threshold)
+{
+    test_run_t run;
+    lexer_t *lexer = lexer_init(input);
+    run.parser = parser_init(lexer);
+    run.program = parse_program(run.parser);
+    run.compiler = compiler_init();
+    run.compiler->fold_constants = fold;
+    run.compiler->inline_functions = inline_functions;
+    compiler_error_t error = compile(run.compiler, (node_t *) run.program);
+    if (error.code != COMPILER_ERROR_NONE)
+        errx(EXIT_FAILURE, "compilation failed for input %s with error %s\n",
+            input, error.msg);
+    run.bytecode = get_bytecode(run.compiler);
+    if (peephole)
+        peephole_optimize(run.bytecode);
+    run.vm = vm_init(run.bytecode);
+    run.vm->jit_threshold = jit_threshold;
+    run.error = vm_run(run.vm);
+    return run;
+}
+
+static void
+free_test_run(test_run_t *run)
+{
+    parser_free(run->parser);
+    program_free(run->program);
+    compiler_free(run->compiler);
+    bytecode_free(run->bytecode);
+    vm_free(run->vm);
+}
+
+static void
+run_vm_test(vm_testcase t, _Bool peephole, _Bool fold, _Bool jit)
+{
+    printf("Testing vm test for input %s%s%s%s\n", t.input,
+        peephole? " with superinstructions": "",
+        fold? " and constant folding and inlining": "",
+        jit? ", compiling functions to machine code": "");
+    /* with jit, functions are compiled on their first call */
+    test_run_t run = compile_and_run(t.input, peephole, fold, fold, jit);
+    if (run.error.code != VM_ERROR_NONE)
+        errx(EXIT_FAILURE, "vm error: %s\n", run.error.msg);
+    monkey_object_t *top = vm_last_popped_stack_elem(run.vm);
+    test_monkey_object(top, t.expected);
+    free_monkey_object(top);
+    free_test_run(&run);
+}
+
+/*
+ * Every test runs on the plain bytecode, on the peephole optimized one and
+ * on the one the drivers run, which has constants folded and small
+ * functions inlined as well. Where there is a JIT the plain and the
+ * optimized bytecode run compiled too.
+ */
 static void
 run_vm_tests(size_t test_count, vm_testcase test_cases[test_count])
 {
     for (size_t i = 0; i < test_count; i++) {
-        vm_testcase t = test_cases[i];
-        printf("Testing vm test for input %s\n", t.input);
-        lexer_t *lexer = lexer_init(t.input);
-        parser_t *parser = parser_init(lexer);
-        program_t *program = parse_program(parser);
-        compiler_t *compiler = compiler_init();
-        compiler_error_t error = compile(compiler, (node_t *) program);
-        if (error.code != COMPILER_ERROR_NONE)
-            errx(EXIT_FAILURE, "compilation failed for input %s with error %s\n",
-                t.input, error.msg);
-        bytecode_t *bytecode = get_bytecode(compiler);
-        vm_t *vm = vm_init(bytecode);
-        vm_error_t vm_error = vm_run(vm);
-        if (vm_error.code != VM_ERROR_NONE)
-            errx(EXIT_FAILURE, "vm error: %s\n", vm_error.msg);
-        monkey_object_t *top = vm_last_popped_stack_elem(vm);
-        test_monkey_object(top, t.expected);
-        free_monkey_object(top);
-        parser_free(parser);
-        program_free(program);
-        compiler_free(compiler);
-        bytecode_free(bytecode);
-        vm_free(vm);
+        run_vm_test(test_cases[i], false, false, false);
+        run_vm_test(test_cases[i], true, false, false);
+        run_vm_test(test_cases[i], true, true, false);
+#ifdef VM_JIT
+        run_vm_test(test_cases[i], false, false, true);
+        run_vm_test(test_cases[i], true, true, true);
+#endif
     }
 }
 
@@ -152,6 +208,30 @@ test_recursive_closures(void)
 
 }
 
+static void
+test_deep_recursion(void)
+{
+    /* not a tail call, so every call gets a frame of its own */
+    vm_testcase tests[] = {
+        {
+            "let countDown = fn(x) {\n"
+            "   if (x == 0) {\n"
+            "       return 0;\n"
+            "   }\n"
+            "   1 + countDown(x - 1);\n"
+            "};\n"
+            "countDown(500);",
+            (monkey_object_t *) create_monkey_int(500)
+        }
+    };
+    print_test_separator_line();
+    printf("Testing recursion deeper than the initial frame array\n");
+    size_t ntests = sizeof(tests) / sizeof(tests[0]);
+    run_vm_tests(ntests, tests);
+    for (size_t i = 0; i < ntests; i++)
+        free_monkey_object(tests[i].expected);
+}
+
 static void
 test_recursive_fibonacci(void)
 {
@@ -266,6 +346,10 @@ test_boolean_expressions(void)
         {"1 != 1", (monkey_object_t *) create_monkey_bool(false)},
         {"1 == 2", (monkey_object_t *) create_monkey_bool(false)},
         {"1 != 2", (monkey_object_t *) create_monkey_bool(true)},
+        {"1 <= 1", (monkey_object_t *) create_monkey_bool(true)},
+        {"2 <= 1", (monkey_object_t *) create_monkey_bool(false)},
+        {"1 >= 1", (monkey_object_t *) create_monkey_bool(true)},
+        {"1 >= 2", (monkey_object_t *) create_monkey_bool(false)},
         {"true == true", (monkey_object_t *) create_monkey_bool(true)},
         {"false == false", (monkey_object_t *) create_monkey_bool(true)},
         {"true == false", (monkey_object_t *) create_monkey_bool(false)},
@@ -302,7 +386,10 @@ test_integer_aritmetic(void)
         {"-5", (monkey_object_t *) create_monkey_int(-5)},
         {"-10", (monkey_object_t *) create_monkey_int(-10)},
         {"-50 + 100 + -50", (monkey_object_t *) create_monkey_int(0)},
-        {"(5 + 10 * 2 + 15 / 3) * 2 + -10", (monkey_object_t *) create_monkey_int(50)}
+        {"(5 + 10 * 2 + 15 / 3) * 2 + -10", (monkey_object_t *) create_monkey_int(50)},
+        {"7 % 3", (monkey_object_t *) create_monkey_int(1)},
+        {"-7 % 3", (monkey_object_t *) create_monkey_int(-1)},
+        {"10 - 10 % 4 * 2", (monkey_object_t *) create_monkey_int(6)}
     };
 
     print_test_separator_line();
@@ -452,7 +539,12 @@ test_index_expresions(void)
         {"{1: 1, 2: 2}[1]", (monkey_object_t *) create_monkey_int(1)},
         {"{1: 1, 2: 2}[2]", (monkey_object_t *) create_monkey_int(2)},
         {"{1: 1}[0]", (monkey_object_t *) create_monkey_null()},
-        {"{}[0]", (monkey_object_t *) create_monkey_null()}
+        {"{}[0]", (monkey_object_t *) create_monkey_null()},
+        {"\"monkey\"[0]", (monkey_object_t *) create_monkey_string("m", 1)},
+        {"\"monkey\"[1 + 4]", (monkey_object_t *) create_monkey_string("y", 1)},
+        {"\"monkey\"[6]", (monkey_object_t *) create_monkey_null()},
+        {"\"\"[0]", (monkey_object_t *) create_monkey_null()},
+        {"\"monkey\"[-1]", (monkey_object_t *) create_monkey_null()}
     };
     print_test_separator_line();
     printf("Testing index expressions\n");
@@ -545,33 +637,33 @@ test_calling_functions_with_wrong_arguments(void)
         {
             "fn(a, b) {a + b;}(1);",
             "wrong number of arguments: want=2, got=1"
+        },
+        {
+            // the call site has cached the first function
+            "let apply = fn(f) { f(1) };\n"
+            "apply(fn(a) { a });\n"
+            "apply(fn(a, b) { a + b });",
+            "wrong number of arguments: want=2, got=1"
+        },
+        {
+            // the error unwinds frames entered through a cached global call
+            "let g = fn(a) { a };\n"
+            "let f = fn(x) { if (x == 0) { g(1, 2) } else { let y = x - 1; 1 + f(y) } };\n"
+            "f(3);",
+            "wrong number of arguments: want=1, got=2"
         }
     };
 
     size_t ntests = sizeof(tests) / sizeof(tests[0]);
-    for (size_t i = 0; i < ntests; i++) {
-        testcase t = tests[i];
-        printf("Testing %s\n", t.input);
-        lexer_t *lexer = lexer_init(t.input);
-        parser_t *parser = parser_init(lexer);
-        program_t *program = parse_program(parser);
-        compiler_t *compiler = compiler_init();
-        compiler_error_t error = compile(compiler, (node_t *) program);
-        if (error.code != COMPILER_ERROR_NONE)
-            errx(EXIT_FAILURE, "compilation failed for input %s with error %s\n",
-                t.input, error.msg);
-        bytecode_t *bytecode = get_bytecode(compiler);
-        // dump_bytecode(bytecode);
-        vm_t *vm = vm_init(bytecode);
-        vm_error_t vm_error = vm_run(vm);
-        test(vm_error.code != VM_ERROR_NONE, "expected VM error but got no error\n");
-        test(strcmp(vm_error.msg, t.expected_errmsg) == 0, "Expected error: %s, got %s\n", t.expected_errmsg, vm_error.msg);
-        free(vm_error.msg);
-        parser_free(parser);
-        program_free(program);
-        vm_free(vm);
-        compiler_free(compiler);
-        bytecode_free(bytecode);
+    for (size_t i = 0; i < 2 * ntests; i++) {
+        testcase t = tests[i / 2];
+        _Bool peephole = i % 2;
+        printf("Testing %s%s\n", t.input, peephole? " with superinstructions": "");
+        test_run_t run = compile_and_run(t.input, peephole, true, true, 0);
+        test(run.error.code != VM_ERROR_NONE, "expected VM error but got no error\n");
+        test(strcmp(run.error.msg, t.expected_errmsg) == 0, "Expected error: %s, got %s\n", t.expected_errmsg, run.error.msg);
+        free(run.error.msg);
+        free_test_run(&run);
     }
 }
 
@@ -779,6 +871,624 @@ test_calling_functions_with_bindings(void)
 
 }
 
+static void
+test_stack_growth(void)
+{
+    /* fn() { 1 + (1 + (1 + ... 1)) }() keeps every operand on the stack */
+    size_t depth = 1000;
+    char *input = malloc(depth * 6 + 16);
+    if (input == NULL)
+        err(EXIT_FAILURE, "malloc failed");
+    char *p = stpcpy(input, "fn() { ");
+    for (size_t i = 1; i < depth; i++)
+        p = stpcpy(p, "1 + (");
+    p = stpcpy(p, "1");
+    for (size_t i = 1; i < depth; i++)
+        p = stpcpy(p, ")");
+    stpcpy(p, " }()");
+    vm_testcase tests[] = {
+        {input, (monkey_object_t *) create_monkey_int(depth)}
+    };
+    print_test_separator_line();
+    printf("Testing a stack deeper than its initial size\n");
+    size_t ntests = sizeof(tests) / sizeof(tests[0]);
+    run_vm_tests(ntests, tests);
+    for (size_t i = 0; i < ntests; i++)
+        free_monkey_object(tests[i].expected);
+    free(input);
+}
+
+static void
+test_tail_calls(void)
+{
+    vm_testcase tests[] = {
+        {
+            "let sum = fn(n, acc) { if (n == 0) { acc } else { sum(n - 1, acc + n) } };\n"
+            "sum(100000, 0);",
+            (monkey_object_t *) create_monkey_int(5000050000)
+        },
+        {
+            // through OPCURRENTCLOSURE, with locals of its own
+            "let wrapper = fn() {\n"
+            "   let loop = fn(x) { let y = x - 1; if (y == 0) { return 42; } loop(y) };\n"
+            "   loop(5000)\n"
+            "};\n"
+            "wrapper();",
+            (monkey_object_t *) create_monkey_int(42)
+        },
+        {
+            // a different function in every step
+            "let ping = fn(f, g, n) { if (n == 0) { \"ping\" } else { g(g, f, n - 1) } };\n"
+            "let pong = fn(f, g, n) { if (n == 0) { \"pong\" } else { g(g, f, n - 1) } };\n"
+            "ping(ping, pong, 3001);",
+            (monkey_object_t *) create_monkey_string("pong", 4)
+        },
+        {
+            // a closure capturing the arguments of the frame it replaces
+            "let adder = fn(a) { let add = fn(b) { a + b }; add };\n"
+            "let make = fn(a) { adder(a) };\n"
+            "make(2)(3);",
+            (monkey_object_t *) create_monkey_int(5)
+        },
+        {
+            "let f = fn(a) { len(a) };\n"
+            "f([1, 2, 3]) + f(\"ab\");",
+            (monkey_object_t *) create_monkey_int(5)
+        }
+    };
+    print_test_separator_line();
+    printf("Testing tail calls\n");
+    size_t ntests = sizeof(tests) / sizeof(tests[0]);
+    run_vm_tests(ntests, tests);
+    for (size_t i = 0; i < ntests; i++)
+        free_monkey_object(tests[i].expected);
+}
+
+static void
+test_while_loops(void)
+{
+    vm_testcase tests[] = {
+        {"let i = 0; while (i < 10) { let i = i + 1; }; i", (monkey_object_t *) create_monkey_int(10)},
+        {"let i = 0; while (i < 3) { let i = i + 1; i * 10 }", (monkey_object_t *) create_monkey_int(30)},
+        {"while (false) { 1 }", (monkey_object_t *) create_monkey_null()},
+        {"let i = 0; while (i < 3) { let i = i + 1; }", (monkey_object_t *) create_monkey_null()},
+        {
+            "let sum = fn(n) {\n"
+            "   let total = 0;\n"
+            "   let i = 1;\n"
+            "   while (i < n + 1) { let total = total + i; let i = i + 1; }\n"
+            "   total\n"
+            "};\n"
+            "sum(100000);",
+            (monkey_object_t *) create_monkey_int(5000050000)
+        },
+        {
+            // nested loops, each with a value left on the stack
+            "let count = 0; let i = 0;\n"
+            "while (i < 3) { let j = 0; while (j < 4) { let count = count + 1; let j = j + 1; }; let i = i + 1; }\n"
+            "count;",
+            (monkey_object_t *) create_monkey_int(12)
+        },
+        {
+            "let find = fn(a, x) { let i = 0; while (i < len(a)) { if (a[i] == x) { return i; } let i = i + 1; }; -1 };\n"
+            "find([5, 6, 7], 7) * 10 + find([5], 7);",
+            (monkey_object_t *) create_monkey_int(19)
+        },
+        {
+            "let a = []; let i = 0; while (i < 3) { let a = push(a, i * i); let i = i + 1; }; a",
+            (monkey_object_t *) create_monkey_int_array(3, 0, 1, 4)
+        },
+        {
+            // the closure reads the global after it is bound again
+            "let x = 1; let f = fn() { x }; let x = 2; f();",
+            (monkey_object_t *) create_monkey_int(2)
+        }
+    };
+    print_test_separator_line();
+    printf("Testing while loops\n");
+    size_t ntests = sizeof(tests) / sizeof(tests[0]);
+    run_vm_tests(ntests, tests);
+    for (size_t i = 0; i < ntests; i++)
+        free_monkey_object(tests[i].expected);
+}
+
+static void
+test_logical_operators(void)
+{
+    vm_testcase tests[] = {
+        {"true && true", (monkey_object_t *) create_monkey_bool(true)},
+        {"true && false", (monkey_object_t *) create_monkey_bool(false)},
+        {"false && true", (monkey_object_t *) create_monkey_bool(false)},
+        {"false || true", (monkey_object_t *) create_monkey_bool(true)},
+        {"false || false", (monkey_object_t *) create_monkey_bool(false)},
+        {"1 < 2 && 2 < 3 || false", (monkey_object_t *) create_monkey_bool(true)},
+        {"let f = fn(x) { x > 0 && 10 / x > 1 }; f(0)", (monkey_object_t *) create_monkey_bool(false)},
+        {"let f = fn(x) { x == 0 || 10 / x > 1 }; f(0)", (monkey_object_t *) create_monkey_bool(true)},
+        // the right side would fail if it were evaluated
+        {"false && 1 / 0 == 0", (monkey_object_t *) create_monkey_bool(false)},
+        {"true || 1 / 0 == 0", (monkey_object_t *) create_monkey_bool(true)},
+        {"let f = fn(x) { x && 5 }; f(true)", (monkey_object_t *) create_monkey_int(5)}
+    };
+    print_test_separator_line();
+    printf("Testing logical operators\n");
+    size_t ntests = sizeof(tests) / sizeof(tests[0]);
+    run_vm_tests(ntests, tests);
+    for (size_t i = 0; i < ntests; i++)
+        free_monkey_object(tests[i].expected);
+}
+
+static void
+test_division_by_zero(void)
+{
+    const char *tests[] = {
+        "let f = fn(a, b) { a / b }; f(1, 0)",
+        "let f = fn(a, b) { a % b }; f(1, 0)"
+    };
+    print_test_separator_line();
+    printf("Testing division by zero\n");
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        printf("Testing %s\n", tests[i]);
+        test_run_t run = compile_and_run(tests[i], false, true, true, 0);
+        test(run.error.code == VM_DIVISION_BY_ZERO, "expected division by zero error, got %s\n",
+            get_vm_error_desc(run.error.code));
+        test(strcmp(run.error.msg, "division by 0 not allowed") == 0,
+            "Expected error: division by 0 not allowed, got %s\n", run.error.msg);
+        free(run.error.msg);
+        free_test_run(&run);
+    }
+}
+
+static void
+test_superinstructions(void)
+{
+    vm_testcase tests[] = {
+        {
+            "let g = fn(y) { y * 2 };\n"
+            "let f = fn(x) { g(x) };\n"
+            "f(21);",
+            (monkey_object_t *) create_monkey_int(42)
+        },
+        {"let f = fn(x) { x - 1 }; f(5);", (monkey_object_t *) create_monkey_int(4)},
+        {"let f = fn(x) { x + 1 }; f(-5);", (monkey_object_t *) create_monkey_int(-4)},
+        {"let f = fn(x) { x + \"b\" }; f(\"a\");", (monkey_object_t *) create_monkey_string("ab", 2)},
+        {
+            "let f = fn(x) { if (x == 1) { 10 } else { 20 } };\n"
+            "f(1) + f(2);",
+            (monkey_object_t *) create_monkey_int(30)
+        },
+        {
+            // boxed integers take the slow path
+            "let f = fn(x) { if (x == 4611686018427387904) { 10 } else { 20 } };\n"
+            "f(4611686018427387904) + f(4611686018427387903);",
+            (monkey_object_t *) create_monkey_int(30)
+        }
+    };
+    print_test_separator_line();
+    printf("Testing superinstructions\n");
+    size_t ntests = sizeof(tests) / sizeof(tests[0]);
+    run_vm_tests(ntests, tests);
+    for (size_t i = 0; i < ntests; i++)
+        free_monkey_object(tests[i].expected);
+}
+
+static void
+test_call_site_caches(void)
+{
+    vm_testcase tests[] = {
+        {
+            // one call site, a different function on every other call
+            "let apply = fn(f, x) { f(x) };\n"
+            "let inc = fn(x) { x + 1 };\n"
+            "let dbl = fn(x) { x * 2 };\n"
+            "apply(inc, 1) + apply(inc, 2) + apply(dbl, 3) + apply(inc, 4) + apply(dbl, 5);",
+            (monkey_object_t *) create_monkey_int(26)
+        },
+        {
+            // closures of the same function with different free variables
+            "let adder = fn(a) { fn(b) { a + b } };\n"
+            "let apply = fn(f, x) { f(x) };\n"
+            "apply(adder(1), 10) + apply(adder(2), 10) + apply(adder(3), 10);",
+            (monkey_object_t *) create_monkey_int(36)
+        },
+        {
+            // a builtin replacing a closure at a cached call site
+            "let apply = fn(f, x) { f(x) };\n"
+            "apply(fn(x) { x }, 5) + apply(len, \"abc\") + apply(fn(x) { x }, 7);",
+            (monkey_object_t *) create_monkey_int(15)
+        },
+        {
+            "let sum = fn(n) { if (n == 0) { 0 } else { n + sum(n - 1) } };\n"
+            "sum(100) + sum(10);",
+            (monkey_object_t *) create_monkey_int(5105)
+        }
+    };
+    print_test_separator_line();
+    printf("Testing call site caches\n");
+    size_t ntests = sizeof(tests) / sizeof(tests[0]);
+    run_vm_tests(ntests, tests);
+    for (size_t i = 0; i < ntests; i++)
+        free_monkey_object(tests[i].expected);
+}
+
+static void
+test_constant_closures(void)
+{
+    const char *input = "let mk = fn(x) { [fn() { 1 }, fn() { x }] };\n"
+        "[mk(1), mk(2)];";
+    print_test_separator_line();
+    printf("Testing closures without free variables\n");
+    test_run_t run = compile_and_run(input, false, true, true, 0);
+    test(run.error.code == VM_ERROR_NONE, "vm error: %s\n", run.error.msg);
+    monkey_array_t *top = (monkey_array_t *) vm_last_popped_stack_elem(run.vm);
+    monkey_array_t *first = cm_array_list_get(top->elements, 0);
+    monkey_array_t *second = cm_array_list_get(top->elements, 1);
+    monkey_closure_t *cl1 = cm_array_list_get(first->elements, 1);
+    monkey_closure_t *cl2 = cm_array_list_get(second->elements, 1);
+    test(cm_array_list_get(first->elements, 0) == cm_array_list_get(second->elements, 0),
+        "Expected the closure without free variables to be built once\n");
+    test(cl1 != cl2, "Expected a closure for each capture\n");
+    test(cl1->free_variables_count == 1 && get_monkey_int_value(cl1->free_variables[0]) == 1,
+        "Expected the first closure to capture 1\n");
+    test(cl2->free_variables_count == 1 && get_monkey_int_value(cl2->free_variables[0]) == 2,
+        "Expected the second closure to capture 2\n");
+    free_monkey_object(top);
+    free_test_run(&run);
+}
+
+static void
+test_inlining(void)
+{
+    vm_testcase tests[] = {
+        {
+            "let max = fn(a, b) { if (a > b) { a } else { b } };\n"
+            "max(3, 7) + max(9, 2);",
+            (monkey_object_t *) create_monkey_int(16)
+        },
+        {
+            "let sub = fn(a, b) { a - b };\n"
+            "sub(sub(10, 3), sub(5, 4));",
+            (monkey_object_t *) create_monkey_int(6)
+        },
+        {
+            "let sq = fn(x) { x * x };\n"
+            "let sumsq = fn(a, b) { sq(a) + sq(b) };\n"
+            "sumsq(3, 4);",
+            (monkey_object_t *) create_monkey_int(25)
+        },
+        {
+            // a parameter hides the function
+            "let sq = fn(x) { x * x };\n"
+            "let f = fn(sq) { sq(3) };\n"
+            "f(fn(x) { x + 1 });",
+            (monkey_object_t *) create_monkey_int(4)
+        },
+        {
+            // the body sees the globals, not the locals of the caller
+            "let n = 100;\n"
+            "let addn = fn(x) { x + n };\n"
+            "let g = fn(n) { addn(n) };\n"
+            "g(1);",
+            (monkey_object_t *) create_monkey_int(101)
+        },
+        {
+            "let x = 10;\n"
+            "let id = fn(x) { x };\n"
+            "id(3) + x;",
+            (monkey_object_t *) create_monkey_int(13)
+        },
+        {
+            "let inc = fn(x) { x + 1 };\n"
+            "let f = fn(y) { let z = inc(y); inc(z) + y };\n"
+            "f(1);",
+            (monkey_object_t *) create_monkey_int(4)
+        },
+        {
+            "let inc = fn(x) { x + 1 };\n"
+            "let mk = fn(a) { fn() { inc(a) } };\n"
+            "mk(4)();",
+            (monkey_object_t *) create_monkey_int(5)
+        },
+        {
+            "let fact = fn(n) { if (n < 2) { 1 } else { n * fact(n - 1) } };\n"
+            "fact(5);",
+            (monkey_object_t *) create_monkey_int(120)
+        }
+    };
+    print_test_separator_line();
+    printf("Testing inlining\n");
+    size_t ntests = sizeof(tests) / sizeof(tests[0]);
+    run_vm_tests(ntests, tests);
+    for (size_t i = 0; i < ntests; i++)
+        free_monkey_object(tests[i].expected);
+}
+
+static void
+test_type_quickening(void)
+{
+    vm_testcase tests[] = {
+        {
+            "let add = fn(a, b) { a + b };\n"
+            "add(1, 2);\n"
+            "add(\"a\", \"b\");",
+            (monkey_object_t *) create_monkey_string("ab", 2)
+        },
+        {
+            "let sub = fn(a, b) { a - b };\n"
+            "sub(sub(10, 3), 2);",
+            (monkey_object_t *) create_monkey_int(5)
+        },
+        {
+            // the product no longer fits in a tagged int
+            "let mul = fn(a, b) { a * b };\n"
+            "mul(2, 3);\n"
+            "mul(4611686018427387903, 2);",
+            (monkey_object_t *) create_monkey_int(9223372036854775806)
+        },
+        {
+            "let gt = fn(a, b) { a > b };\n"
+            "gt(2, 1);\n"
+            "gt(true, false);",
+            (monkey_object_t *) create_monkey_bool(false)
+        },
+        {
+            "let eq = fn(a, b) { a == b };\n"
+            "eq(1, 2);\n"
+            "eq(true, true);",
+            (monkey_object_t *) create_monkey_bool(true)
+        },
+        {
+            "let neq = fn(a, b) { a != b };\n"
+            "neq(1, 2);\n"
+            "neq(false, false);",
+            (monkey_object_t *) create_monkey_bool(false)
+        },
+        {
+            // a boxed int fails the guard
+            "let le = fn(a, b) { a <= b };\n"
+            "le(1, 2);\n"
+            "le(9223372036854775807, 9223372036854775806);",
+            (monkey_object_t *) create_monkey_bool(false)
+        },
+        {
+            "let lt = fn(a, b) { a < b };\n"
+            "lt(1, 2);\n"
+            "lt(1, 1);",
+            (monkey_object_t *) create_monkey_bool(false)
+        },
+        {
+            "let ge = fn(a, b) { a >= b };\n"
+            "ge(1, 2);\n"
+            "ge(2, 2);",
+            (monkey_object_t *) create_monkey_bool(true)
+        }
+    };
+    print_test_separator_line();
+    printf("Testing type quickening\n");
+    size_t ntests = sizeof(tests) / sizeof(tests[0]);
+    run_vm_tests(ntests, tests);
+    for (size_t i = 0; i < ntests; i++)
+        free_monkey_object(tests[i].expected);
+}
+
+static _Bool
+has_opcode(instructions_t *ins, opcode_t op)
+{
+    for (size_t i = 0; i < ins->length; i += get_instruction_length(ins->bytes[i])) {
+        if (ins->bytes[i] == op)
+            return true;
+    }
+    return false;
+}
+
+static monkey_compiled_fn_t *
+run_and_get_function(const char *input, size_t const_index, vm_error_t *vm_error)
+{
+    // the function has to be called to be quickened
+    test_run_t run = compile_and_run(input, false, true, false, 0);
+    *vm_error = run.error;
+    monkey_compiled_fn_t *fn = cm_array_list_get(run.bytecode->constants_pool, const_index);
+    copy_monkey_object((monkey_object_t *) fn);
+    free_monkey_object(vm_last_popped_stack_elem(run.vm));
+    free_test_run(&run);
+    return fn;
+}
+
+static void
+test_quickened_instructions(void)
+{
+    vm_error_t vm_error;
+    monkey_compiled_fn_t *fn;
+    print_test_separator_line();
+    printf("Testing quickened instructions\n");
+
+    fn = run_and_get_function("let add = fn(a, b) { a + b }; add(1, 2);", 0, &vm_error);
+    test(vm_error.code == VM_ERROR_NONE, "vm error: %s\n", vm_error.msg);
+    test(has_opcode(fn->instructions, OPADDINT), "Expected OPADD to be quickened to OPADDINT\n");
+    free_monkey_object(fn);
+
+    fn = run_and_get_function("let add = fn(a, b) { a + b }; add(1, 2); add(\"a\", \"b\");",
+        0, &vm_error);
+    test(vm_error.code == VM_ERROR_NONE, "vm error: %s\n", vm_error.msg);
+    test(has_opcode(fn->instructions, OPADD), "Expected OPADDINT to be deoptimized to OPADD\n");
+    free_monkey_object(fn);
+}
+
+#ifdef VM_JIT
+/*
+ * Runs the peephole optimized input with functions compiled after
+ * threshold calls, checking that some function was compiled.
+ */
+static void
+run_jit_test(const char *input, size_t threshold, monkey_object_t *expected,
+    vm_error_code expected_error)
+{
+    printf("Testing %s compiled after %zu calls\n", input, threshold);
+    test_run_t run = compile_and_run(input, true, true, false, threshold);
+    test(run.error.code == expected_error, "Expected error %s, got %s\n",
+        get_vm_error_desc(expected_error), get_vm_error_desc(run.error.code));
+    if (run.error.code == VM_ERROR_NONE) {
+        monkey_object_t *top = vm_last_popped_stack_elem(run.vm);
+        test_monkey_object(top, expected);
+        free_monkey_object(top);
+    }
+    free(run.error.msg);
+    _Bool compiled = false;
+    for (size_t i = 0; i < run.bytecode->constants_pool->length; i++) {
+        monkey_compiled_fn_t *fn = run.bytecode->constants_pool->array[i];
+        if (get_monkey_object_type(fn) == MONKEY_COMPILED_FUNCTION && fn->jit_code != NULL)
+            compiled = true;
+    }
+    test(compiled, "Expected a function compiled to machine code\n");
+    free_test_run(&run);
+}
+
+static void
+test_jit(void)
+{
+    print_test_separator_line();
+    printf("Testing functions compiled to machine code\n");
+    /* quickened before they are compiled, so the int fast paths run */
+    const char *fib = "let fib = fn(n) { if (n < 2) { n } else { fib(n - 1) + fib(n - 2) } };\n"
+        "fib(20);";
+    monkey_object_t *expected = (monkey_object_t *) create_monkey_int(6765);
+    run_jit_test(fib, 100, expected, VM_ERROR_NONE);
+    free_monkey_object(expected);
+
+    const char *loop = "let sum = fn(n, acc) { if (n == 0) { acc } else { sum(n - 1, acc + n) } };\n"
+        "sum(1000, 0);";
+    expected = (monkey_object_t *) create_monkey_int(500500);
+    run_jit_test(loop, 10, expected, VM_ERROR_NONE);
+    free_monkey_object(expected);
+
+    /* overflowing the tagged ints falls back to boxed ones */
+    const char *overflow = "let f = fn(x) { x + 4611686018427387903 };\n"
+        "let g = fn(x, y) { x + y };\n"
+        "f(1); f(1); g(f(1), 1) - g(4611686018427387903, 1);";
+    expected = (monkey_object_t *) create_monkey_int(1);
+    run_jit_test(overflow, 1, expected, VM_ERROR_NONE);
+    free_monkey_object(expected);
+
+    /* operands of other types after the function has been compiled */
+    const char *mixed = "let add = fn(a, b) { a + b };\n"
+        "let lt = fn(a, b) { a < b };\n"
+        "add(1, 2); lt(1, 2); lt(1, 2);\n"
+        "if (lt(1, 2)) { add(\"mon\", \"key\") } else { add(1, 2) }";
+    expected = (monkey_object_t *) create_monkey_string("monkey", 6);
+    run_jit_test(mixed, 2, expected, VM_ERROR_NONE);
+    free_monkey_object(expected);
+
+    const char *closures = "let adder = fn(x) { fn(y) { x + y } };\n"
+        "let apply = fn(f, v) { let r = [f(v), {\"k\": -v}]; r[0] + r[1][\"k\"] + len(r) };\n"
+        "apply(adder(3), 4) + apply(adder(3), 4) + apply(adder(10), 1)";
+    expected = (monkey_object_t *) create_monkey_int(22);
+    run_jit_test(closures, 1, expected, VM_ERROR_NONE);
+    free_monkey_object(expected);
+
+    run_jit_test("let f = fn(a, b) { a / b }; f(4, 2); f(1, 0)", 1, NULL, VM_DIVISION_BY_ZERO);
+}
+#endif
+
+/*
+ * Verifies a main function, and a function in constant 1 if fn_ins is
+ * given. Takes over the instructions.
+ */
+static vm_error_t
+verify(instructions_t *main_ins, instructions_t *fn_ins, size_t num_locals,
+    size_t nglobals, size_t *max_stack)
+{
+    cm_array_list *constants = cm_array_list_init(2, free_monkey_object);
+    cm_array_list_add(constants, create_monkey_int_value(1));
+    if (fn_ins != NULL)
+        cm_array_list_add(constants, create_monkey_compiled_fn(fn_ins, num_locals, 0));
+    monkey_compiled_fn_t *main_fn = create_monkey_compiled_fn(main_ins, 0, 0);
+    vm_error_t vm_err = verify_bytecode(main_fn, constants, nglobals);
+    *max_stack = main_fn->max_stack;
+    free_monkey_object(main_fn);
+    cm_array_list_free(constants);
+    return vm_err;
+}
+
+static void
+test_verifier(void)
+{
+    print_test_separator_line();
+    printf("Testing bytecode verification\n");
+    instructions_t *ins, *fn_ins;
+    size_t max_stack;
+    vm_error_t vm_err;
+
+    ins = instruction_init(OPCONSTANT, 0);
+    instructions_append(ins, OPCONSTANT, 0);
+    instructions_append(ins, OPADD);
+    instructions_append(ins, OPPOP);
+    vm_err = verify(ins, NULL, 0, 0, &max_stack);
+    test(vm_err.code == VM_ERROR_NONE, "Expected valid bytecode, got %s\n", vm_err.msg);
+    test(max_stack == 2, "Expected a stack of 2, got %zu\n", max_stack);
+
+    ins = instruction_init(OPCONSTANT, 1);
+    vm_err = verify(ins, NULL, 0, 0, &max_stack);
+    test(vm_err.code == VM_INVALID_BYTECODE, "Expected an out of range constant to fail\n");
+    free(vm_err.msg);
+
+    ins = instruction_init(OPGETGLOBAL, 1);
+    vm_err = verify(ins, NULL, 0, 1, &max_stack);
+    test(vm_err.code == VM_INVALID_BYTECODE, "Expected an out of range global to fail\n");
+    free(vm_err.msg);
+
+    ins = instruction_init(OPPOP);
+    vm_err = verify(ins, NULL, 0, 0, &max_stack);
+    test(vm_err.code == VM_INVALID_BYTECODE, "Expected a stack underflow to fail\n");
+    free(vm_err.msg);
+
+    ins = instruction_init(OPJMP, 1);
+    vm_err = verify(ins, NULL, 0, 0, &max_stack);
+    test(vm_err.code == VM_INVALID_BYTECODE, "Expected a jump into an operand to fail\n");
+    free(vm_err.msg);
+
+    /* the branches reach the pop with different stack depths */
+    ins = instruction_init(OPTRUE);
+    instructions_append(ins, OPJMPFALSE, 6);
+    instructions_append(ins, OPTRUE);
+    instructions_append(ins, OPTRUE);
+    instructions_append(ins, OPPOP);
+    vm_err = verify(ins, NULL, 0, 0, &max_stack);
+    test(vm_err.code == VM_INVALID_BYTECODE, "Expected unbalanced branches to fail\n");
+    free(vm_err.msg);
+
+    ins = instruction_init(OPRETURN);
+    vm_err = verify(ins, NULL, 0, 0, &max_stack);
+    test(vm_err.code == VM_INVALID_BYTECODE, "Expected a return from main to fail\n");
+    free(vm_err.msg);
+
+    ins = instruction_init(OPCLOSURE, 1, 0);
+    instructions_append(ins, OPPOP);
+    fn_ins = instruction_init(OPGETLOCAL, 1);
+    instructions_append(fn_ins, OPRETURNVALUE);
+    vm_err = verify(ins, fn_ins, 1, 0, &max_stack);
+    test(vm_err.code == VM_INVALID_BYTECODE, "Expected an out of range local to fail\n");
+    free(vm_err.msg);
+
+    ins = instruction_init(OPCLOSURE, 1, 0);
+    instructions_append(ins, OPPOP);
+    fn_ins = instruction_init(OPGETFREE, 0);
+    instructions_append(fn_ins, OPRETURNVALUE);
+    vm_err = verify(ins, fn_ins, 0, 0, &max_stack);
+    test(vm_err.code == VM_INVALID_BYTECODE, "Expected an out of range free variable to fail\n");
+    free(vm_err.msg);
+
+    ins = instruction_init(OPCLOSURE, 1, 0);
+    instructions_append(ins, OPPOP);
+    fn_ins = instruction_init(OPTRUE);
+    vm_err = verify(ins, fn_ins, 0, 0, &max_stack);
+    test(vm_err.code == VM_INVALID_BYTECODE, "Expected a function without a return to fail\n");
+    free(vm_err.msg);
+
+    ins = instruction_init(OPCLOSURE, 0, 0);
+    vm_err = verify(ins, NULL, 0, 0, &max_stack);
+    test(vm_err.code == VM_INVALID_BYTECODE, "Expected a closure of an integer to fail\n");
+    free(vm_err.msg);
+}
+
 int
 main(int argc, char **argv)
 {
@@ -801,5 +1511,21 @@ main(int argc, char **argv)
     test_closures();
     test_recursive_closures();
     test_recursive_fibonacci();
+    test_deep_recursion();
+    test_stack_growth();
+    test_tail_calls();
+    test_while_loops();
+    test_logical_operators();
+    test_division_by_zero();
+    test_superinstructions();
+    test_call_site_caches();
+    test_type_quickening();
+    test_quickened_instructions();
+    test_inlining();
+    test_constant_closures();
+    test_verifier();
+#ifdef VM_JIT
+    test_jit();
+#endif
     return 0;
 }
@@ -29,6 +29,7 @@
 
 #include <err.h>
 #include <errno.h>
+#include <getopt.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -36,17 +37,27 @@
 
 #include "ast.h"
 #include "builtins.h"
+#include "bytecode_file.h"
 #include "cmonkey_utils.h"
 #include "compiler.h"
+#include "emit_c.h"
 #include "environment.h"
 #include "evaluator.h"
+#include "jit.h"
 #include "token.h"
 #include "lexer.h"
 #include "object.h"
 #include "parser.h"
+#include "regcompiler.h"
+#include "regvm.h"
+#include "snapshot.h"
 #include "vm.h"
 
 static const char * PROMPT = ">> ";
+static size_t jit_threshold = 0; // set by --jit, for every vm run
+static _Bool compile_to_c = false; // set by --emit-c, files compile to C instead of bytecode
+static snapshot_t *restored = NULL; // set by --restore, the state programs start from
+static const char *snapshot_path = NULL; // set by --snapshot, where a file saves its state
 static const char *MONKEY_FACE = "            __,__\n\
    .--.  .-\"     \"-.  .--.\n\
   / .. \\/  .-. .-.  \\/ .. \\\n\
@@ -83,8 +94,177 @@ free_lines(cm_array_list *lines)
 	lines->length = 0;
 }
 
+static void
+print_result(monkey_object_t *top)
+{
+	if (top != NULL) {
+		if (get_monkey_object_type(top) != MONKEY_NULL) {
+			char *s = inspect(top);
+			printf("%s\n", s);
+			free(s);
+		}
+		free_monkey_object(top);
+	}
+}
+
+static void
+save_snapshot(compiler_t *compiler, vm_t *machine)
+{
+	char *errmsg;
+	if (snapshot_write(snapshot_path, compiler, machine, &errmsg) == -1) {
+		fprintf(stderr, "monkeyvm: %s\n", errmsg);
+		free(errmsg);
+	}
+}
+
+/*
+ * Compiles and runs the program, saving its bytecode to cache_path unless
+ * that is NULL. A restored snapshot gives the program the globals of the
+ * one that saved it.
+ */
+static void
+execute_stack_vm(program_t *program, _Bool peephole, const char *cache_path)
+{
+	compiler_t *compiler = restored == NULL? compiler_init():
+	    compiler_init_with_state(restored->symbol_table, restored->constants);
+	compiler_error_t compile_err = compile(compiler, (node_t *) program);
+	if (compile_err.code != COMPILER_ERROR_NONE) {
+		printf("Compile error: %s\n", compile_err.msg);
+		free(compile_err.msg);
+		compiler_free(compiler);
+		return;
+	}
+
+	bytecode_t *bytecode = get_bytecode(compiler);
+	if (peephole)
+		peephole_optimize(bytecode);
+	if (cache_path != NULL)
+		bytecode_cache_store(cache_path, bytecode);
+	vm_t *machine = restored == NULL? vm_init(bytecode):
+	    vm_init_with_state(bytecode, restored->globals, restored->nglobals);
+	machine->jit_threshold = jit_threshold;
+	vm_error_t vm_err =  vm_run(machine);
+	if (vm_err.code != VM_ERROR_NONE) {
+		printf("VM Error: %s\n", vm_err.msg);
+		free(vm_err.msg);
+	} else {
+		print_result(vm_last_popped_stack_elem(machine));
+		if (snapshot_path != NULL)
+			save_snapshot(compiler, machine);
+	}
+	vm_free(machine);
+	compiler_free(compiler);
+	bytecode_free(bytecode);
+}
+
+/*
+ * Saves the bytecode of a source file next to it, foo.mnk is compiled
+ * to foo.mnkc, or translated to foo.c with --emit-c.
+ */
+static void
+compile_to_file(program_t *program, const char *filename, _Bool peephole)
+{
+	char *path;
+	char *errmsg;
+	int ret = EXIT_FAILURE;
+	size_t len = strlen(filename);
+	if (len > 4 && strcmp(filename + len - 4, ".mnk") == 0)
+		len -= 4;
+	if (asprintf(&path, "%.*s%s", (int) len, filename,
+	    compile_to_c? ".c": MNKC_EXTENSION) == -1)
+		err(EXIT_FAILURE, "malloc failed");
+	compiler_t *compiler = compiler_init();
+	compiler_error_t compile_err = compile(compiler, (node_t *) program);
+	if (compile_err.code != COMPILER_ERROR_NONE) {
+		printf("Compile error: %s\n", compile_err.msg);
+		free(compile_err.msg);
+		compiler_free(compiler);
+		free(path);
+		return;
+	}
+	bytecode_t *bytecode = get_bytecode(compiler);
+	if (peephole)
+		peephole_optimize(bytecode);
+	if (compile_to_c)
+		ret = emit_c(bytecode, path, &errmsg);
+	else
+		ret = bytecode_write(bytecode, path, &errmsg);
+	if (ret == -1) {
+		fprintf(stderr, "monkeyvm: %s\n", errmsg);
+		free(errmsg);
+	}
+	instructions_free(bytecode->instructions);
+	bytecode_free(bytecode);
+	compiler_free(compiler);
+	free(path);
+}
+
+static void
+execute_mapped_bytecode(mapped_bytecode_t *mapped)
+{
+	vm_t *machine = vm_init(mapped->bytecode);
+	machine->jit_threshold = jit_threshold;
+	vm_error_t vm_err = vm_run(machine);
+	if (vm_err.code != VM_ERROR_NONE) {
+		printf("VM Error: %s\n", vm_err.msg);
+		free(vm_err.msg);
+	} else
+		print_result(vm_last_popped_stack_elem(machine));
+	vm_free(machine);
+	bytecode_unmap(mapped);
+}
+
+/*
+ * Runs bytecode saved by compile_to_file, without lexing, parsing or
+ * compiling anything.
+ */
+static int
+execute_mapped_file(const char *filename)
+{
+	char *errmsg;
+	mapped_bytecode_t *mapped = bytecode_map(filename, &errmsg);
+	if (mapped == NULL)
+		errx(EXIT_FAILURE, "%s", errmsg);
+	execute_mapped_bytecode(mapped);
+	return 0;
+}
+
+static _Bool
+is_bytecode_file(const char *filename)
+{
+	size_t len = strlen(filename);
+	size_t extlen = strlen(MNKC_EXTENSION);
+	return len > extlen && strcmp(filename + len - extlen, MNKC_EXTENSION) == 0;
+}
+
+static void
+execute_register_vm(program_t *program)
+{
+	regcompiler_t *compiler = regcompiler_init();
+	compiler_error_t compile_err = regcompile(compiler, program);
+	if (compile_err.code != COMPILER_ERROR_NONE) {
+		printf("Compile error: %s\n", compile_err.msg);
+		free(compile_err.msg);
+		regcompiler_free(compiler);
+		return;
+	}
+
+	bytecode_t *bytecode = regcompiler_get_bytecode(compiler);
+	regvm_t *machine = regvm_init(bytecode);
+	vm_error_t vm_err = regvm_run(machine);
+	if (vm_err.code != VM_ERROR_NONE) {
+		printf("VM Error: %s\n", vm_err.msg);
+		free(vm_err.msg);
+	} else
+		print_result(regvm_last_popped_stack_elem(machine));
+	regvm_free(machine);
+	regcompiler_free(compiler);
+	bytecode_free(bytecode);
+}
+
 static int
-execute_file(const char *filename)
+execute_file(const char *filename, _Bool register_vm, _Bool peephole, _Bool compile_only,
+    _Bool use_cache)
 {
 	ssize_t bytes_read;
 	size_t linesize = 0;
@@ -93,6 +273,8 @@ execute_file(const char *filename)
 	lexer_t *l;
 	parser_t *parser = NULL;
 	program_t *program = NULL;
+	char *cache_path = NULL;
+	mapped_bytecode_t *mapped;
 
 	FILE *file = fopen(filename, "r");
 	if (file == NULL) {
@@ -113,7 +295,6 @@ execute_file(const char *filename)
 		}
 	}
 
-	environment_t *env = create_env();
 	cm_array_list *lines = cm_array_list_init(4, free);
 	while ((bytes_read = getline(&line, &linesize, file)) != -1) {
 		cm_array_list_add(lines, line);
@@ -121,8 +302,15 @@ execute_file(const char *filename)
 		linesize = 0;
 	}
 	program_string = cm_array_string_list_join(lines, "\n");
+	if (use_cache && !register_vm && !compile_only)
+		cache_path = bytecode_cache_path(program_string, peephole);
+	if (cache_path != NULL && (mapped = bytecode_cache_lookup(cache_path)) != NULL) {
+		free(program_string);
+		execute_mapped_bytecode(mapped);
+		goto EXIT;
+	}
 	l = lexer_init(program_string);
-	parser = parser_init(l);
+	parser = parser_init_arena(l);
 	program = parse_program(parser);
 	free(program_string);
 
@@ -131,39 +319,19 @@ execute_file(const char *filename)
 		goto EXIT;
 	}
 
-	compiler_t *compiler = compiler_init();
-	compiler_error_t compile_err = compile(compiler, (node_t *) program);
-	if (compile_err.code != COMPILER_ERROR_NONE) {
-		printf("Compile error: %s\n", compile_err.msg);
-		free(compile_err.msg);
-		goto EXIT;
-	}
-
-	bytecode_t *bytecode = get_bytecode(compiler);
-	vm_t *machine = vm_init(bytecode);
-	vm_error_t vm_err =  vm_run(machine);
-	if (vm_err.code != VM_ERROR_NONE) {
-		printf("VM Error: %s\n", vm_err.msg);
-		free(vm_err.msg);
-		goto EXIT;
-	}
-	monkey_object_t *top = vm_last_popped_stack_elem(machine);
-	if (top != NULL) {
-		if (top->type != MONKEY_NULL) {
-			char *s = top->inspect(top);
-			printf("%s\n", s);
-			free(s);
-		}
-	}
-	vm_free(machine);
-	compiler_free(compiler);
-	bytecode_free(bytecode);
-	env_free(env);
+	if (compile_only)
+		compile_to_file(program, filename, peephole);
+	else if (register_vm)
+		execute_register_vm(program);
+	else
+		execute_stack_vm(program, peephole, cache_path);
 
 EXIT:
 	cm_array_list_free(lines);
 	program_free(program);
-	parser_free(parser);
+	if (parser)
+		parser_free(parser);
+	free(cache_path);
 	fclose(file);
 	if (line)
 		free(line);
@@ -171,15 +339,26 @@ EXIT:
 }
 
 static void
-copy_globals(monkey_object_t *dst[GLOBALS_SIZE], monkey_object_t *src[GLOBALS_SIZE])
+free_globals(monkey_object_t **globals, size_t nglobals)
+{
+	for (size_t i = 0; i < nglobals; i++) {
+		if (globals[i] != NULL)
+			free_monkey_object(globals[i]);
+	}
+	free(globals);
+}
+
+static monkey_object_t **
+copy_globals(monkey_object_t **from, size_t nglobals)
 {
-	for (size_t i = 0; i < GLOBALS_SIZE; i++) {
-		if (dst[i] != NULL)
-			free_monkey_object(dst[i]);
-		if (src[i] == NULL)
-			return;
-		dst[i] = copy_monkey_object(src[i]);
+	monkey_object_t **globals = calloc(nglobals == 0? 1: nglobals, sizeof(*globals));
+	if (globals == NULL)
+		err(EXIT_FAILURE, "malloc failed");
+	for (size_t i = 0; i < nglobals; i++) {
+		if (from[i] != NULL)
+			globals[i] = copy_monkey_object(from[i]);
 	}
+	return globals;
 }
 
 static void *
@@ -189,7 +368,7 @@ _copy_monkey_object(void *obj)
 }
 
 static int
-repl(void)
+repl(_Bool peephole)
 {
 	ssize_t bytes_read;
 	size_t linesize = 0;
@@ -200,7 +379,8 @@ repl(void)
 	program_t *program = NULL;
 	compiler_t *compiler = NULL;
 	bytecode_t *bytecode = NULL;
-	monkey_object_t *globals[GLOBALS_SIZE] = {NULL};
+	monkey_object_t **globals = NULL;
+	size_t nglobals = 0;
 	cm_array_list *constants = cm_array_list_init(16, free_monkey_object);
 	symbol_table_t *symbol_table = symbol_table_init();
 	for (size_t i = 0; i < get_builtins_count(); i++) {
@@ -209,6 +389,14 @@ repl(void)
 			break;
 		symbol_define_builtin(symbol_table, i, builtin_name);
 	}
+	if (restored != NULL) {
+		free_symbol_table(symbol_table);
+		cm_array_list_free(constants);
+		symbol_table = symbol_table_copy(restored->symbol_table);
+		constants = cm_array_list_copy(restored->constants, _copy_monkey_object);
+		globals = copy_globals(restored->globals, restored->nglobals);
+		nglobals = restored->nglobals;
+	}
 
 	vm_t *machine = NULL;
 	environment_t *env = create_env();
@@ -235,7 +423,7 @@ repl(void)
 
 		program_string = cm_array_string_list_join(lines, "\n");
 		l = lexer_init(program_string);
-		parser = parser_init(l);
+		parser = parser_init_arena(l);
 		program = parse_program(parser);
 
 		if (parser->errors) {
@@ -251,7 +439,10 @@ repl(void)
 		}
 
 		bytecode = get_bytecode(compiler);
-		machine = vm_init_with_state(bytecode, globals);
+		if (peephole)
+			peephole_optimize(bytecode);
+		machine = vm_init_with_state(bytecode, globals, nglobals);
+		machine->jit_threshold = jit_threshold;
 		vm_error_t vm_err = vm_run(machine);
 		if (vm_err.code != VM_ERROR_NONE) {
 			printf("VM error: %s\n", vm_err.msg);
@@ -260,7 +451,7 @@ repl(void)
 		}
 		monkey_object_t *top = vm_last_popped_stack_elem(machine);
 		if (top != NULL) {
-			char *s = top->inspect(top);
+			char *s = inspect(top);
 			printf("%s\n", s);
 			free(s);
 			free_monkey_object(top);
@@ -281,7 +472,9 @@ CONTINUE:
 			compiler_free(compiler);
 		}
 		if (machine) {
-			copy_globals(globals, machine->globals);
+			free_globals(globals, nglobals);
+			globals = copy_globals(machine->globals, machine->globals_size);
+			nglobals = machine->globals_size;
 			vm_free(machine);
 		}
 		line = NULL;
@@ -309,20 +502,140 @@ CONTINUE:
 	env_free(env);
 	free_symbol_table(symbol_table);
 	cm_array_list_free(constants);
-	for (size_t i = 0; i < GLOBALS_SIZE; i++) {
-		if (globals[i] == NULL)
-			break;
-		free_monkey_object(globals[i]);
-	}
+	free_globals(globals, nglobals);
 	return 0;
 }
 
+static void
+print_alloc_stats(void)
+{
+	const monkey_alloc_stats_t *stats = get_monkey_alloc_stats();
+	for (size_t i = 0; i <= MONKEY_CLOSURE; i++) {
+		if (stats->allocations[i] == 0)
+			continue;
+		fprintf(stderr, "%-18s %10zu allocations %10zu pool hits (%.1f%%)\n",
+		    get_type_name(i), stats->allocations[i], stats->pool_hits[i],
+		    100.0 * stats->pool_hits[i] / stats->allocations[i]);
+	}
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: monkeyvm [-CP] [-r] [--compile | --emit-c] [--jit]\n"
+	    "                [--restore snapshot] [--snapshot snapshot] [--alloc-stats]\n"
+	    "                [file]\n");
+	fprintf(stderr, "  -C         do not use the compile cache ($MONKEY_CACHE_DIR,\n"
+	    "             $XDG_CACHE_HOME/cmonkey or ~/.cache/cmonkey)\n");
+	fprintf(stderr, "  -P         do not fuse instructions into superinstructions\n");
+	fprintf(stderr, "  -r         run the file on the register based vm\n");
+	fprintf(stderr, "  --compile  save the bytecode of file.mnk to file.mnkc instead of\n"
+	    "             running it, monkeyvm file.mnkc runs it\n");
+	fprintf(stderr, "  --emit-c   translate file.mnk to the C program file.c, built with\n"
+	    "             cc -Isrc file.c bin/libcmonkey.a\n");
+	fprintf(stderr, "  --restore  start from the globals a program saved with --snapshot\n");
+	fprintf(stderr, "  --alloc-stats\n"
+	    "             print how many objects of each type were allocated and how\n"
+	    "             many of them reused freed ones, on exit\n");
+	fprintf(stderr, "  --snapshot save the globals of file and what they refer to once it\n"
+	    "             has run, for --restore\n");
+#ifdef VM_JIT
+	fprintf(stderr, "  --jit      compile functions called %d times to machine code\n",
+	    JIT_THRESHOLD);
+#endif
+	exit(EXIT_FAILURE);
+}
+
 int
 main(int argc, char **argv)
 {
-	if (argc == 1)
-		return repl();
-	if (argc == 2)
-		return execute_file(argv[1]);
-	errx(EXIT_FAILURE, "Unsupported numberof arguments %d", argc);
+	int ch;
+	_Bool register_vm = false;
+	_Bool peephole = true;
+	_Bool compile_only = false;
+	_Bool use_cache = true;
+	_Bool alloc_stats = false;
+	char *errmsg;
+	int ret = EXIT_FAILURE;
+	static const struct option longopts[] = {
+		{"alloc-stats", no_argument, NULL, 'a'},
+		{"compile", no_argument, NULL, 'c'},
+		{"emit-c", no_argument, NULL, 'e'},
+		{"jit", no_argument, NULL, 'j'},
+		{"restore", required_argument, NULL, 'R'},
+		{"snapshot", required_argument, NULL, 's'},
+		{NULL, 0, NULL, 0}
+	};
+	while ((ch = getopt_long(argc, argv, "CPr", longopts, NULL)) != -1) {
+		switch (ch) {
+		case 'a':
+			alloc_stats = true;
+			break;
+		case 'c':
+			compile_only = true;
+			break;
+		case 'e':
+			compile_only = true;
+			compile_to_c = true;
+			break;
+		case 'C':
+			use_cache = false;
+			break;
+		case 'j':
+#ifdef VM_JIT
+			jit_threshold = JIT_THRESHOLD;
+#else
+			warnx("no JIT for this architecture, --jit is ignored");
+#endif
+			break;
+		case 'P':
+			peephole = false;
+			break;
+		case 'r':
+			register_vm = true;
+			break;
+		case 'R':
+			if (restored != NULL)
+				snapshot_free(restored);
+			if ((restored = snapshot_map(optarg, &errmsg)) == NULL)
+				errx(EXIT_FAILURE, "%s", errmsg);
+			break;
+		case 's':
+			snapshot_path = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if ((restored != NULL || snapshot_path != NULL) && (register_vm || compile_only ||
+	    (argc > 0 && is_bytecode_file(argv[0]))))
+		errx(EXIT_FAILURE, "snapshots are only restored into and saved from programs "
+		    "compiled and run on the stack vm");
+	if (snapshot_path != NULL && argc == 0)
+		usage();
+	/* the bytecode depends on the restored globals, saving needs the compiler */
+	if (restored != NULL || snapshot_path != NULL)
+		use_cache = false;
+	if (argc == 0) {
+		if (register_vm)
+			errx(EXIT_FAILURE, "the register vm can only run files");
+		if (compile_only)
+			usage();
+		ret = repl(peephole);
+	} else if (argc > 1)
+		usage();
+	else if (register_vm && (compile_only || is_bytecode_file(argv[0])))
+		errx(EXIT_FAILURE, "bytecode files are only run on the stack vm");
+	else if (is_bytecode_file(argv[0]) && !compile_only)
+		ret = execute_mapped_file(argv[0]);
+	else
+		ret = execute_file(argv[0], register_vm, peephole, compile_only, use_cache);
+	if (restored != NULL)
+		snapshot_free(restored);
+	if (alloc_stats)
+		print_alloc_stats();
+	return ret;
 }
+